@@ -0,0 +1,319 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+#include <osd/osd.h>
+#include <osd/clock_corr.h>
+#include "osd-private.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct osd_clock_corr {
+    struct osd_log_ctx *log_ctx;
+
+    /** Mask of the valid device timestamp bits */
+    uint64_t device_ts_mask;
+
+    /** Sample window (ring buffer): unwrapped device time and host time */
+    int64_t *device;
+    uint64_t *host;
+    unsigned int window_size;
+    /** index of the oldest sample */
+    unsigned int first;
+    /** number of samples in the window */
+    unsigned int count;
+
+    /** Most recent raw device timestamp and its unwrapped value */
+    uint64_t last_device_ts;
+    int64_t last_device;
+
+    /**
+     * Running sums over the window. To keep the sums small (and precise),
+     * all values are relative to a reference sample, which is moved to the
+     * oldest sample in the window every |window_size| samples. The sums are
+     * recomputed from scratch then, which also discards accumulated rounding
+     * errors.
+     */
+    int64_t ref_device;
+    uint64_t ref_host;
+    unsigned int adds_since_rebase;
+    double sum_x, sum_y, sum_xx, sum_xy, sum_yy;
+
+    /** The fit below is up to date */
+    bool fit_valid;
+    /** host = ref_host + offset + slope * (device - ref_device) */
+    double slope;
+    double offset;
+    double residual;
+
+    /** At most one sample per interval is used (0: all samples) */
+    uint64_t sample_interval_ns;
+};
+
+API_EXPORT
+osd_result osd_clock_corr_new(struct osd_clock_corr **corr,
+                              struct osd_log_ctx *log_ctx,
+                              unsigned int window_size,
+                              unsigned int device_ts_bits)
+{
+    assert(window_size >= 2);
+    assert(device_ts_bits >= 1 && device_ts_bits <= 64);
+
+    struct osd_clock_corr *c = calloc(1, sizeof(*c));
+    assert(c);
+    c->log_ctx = log_ctx;
+    c->device_ts_mask = (device_ts_bits == 64) ? UINT64_MAX
+                        : ((uint64_t)1 << device_ts_bits) - 1;
+    c->window_size = window_size;
+    c->device = calloc(window_size, sizeof(int64_t));
+    assert(c->device);
+    c->host = calloc(window_size, sizeof(uint64_t));
+    assert(c->host);
+
+    *corr = c;
+    return OSD_OK;
+}
+
+/**
+ * Unwrap a device timestamp relative to the most recent sample
+ */
+static int64_t unwrap(struct osd_clock_corr *c, uint64_t device_ts)
+{
+    uint64_t delta = (device_ts - c->last_device_ts) & c->device_ts_mask;
+    if (delta <= c->device_ts_mask / 2) {
+        return c->last_device + (int64_t)delta;
+    }
+    // timestamp before the most recent sample
+    return c->last_device - (int64_t)(c->device_ts_mask - delta + 1);
+}
+
+static void sums_add(struct osd_clock_corr *c, int64_t device, uint64_t host,
+                     double sign)
+{
+    double x = (double)(device - c->ref_device);
+    double y = (double)(int64_t)(host - c->ref_host);
+    c->sum_x += sign * x;
+    c->sum_y += sign * y;
+    c->sum_xx += sign * x * x;
+    c->sum_xy += sign * x * y;
+    c->sum_yy += sign * y * y;
+}
+
+/**
+ * Move the reference to the oldest sample and recompute the sums
+ */
+static void rebase(struct osd_clock_corr *c)
+{
+    c->ref_device = c->device[c->first];
+    c->ref_host = c->host[c->first];
+    c->sum_x = c->sum_y = c->sum_xx = c->sum_xy = c->sum_yy = 0;
+    for (unsigned int i = 0; i < c->count; i++) {
+        unsigned int idx = (c->first + i) % c->window_size;
+        sums_add(c, c->device[idx], c->host[idx], 1);
+    }
+    c->adds_since_rebase = 0;
+}
+
+/**
+ * Update the fit from the running sums
+ */
+static osd_result update_fit(struct osd_clock_corr *c)
+{
+    if (c->fit_valid) {
+        return OSD_OK;
+    }
+    if (c->count < 2) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    double n = c->count;
+    double sxx = c->sum_xx - c->sum_x * c->sum_x / n;
+    double sxy = c->sum_xy - c->sum_x * c->sum_y / n;
+    double syy = c->sum_yy - c->sum_y * c->sum_y / n;
+    if (sxx <= 0) {
+        // all samples have the same device timestamp
+        return OSD_ERROR_FAILURE;
+    }
+
+    c->slope = sxy / sxx;
+    c->offset = (c->sum_y - c->slope * c->sum_x) / n;
+
+    double var = 0;
+    if (c->count > 2) {
+        var = (syy - c->slope * sxy) / (n - 2);
+    }
+    c->residual = var > 0 ? sqrt(var) : 0;
+
+    c->fit_valid = true;
+    return OSD_OK;
+}
+
+/**
+ * Replace the most recent sample if the new one has a lower latency
+ *
+ * The latency of two samples is compared using the slope of the current fit;
+ * without a fit the most recent sample is kept.
+ */
+static void replace_last_if_earlier(struct osd_clock_corr *c, int64_t device,
+                                    uint64_t host)
+{
+    if (OSD_FAILED(update_fit(c))) {
+        return;
+    }
+
+    unsigned int last = (c->first + c->count - 1) % c->window_size;
+    double latency_diff = (double)(int64_t)(host - c->host[last])
+                          - c->slope * (double)(device - c->device[last]);
+    if (latency_diff >= 0) {
+        return;
+    }
+
+    sums_add(c, c->device[last], c->host[last], -1);
+    c->device[last] = device;
+    c->host[last] = host;
+    sums_add(c, device, host, 1);
+    c->fit_valid = false;
+}
+
+API_EXPORT
+void osd_clock_corr_add(struct osd_clock_corr *corr, uint64_t device_ts,
+                        uint64_t host_ns)
+{
+    assert(corr);
+    struct osd_clock_corr *c = corr;
+
+    device_ts &= c->device_ts_mask;
+    int64_t device = c->count ? unwrap(c, device_ts) : (int64_t)device_ts;
+
+    if (c->sample_interval_ns && c->count) {
+        unsigned int last = (c->first + c->count - 1) % c->window_size;
+        if (host_ns / c->sample_interval_ns ==
+            c->host[last] / c->sample_interval_ns) {
+            replace_last_if_earlier(c, device, host_ns);
+            return;
+        }
+    }
+
+    c->last_device_ts = device_ts;
+    c->last_device = device;
+
+    if (c->count == c->window_size) {
+        sums_add(c, c->device[c->first], c->host[c->first], -1);
+        c->first = (c->first + 1) % c->window_size;
+        c->count--;
+    }
+    unsigned int idx = (c->first + c->count) % c->window_size;
+    c->device[idx] = device;
+    c->host[idx] = host_ns;
+    c->count++;
+
+    if (c->count == 1 || ++c->adds_since_rebase >= c->window_size) {
+        rebase(c);
+    } else {
+        sums_add(c, device, host_ns, 1);
+    }
+    c->fit_valid = false;
+}
+
+API_EXPORT
+void osd_clock_corr_set_sample_interval(struct osd_clock_corr *corr,
+                                        uint64_t interval_ns)
+{
+    assert(corr);
+    corr->sample_interval_ns = interval_ns;
+}
+
+API_EXPORT
+osd_result osd_clock_corr_to_host(struct osd_clock_corr *corr,
+                                  uint64_t device_ts, uint64_t *host_ns)
+{
+    assert(corr);
+    assert(host_ns);
+
+    osd_result rv = update_fit(corr);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+
+    int64_t device = unwrap(corr, device_ts & corr->device_ts_mask);
+    double y = corr->offset
+               + corr->slope * (double)(device - corr->ref_device);
+    int64_t host_rel = llround(y);
+    if (host_rel < 0 && (uint64_t)-host_rel > corr->ref_host) {
+        *host_ns = 0;
+    } else {
+        *host_ns = corr->ref_host + host_rel;
+    }
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_clock_corr_get_fit(struct osd_clock_corr *corr,
+                                  struct osd_clock_corr_fit *fit)
+{
+    assert(corr);
+    assert(fit);
+
+    osd_result rv = update_fit(corr);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+
+    fit->samples = corr->count;
+    fit->ns_per_tick = corr->slope;
+    fit->residual_ns = corr->residual;
+    return OSD_OK;
+}
+
+API_EXPORT
+void osd_clock_corr_reset(struct osd_clock_corr *corr)
+{
+    assert(corr);
+
+    corr->first = 0;
+    corr->count = 0;
+    corr->adds_since_rebase = 0;
+    corr->fit_valid = false;
+}
+
+API_EXPORT
+void osd_clock_corr_free(struct osd_clock_corr **corr_p)
+{
+    assert(corr_p);
+    struct osd_clock_corr *corr = *corr_p;
+    if (!corr) {
+        return;
+    }
+
+    free(corr->device);
+    free(corr->host);
+    free(corr);
+    *corr_p = NULL;
+}
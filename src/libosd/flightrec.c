@@ -0,0 +1,314 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+#include <osd/osd.h>
+#include <osd/flightrec.h>
+#include "osd-private.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Header of a packet record in the ring buffer (host byte order)
+ *
+ * The header is followed by size_words 16 bit packet words. Records are
+ * padded to a multiple of 8 bytes.
+ */
+struct flightrec_record {
+    /**
+     * size of the record including this header and the padding. A size of 0
+     * marks the end of the used part of the buffer: the next record starts
+     * at offset 0.
+     */
+    uint32_t size;
+    uint16_t size_words;
+    uint16_t reserved;
+    uint64_t timestamp_ns;
+};
+
+/** Size of the largest possible record */
+#define RECORD_SIZE_MAX (sizeof(struct flightrec_record) \
+                         + UINT16_MAX * sizeof(uint16_t) + 8)
+
+_Static_assert(OSD_FLIGHTREC_SIZE_MIN >= 2 * RECORD_SIZE_MAX,
+               "the minimum buffer must hold at least two records");
+
+struct osd_flightrec {
+    struct osd_log_ctx *log_ctx;
+
+    char *buf;
+    size_t size;
+
+    /**
+     * Ring buffer state. Only changed by osd_flightrec_add(), or while the
+     * recorder is frozen.
+     */
+    size_t head; //!< offset of the next record
+    size_t tail; //!< offset of the oldest record
+
+    /**
+     * Statistics. Counters are written by a single thread and read with
+     * relaxed atomics.
+     */
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t packets_overwritten;
+    uint64_t packets_dropped;
+
+    /**
+     * Freezing works without locks: osd_flightrec_add() increments
+     * |write_seq| before and after accessing the buffer, i.e. it is odd
+     * while a packet is being added. osd_flightrec_freeze() sets |frozen|
+     * and then waits until |write_seq| is even. All later calls to
+     * osd_flightrec_add() see |frozen| and drop the packet.
+     */
+    int frozen;
+    unsigned int write_seq;
+};
+
+static void counter_add(uint64_t *counter, int64_t value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static size_t record_size(uint16_t size_words)
+{
+    size_t size = sizeof(struct flightrec_record)
+                  + size_words * sizeof(uint16_t);
+    return (size + 7) & ~(size_t)7;
+}
+
+/**
+ * Get the offset of the record at |offset|, following an end marker
+ */
+static size_t record_wrap(struct osd_flightrec *rec, size_t offset)
+{
+    if (offset + sizeof(uint32_t) > rec->size) {
+        return 0;
+    }
+    uint32_t size;
+    memcpy(&size, rec->buf + offset, sizeof(size));
+    return size == 0 ? 0 : offset;
+}
+
+/**
+ * Remove the oldest record from the buffer
+ */
+static void drop_oldest(struct osd_flightrec *rec)
+{
+    struct flightrec_record hdr;
+    memcpy(&hdr, rec->buf + rec->tail, sizeof(hdr));
+    rec->tail = record_wrap(rec, rec->tail + hdr.size);
+
+    counter_add(&rec->packets, -1);
+    counter_add(&rec->bytes, -(int64_t)hdr.size);
+    counter_add(&rec->packets_overwritten, 1);
+}
+
+API_EXPORT
+osd_result osd_flightrec_new(struct osd_flightrec **rec,
+                             struct osd_log_ctx *log_ctx,
+                             size_t size)
+{
+    if (size < OSD_FLIGHTREC_SIZE_MIN) {
+        err(log_ctx, "Flight recorder buffer must be at least %u bytes.\n",
+            OSD_FLIGHTREC_SIZE_MIN);
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct osd_flightrec *r = calloc(1, sizeof(*r));
+    assert(r);
+    r->log_ctx = log_ctx;
+    r->size = size & ~(size_t)7;
+
+    // touch all pages now to avoid page faults while recording
+    r->buf = malloc(r->size);
+    assert(r->buf);
+    memset(r->buf, 0, r->size);
+
+    *rec = r;
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_flightrec_add(struct osd_flightrec *rec,
+                             const struct osd_packet *packet,
+                             uint64_t timestamp_ns)
+{
+    assert(rec);
+    assert(packet);
+
+    __atomic_fetch_add(&rec->write_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&rec->frozen, __ATOMIC_SEQ_CST)) {
+        counter_add(&rec->packets_dropped, 1);
+        __atomic_fetch_add(&rec->write_seq, 1, __ATOMIC_RELEASE);
+        return OSD_OK;
+    }
+
+    size_t size = record_size(packet->data_size_words);
+    size_t pos = rec->head;
+
+    if (pos + size > rec->size) {
+        // the record does not fit at the end: drop all records behind |pos|
+        // and continue at the start of the buffer
+        while (rec->packets && rec->tail >= pos) {
+            drop_oldest(rec);
+        }
+        if (pos + sizeof(uint32_t) <= rec->size) {
+            memset(rec->buf + pos, 0, sizeof(uint32_t));
+        }
+        pos = 0;
+    }
+    while (rec->packets && rec->tail >= pos && rec->tail < pos + size) {
+        drop_oldest(rec);
+    }
+    if (rec->packets == 0) {
+        rec->tail = pos;
+    }
+
+    struct flightrec_record hdr = {
+        .size = size,
+        .size_words = packet->data_size_words,
+        .timestamp_ns = timestamp_ns,
+    };
+    memcpy(rec->buf + pos, &hdr, sizeof(hdr));
+    memcpy(rec->buf + pos + sizeof(hdr), packet->data_raw,
+           packet->data_size_words * sizeof(uint16_t));
+    rec->head = pos + size;
+
+    counter_add(&rec->packets, 1);
+    counter_add(&rec->bytes, size);
+
+    __atomic_fetch_add(&rec->write_seq, 1, __ATOMIC_RELEASE);
+    return OSD_OK;
+}
+
+API_EXPORT
+void osd_flightrec_freeze(struct osd_flightrec *rec)
+{
+    assert(rec);
+
+    __atomic_store_n(&rec->frozen, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&rec->write_seq, __ATOMIC_SEQ_CST) & 1) {
+        sched_yield();
+    }
+}
+
+API_EXPORT
+void osd_flightrec_resume(struct osd_flightrec *rec)
+{
+    assert(rec);
+
+    __atomic_store_n(&rec->frozen, 0, __ATOMIC_RELEASE);
+}
+
+API_EXPORT
+bool osd_flightrec_is_frozen(struct osd_flightrec *rec)
+{
+    assert(rec);
+
+    return __atomic_load_n(&rec->frozen, __ATOMIC_ACQUIRE);
+}
+
+API_EXPORT
+osd_result osd_flightrec_write(struct osd_flightrec *rec,
+                               struct osd_tracefile_writer *writer)
+{
+    osd_result rv;
+
+    assert(rec);
+    assert(writer);
+    assert(osd_flightrec_is_frozen(rec));
+
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, UINT16_MAX);
+    assert(OSD_SUCCEEDED(rv));
+
+    size_t pos = rec->tail;
+    for (uint64_t i = 0; i < rec->packets; i++) {
+        struct flightrec_record hdr;
+        memcpy(&hdr, rec->buf + pos, sizeof(hdr));
+
+        pkg->data_size_words = hdr.size_words;
+        memcpy(pkg->data_raw, rec->buf + pos + sizeof(hdr),
+               hdr.size_words * sizeof(uint16_t));
+        rv = osd_tracefile_writer_add(writer, pkg, hdr.timestamp_ns);
+        if (OSD_FAILED(rv)) {
+            break;
+        }
+
+        pos = record_wrap(rec, pos + hdr.size);
+    }
+
+    osd_packet_free(&pkg);
+    return rv;
+}
+
+API_EXPORT
+void osd_flightrec_clear(struct osd_flightrec *rec)
+{
+    assert(rec);
+    assert(osd_flightrec_is_frozen(rec));
+
+    rec->head = 0;
+    rec->tail = 0;
+    __atomic_store_n(&rec->packets, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->bytes, 0, __ATOMIC_RELAXED);
+}
+
+API_EXPORT
+void osd_flightrec_get_stats(struct osd_flightrec *rec,
+                             struct osd_flightrec_stats *stats)
+{
+    assert(rec);
+    assert(stats);
+
+    stats->packets = __atomic_load_n(&rec->packets, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&rec->bytes, __ATOMIC_RELAXED);
+    stats->packets_overwritten = __atomic_load_n(&rec->packets_overwritten,
+                                                 __ATOMIC_RELAXED);
+    stats->packets_dropped = __atomic_load_n(&rec->packets_dropped,
+                                             __ATOMIC_RELAXED);
+}
+
+API_EXPORT
+void osd_flightrec_free(struct osd_flightrec **rec_p)
+{
+    assert(rec_p);
+    struct osd_flightrec *rec = *rec_p;
+    if (!rec) {
+        return;
+    }
+
+    free(rec->buf);
+    free(rec);
+    *rec_p = NULL;
+}
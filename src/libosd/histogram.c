@@ -0,0 +1,184 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#include <osd/osd.h>
+#include <osd/histogram.h>
+#include "osd-private.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+API_EXPORT
+void osd_histogram_reset(struct osd_histogram *hist)
+{
+    assert(hist);
+    memset(hist, 0, sizeof(struct osd_histogram));
+    hist->min = UINT64_MAX;
+}
+
+API_EXPORT
+unsigned int osd_histogram_bucket_idx(uint64_t value)
+{
+    if (value < OSD_HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+
+    // position of the most significant set bit; the following
+    // OSD_HISTOGRAM_SUB_BUCKET_BITS bits select the sub-bucket
+    unsigned int msb = 63 - __builtin_clzll(value);
+    unsigned int shift = msb - OSD_HISTOGRAM_SUB_BUCKET_BITS;
+    unsigned int magnitude = shift + 1;
+    if (magnitude >= OSD_HISTOGRAM_MAGNITUDES) {
+        return OSD_HISTOGRAM_BUCKETS - 1;
+    }
+    unsigned int sub_bucket = (value >> shift) & (OSD_HISTOGRAM_SUB_BUCKETS - 1);
+
+    return magnitude * OSD_HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+API_EXPORT
+uint64_t osd_histogram_bucket_lowest_value(unsigned int bucket_idx)
+{
+    assert(bucket_idx < OSD_HISTOGRAM_BUCKETS);
+
+    unsigned int magnitude = bucket_idx / OSD_HISTOGRAM_SUB_BUCKETS;
+    unsigned int sub_bucket = bucket_idx % OSD_HISTOGRAM_SUB_BUCKETS;
+    if (magnitude == 0) {
+        return sub_bucket;
+    }
+    return (uint64_t)(OSD_HISTOGRAM_SUB_BUCKETS + sub_bucket) << (magnitude - 1);
+}
+
+API_EXPORT
+uint64_t osd_histogram_bucket_highest_value(unsigned int bucket_idx)
+{
+    assert(bucket_idx < OSD_HISTOGRAM_BUCKETS);
+
+    if (bucket_idx == OSD_HISTOGRAM_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+    return osd_histogram_bucket_lowest_value(bucket_idx + 1) - 1;
+}
+
+API_EXPORT
+void osd_histogram_record(struct osd_histogram *hist, uint64_t value)
+{
+    unsigned int idx = osd_histogram_bucket_idx(value);
+
+    __atomic_fetch_add(&hist->buckets[idx], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+
+    uint64_t cur = __atomic_load_n(&hist->min, __ATOMIC_RELAXED);
+    while (value < cur &&
+           !__atomic_compare_exchange_n(&hist->min, &cur, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    cur = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (value > cur &&
+           !__atomic_compare_exchange_n(&hist->max, &cur, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+API_EXPORT
+void osd_histogram_copy(struct osd_histogram *dest,
+                        const struct osd_histogram *src)
+{
+    assert(dest);
+    assert(src);
+
+    dest->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dest->sum = __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    dest->min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+    dest->max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    for (unsigned int i = 0; i < OSD_HISTOGRAM_BUCKETS; i++) {
+        dest->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+API_EXPORT
+uint64_t osd_histogram_percentile(const struct osd_histogram *hist,
+                                  double percentile)
+{
+    assert(percentile >= 0.0 && percentile <= 100.0);
+
+    // Use the sum of all buckets instead of hist->count, which might not
+    // match exactly if values are recorded in parallel.
+    uint64_t total = 0;
+    for (unsigned int i = 0; i < OSD_HISTOGRAM_BUCKETS; i++) {
+        total += hist->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    double target_exact = percentile / 100.0 * total;
+    uint64_t target = (uint64_t)target_exact;
+    if (target < target_exact) {
+        target++;
+    }
+    if (target == 0) {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    unsigned int i;
+    for (i = 0; i < OSD_HISTOGRAM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            break;
+        }
+    }
+
+    uint64_t value = osd_histogram_bucket_highest_value(i);
+    if (value > hist->max) {
+        value = hist->max;
+    }
+    return value;
+}
+
+API_EXPORT
+void osd_histogram_to_json(const struct osd_histogram *hist, char **str)
+{
+    if (hist->count == 0) {
+        sprintf_append(str, "{\"count\": 0}");
+        return;
+    }
+
+    sprintf_append(str, "{\"count\": %" PRIu64 ", \"min\": %" PRIu64 ", "
+                   "\"mean\": %" PRIu64 ", \"p50\": %" PRIu64 ", "
+                   "\"p90\": %" PRIu64 ", \"p99\": %" PRIu64 ", "
+                   "\"p99.9\": %" PRIu64 ", \"max\": %" PRIu64 "}",
+                   hist->count, hist->min, hist->sum / hist->count,
+                   osd_histogram_percentile(hist, 50.0),
+                   osd_histogram_percentile(hist, 90.0),
+                   osd_histogram_percentile(hist, 99.0),
+                   osd_histogram_percentile(hist, 99.9),
+                   hist->max);
+}
@@ -35,6 +35,15 @@
 #include <string.h>
 #include <stdbool.h>
 
+/**
+ * Time (in ms) without any message from a host module or gateway after which
+ * it is considered dead and its address is reclaimed
+ */
+#define PEER_TIMEOUT_MS (5 * OSD_HEARTBEAT_INTERVAL_MS)
+
+/** Interval (in ms) in which dead peers are searched for */
+#define PEER_REAP_INTERVAL_MS OSD_HEARTBEAT_INTERVAL_MS
+
 
 /**
  * Host Controller context
@@ -68,8 +77,141 @@ struct iothread_usr_ctx {
 
     /** Gateways registered in this subnet */
     zframe_t** gateways;
+
+    /**
+     * Liveness information of all registered host modules and gateways
+     * (struct peer), indexed by their ZeroMQ identity frame
+     */
+    zhashx_t *peers;
+
+    /** zloop timer reclaiming the addresses of dead peers */
+    int reaper_timer_id;
+};
+
+/**
+ * A host module or gateway connected to the host controller
+ */
+struct peer {
+    /** Is the peer a gateway (or a host module)? */
+    bool is_gateway;
+
+    /** Subnet (gateways) or local DI address (host modules) of the peer */
+    unsigned int addr;
+
+    /** Time (zclock_mono()) the last message was received from the peer */
+    int64_t last_seen_ms;
 };
 
+static size_t peer_key_hash(const void *key)
+{
+    const zframe_t *frame = key;
+    const unsigned char *data = zframe_data((zframe_t*)frame);
+    size_t size = zframe_size((zframe_t*)frame);
+
+    // FNV-1a
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int peer_key_cmp(const void *key1, const void *key2)
+{
+    return zframe_eq((zframe_t*)key1, (zframe_t*)key2) ? 0 : 1;
+}
+
+static void* peer_key_dup(const void *key)
+{
+    return zframe_dup((zframe_t*)key);
+}
+
+static void peer_key_destroy(void **key_p)
+{
+    zframe_destroy((zframe_t**)key_p);
+}
+
+static void peer_destroy(void **peer_p)
+{
+    free(*peer_p);
+    *peer_p = NULL;
+}
+
+/**
+ * Start tracking the liveness of a newly registered peer
+ */
+static void peer_add(struct iothread_usr_ctx *usrctx, zframe_t *hostaddr,
+                     bool is_gateway, unsigned int addr)
+{
+    struct peer *peer = calloc(1, sizeof(struct peer));
+    assert(peer);
+    peer->is_gateway = is_gateway;
+    peer->addr = addr;
+    peer->last_seen_ms = zclock_mono();
+
+    zhashx_update(usrctx->peers, hostaddr, peer);
+}
+
+/**
+ * Unregister a peer and free its address or gateway slot
+ */
+static void peer_reclaim(struct worker_thread_ctx *thread_ctx,
+                         zframe_t *hostaddr)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    struct peer *peer = zhashx_lookup(usrctx->peers, hostaddr);
+    if (!peer) {
+        return;
+    }
+
+    if (peer->is_gateway) {
+        info(thread_ctx->log_ctx, "Reclaiming slot of gateway for subnet %u.",
+             peer->addr);
+        zframe_destroy(&usrctx->gateways[peer->addr]);
+    } else {
+        info(thread_ctx->log_ctx, "Reclaiming DI address %u.%u.",
+             usrctx->subnet_addr, peer->addr);
+        zframe_destroy(&usrctx->mods_in_subnet[peer->addr]);
+    }
+
+    zhashx_delete(usrctx->peers, hostaddr);
+}
+
+/**
+ * Reclaim the addresses of all peers which haven't been seen for a while
+ */
+static int peer_reaper(zloop_t *loop, int timer_id, void *thread_ctx_void)
+{
+    struct worker_thread_ctx *thread_ctx = thread_ctx_void;
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    int64_t now = zclock_mono();
+
+    // collect first, the hash table can't be modified while iterating
+    zlist_t *dead = zlist_new();
+    assert(dead);
+    struct peer *peer = zhashx_first(usrctx->peers);
+    while (peer) {
+        if (now - peer->last_seen_ms > PEER_TIMEOUT_MS) {
+            zlist_append(dead, (void*)zhashx_cursor(usrctx->peers));
+        }
+        peer = zhashx_next(usrctx->peers);
+    }
+
+    zframe_t *hostaddr;
+    while ((hostaddr = zlist_pop(dead))) {
+        err(thread_ctx->log_ctx, "No message received from peer in %d ms, "
+            "assuming it is dead.", PEER_TIMEOUT_MS);
+        zframe_t *key = zframe_dup(hostaddr);
+        peer_reclaim(thread_ctx, key);
+        zframe_destroy(&key);
+    }
+    zlist_destroy(&dead);
+
+    return 0;
+}
+
 /**
  * Get an available address in the local subnet
  */
@@ -91,6 +233,39 @@ static osd_result get_available_diaddr(struct worker_thread_ctx *thread_ctx,
     return OSD_ERROR_FAILURE;
 }
 
+/**
+ * Look up the DI address registered for a host module
+ *
+ * @return OSD_OK if the host module is registered,
+ *         OSD_ERROR_FAILURE otherwise
+ */
+static osd_result lookup_diaddr(struct worker_thread_ctx *thread_ctx,
+                                zframe_t* hostaddr, unsigned int *diaddr)
+{
+    assert(thread_ctx);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    struct peer *peer = zhashx_lookup(usrctx->peers, hostaddr);
+    if (!peer || peer->is_gateway) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    *diaddr = osd_diaddr_build(usrctx->subnet_addr, peer->addr);
+    return OSD_OK;
+}
+
+/**
+ * Is a host module or gateway registered with the given host address?
+ */
+static bool is_registered(struct worker_thread_ctx *thread_ctx,
+                          zframe_t* hostaddr)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    return zhashx_lookup(usrctx->peers, hostaddr) != NULL;
+}
+
 /**
  * Register a host address for a given DI address
  */
@@ -106,6 +281,7 @@ static osd_result register_diaddr(struct worker_thread_ctx *thread_ctx,
         return OSD_ERROR_FAILURE;
     }
     usrctx->mods_in_subnet[localaddr] = hostaddr;
+    peer_add(usrctx, hostaddr, false, localaddr);
 
 #ifdef DEBUG
     char* hostaddr_str = zframe_strhex((zframe_t*)hostaddr);
@@ -118,7 +294,8 @@ static osd_result register_diaddr(struct worker_thread_ctx *thread_ctx,
     return OSD_OK;
 }
 
-static void mgmt_send_ack(struct worker_thread_ctx *thread_ctx, zframe_t* dest)
+static void mgmt_send_reply(struct worker_thread_ctx *thread_ctx,
+                            zframe_t* dest, const char* reply)
 {
     assert(thread_ctx);
     assert(dest);
@@ -128,22 +305,18 @@ static void mgmt_send_ack(struct worker_thread_ctx *thread_ctx, zframe_t* dest)
     zmsg_t* msg = zmsg_new();
     zmsg_add(msg, dest);
     zmsg_addstr(msg, "M");
-    zmsg_addstr(msg, "ACK");
-    zmsg_send(&msg, usrctx->router_socket);
+    zmsg_addstr(msg, reply);
+    worker_tx(thread_ctx, usrctx->router_socket, &msg);
 }
 
-static void mgmt_send_nack(struct worker_thread_ctx *thread_ctx, zframe_t* dest)
+static void mgmt_send_ack(struct worker_thread_ctx *thread_ctx, zframe_t* dest)
 {
-    assert(thread_ctx);
-    assert(dest);
-    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
-    assert(usrctx);
+    mgmt_send_reply(thread_ctx, dest, "ACK");
+}
 
-    zmsg_t* msg = zmsg_new();
-    zmsg_add(msg, dest);
-    zmsg_addstr(msg, "M");
-    zmsg_addstr(msg, "NACK");
-    zmsg_send(&msg, usrctx->router_socket);
+static void mgmt_send_nack(struct worker_thread_ctx *thread_ctx, zframe_t* dest)
+{
+    mgmt_send_reply(thread_ctx, dest, "NACK");
 }
 
 /**
@@ -159,18 +332,24 @@ static void mgmt_diaddr_request(struct worker_thread_ctx *thread_ctx,
 
     osd_result rv;
     unsigned int diaddr;
-    rv = get_available_diaddr(thread_ctx, &diaddr);
-    // XXX: Return error to host module instead of failing hard
-    assert(OSD_SUCCEEDED(rv));
 
-    rv = register_diaddr(thread_ctx, zframe_dup(hostaddr), diaddr);
-    assert(OSD_SUCCEEDED(rv));
+    // Host modules repeat their request if they don't get a response in
+    // time; hand out the same address again in this case.
+    rv = lookup_diaddr(thread_ctx, hostaddr, &diaddr);
+    if (OSD_FAILED(rv)) {
+        rv = get_available_diaddr(thread_ctx, &diaddr);
+        // XXX: Return error to host module instead of failing hard
+        assert(OSD_SUCCEEDED(rv));
+
+        rv = register_diaddr(thread_ctx, zframe_dup(hostaddr), diaddr);
+        assert(OSD_SUCCEEDED(rv));
+    }
 
     zmsg_t* msg = zmsg_new();
     zmsg_add(msg, hostaddr);
     zmsg_addstr(msg, "M");
     zmsg_addstrf(msg, "%u", diaddr);
-    zmsg_send(&msg, usrctx->router_socket);
+    worker_tx(thread_ctx, usrctx->router_socket, &msg);
 }
 
 static void mgmt_diaddr_release(struct worker_thread_ctx *thread_ctx,
@@ -183,8 +362,9 @@ static void mgmt_diaddr_release(struct worker_thread_ctx *thread_ctx,
 
     unsigned int i, localaddr;
     int found = 0;
-    for (i = 1; i < OSD_DIADDR_SUBNET_MAX; i++) {
-        if (zframe_eq(usrctx->mods_in_subnet[i], hostaddr)) {
+    for (i = 1; i <= OSD_DIADDR_LOCAL_MAX; i++) {
+        if (usrctx->mods_in_subnet[i] &&
+            zframe_eq(usrctx->mods_in_subnet[i], hostaddr)) {
             localaddr = i;
             found = 1;
             break;
@@ -197,6 +377,7 @@ static void mgmt_diaddr_release(struct worker_thread_ctx *thread_ctx,
     }
 
     zframe_destroy(&usrctx->mods_in_subnet[localaddr]);
+    zhashx_delete(usrctx->peers, hostaddr);
 
 #ifdef DEBUG
     char* hostaddr_str = zframe_strhex((zframe_t*)hostaddr);
@@ -223,12 +404,18 @@ static void mgmt_gw_register(struct worker_thread_ctx *thread_ctx,
     assert(subnet <= OSD_DIADDR_SUBNET_MAX);
 
     if (usrctx->gateways[subnet] != NULL) {
+        if (zframe_eq(usrctx->gateways[subnet], hostaddr)) {
+            // repeated registration
+            return mgmt_send_ack(thread_ctx, hostaddr);
+        }
         err(thread_ctx->log_ctx, "A gateway for subnet %u is already "
             "registered.", subnet);
         return mgmt_send_nack(thread_ctx, hostaddr);
     }
 
-    usrctx->gateways[subnet] = hostaddr;
+    // |hostaddr| is passed on to mgmt_send_ack() below; keep a copy
+    usrctx->gateways[subnet] = zframe_dup(hostaddr);
+    peer_add(usrctx, hostaddr, true, subnet);
 
 #ifdef DEBUG
     char* hostaddr_str = zframe_strhex((zframe_t*)hostaddr);
@@ -239,6 +426,54 @@ static void mgmt_gw_register(struct worker_thread_ctx *thread_ctx,
     mgmt_send_ack(thread_ctx, hostaddr);
 }
 
+/**
+ * Forward a filter rule to the device gateway of a subnet
+ *
+ * |params| is "<subnet> <rule>". The sender is acknowledged once the rule has
+ * been forwarded; malformed requests and rules for subnets without a
+ * registered gateway are rejected with a NACK.
+ */
+static void mgmt_gw_filter(struct worker_thread_ctx *thread_ctx,
+                           zframe_t* hostaddr, const char* params)
+{
+    assert(thread_ctx);
+    assert(hostaddr);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    char* end;
+
+    unsigned long subnet = strtoul(params, &end, 10);
+    if (end == params || *end != ' ' || !end[1] ||
+        subnet > OSD_DIADDR_SUBNET_MAX) {
+        err(thread_ctx->log_ctx, "Invalid GW_FILTER request '%s'.", params);
+        return mgmt_send_nack(thread_ctx, hostaddr);
+    }
+    const char* rule = end + 1;
+
+    if (usrctx->gateways[subnet] == NULL) {
+        err(thread_ctx->log_ctx, "No gateway registered for subnet %lu, "
+            "rejecting filter rule '%s'.", subnet, rule);
+        return mgmt_send_nack(thread_ctx, hostaddr);
+    }
+
+    zmsg_t* msg = zmsg_new();
+    zmsg_add(msg, zframe_dup(usrctx->gateways[subnet]));
+    zmsg_addstr(msg, "M");
+    zmsg_addstrf(msg, "FILTER %s", rule);
+    osd_result rv = worker_tx(thread_ctx, usrctx->router_socket, &msg);
+    if (OSD_FAILED(rv)) {
+        err(thread_ctx->log_ctx, "Unable to forward filter rule '%s' to "
+            "gateway for subnet %lu.", rule, subnet);
+        return mgmt_send_nack(thread_ctx, hostaddr);
+    }
+
+    dbg(thread_ctx->log_ctx, "Forwarded filter rule '%s' to gateway for "
+        "subnet %lu", rule, subnet);
+
+    mgmt_send_ack(thread_ctx, hostaddr);
+}
+
 /**
  * Process an incoming management message (from the host modules)
  */
@@ -258,6 +493,18 @@ static void process_mgmt_msg(struct worker_thread_ctx *thread_ctx,
         mgmt_diaddr_release(thread_ctx, src);
     } else if (!strncmp(request, "GW_REGISTER", strlen("GW_REGISTER"))) {
         mgmt_gw_register(thread_ctx, src, request + strlen("GW_REGISTER "));
+    } else if (!strncmp(request, "GW_FILTER ", strlen("GW_FILTER "))) {
+        mgmt_gw_filter(thread_ctx, src, request + strlen("GW_FILTER "));
+    } else if (!strcmp(request, "PING")) {
+        // heartbeat: tell the sender if we don't know it (any more), e.g.
+        // after a restart of the host controller. The replies are distinct
+        // from ACK/NACK so that they can't be confused with the answer to
+        // another request.
+        if (is_registered(thread_ctx, src)) {
+            mgmt_send_reply(thread_ctx, src, "PONG");
+        } else {
+            mgmt_send_reply(thread_ctx, src, "UNKNOWN_PEER");
+        }
     } else {
         mgmt_send_ack(thread_ctx, src);
     }
@@ -268,6 +515,71 @@ static void process_mgmt_msg(struct worker_thread_ctx *thread_ctx,
     free(payload_frame);
 }
 
+/**
+ * Tell the sender of a data packet that its destination is not reachable
+ *
+ * The message sent is "DEST_UNREACHABLE <diaddr>".
+ */
+static void mgmt_send_dest_unreachable(struct worker_thread_ctx *thread_ctx,
+                                       const zframe_t* dest,
+                                       unsigned int unreachable_diaddr)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    zmsg_t* msg = zmsg_new();
+    zmsg_add(msg, zframe_dup((zframe_t*)dest));
+    zmsg_addstr(msg, "M");
+    zmsg_addstrf(msg, "DEST_UNREACHABLE %u", unreachable_diaddr);
+    worker_tx(thread_ctx, usrctx->router_socket, &msg);
+}
+
+/**
+ * Send a data message to a peer
+ *
+ * If the peer has disconnected the message is dropped right away and the
+ * sender is notified, instead of queuing the message for a peer which will
+ * never pick it up.
+ */
+static void route_to_peer(struct worker_thread_ctx *thread_ctx,
+                          const zframe_t *src, const zframe_t *dest_hostaddr,
+                          unsigned int dest_diaddr, zframe_t *payload_frame)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    zmsg_t *msg = zmsg_new();
+    assert(msg);
+    zmsg_add(msg, zframe_dup((zframe_t*)dest_hostaddr));
+    zmsg_addstr(msg, "D");
+    zmsg_add(msg, payload_frame);
+
+    // Only try to send directly if no older messages are waiting to keep the
+    // message order intact.
+    if (zlist_size(thread_ctx->tx_backlog) == 0) {
+        int rv = worker_send_nowait(usrctx->router_socket, &msg);
+        if (rv == 0) {
+            return;
+        }
+        if (errno == EHOSTUNREACH) {
+            err(thread_ctx->log_ctx, "Destination %u.%u is unreachable, "
+                "dropping data packet.", osd_diaddr_subnet(dest_diaddr),
+                osd_diaddr_localaddr(dest_diaddr));
+            zmsg_destroy(&msg);
+
+            zframe_t *hostaddr = zframe_dup((zframe_t*)dest_hostaddr);
+            peer_reclaim(thread_ctx, hostaddr);
+            zframe_destroy(&hostaddr);
+
+            mgmt_send_dest_unreachable(thread_ctx, src, dest_diaddr);
+            return;
+        }
+    }
+
+    // the peer is slow (its queue is full) or older messages are waiting:
+    // queue the message on our side
+    worker_tx(thread_ctx, usrctx->router_socket, &msg);
+}
+
 /**
  * Route a DI data message to its destination
  */
@@ -304,6 +616,8 @@ static void process_data_msg(struct worker_thread_ctx *thread_ctx,
         if (dest_hostaddr == NULL) {
             err(thread_ctx->log_ctx, "No destination module registered for "
                 "DI address %u.%u", dest_diaddr_subnet, dest_diaddr_local);
+            mgmt_send_dest_unreachable(thread_ctx, src,
+                                       osd_packet_get_dest(pkg));
             goto free_return;
         }
         dbg(thread_ctx->log_ctx,
@@ -315,6 +629,8 @@ static void process_data_msg(struct worker_thread_ctx *thread_ctx,
             err(thread_ctx->log_ctx,
                 "No gateway for subnet %u registered to route di address %u.%u",
                 dest_diaddr_subnet, dest_diaddr_subnet, dest_diaddr_local);
+            mgmt_send_dest_unreachable(thread_ctx, src,
+                                       osd_packet_get_dest(pkg));
             goto free_return;
         }
         dbg(thread_ctx->log_ctx, "Destination address is in a different "
@@ -327,16 +643,14 @@ static void process_data_msg(struct worker_thread_ctx *thread_ctx,
     free(dest_hostaddr_str);
 #endif
 
-    zmsg_t *msg = zmsg_new();
-    assert(msg);
-    zmsg_add(msg, zframe_dup(dest_hostaddr));
-    zmsg_addstr(msg, "D");
-    zmsg_add(msg, payload_frame);
-    zmsg_send(&msg, usrctx->router_socket);
+    route_to_peer(thread_ctx, src, dest_hostaddr, osd_packet_get_dest(pkg),
+                  payload_frame);
+    payload_frame = NULL;
 
 free_return:
     osd_packet_free(&pkg);
     zframe_destroy(&payload_frame);
+    zframe_destroy(&src);
 }
 
 /**
@@ -362,6 +676,12 @@ static int iothread_handle_ext_msg(zloop_t *loop, zsock_t *reader,
     zframe_t *type_frame = zmsg_pop(msg);
     char* type_str = (char*)zframe_data(type_frame);
 
+    // any message counts as sign of life
+    struct peer *peer = zhashx_lookup(usrctx->peers, src_frame);
+    if (peer) {
+        peer->last_seen_ms = zclock_mono();
+    }
+
     if (type_str[0] == 'M') {
         zframe_t* payload_frame = zmsg_pop(msg);
         process_mgmt_msg(thread_ctx, src_frame, payload_frame);
@@ -405,6 +725,16 @@ static void iothread_router_start(struct worker_thread_ctx *thread_ctx)
     }
     zsock_set_rcvtimeo(usrctx->router_socket, ZMQ_RCV_TIMEOUT);
 
+    // fail sending to peers which have disconnected (instead of silently
+    // dropping the message), and don't block on slow peers
+    zsock_set_router_mandatory(usrctx->router_socket, 1);
+    zsock_set_sndtimeo(usrctx->router_socket, 0);
+
+    usrctx->reaper_timer_id = zloop_timer(thread_ctx->zloop,
+                                          PEER_REAP_INTERVAL_MS, 0,
+                                          peer_reaper, thread_ctx);
+    assert(usrctx->reaper_timer_id != -1);
+
     // register event handler for incoming messages
     int zmq_rv;
     zmq_rv = zloop_reader(thread_ctx->zloop, usrctx->router_socket,
@@ -412,21 +742,32 @@ static void iothread_router_start(struct worker_thread_ctx *thread_ctx)
     assert(zmq_rv == 0);
     zloop_reader_set_tolerant(thread_ctx->zloop, usrctx->router_socket);
 
+    retval = OSD_OK;
+
 free_return:
     worker_send_status(thread_ctx->inproc_socket, "I-START-DONE", retval);
 }
 
 /**
  * Stop the host controller router function in the I/O thread
+ *
+ * Outbound messages still pending are sent out until @p deadline
+ * (zclock_mono() timestamp in ms).
  */
-static void iothread_router_stop(struct worker_thread_ctx *thread_ctx)
+static void iothread_router_stop(struct worker_thread_ctx *thread_ctx,
+                                 int64_t deadline)
 {
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
     osd_result retval;
 
+    zloop_timer_end(thread_ctx->zloop, usrctx->reaper_timer_id);
+    usrctx->reaper_timer_id = -1;
+
     zloop_reader_end(thread_ctx->zloop, usrctx->router_socket);
+    worker_tx_flush(thread_ctx, usrctx->router_socket,
+                    worker_time_left(deadline), NULL);
     zsock_destroy(&usrctx->router_socket);
 
     retval = OSD_OK;
@@ -444,7 +785,7 @@ static osd_result iothread_handle_inproc_msg(struct worker_thread_ctx *thread_ct
         iothread_router_start(thread_ctx);
 
     } else if (!strcmp(name, "I-STOP")) {
-        iothread_router_stop(thread_ctx);
+        iothread_router_stop(thread_ctx, worker_msg_get_deadline(msg));
 
     } else {
         assert(0 && "Received unknown message from main thread.");
@@ -459,6 +800,14 @@ static osd_result iothread_destroy(struct worker_thread_ctx *thread_ctx)
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
+    for (unsigned int i = 0; i <= OSD_DIADDR_LOCAL_MAX; i++) {
+        zframe_destroy(&usrctx->mods_in_subnet[i]);
+    }
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        zframe_destroy(&usrctx->gateways[i]);
+    }
+    zhashx_destroy(&usrctx->peers);
+
     free(usrctx->router_address);
     free(usrctx->mods_in_subnet);
     free(usrctx->gateways);
@@ -502,6 +851,15 @@ osd_result osd_hostctrl_new(struct osd_hostctrl_ctx **ctx,
             calloc(OSD_DIADDR_SUBNET_MAX + 1, sizeof(zframe_t*));
     assert(iothread_usr_data->gateways);
 
+    iothread_usr_data->peers = zhashx_new();
+    assert(iothread_usr_data->peers);
+    zhashx_set_key_hasher(iothread_usr_data->peers, peer_key_hash);
+    zhashx_set_key_comparator(iothread_usr_data->peers, peer_key_cmp);
+    zhashx_set_key_duplicator(iothread_usr_data->peers, peer_key_dup);
+    zhashx_set_key_destructor(iothread_usr_data->peers, peer_key_destroy);
+    zhashx_set_destructor(iothread_usr_data->peers, peer_destroy);
+    iothread_usr_data->reaper_timer_id = -1;
+
     rv = worker_new(&c->ioworker_ctx, log_ctx, NULL, iothread_destroy,
                     iothread_handle_inproc_msg, iothread_usr_data);
     if (OSD_FAILED(rv)) {
@@ -513,8 +871,23 @@ osd_result osd_hostctrl_new(struct osd_hostctrl_ctx **ctx,
     return OSD_OK;
 }
 
+API_EXPORT
+void osd_hostctrl_set_shutdown_timeout(struct osd_hostctrl_ctx *ctx,
+                                       int timeout_ms)
+{
+    assert(ctx);
+    worker_set_shutdown_timeout(ctx->ioworker_ctx, timeout_ms);
+}
+
 API_EXPORT
 void osd_hostctrl_free(struct osd_hostctrl_ctx **ctx_p)
+{
+    osd_hostctrl_free_with_stats(ctx_p, NULL);
+}
+
+API_EXPORT
+void osd_hostctrl_free_with_stats(struct osd_hostctrl_ctx **ctx_p,
+                                  struct osd_shutdown_stats *stats)
 {
     assert(ctx_p);
     struct osd_hostctrl_ctx *ctx = *ctx_p;
@@ -524,7 +897,7 @@ void osd_hostctrl_free(struct osd_hostctrl_ctx **ctx_p)
 
     assert(!ctx->is_running);
 
-    worker_free(&ctx->ioworker_ctx);
+    worker_free(&ctx->ioworker_ctx, stats);
 
     free(ctx);
     *ctx_p = NULL;
@@ -566,10 +939,9 @@ osd_result osd_hostctrl_stop(struct osd_hostctrl_ctx *ctx)
         return OSD_ERROR_NOT_CONNECTED;
     }
 
-    worker_send_status(ctx->ioworker_ctx->inproc_socket, "I-STOP", 0);
     osd_result retval;
-    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket, "I-STOP-DONE",
-                                &retval);
+    rv = worker_request_with_deadline(ctx->ioworker_ctx, "I-STOP",
+                                      "I-STOP-DONE", &retval);
     if (OSD_FAILED(rv)) {
         return rv;
     }
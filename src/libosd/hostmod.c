@@ -36,6 +36,27 @@
 #include <errno.h>
 #include <string.h>
 
+/**
+ * Coalescing window for periodic register polls (in ns)
+ *
+ * All polls falling due within this time are issued together.
+ */
+#define POLL_COALESCE_WINDOW_NS (500 * 1000)
+
+/**
+ * Time (in ns) after which an unanswered register read request is considered
+ * lost
+ */
+#define REQ_OWNER_TIMEOUT_NS ((uint64_t)ZMQ_RCV_TIMEOUT * 1000 * 1000)
+
+/** Owner of requests issued by the I/O thread itself (see struct req_owner) */
+#define REQ_OWNER_INTERNAL -2
+
+/**
+ * Time (in ns) without any message from the host controller after which the
+ * connection is considered lost
+ */
+#define HEARTBEAT_TIMEOUT_NS (3ULL * OSD_HEARTBEAT_INTERVAL_MS * 1000 * 1000)
 
 /**
  * Host module context
@@ -47,11 +68,24 @@ struct osd_hostmod_ctx {
     /** Logging context */
     struct osd_log_ctx *log_ctx;
 
-    /** Address assigned to this module in the debug interconnect */
+    /**
+     * Address assigned to this module in the debug interconnect
+     *
+     * Updated by the I/O thread if the address changes after a reconnect.
+     */
     uint16_t diaddr;
 
     /** I/O worker */
     struct worker_ctx *ioworker_ctx;
+
+    /** Latency statistics (shared with the I/O thread) */
+    struct osd_hostmod_stats *stats;
+
+    /** ID assigned to the next register request (0 is never used) */
+    uint32_t req_next_id;
+
+    /** ID assigned to the next management request */
+    uint32_t mgmt_req_next_id;
 };
 
 /**
@@ -64,12 +98,986 @@ struct iothread_usr_ctx {
     /** ZeroMQ address/URL of the host controller */
     char* host_controller_address;
 
-    /** Event packet handler function */
-    osd_hostmod_event_handler_fn event_handler;
+    /** Event packet handler function */
+    osd_hostmod_event_handler_fn event_handler;
+
+    /** Argument passed to event_handler */
+    void* event_handler_arg;
+
+    /** Latency statistics (owned by osd_hostmod_ctx) */
+    struct osd_hostmod_stats *stats;
+
+    /** DI address of this host module */
+    uint16_t diaddr;
+
+    /** DI address as seen by the main thread (osd_hostmod_ctx.diaddr) */
+    uint16_t *diaddr_shared;
+
+    /** Is the connection to the host controller alive? */
+    bool link_up;
+
+    /** Time the last message was received from the host controller */
+    uint64_t last_rx_ns;
+
+    /** Time the connection was lost (if link_up is false) */
+    uint64_t link_down_since_ns;
+
+    /** zloop timer sending heartbeats to the host controller */
+    int heartbeat_timer_id;
+
+    /**
+     * Modules configured to send their events to us (list of uint16_t*)
+     *
+     * If our DI address changes after a reconnect these modules are
+     * reconfigured to send their events to the new address.
+     */
+    zlist_t *event_dest_mods;
+
+    /** Periodic register polls (list of struct poll_entry) */
+    zlist_t *polls;
+
+    /** ID assigned to the next poll */
+    int poll_next_id;
+
+    /** zloop timer issuing the next batch of polls; -1 if not running */
+    int poll_timer_id;
+
+    /**
+     * Outstanding register requests in the order they were sent out
+     * (list of struct req_owner)
+     */
+    zlist_t *req_owners;
+
+    /**
+     * IDs of management requests of the main thread waiting for an answer
+     * of the host controller, in the order they were sent out (list of
+     * uint32_t*)
+     */
+    zlist_t *mgmt_reqs;
+};
+
+/**
+ * Periodic register poll
+ */
+struct poll_entry {
+    int id;
+    uint16_t diaddr;
+    uint16_t reg_addr;
+    int reg_size_bit;
+    uint64_t interval_ns;
+
+    /**
+     * Time the poll was added. All due times are calculated relative to this
+     * time to avoid accumulating drift.
+     */
+    uint64_t anchor_ns;
+
+    /** Number of the period which is due next */
+    uint64_t period;
+
+    /** Time the next read is due */
+    uint64_t next_due_ns;
+
+    /** Time the currently outstanding read was due; 0 if none is pending */
+    uint64_t outstanding_due_ns;
+
+    osd_hostmod_poll_cb_fn cb;
+    void *cb_arg;
+};
+
+/**
+ * Poll request sent from the main thread to the I/O thread (I-POLL-ADD)
+ */
+struct poll_add_req {
+    uint16_t diaddr;
+    uint16_t reg_addr;
+    int reg_size_bit;
+    unsigned int interval_ms;
+    osd_hostmod_poll_cb_fn cb;
+    void *cb_arg;
+};
+
+/**
+ * Management request sent from the main thread to the I/O thread (I-MGMT)
+ */
+struct mgmt_req {
+    /** ID of the request */
+    uint32_t req_id;
+
+    /** the message to be sent to the host controller (NUL-terminated) */
+    char cmd[];
+};
+
+/**
+ * Result of a management request of the main thread (I-MGMT-DONE)
+ */
+struct mgmt_req_status {
+    /** ID of the request */
+    uint32_t req_id;
+
+    /** OSD_OK if the host controller acknowledged the request */
+    osd_result result;
+};
+
+/**
+ * Failure of a register request issued by the main thread (I-REQ-FAILED)
+ */
+struct req_failed_status {
+    /** ID of the failed request */
+    uint32_t req_id;
+
+    /** Reason for the failure */
+    osd_result result;
+};
+
+/**
+ * Originator of an outstanding register request
+ *
+ * Register responses don't carry a request identifier. Modules answer
+ * requests in order, which allows us to match a response to the first
+ * outstanding request to the same module.
+ */
+struct req_owner {
+    /** DI address of the module the request was sent to */
+    uint16_t diaddr;
+
+    /**
+     * ID of the poll which issued the request, -1 for the main thread,
+     * REQ_OWNER_INTERNAL for the I/O thread itself
+     */
+    int poll_id;
+
+    /**
+     * ID of the request assigned by the main thread (if poll_id is -1)
+     *
+     * It is passed back to the main thread together with the response, which
+     * allows the main thread to discard responses to requests it has given
+     * up on already.
+     */
+    uint32_t req_id;
+
+    /** Time the request was sent */
+    uint64_t ts_issued_ns;
+};
+
+/**
+ * Initialize the statistics data structure
+ */
+static void stats_init(struct osd_hostmod_stats *stats)
+{
+    struct osd_hostmod_stats_module *mods[OSD_HOSTMOD_STATS_MODULES_MAX + 1];
+    for (int i = 0; i < OSD_HOSTMOD_STATS_MODULES_MAX; i++) {
+        mods[i] = &stats->modules[i];
+    }
+    mods[OSD_HOSTMOD_STATS_MODULES_MAX] = &stats->other_modules;
+
+    for (int i = 0; i < OSD_HOSTMOD_STATS_MODULES_MAX + 1; i++) {
+        mods[i]->diaddr = -1;
+        for (int op = 0; op < OSD_HOSTMOD_STATS_OP_COUNT; op++) {
+            for (int size = 0; size < OSD_HOSTMOD_STATS_REG_SIZES; size++) {
+                osd_histogram_reset(&mods[i]->round_trip[op][size]);
+                osd_histogram_reset(&mods[i]->queueing[op][size]);
+            }
+        }
+    }
+    osd_histogram_reset(&stats->event_handler);
+    osd_histogram_reset(&stats->poll_jitter);
+    osd_histogram_reset(&stats->link_downtime);
+}
+
+/**
+ * Get the statistics entry for a module
+ *
+ * Entries are claimed in the order modules are accessed for the first time.
+ * The calling threads of the register access functions claim new entries
+ * (@p claim set to true); the I/O thread only looks up existing ones.
+ */
+static struct osd_hostmod_stats_module*
+stats_module_get(struct osd_hostmod_stats *stats, uint16_t diaddr, bool claim)
+{
+    for (int i = 0; i < OSD_HOSTMOD_STATS_MODULES_MAX; i++) {
+        int entry_diaddr = __atomic_load_n(&stats->modules[i].diaddr,
+                                           __ATOMIC_ACQUIRE);
+        if (entry_diaddr == -1) {
+            if (!claim) {
+                break;
+            }
+            // Multiple threads might race for the same free entry; on
+            // failure entry_diaddr holds the address of the winner.
+            if (__atomic_compare_exchange_n(&stats->modules[i].diaddr,
+                                            &entry_diaddr, diaddr, false,
+                                            __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)) {
+                return &stats->modules[i];
+            }
+        }
+        if (entry_diaddr == diaddr) {
+            return &stats->modules[i];
+        }
+    }
+    return &stats->other_modules;
+}
+
+/**
+ * Get the operation and register size index from a REG request subtype
+ */
+static void stats_reg_req_idx(unsigned int type_sub, unsigned int *op,
+                              unsigned int *size_idx)
+{
+    *op = (type_sub & 0b0100) ? OSD_HOSTMOD_STATS_OP_REG_WRITE :
+                                OSD_HOSTMOD_STATS_OP_REG_READ;
+    *size_idx = type_sub & 0b0011;
+}
+
+/**
+ * Get destination and subtype of a REG request packet stored in a frame
+ *
+ * @return true if the frame contains a REG request, false otherwise
+ */
+static bool frame_get_reg_req(zframe_t *data_frame, uint16_t *dest,
+                              unsigned int *type_sub)
+{
+    if (zframe_size(data_frame) < 3 * sizeof(uint16_t)) {
+        return false;
+    }
+    const uint16_t *data = (const uint16_t*)zframe_data(data_frame);
+    unsigned int type = (data[2] >> DP_HEADER_TYPE_SHIFT) & DP_HEADER_TYPE_MASK;
+    *type_sub = (data[2] >> DP_HEADER_TYPE_SUB_SHIFT) & DP_HEADER_TYPE_SUB_MASK;
+    *dest = data[0];
+
+    return type == OSD_PACKET_TYPE_REG && !(*type_sub & 0b1000);
+}
+
+/**
+ * Record the queueing delay of a register request
+ *
+ * @param stats the statistics
+ * @param dest destination of the request
+ * @param type_sub subtype of the request
+ * @param ts_enqueue time the packet was enqueued in the main thread
+ */
+static void stats_record_queueing(struct osd_hostmod_stats *stats,
+                                  uint16_t dest, unsigned int type_sub,
+                                  uint64_t ts_enqueue)
+{
+    uint64_t delay = osd_clock_monotonic_ns() - ts_enqueue;
+
+    unsigned int op, size_idx;
+    stats_reg_req_idx(type_sub, &op, &size_idx);
+    struct osd_hostmod_stats_module *mod = stats_module_get(stats, dest,
+                                                            false);
+    osd_histogram_record(&mod->queueing[op][size_idx], delay);
+}
+
+static void req_owner_add(struct iothread_usr_ctx *usrctx, uint16_t diaddr,
+                          int poll_id, uint32_t req_id)
+{
+    struct req_owner *owner = malloc(sizeof(struct req_owner));
+    assert(owner);
+    owner->diaddr = diaddr;
+    owner->poll_id = poll_id;
+    owner->req_id = req_id;
+    owner->ts_issued_ns = osd_clock_monotonic_ns();
+    int rv = zlist_append(usrctx->req_owners, owner);
+    assert(rv == 0);
+}
+
+static struct poll_entry* poll_find(struct iothread_usr_ctx *usrctx,
+                                    int poll_id)
+{
+    struct poll_entry *p = zlist_first(usrctx->polls);
+    while (p) {
+        if (p->id == poll_id) {
+            return p;
+        }
+        p = zlist_next(usrctx->polls);
+    }
+    return NULL;
+}
+
+/**
+ * Fail outstanding requests which did not receive a response in time
+ *
+ * Requests of the main thread are not expired: the main thread decides itself
+ * how long it waits for a response (possibly forever), and cancels the request
+ * when giving up (see iothread_cancel_request()).
+ */
+static void req_owners_expire(struct iothread_usr_ctx *usrctx, uint64_t now)
+{
+    struct req_owner *owner = zlist_first(usrctx->req_owners);
+    while (owner) {
+        struct req_owner *next = zlist_next(usrctx->req_owners);
+        if (owner->poll_id != -1 &&
+            now - owner->ts_issued_ns > REQ_OWNER_TIMEOUT_NS) {
+            struct poll_entry *p = poll_find(usrctx, owner->poll_id);
+            if (p) {
+                p->cb(p->cb_arg, p->id, OSD_ERROR_TIMEDOUT, NULL,
+                      p->outstanding_due_ns);
+                p->outstanding_due_ns = 0;
+            }
+            zlist_remove(usrctx->req_owners, owner);
+            free(owner);
+        }
+        owner = next;
+    }
+}
+
+/**
+ * Find and remove the originator of a register response
+ *
+ * @return the originator of the request (to be freed by the caller), or NULL
+ *         if the originator is unknown
+ */
+static struct req_owner* req_owner_pop(struct iothread_usr_ctx *usrctx,
+                                       const struct osd_packet *pkg)
+{
+    req_owners_expire(usrctx, osd_clock_monotonic_ns());
+
+    struct req_owner *owner = zlist_first(usrctx->req_owners);
+    while (owner) {
+        if (owner->diaddr == osd_packet_get_src(pkg)) {
+            zlist_remove(usrctx->req_owners, owner);
+            return owner;
+        }
+        owner = zlist_next(usrctx->req_owners);
+    }
+    return NULL;
+}
+
+/**
+ * Tell the main thread that no response to its request will arrive
+ */
+static void iothread_send_req_failed(struct worker_thread_ctx *thread_ctx,
+                                     uint32_t req_id, osd_result reason)
+{
+    struct req_failed_status status = {
+        .req_id = req_id,
+        .result = reason,
+    };
+    worker_send_data(thread_ctx->inproc_socket, "I-REQ-FAILED", &status,
+                     sizeof(status));
+}
+
+/**
+ * The main thread gave up waiting for the response to a request
+ *
+ * Keep the request in the list of outstanding requests to match a possibly
+ * still arriving response correctly, but discard this response.
+ */
+static void iothread_cancel_request(struct worker_thread_ctx *thread_ctx,
+                                    zmsg_t *msg)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    zframe_t *id_frame = zmsg_last(msg);
+    assert(id_frame && zframe_size(id_frame) == sizeof(uint32_t));
+    uint32_t req_id;
+    memcpy(&req_id, zframe_data(id_frame), sizeof(uint32_t));
+
+    struct req_owner *owner = zlist_first(usrctx->req_owners);
+    while (owner) {
+        if (owner->poll_id == -1 && owner->req_id == req_id) {
+            owner->poll_id = REQ_OWNER_INTERNAL;
+            owner->ts_issued_ns = osd_clock_monotonic_ns();
+            return;
+        }
+        owner = zlist_next(usrctx->req_owners);
+    }
+}
+
+/**
+ * Deliver the response to a periodic register read to its callback
+ */
+static void poll_handle_response(struct iothread_usr_ctx *usrctx,
+                                 int poll_id, const struct osd_packet *pkg)
+{
+    struct poll_entry *p = poll_find(usrctx, poll_id);
+    if (!p) {
+        // poll has been removed in the meantime
+        return;
+    }
+
+    uint64_t ts_due = p->outstanding_due_ns;
+    p->outstanding_due_ns = 0;
+
+    unsigned int exp_type_sub = ((p->reg_size_bit / 16) - 1) | 0b1000;
+    unsigned int exp_data_size_words =
+        osd_packet_get_data_size_words_from_payload(p->reg_size_bit / 16);
+    if (osd_packet_get_type_sub(pkg) != exp_type_sub ||
+        pkg->data_size_words != exp_data_size_words) {
+        p->cb(p->cb_arg, p->id, OSD_ERROR_DEVICE_ERROR, NULL, ts_due);
+        return;
+    }
+
+    p->cb(p->cb_arg, p->id, OSD_OK, pkg->data.payload, ts_due);
+}
+
+/**
+ * Send out a register read request for a poll
+ */
+static void poll_issue(struct worker_thread_ctx *thread_ctx,
+                       struct poll_entry *p, uint64_t now)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    osd_result rv;
+
+    if (!usrctx->link_up) {
+        return;
+    }
+
+    if (p->outstanding_due_ns) {
+        dbg(thread_ctx->log_ctx, "Skipping poll %d of register 0x%x of module "
+            "%u: previous read is still pending.", p->id, p->reg_addr,
+            p->diaddr);
+        return;
+    }
+
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(1));
+    assert(OSD_SUCCEEDED(rv));
+    osd_packet_set_header(pkg, p->diaddr, usrctx->diaddr, OSD_PACKET_TYPE_REG,
+                          (p->reg_size_bit / 16) - 1);
+    pkg->data.payload[0] = p->reg_addr;
+
+    zmsg_t *msg = zmsg_new();
+    assert(msg);
+    int zmq_rv = zmsg_addstr(msg, "D");
+    assert(zmq_rv == 0);
+    zmq_rv = zmsg_addmem(msg, pkg->data_raw, osd_packet_sizeof(pkg));
+    assert(zmq_rv == 0);
+    osd_packet_free(&pkg);
+
+    rv = worker_tx(thread_ctx, usrctx->ctrl_socket, &msg);
+    if (OSD_FAILED(rv)) {
+        err(thread_ctx->log_ctx, "Unable to send poll request to host "
+            "controller (%d)", rv);
+        return;
+    }
+
+    req_owner_add(usrctx, p->diaddr, p->id, 0);
+    p->outstanding_due_ns = p->next_due_ns;
+
+    osd_histogram_record(&usrctx->stats->poll_jitter,
+                         now > p->next_due_ns ? now - p->next_due_ns : 0);
+}
+
+/**
+ * Advance a poll to its next period
+ */
+static void poll_advance(struct worker_thread_ctx *thread_ctx,
+                         struct poll_entry *p, uint64_t now)
+{
+    p->period++;
+    p->next_due_ns = p->anchor_ns + p->period * p->interval_ns;
+
+    if (p->next_due_ns <= now) {
+        // we fell behind: skip all periods which have already passed
+        uint64_t missed = (now - p->next_due_ns) / p->interval_ns + 1;
+        dbg(thread_ctx->log_ctx, "Poll %d missed %lu periods.", p->id,
+            (unsigned long)missed);
+        p->period += missed;
+        p->next_due_ns = p->anchor_ns + p->period * p->interval_ns;
+    }
+}
+
+static int poll_timer_handler(zloop_t *loop, int timer_id,
+                              void *thread_ctx_void);
+
+/**
+ * (Re-)arm the poll timer to fire when the next poll falls due
+ */
+static void poll_schedule(struct worker_thread_ctx *thread_ctx)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    if (usrctx->poll_timer_id != -1) {
+        zloop_timer_end(thread_ctx->zloop, usrctx->poll_timer_id);
+        usrctx->poll_timer_id = -1;
+    }
+
+    uint64_t next_due_ns = UINT64_MAX;
+    struct poll_entry *p = zlist_first(usrctx->polls);
+    while (p) {
+        if (p->next_due_ns < next_due_ns) {
+            next_due_ns = p->next_due_ns;
+        }
+        p = zlist_next(usrctx->polls);
+    }
+    if (next_due_ns == UINT64_MAX) {
+        return;
+    }
+
+    // zloop timers have a resolution of 1 ms: round up to never fire early
+    uint64_t now = osd_clock_monotonic_ns();
+    size_t delay_ms = 0;
+    if (next_due_ns > now) {
+        delay_ms = (next_due_ns - now + 1000 * 1000 - 1) / (1000 * 1000);
+    }
+    usrctx->poll_timer_id = zloop_timer(thread_ctx->zloop, delay_ms, 1,
+                                        poll_timer_handler, thread_ctx);
+    assert(usrctx->poll_timer_id != -1);
+}
+
+/**
+ * Issue all polls which are due (or fall due within the coalescing window)
+ */
+static int poll_timer_handler(zloop_t *loop, int timer_id,
+                              void *thread_ctx_void)
+{
+    struct worker_thread_ctx *thread_ctx = thread_ctx_void;
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    // one-shot timer: zloop removes it after this handler returns
+    usrctx->poll_timer_id = -1;
+
+    uint64_t now = osd_clock_monotonic_ns();
+    req_owners_expire(usrctx, now);
+
+    struct poll_entry *p = zlist_first(usrctx->polls);
+    while (p) {
+        if (p->next_due_ns <= now + POLL_COALESCE_WINDOW_NS) {
+            poll_issue(thread_ctx, p, now);
+            poll_advance(thread_ctx, p, now);
+        }
+        p = zlist_next(usrctx->polls);
+    }
+
+    poll_schedule(thread_ctx);
+    return 0;
+}
+
+/**
+ * Add a poll in the I/O thread (I-POLL-ADD)
+ *
+ * Responds with I-POLL-ADD-DONE, carrying the poll ID or -1 on failure.
+ */
+static void iothread_poll_add(struct worker_thread_ctx *thread_ctx,
+                              zmsg_t *msg)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    zframe_t *req_frame = zmsg_next(msg);
+    assert(req_frame && zframe_size(req_frame) == sizeof(struct poll_add_req));
+    struct poll_add_req *req = (struct poll_add_req*)zframe_data(req_frame);
+
+    struct poll_entry *p = calloc(1, sizeof(struct poll_entry));
+    assert(p);
+    p->id = usrctx->poll_next_id++;
+    p->diaddr = req->diaddr;
+    p->reg_addr = req->reg_addr;
+    p->reg_size_bit = req->reg_size_bit;
+    p->interval_ns = (uint64_t)req->interval_ms * 1000 * 1000;
+    p->cb = req->cb;
+    p->cb_arg = req->cb_arg;
+    p->anchor_ns = osd_clock_monotonic_ns();
+    p->period = 0;
+    p->next_due_ns = p->anchor_ns;
+
+    int rv = zlist_append(usrctx->polls, p);
+    assert(rv == 0);
+
+    poll_schedule(thread_ctx);
+
+    worker_send_status(thread_ctx->inproc_socket, "I-POLL-ADD-DONE", p->id);
+}
+
+/**
+ * Remove a poll in the I/O thread (I-POLL-REMOVE)
+ *
+ * Responds with I-POLL-REMOVE-DONE.
+ */
+static void iothread_poll_remove(struct worker_thread_ctx *thread_ctx,
+                                 zmsg_t *msg)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    osd_result retval;
+
+    zframe_t *id_frame = zmsg_next(msg);
+    assert(id_frame && zframe_size(id_frame) == sizeof(int));
+    int poll_id = *(int*)zframe_data(id_frame);
+
+    struct poll_entry *p = poll_find(usrctx, poll_id);
+    if (p) {
+        zlist_remove(usrctx->polls, p);
+        free(p);
+        poll_schedule(thread_ctx);
+        retval = OSD_OK;
+    } else {
+        retval = OSD_ERROR_FAILURE;
+    }
+
+    worker_send_status(thread_ctx->inproc_socket, "I-POLL-REMOVE-DONE",
+                       retval);
+}
+
+/**
+ * Remove all polls and forget about all outstanding requests
+ */
+static void iothread_poll_clear(struct worker_thread_ctx *thread_ctx)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    if (usrctx->poll_timer_id != -1) {
+        zloop_timer_end(thread_ctx->zloop, usrctx->poll_timer_id);
+        usrctx->poll_timer_id = -1;
+    }
+
+    struct poll_entry *p;
+    while ((p = zlist_pop(usrctx->polls))) {
+        free(p);
+    }
+    struct req_owner *owner;
+    while ((owner = zlist_pop(usrctx->req_owners))) {
+        free(owner);
+    }
+}
+
+/**
+ * Send a management message to the host controller
+ */
+static osd_result iothread_send_mgmt(struct worker_thread_ctx *thread_ctx,
+                                     const char *cmd)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    zmsg_t *msg = zmsg_new();
+    assert(msg);
+    int rv = zmsg_addstr(msg, "M");
+    assert(rv == 0);
+    rv = zmsg_addstr(msg, cmd);
+    assert(rv == 0);
+    return worker_tx(thread_ctx, usrctx->ctrl_socket, &msg);
+}
+
+/**
+ * Tell the main thread the result of its management request
+ */
+static void iothread_send_mgmt_done(struct worker_thread_ctx *thread_ctx,
+                                    uint32_t req_id, osd_result result)
+{
+    struct mgmt_req_status status = {
+        .req_id = req_id,
+        .result = result,
+    };
+    worker_send_data(thread_ctx->inproc_socket, "I-MGMT-DONE", &status,
+                     sizeof(status));
+}
+
+/**
+ * Forward a management request of the main thread to the host controller
+ *
+ * The main thread is told the result once the host controller answers.
+ */
+static void iothread_mgmt_req(struct worker_thread_ctx *thread_ctx,
+                              zmsg_t *msg)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    osd_result rv;
+
+    zframe_t *req_frame = zmsg_last(msg);
+    assert(req_frame && zframe_size(req_frame) > sizeof(struct mgmt_req));
+    const struct mgmt_req *req = (const struct mgmt_req*)zframe_data(req_frame);
+    assert(req->cmd[zframe_size(req_frame) - sizeof(struct mgmt_req) - 1] ==
+           '\0');
+
+    if (!usrctx->link_up) {
+        err(thread_ctx->log_ctx, "Not connected to the host controller, "
+            "dropping management message '%s'", req->cmd);
+        iothread_send_mgmt_done(thread_ctx, req->req_id,
+                                OSD_ERROR_CONNECTION_FAILED);
+        return;
+    }
+
+    rv = iothread_send_mgmt(thread_ctx, req->cmd);
+    if (OSD_FAILED(rv)) {
+        iothread_send_mgmt_done(thread_ctx, req->req_id, rv);
+        return;
+    }
+
+    uint32_t *req_id = malloc(sizeof(uint32_t));
+    assert(req_id);
+    *req_id = req->req_id;
+    zlist_append(usrctx->mgmt_reqs, req_id);
+}
+
+/**
+ * Send a 16 bit register write request on behalf of the I/O thread
+ *
+ * The response is discarded.
+ */
+static void iothread_reg_write16(struct worker_thread_ctx *thread_ctx,
+                                 uint16_t diaddr, uint16_t reg_addr,
+                                 uint16_t value)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    osd_result rv;
+
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(2));
+    assert(OSD_SUCCEEDED(rv));
+    osd_packet_set_header(pkg, diaddr, usrctx->diaddr, OSD_PACKET_TYPE_REG,
+                          REQ_WRITE_REG_16);
+    pkg->data.payload[0] = reg_addr;
+    pkg->data.payload[1] = value;
+
+    zmsg_t *msg = zmsg_new();
+    assert(msg);
+    int zmq_rv = zmsg_addstr(msg, "D");
+    assert(zmq_rv == 0);
+    zmq_rv = zmsg_addmem(msg, pkg->data_raw, osd_packet_sizeof(pkg));
+    assert(zmq_rv == 0);
+    osd_packet_free(&pkg);
+
+    rv = worker_tx(thread_ctx, usrctx->ctrl_socket, &msg);
+    if (OSD_SUCCEEDED(rv)) {
+        req_owner_add(usrctx, diaddr, REQ_OWNER_INTERNAL, 0);
+    }
+}
+
+/**
+ * Keep track of modules sending their events to this host module
+ *
+ * Called for every 16 bit register write request sent to a module.
+ */
+static void event_dest_track(struct iothread_usr_ctx *usrctx,
+                             zframe_t *data_frame)
+{
+    if (zframe_size(data_frame) < 5 * sizeof(uint16_t)) {
+        return;
+    }
+    const uint16_t *data = (const uint16_t*)zframe_data(data_frame);
+    uint16_t mod_diaddr = data[0];
+    uint16_t reg_addr = data[3];
+    uint16_t value = data[4];
+    if (reg_addr != OSD_REG_BASE_MOD_EVENT_DEST) {
+        return;
+    }
+
+    uint16_t *entry = zlist_first(usrctx->event_dest_mods);
+    while (entry && *entry != mod_diaddr) {
+        entry = zlist_next(usrctx->event_dest_mods);
+    }
+
+    bool is_dest = (value == usrctx->diaddr);
+    if (is_dest && !entry) {
+        entry = malloc(sizeof(uint16_t));
+        assert(entry);
+        *entry = mod_diaddr;
+        int rv = zlist_append(usrctx->event_dest_mods, entry);
+        assert(rv == 0);
+    } else if (!is_dest && entry) {
+        zlist_remove(usrctx->event_dest_mods, entry);
+        free(entry);
+    }
+}
+
+/**
+ * Handle the loss of the connection to the host controller
+ *
+ * All outstanding requests are failed.
+ */
+static void iothread_link_lost(struct worker_thread_ctx *thread_ctx,
+                               const char *reason)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    if (!usrctx->link_up) {
+        return;
+    }
+
+    err(thread_ctx->log_ctx, "Lost connection to host controller at %s: %s. "
+        "Reconnecting.", usrctx->host_controller_address, reason);
+
+    usrctx->link_up = false;
+    usrctx->link_down_since_ns = osd_clock_monotonic_ns();
+
+    // Let register accesses waiting in the main thread fail right away
+    // instead of waiting for their timeout.
+    struct req_owner *owner;
+    while ((owner = zlist_pop(usrctx->req_owners))) {
+        if (owner->poll_id == -1) {
+            iothread_send_req_failed(thread_ctx, owner->req_id,
+                                     OSD_ERROR_CONNECTION_FAILED);
+        } else if (owner->poll_id != REQ_OWNER_INTERNAL) {
+            struct poll_entry *p = poll_find(usrctx, owner->poll_id);
+            if (p) {
+                p->cb(p->cb_arg, p->id, OSD_ERROR_CONNECTION_FAILED, NULL,
+                      p->outstanding_due_ns);
+                p->outstanding_due_ns = 0;
+            }
+        }
+        free(owner);
+    }
+    uint32_t *mgmt_req_id;
+    while ((mgmt_req_id = zlist_pop(usrctx->mgmt_reqs))) {
+        iothread_send_mgmt_done(thread_ctx, *mgmt_req_id,
+                                OSD_ERROR_CONNECTION_FAILED);
+        free(mgmt_req_id);
+    }
+
+    iothread_send_mgmt(thread_ctx, "DIADDR_REQUEST");
+}
+
+/**
+ * Fail the oldest outstanding request to a module
+ */
+static void iothread_fail_request(struct worker_thread_ctx *thread_ctx,
+                                  uint16_t diaddr, osd_result reason)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    struct req_owner *owner = zlist_first(usrctx->req_owners);
+    while (owner && owner->diaddr != diaddr) {
+        owner = zlist_next(usrctx->req_owners);
+    }
+    if (!owner) {
+        return;
+    }
+    zlist_remove(usrctx->req_owners, owner);
+
+    if (owner->poll_id == -1) {
+        iothread_send_req_failed(thread_ctx, owner->req_id, reason);
+    } else if (owner->poll_id != REQ_OWNER_INTERNAL) {
+        struct poll_entry *p = poll_find(usrctx, owner->poll_id);
+        if (p) {
+            p->cb(p->cb_arg, p->id, reason, NULL, p->outstanding_due_ns);
+            p->outstanding_due_ns = 0;
+        }
+    }
+    free(owner);
+}
+
+/**
+ * Resume operation after a new DI address has been obtained
+ */
+static void iothread_link_restored(struct worker_thread_ctx *thread_ctx,
+                                   uint16_t diaddr)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    uint64_t downtime_ns = osd_clock_monotonic_ns() -
+                           usrctx->link_down_since_ns;
+    osd_histogram_record(&usrctx->stats->link_downtime, downtime_ns);
+
+    info(thread_ctx->log_ctx, "Connection to host controller re-established "
+         "after %lu ms. New DI address is %u (was %u).",
+         (unsigned long)(downtime_ns / (1000 * 1000)), diaddr, usrctx->diaddr);
+
+    uint16_t old_diaddr = usrctx->diaddr;
+    usrctx->diaddr = diaddr;
+    __atomic_store_n(usrctx->diaddr_shared, diaddr, __ATOMIC_RELAXED);
+    usrctx->link_up = true;
+
+    // Redirect events to our new address
+    if (diaddr != old_diaddr) {
+        uint16_t *mod_diaddr = zlist_first(usrctx->event_dest_mods);
+        while (mod_diaddr) {
+            dbg(thread_ctx->log_ctx, "Redirecting events of module %u to new "
+                "DI address %u", *mod_diaddr, diaddr);
+            iothread_reg_write16(thread_ctx, *mod_diaddr,
+                                 OSD_REG_BASE_MOD_EVENT_DEST, diaddr);
+            mod_diaddr = zlist_next(usrctx->event_dest_mods);
+        }
+    }
+}
+
+/**
+ * Send a heartbeat to the host controller, and detect a lost connection
+ */
+static int iothread_heartbeat(zloop_t *loop, int timer_id,
+                              void *thread_ctx_void)
+{
+    struct worker_thread_ctx *thread_ctx = thread_ctx_void;
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    if (!usrctx->link_up) {
+        // retry to obtain a DI address until the host controller is back
+        iothread_send_mgmt(thread_ctx, "DIADDR_REQUEST");
+        return 0;
+    }
+
+    if (osd_clock_monotonic_ns() - usrctx->last_rx_ns > HEARTBEAT_TIMEOUT_NS) {
+        iothread_link_lost(thread_ctx, "heartbeat timed out");
+        return 0;
+    }
+
+    iothread_send_mgmt(thread_ctx, "PING");
+    return 0;
+}
+
+/**
+ * Process a management message from the host controller
+ */
+static void iothread_handle_mgmt_msg(struct worker_thread_ctx *thread_ctx,
+                                     zmsg_t *msg)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+
+    zframe_t *payload_frame = zmsg_next(msg);
+    if (!payload_frame) {
+        err(thread_ctx->log_ctx, "Ignoring empty management message.");
+        return;
+    }
+    char *payload = zframe_strdup(payload_frame);
+    assert(payload);
+
+    if (!strcmp(payload, "PONG")) {
+        // heartbeat response, nothing to do
+
+    } else if (!strcmp(payload, "UNKNOWN_PEER")) {
+        // Heartbeat response: the host controller doesn't know us (any
+        // more), e.g. because it has been restarted.
+        iothread_link_lost(thread_ctx, "host controller doesn't know us");
+
+    } else if (!strcmp(payload, "ACK") || !strcmp(payload, "NACK")) {
+        // Response to a management request of the main thread. The host
+        // controller answers requests in the order they were sent.
+        uint32_t *req_id = zlist_pop(usrctx->mgmt_reqs);
+        if (req_id) {
+            iothread_send_mgmt_done(thread_ctx, *req_id,
+                                    !strcmp(payload, "ACK") ?
+                                    OSD_OK : OSD_ERROR_FAILURE);
+            free(req_id);
+        } else {
+            err(thread_ctx->log_ctx, "Ignoring unexpected %s from the host "
+                "controller.", payload);
+        }
+
+    } else if (!strncmp(payload, "DEST_UNREACHABLE ",
+                        strlen("DEST_UNREACHABLE "))) {
+        // The host controller couldn't deliver a packet we sent.
+        unsigned int diaddr = atoi(payload + strlen("DEST_UNREACHABLE "));
+        err(thread_ctx->log_ctx, "Module %u is unreachable.", diaddr);
+        iothread_fail_request(thread_ctx, diaddr, OSD_ERROR_COM);
+
+    } else if (!usrctx->link_up) {
+        // response to DIADDR_REQUEST
+        char *end;
+        long int addr = strtol(payload, &end, 10);
+        if (*end || addr < 0 || addr > UINT16_MAX) {
+            err(thread_ctx->log_ctx, "Invalid DI address '%s' received.",
+                payload);
+        } else {
+            iothread_link_restored(thread_ctx, (uint16_t)addr);
+        }
+
+    } else if (atoi(payload) == usrctx->diaddr) {
+        // duplicate response to a repeated DIADDR_REQUEST
+
+    } else {
+        err(thread_ctx->log_ctx, "Ignoring unexpected management message "
+            "'%s'.", payload);
+    }
 
-    /** Argument passed to event_handler */
-    void* event_handler_arg;
-};
+    free(payload);
+}
+
+/**
+ * Host receive time of the event packet currently passed to the event handler
+ *
+ * Only valid in the I/O thread during the event handler call.
+ */
+static __thread uint64_t event_rx_time_ns;
 
 /**
  * Process incoming messages from the host controller
@@ -93,6 +1101,8 @@ static int iothread_rcv_from_hostctrl(zloop_t *loop, zsock_t *reader,
         return -1; // process was interrupted, terminate zloop
     }
 
+    usrctx->last_rx_ns = osd_clock_monotonic_ns();
+
     zframe_t *type_frame = zmsg_first(msg);
     assert(type_frame);
     if (zframe_streq(type_frame, "D")) {
@@ -107,24 +1117,69 @@ static int iothread_rcv_from_hostctrl(zloop_t *loop, zsock_t *reader,
         // Ownership of |pkg| is transferred to the event handler.
         if (osd_packet_get_type(pkg) == OSD_PACKET_TYPE_EVENT) {
             zmsg_destroy(&msg);
+            event_rx_time_ns = usrctx->last_rx_ns;
+            uint64_t ts_start = osd_clock_monotonic_ns();
             osd_rv = usrctx->event_handler(usrctx->event_handler_arg, pkg);
+            osd_histogram_record(&usrctx->stats->event_handler,
+                                 osd_clock_monotonic_ns() - ts_start);
             if (OSD_FAILED(osd_rv)) {
                 err(thread_ctx->log_ctx, "Handling EVENT packet failed: %d", osd_rv);
             }
             return 0;
         }
 
+        // Only register responses are expected beyond this point
+        if (osd_packet_get_type(pkg) != OSD_PACKET_TYPE_REG ||
+            !(osd_packet_get_type_sub(pkg) & 0b1000)) {
+            err(thread_ctx->log_ctx, "Ignoring unexpected packet of type %u "
+                "from module %u.", osd_packet_get_type(pkg),
+                osd_packet_get_src(pkg));
+            osd_packet_free(&pkg);
+            zmsg_destroy(&msg);
+            return 0;
+        }
+
+        struct req_owner *owner = req_owner_pop(usrctx, pkg);
+        if (!owner || owner->poll_id == REQ_OWNER_INTERNAL) {
+            // internal request, or a request the main thread has given up on
+            if (!owner) {
+                dbg(thread_ctx->log_ctx, "Discarding register response "
+                    "from module %u without outstanding request.",
+                    osd_packet_get_src(pkg));
+            }
+            free(owner);
+            osd_packet_free(&pkg);
+            zmsg_destroy(&msg);
+            return 0;
+        }
+
+        if (owner->poll_id != -1) {
+            // Hand responses to periodic register reads to the poll callback
+            poll_handle_response(usrctx, owner->poll_id, pkg);
+            free(owner);
+            osd_packet_free(&pkg);
+            zmsg_destroy(&msg);
+            return 0;
+        }
+
+        // Forward the response to the main thread, together with the ID of
+        // the request it belongs to
+        rv = zmsg_addmem(msg, &owner->req_id, sizeof(owner->req_id));
+        assert(rv == 0);
+        free(owner);
         osd_packet_free(&pkg);
 
-        // Forward all other data messages to the main thread
         rv = zmsg_send(&msg, thread_ctx->inproc_socket);
         assert(rv == 0);
 
     } else if (zframe_streq(type_frame, "M")) {
-        assert(0 && "TODO: Handle incoming management messages.");
+        iothread_handle_mgmt_msg(thread_ctx, msg);
+        zmsg_destroy(&msg);
 
     } else {
-        assert(0 && "Message of unknown type received.");
+        err(thread_ctx->log_ctx, "Ignoring message of unknown type received "
+            "from host controller.");
+        zmsg_destroy(&msg);
     }
 
 
@@ -223,6 +1278,7 @@ static void iothread_connect_to_hostctrl(struct worker_thread_ctx *thread_ctx)
         goto free_return;
     }
     retval = di_addr;
+    usrctx->diaddr = di_addr;
 
     // register handler for messages coming from the host controller
     int zmq_rv;
@@ -231,6 +1287,13 @@ static void iothread_connect_to_hostctrl(struct worker_thread_ctx *thread_ctx)
     assert(zmq_rv == 0);
     zloop_reader_set_tolerant(thread_ctx->zloop, usrctx->ctrl_socket);
 
+    usrctx->link_up = true;
+    usrctx->last_rx_ns = osd_clock_monotonic_ns();
+    usrctx->heartbeat_timer_id = zloop_timer(thread_ctx->zloop,
+                                             OSD_HEARTBEAT_INTERVAL_MS, 0,
+                                             iothread_heartbeat, thread_ctx);
+    assert(usrctx->heartbeat_timer_id != -1);
+
 free_return:
     if (retval == -1) {
         zsock_destroy(&usrctx->ctrl_socket);
@@ -243,17 +1306,32 @@ free_return:
  * Disconnect from the host controller in the I/O thread
  *
  * This function is called when receiving a I-DISCONNECT message in the
- * I/O thread. After the disconnect is done a I-DISCONNECT-DONE message is sent
- * to the main thread.
+ * I/O thread. Outbound messages still pending are sent out until @p deadline
+ * (zclock_mono() timestamp in ms). After the disconnect is done a
+ * I-DISCONNECT-DONE message is sent to the main thread.
  */
-static void iothread_disconnect_from_hostctrl(struct worker_thread_ctx *thread_ctx)
+static void iothread_disconnect_from_hostctrl(struct worker_thread_ctx *thread_ctx,
+                                              int64_t deadline)
 {
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
     osd_result retval;
 
+    iothread_poll_clear(thread_ctx);
+
+    zloop_timer_end(thread_ctx->zloop, usrctx->heartbeat_timer_id);
+    usrctx->heartbeat_timer_id = -1;
+    usrctx->link_up = false;
+
+    uint16_t *mod_diaddr;
+    while ((mod_diaddr = zlist_pop(usrctx->event_dest_mods))) {
+        free(mod_diaddr);
+    }
+
     zloop_reader_end(thread_ctx->zloop, usrctx->ctrl_socket);
+    worker_tx_flush(thread_ctx, usrctx->ctrl_socket,
+                    worker_time_left(deadline), NULL);
     zsock_destroy(&usrctx->ctrl_socket);
 
     retval = OSD_OK;
@@ -268,18 +1346,82 @@ static osd_result iothread_handle_inproc_request(struct worker_thread_ctx *threa
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    int rv;
+    osd_result rv;
 
     if (!strcmp(name, "I-CONNECT")) {
         iothread_connect_to_hostctrl(thread_ctx);
 
     } else if (!strcmp(name, "I-DISCONNECT")) {
-        iothread_disconnect_from_hostctrl(thread_ctx);
+        iothread_disconnect_from_hostctrl(thread_ctx,
+                                          worker_msg_get_deadline(msg));
 
     } else if (!strcmp(name, "D")) {
+        // The last two frames hold the time the packet was enqueued by the
+        // main thread and the request ID; they are not forwarded.
+        zframe_t *ts_frame = zmsg_last(msg);
+        assert(ts_frame && zframe_size(ts_frame) == sizeof(uint64_t));
+        uint64_t ts_enqueue;
+        memcpy(&ts_enqueue, zframe_data(ts_frame), sizeof(uint64_t));
+        zmsg_remove(msg, ts_frame);
+        zframe_destroy(&ts_frame);
+
+        zframe_t *id_frame = zmsg_last(msg);
+        assert(id_frame && zframe_size(id_frame) == sizeof(uint32_t));
+        uint32_t req_id;
+        memcpy(&req_id, zframe_data(id_frame), sizeof(uint32_t));
+        zmsg_remove(msg, id_frame);
+        zframe_destroy(&id_frame);
+
+        uint16_t dest;
+        unsigned int type_sub;
+        zframe_t *data_frame = zmsg_last(msg);
+        bool is_reg_req = frame_get_reg_req(data_frame, &dest, &type_sub);
+        if (is_reg_req) {
+            stats_record_queueing(usrctx->stats, dest, type_sub, ts_enqueue);
+        }
+
+        if (!usrctx->link_up) {
+            // We have no valid DI address right now; fail the request.
+            if (is_reg_req) {
+                iothread_send_req_failed(thread_ctx, req_id,
+                                         OSD_ERROR_CONNECTION_FAILED);
+            }
+            zmsg_destroy(&msg);
+            return OSD_OK;
+        }
+
+        // The DI address might have changed since the packet was assembled.
+        if (zframe_size(data_frame) >= 2 * sizeof(uint16_t)) {
+            ((uint16_t*)zframe_data(data_frame))[1] = usrctx->diaddr;
+        }
+
+        if (is_reg_req && type_sub == REQ_WRITE_REG_16) {
+            event_dest_track(usrctx, data_frame);
+        }
+
         // Forward data packet to the host controller
-        rv = zmsg_send(&msg, usrctx->ctrl_socket);
-        assert(rv == 0);
+        rv = worker_tx(thread_ctx, usrctx->ctrl_socket, &msg);
+        if (OSD_FAILED(rv)) {
+            err(thread_ctx->log_ctx, "Unable to send data packet to host "
+                "controller (%d)", rv);
+            if (is_reg_req) {
+                iothread_send_req_failed(thread_ctx, req_id, rv);
+            }
+        } else if (is_reg_req) {
+            req_owner_add(usrctx, dest, -1, req_id);
+        }
+
+    } else if (!strcmp(name, "I-REQ-CANCEL")) {
+        iothread_cancel_request(thread_ctx, msg);
+
+    } else if (!strcmp(name, "I-POLL-ADD")) {
+        iothread_poll_add(thread_ctx, msg);
+
+    } else if (!strcmp(name, "I-POLL-REMOVE")) {
+        iothread_poll_remove(thread_ctx, msg);
+
+    } else if (!strcmp(name, "I-MGMT")) {
+        iothread_mgmt_req(thread_ctx, msg);
 
     } else {
         assert(0 && "Received unknown message from main thread.");
@@ -296,6 +1438,23 @@ static osd_result iothread_destroy(struct worker_thread_ctx *thread_ctx)
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
+    // the zloop is not running any more, the poll timer is gone with it
+    usrctx->poll_timer_id = -1;
+    iothread_poll_clear(thread_ctx);
+    zlist_destroy(&usrctx->polls);
+    zlist_destroy(&usrctx->req_owners);
+    uint32_t *mgmt_req_id;
+    while ((mgmt_req_id = zlist_pop(usrctx->mgmt_reqs))) {
+        free(mgmt_req_id);
+    }
+    zlist_destroy(&usrctx->mgmt_reqs);
+
+    uint16_t *mod_diaddr;
+    while ((mod_diaddr = zlist_pop(usrctx->event_dest_mods))) {
+        free(mod_diaddr);
+    }
+    zlist_destroy(&usrctx->event_dest_mods);
+
     free(usrctx->host_controller_address);
     free(usrctx);
     thread_ctx->usr = NULL;
@@ -304,21 +1463,37 @@ static osd_result iothread_destroy(struct worker_thread_ctx *thread_ctx)
 }
 
 /**
- * Send a DI Packet to the host controller
+ * Send a register request to the host controller
  *
  * The actual sending is done through the I/O worker.
+ *
+ * @param ctx the osd_hostmod library context
+ * @param packet the request packet
+ * @param req_id the ID of the request, used to identify the response in
+ *               osd_hostmod_receive_packet()
  */
 static osd_result osd_hostmod_send_packet(struct osd_hostmod_ctx *ctx,
-                                          struct osd_packet *packet)
+                                          struct osd_packet *packet,
+                                          uint32_t *req_id)
 {
     int rv;
     zmsg_t *msg = zmsg_new();
     assert(msg);
 
+    if (++ctx->req_next_id == 0) {
+        ctx->req_next_id = 1;
+    }
+    *req_id = ctx->req_next_id;
+
     rv = zmsg_addstr(msg, "D");
     assert(rv == 0);
     rv = zmsg_addmem(msg, packet->data_raw, osd_packet_sizeof(packet));
     assert(rv == 0);
+    rv = zmsg_addmem(msg, req_id, sizeof(*req_id));
+    assert(rv == 0);
+    uint64_t ts_enqueue = osd_clock_monotonic_ns();
+    rv = zmsg_addmem(msg, &ts_enqueue, sizeof(ts_enqueue));
+    assert(rv == 0);
 
     rv = zmsg_send(&msg, ctx->ioworker_ctx->inproc_socket);
     if (rv != 0) {
@@ -329,45 +1504,93 @@ static osd_result osd_hostmod_send_packet(struct osd_hostmod_ctx *ctx,
 }
 
 /**
- * Receive a DI Packet
+ * Receive the response to a register request
+ *
+ * Stale status messages from the I/O thread (e.g. the reply to a poll_add()
+ * call which timed out) are discarded. Responses to requests other than the
+ * one the caller is waiting for are returned nevertheless; the caller needs to
+ * compare @p req_id.
+ *
+ * @param ctx the osd_hostmod library context
+ * @param req_id the ID of the request the response belongs to (unless the
+ *               operation timed out)
+ * @param packet the response packet (if OSD_OK is returned)
  *
  * @return OSD_OK if the operation was successful,
  *         OSD_ERROR_TIMEDOUT if the operation timed out.
- *         Any other value indicates an error
+ *         Any other value indicates that the request failed.
  */
 static osd_result osd_hostmod_receive_packet(struct osd_hostmod_ctx *ctx,
+                                             uint32_t *req_id,
                                              struct osd_packet **packet)
 {
     osd_result osd_rv;
 
-    errno = 0;
-    zmsg_t* msg = zmsg_recv(ctx->ioworker_ctx->inproc_socket);
-    if (!msg && errno == EAGAIN) {
-        return OSD_ERROR_TIMEDOUT;
-    }
-    assert(msg);
+    while (1) {
+        errno = 0;
+        zmsg_t* msg = zmsg_recv(ctx->ioworker_ctx->inproc_socket);
+        if (!msg && errno == EAGAIN) {
+            return OSD_ERROR_TIMEDOUT;
+        }
+        assert(msg);
+
+        zframe_t *type_frame = zmsg_pop(msg);
+        assert(type_frame);
+        if (zframe_streq(type_frame, "I-REQ-FAILED")) {
+            // the I/O thread knows that no response will arrive
+            zframe_destroy(&type_frame);
+            zframe_t *status_frame = zmsg_pop(msg);
+            assert(status_frame && zframe_size(status_frame) ==
+                   sizeof(struct req_failed_status));
+            struct req_failed_status status;
+            memcpy(&status, zframe_data(status_frame), sizeof(status));
+            zframe_destroy(&status_frame);
+            zmsg_destroy(&msg);
+            *req_id = status.req_id;
+            return status.result;
+        }
+        if (!zframe_streq(type_frame, "D")) {
+            char *name = zframe_strdup(type_frame);
+            dbg(ctx->log_ctx, "Discarding stale message %s from I/O thread.",
+                name);
+            free(name);
+            zframe_destroy(&type_frame);
+            zmsg_destroy(&msg);
+            continue;
+        }
+        zframe_destroy(&type_frame);
 
-    // ensure that the message we got from the I/O thread is packet data
-    // XXX: possibly extend to hand off non-packet messages to their appropriate
-    // handler
-    zframe_t *type_frame = zmsg_pop(msg);
-    assert(type_frame);
-    assert(zframe_streq(type_frame, "D"));
-    zframe_destroy(&type_frame);
+        // get osd_packet from frame data
+        zframe_t *data_frame = zmsg_pop(msg);
+        assert(data_frame);
+        struct osd_packet *p;
+        osd_rv = osd_packet_new_from_zframe(&p, data_frame);
+        assert(OSD_SUCCEEDED(osd_rv));
+        zframe_destroy(&data_frame);
 
-    // get osd_packet from frame data
-    zframe_t *data_frame = zmsg_pop(msg);
-    assert(data_frame);
-    struct osd_packet *p;
-    osd_rv = osd_packet_new_from_zframe(&p, data_frame);
-    assert(OSD_SUCCEEDED(osd_rv));
+        zframe_t *id_frame = zmsg_pop(msg);
+        assert(id_frame && zframe_size(id_frame) == sizeof(uint32_t));
+        memcpy(req_id, zframe_data(id_frame), sizeof(uint32_t));
+        zframe_destroy(&id_frame);
 
-    zframe_destroy(&data_frame);
-    zmsg_destroy(&msg);
+        zmsg_destroy(&msg);
 
-    *packet = p;
+        *packet = p;
 
-    return OSD_OK;
+        return OSD_OK;
+    }
+}
+
+/**
+ * Stop waiting for the response to a register request
+ *
+ * The I/O thread discards the response once it arrives.
+ */
+static void osd_hostmod_cancel_request(struct osd_hostmod_ctx *ctx,
+                                       uint32_t req_id)
+{
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-REQ-CANCEL",
+                     &req_id, sizeof(req_id));
 }
 
 API_EXPORT
@@ -385,6 +1608,10 @@ osd_result osd_hostmod_new(struct osd_hostmod_ctx **ctx,
     c->log_ctx = log_ctx;
     c->is_connected = false;
 
+    c->stats = calloc(1, sizeof(struct osd_hostmod_stats));
+    assert(c->stats);
+    stats_init(c->stats);
+
     // prepare custom data passed to I/O thread
     struct iothread_usr_ctx *iothread_usr_data = calloc(1, sizeof(struct iothread_usr_ctx));
     assert(iothread_usr_data);
@@ -392,6 +1619,19 @@ osd_result osd_hostmod_new(struct osd_hostmod_ctx **ctx,
     iothread_usr_data->event_handler = event_handler;
     iothread_usr_data->event_handler_arg = event_handler_arg;
     iothread_usr_data->host_controller_address = strdup(host_controller_address);
+    iothread_usr_data->stats = c->stats;
+    iothread_usr_data->polls = zlist_new();
+    assert(iothread_usr_data->polls);
+    iothread_usr_data->poll_next_id = 1;
+    iothread_usr_data->poll_timer_id = -1;
+    iothread_usr_data->req_owners = zlist_new();
+    assert(iothread_usr_data->req_owners);
+    iothread_usr_data->mgmt_reqs = zlist_new();
+    assert(iothread_usr_data->mgmt_reqs);
+    iothread_usr_data->event_dest_mods = zlist_new();
+    assert(iothread_usr_data->event_dest_mods);
+    iothread_usr_data->heartbeat_timer_id = -1;
+    iothread_usr_data->diaddr_shared = &c->diaddr;
 
     rv = worker_new(&c->ioworker_ctx, log_ctx, NULL, iothread_destroy,
                           iothread_handle_inproc_request, iothread_usr_data);
@@ -404,12 +1644,18 @@ osd_result osd_hostmod_new(struct osd_hostmod_ctx **ctx,
     return OSD_OK;
 }
 
+API_EXPORT
+uint64_t osd_hostmod_get_event_rx_time_ns(void)
+{
+    return event_rx_time_ns;
+}
+
 API_EXPORT
 uint16_t osd_hostmod_get_diaddr(struct osd_hostmod_ctx *ctx)
 {
     assert(ctx);
     assert(ctx->is_connected);
-    return ctx->diaddr;
+    return __atomic_load_n(&ctx->diaddr, __ATOMIC_RELAXED);
 }
 
 
@@ -456,10 +1702,9 @@ osd_result osd_hostmod_disconnect(struct osd_hostmod_ctx *ctx)
         return OSD_ERROR_NOT_CONNECTED;
     }
 
-    worker_send_status(ctx->ioworker_ctx->inproc_socket, "I-DISCONNECT", 0);
     osd_result retval;
-    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
-                                "I-DISCONNECT-DONE", &retval);
+    rv = worker_request_with_deadline(ctx->ioworker_ctx, "I-DISCONNECT",
+                                      "I-DISCONNECT-DONE", &retval);
     if (OSD_FAILED(rv)) {
         return rv;
     }
@@ -472,21 +1717,46 @@ osd_result osd_hostmod_disconnect(struct osd_hostmod_ctx *ctx)
     return OSD_OK;
 }
 
+API_EXPORT
+void osd_hostmod_set_shutdown_timeout(struct osd_hostmod_ctx *ctx,
+                                      int timeout_ms)
+{
+    assert(ctx);
+    worker_set_shutdown_timeout(ctx->ioworker_ctx, timeout_ms);
+}
+
 API_EXPORT
 void osd_hostmod_free(struct osd_hostmod_ctx **ctx_p)
 {
-    assert(ctx_p);
-    struct osd_hostmod_ctx *ctx = *ctx_p;
-    if (!ctx) {
-        return;
-    }
+    osd_hostmod_free_all(ctx_p, 1, NULL);
+}
 
-    assert(!ctx->is_connected);
+API_EXPORT
+void osd_hostmod_free_all(struct osd_hostmod_ctx **ctxs, size_t count,
+                          struct osd_shutdown_stats *stats)
+{
+    assert(ctxs);
+
+    struct worker_ctx **workers = calloc(count, sizeof(struct worker_ctx*));
+    assert(workers);
+    for (size_t i = 0; i < count; i++) {
+        if (ctxs[i]) {
+            assert(!ctxs[i]->is_connected);
+            workers[i] = ctxs[i]->ioworker_ctx;
+        }
+    }
 
-    worker_free(&ctx->ioworker_ctx);
+    // shut down all I/O threads in parallel
+    worker_free_all(workers, count, stats);
+    free(workers);
 
-    free(ctx);
-    *ctx_p = NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (ctxs[i]) {
+            free(ctxs[i]->stats);
+            free(ctxs[i]);
+            ctxs[i] = NULL;
+        }
+    }
 }
 
 static osd_result osd_hostmod_regaccess(struct osd_hostmod_ctx *ctx,
@@ -528,23 +1798,50 @@ static osd_result osd_hostmod_regaccess(struct osd_hostmod_ctx *ctx,
     }
 
 
+    unsigned int stats_op, stats_size_idx;
+    stats_reg_req_idx(subtype_req, &stats_op, &stats_size_idx);
+    struct osd_hostmod_stats_module *stats_mod =
+        stats_module_get(ctx->stats, module_addr, true);
+    uint64_t ts_start = osd_clock_monotonic_ns();
+
     // send register read request
-    rv = osd_hostmod_send_packet(ctx, pkg_req);
+    uint32_t req_id;
+    rv = osd_hostmod_send_packet(ctx, pkg_req, &req_id);
     if (OSD_FAILED(rv)) {
         retval = rv;
         goto err_free_req;
     }
 
-    // wait for response
+    // wait for response, skipping responses to requests which timed out
+    // earlier
     struct osd_packet *pkg_resp;
-    do {
-        rv = osd_hostmod_receive_packet(ctx, &pkg_resp);
-    } while (rv == OSD_ERROR_TIMEDOUT && do_block);
+    while (1) {
+        uint32_t resp_req_id;
+        rv = osd_hostmod_receive_packet(ctx, &resp_req_id, &pkg_resp);
+        if (rv == OSD_ERROR_TIMEDOUT) {
+            if (do_block) {
+                continue;
+            }
+            osd_hostmod_cancel_request(ctx, req_id);
+            break;
+        }
+        if (resp_req_id == req_id) {
+            break;
+        }
+        dbg(ctx->log_ctx, "Discarding stale response to request %u.",
+            resp_req_id);
+        if (OSD_SUCCEEDED(rv)) {
+            free(pkg_resp);
+        }
+    }
     if (OSD_FAILED(rv)) {
         retval = rv;
         goto err_free_req;
     }
 
+    osd_histogram_record(&stats_mod->round_trip[stats_op][stats_size_idx],
+                         osd_clock_monotonic_ns() - ts_start);
+
     // parse response
     assert(osd_packet_get_type(pkg_resp) == OSD_PACKET_TYPE_REG);
 
@@ -685,6 +1982,147 @@ err_free_resp:
 }
 
 
+API_EXPORT
+osd_result osd_hostmod_reg_write_batch(struct osd_hostmod_ctx *ctx,
+                                       struct osd_hostmod_reg_write_req *reqs,
+                                       size_t num_reqs, int flags)
+{
+    assert(ctx);
+    if (!ctx->is_connected) {
+        return OSD_ERROR_NOT_CONNECTED;
+    }
+
+    osd_result rv;
+    bool do_block = (flags & OSD_HOSTMOD_BLOCKING);
+
+    bool *pending = calloc(num_reqs, sizeof(bool));
+    assert(pending);
+    uint32_t *req_ids = calloc(num_reqs, sizeof(uint32_t));
+    assert(req_ids);
+    uint64_t *ts_sent = calloc(num_reqs, sizeof(uint64_t));
+    assert(ts_sent);
+    size_t num_pending = 0;
+
+    // send all requests before waiting for the first response
+    for (size_t i = 0; i < num_reqs; i++) {
+        struct osd_hostmod_reg_write_req *req = &reqs[i];
+        assert(req->reg_size_bit % 16 == 0 && req->reg_size_bit <= 128);
+
+        dbg(ctx->log_ctx, "Issuing %d bit write request to register 0x%x of "
+            "module 0x%x (batched)", req->reg_size_bit, req->reg_addr,
+            req->diaddr);
+
+        struct osd_packet *pkg_req;
+        unsigned int wr_data_len_words = req->reg_size_bit / 16;
+        rv = osd_packet_new(&pkg_req,
+            osd_packet_get_data_size_words_from_payload(1 + wr_data_len_words));
+        if (OSD_FAILED(rv)) {
+            req->result = rv;
+            continue;
+        }
+        osd_packet_set_header(pkg_req, req->diaddr, ctx->diaddr,
+                              OSD_PACKET_TYPE_REG,
+                              get_subtype_reg_write_req(req->reg_size_bit));
+        pkg_req->data.payload[0] = req->reg_addr;
+        memcpy(&pkg_req->data.payload[1], req->data, req->reg_size_bit / 8);
+
+        stats_module_get(ctx->stats, req->diaddr, true);
+
+        ts_sent[i] = osd_clock_monotonic_ns();
+        rv = osd_hostmod_send_packet(ctx, pkg_req, &req_ids[i]);
+        free(pkg_req);
+        if (OSD_FAILED(rv)) {
+            req->result = rv;
+            continue;
+        }
+
+        req->result = OSD_ERROR_TIMEDOUT;
+        pending[i] = true;
+        num_pending++;
+    }
+
+    // collect the responses
+    while (num_pending > 0) {
+        struct osd_packet *pkg_resp;
+        uint32_t resp_req_id;
+        rv = osd_hostmod_receive_packet(ctx, &resp_req_id, &pkg_resp);
+        if (rv == OSD_ERROR_TIMEDOUT) {
+            if (do_block) {
+                continue;
+            }
+            for (size_t i = 0; i < num_reqs; i++) {
+                if (pending[i]) {
+                    osd_hostmod_cancel_request(ctx, req_ids[i]);
+                }
+            }
+            break;
+        }
+
+        size_t i;
+        for (i = 0; i < num_reqs; i++) {
+            if (pending[i] && req_ids[i] == resp_req_id) {
+                break;
+            }
+        }
+        if (i == num_reqs) {
+            dbg(ctx->log_ctx, "Discarding stale response to request %u.",
+                resp_req_id);
+            if (OSD_SUCCEEDED(rv)) {
+                free(pkg_resp);
+            }
+            continue;
+        }
+
+        if (OSD_FAILED(rv)) {
+            reqs[i].result = rv;
+            pending[i] = false;
+            num_pending--;
+            continue;
+        }
+
+        uint16_t src = osd_packet_get_src(pkg_resp);
+
+        unsigned int stats_op, stats_size_idx;
+        stats_reg_req_idx(get_subtype_reg_write_req(reqs[i].reg_size_bit),
+                          &stats_op, &stats_size_idx);
+        struct osd_hostmod_stats_module *stats_mod =
+            stats_module_get(ctx->stats, src, true);
+        osd_histogram_record(&stats_mod->round_trip[stats_op][stats_size_idx],
+                             osd_clock_monotonic_ns() - ts_sent[i]);
+
+        unsigned int type_sub = osd_packet_get_type_sub(pkg_resp);
+        if (type_sub == RESP_WRITE_REG_ERROR) {
+            err(ctx->log_ctx, "Device returned error packet %u when "
+                "accessing register 0x%x of module %u.", type_sub,
+                reqs[i].reg_addr, src);
+            reqs[i].result = OSD_ERROR_DEVICE_ERROR;
+        } else if (osd_packet_get_type(pkg_resp) != OSD_PACKET_TYPE_REG ||
+                   type_sub != RESP_WRITE_REG_SUCCESS ||
+                   pkg_resp->data_size_words !=
+                   osd_packet_get_data_size_words_from_payload(0)) {
+            err(ctx->log_ctx, "Invalid write response received from module "
+                "%u.", src);
+            reqs[i].result = OSD_ERROR_DEVICE_INVALID_DATA;
+        } else {
+            reqs[i].result = OSD_OK;
+        }
+        pending[i] = false;
+        num_pending--;
+        free(pkg_resp);
+    }
+
+    free(pending);
+    free(req_ids);
+    free(ts_sent);
+
+    for (size_t i = 0; i < num_reqs; i++) {
+        if (OSD_FAILED(reqs[i].result)) {
+            return reqs[i].result;
+        }
+    }
+    return OSD_OK;
+}
+
 /**
  * Read the system information from the device, as stored in the SCM
  */
@@ -788,3 +2226,235 @@ static osd_result enumerate_debug_modules(struct osd_hostmod_ctx *ctx)
     return ret;
 }
 #endif
+
+API_EXPORT
+osd_result osd_hostmod_poll_add(struct osd_hostmod_ctx *ctx,
+                                uint16_t diaddr, uint16_t reg_addr,
+                                int reg_size_bit, unsigned int interval_ms,
+                                osd_hostmod_poll_cb_fn cb, void *cb_arg,
+                                int *poll_id)
+{
+    osd_result rv;
+
+    assert(ctx);
+    assert(cb);
+    assert(reg_size_bit % 16 == 0 && reg_size_bit <= 128);
+    assert(interval_ms > 0);
+
+    if (!ctx->is_connected) {
+        return OSD_ERROR_NOT_CONNECTED;
+    }
+
+    struct poll_add_req req = {
+        .diaddr = diaddr,
+        .reg_addr = reg_addr,
+        .reg_size_bit = reg_size_bit,
+        .interval_ms = interval_ms,
+        .cb = cb,
+        .cb_arg = cb_arg
+    };
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-POLL-ADD", &req,
+                     sizeof(req));
+
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-POLL-ADD-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    if (retval == -1) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    dbg(ctx->log_ctx, "Polling %d bit register 0x%x of module %u every %u ms "
+        "(poll %d)", reg_size_bit, reg_addr, diaddr, interval_ms, retval);
+
+    *poll_id = retval;
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_hostmod_poll_remove(struct osd_hostmod_ctx *ctx, int poll_id)
+{
+    osd_result rv;
+
+    assert(ctx);
+
+    if (!ctx->is_connected) {
+        return OSD_ERROR_NOT_CONNECTED;
+    }
+
+    worker_send_status(ctx->ioworker_ctx->inproc_socket, "I-POLL-REMOVE",
+                       poll_id);
+
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-POLL-REMOVE-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+/**
+ * Send a management request to the host controller and wait for its answer
+ *
+ * @return OSD_OK if the host controller acknowledged the request,
+ *         OSD_ERROR_FAILURE if it rejected the request,
+ *         OSD_ERROR_TIMEDOUT if no answer arrived in time,
+ *         OSD_ERROR_CONNECTION_FAILED if the connection to the host
+ *         controller is lost
+ */
+static osd_result osd_hostmod_mgmt_request(struct osd_hostmod_ctx *ctx,
+                                           const char *cmd)
+{
+    osd_result rv;
+
+    size_t cmd_size = strlen(cmd) + 1;
+    size_t req_size = sizeof(struct mgmt_req) + cmd_size;
+    struct mgmt_req *req = malloc(req_size);
+    assert(req);
+    req->req_id = ctx->mgmt_req_next_id++;
+    memcpy(req->cmd, cmd, cmd_size);
+    uint32_t req_id = req->req_id;
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-MGMT", req,
+                     req_size);
+    free(req);
+
+    struct mgmt_req_status status;
+    do {
+        rv = worker_wait_for_data(ctx->ioworker_ctx->inproc_socket,
+                                  "I-MGMT-DONE", &status, sizeof(status));
+        if (OSD_FAILED(rv)) {
+            return rv;
+        }
+        // skip the results of earlier requests which timed out
+    } while (status.req_id != req_id);
+
+    return status.result;
+}
+
+API_EXPORT
+osd_result osd_hostmod_gw_filter(struct osd_hostmod_ctx *ctx,
+                                 unsigned int subnet, const char *rule)
+{
+    assert(ctx);
+    assert(rule);
+
+    if (!ctx->is_connected) {
+        return OSD_ERROR_NOT_CONNECTED;
+    }
+    if (subnet > OSD_DIADDR_SUBNET_MAX) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    char *cmd = zsys_sprintf("GW_FILTER %u %s", subnet, rule);
+    assert(cmd);
+    osd_result rv = osd_hostmod_mgmt_request(ctx, cmd);
+    free(cmd);
+
+    return rv;
+}
+
+static void stats_module_copy(struct osd_hostmod_stats_module *dest,
+                              const struct osd_hostmod_stats_module *src)
+{
+    dest->diaddr = __atomic_load_n(&src->diaddr, __ATOMIC_ACQUIRE);
+    for (int op = 0; op < OSD_HOSTMOD_STATS_OP_COUNT; op++) {
+        for (int size = 0; size < OSD_HOSTMOD_STATS_REG_SIZES; size++) {
+            osd_histogram_copy(&dest->round_trip[op][size],
+                               &src->round_trip[op][size]);
+            osd_histogram_copy(&dest->queueing[op][size],
+                               &src->queueing[op][size]);
+        }
+    }
+}
+
+API_EXPORT
+void osd_hostmod_get_stats(struct osd_hostmod_ctx *ctx,
+                           struct osd_hostmod_stats *stats)
+{
+    assert(ctx);
+    assert(stats);
+
+    for (int i = 0; i < OSD_HOSTMOD_STATS_MODULES_MAX; i++) {
+        stats_module_copy(&stats->modules[i], &ctx->stats->modules[i]);
+    }
+    stats_module_copy(&stats->other_modules, &ctx->stats->other_modules);
+    osd_histogram_copy(&stats->event_handler, &ctx->stats->event_handler);
+    osd_histogram_copy(&stats->poll_jitter, &ctx->stats->poll_jitter);
+    osd_histogram_copy(&stats->link_downtime, &ctx->stats->link_downtime);
+}
+
+static void stats_module_to_json(const struct osd_hostmod_stats_module *mod,
+                                 bool is_other, char **str)
+{
+    static const char *op_names[OSD_HOSTMOD_STATS_OP_COUNT] = {
+        "reg_read", "reg_write"
+    };
+
+    if (is_other) {
+        sprintf_append(str, "{\"diaddr\": \"other\"");
+    } else {
+        sprintf_append(str, "{\"diaddr\": %d", mod->diaddr);
+    }
+
+    for (int op = 0; op < OSD_HOSTMOD_STATS_OP_COUNT; op++) {
+        sprintf_append(str, ", \"%s\": {", op_names[op]);
+        bool first = true;
+        for (int size = 0; size < OSD_HOSTMOD_STATS_REG_SIZES; size++) {
+            if (mod->round_trip[op][size].count == 0 &&
+                mod->queueing[op][size].count == 0) {
+                continue;
+            }
+            sprintf_append(str, "%s\"%d\": {\"round_trip\": ",
+                           first ? "" : ", ", 16 << size);
+            osd_histogram_to_json(&mod->round_trip[op][size], str);
+            sprintf_append(str, ", \"queueing\": ");
+            osd_histogram_to_json(&mod->queueing[op][size], str);
+            sprintf_append(str, "}");
+            first = false;
+        }
+        sprintf_append(str, "}");
+    }
+    sprintf_append(str, "}");
+}
+
+API_EXPORT
+void osd_hostmod_stats_to_json(const struct osd_hostmod_stats *stats,
+                               char **str)
+{
+    *str = NULL;
+
+    sprintf_append(str, "{\"modules\": [");
+    bool first = true;
+    for (int i = 0; i < OSD_HOSTMOD_STATS_MODULES_MAX; i++) {
+        if (stats->modules[i].diaddr == -1) {
+            continue;
+        }
+        if (!first) {
+            sprintf_append(str, ", ");
+        }
+        stats_module_to_json(&stats->modules[i], false, str);
+        first = false;
+    }
+    bool other_used = false;
+    for (int op = 0; op < OSD_HOSTMOD_STATS_OP_COUNT; op++) {
+        for (int size = 0; size < OSD_HOSTMOD_STATS_REG_SIZES; size++) {
+            other_used |= stats->other_modules.round_trip[op][size].count > 0;
+        }
+    }
+    if (other_used) {
+        if (!first) {
+            sprintf_append(str, ", ");
+        }
+        stats_module_to_json(&stats->other_modules, true, str);
+    }
+    sprintf_append(str, "], \"event_handler\": ");
+    osd_histogram_to_json(&stats->event_handler, str);
+    sprintf_append(str, ", \"poll_jitter\": ");
+    osd_histogram_to_json(&stats->poll_jitter, str);
+    sprintf_append(str, ", \"link_downtime\": ");
+    osd_histogram_to_json(&stats->link_downtime, str);
+    sprintf_append(str, "}");
+}
@@ -26,33 +26,265 @@
 
 
 #include <osd/osd.h>
+#include <osd/clock_corr.h>
+#include <osd/flightrec.h>
 #include <osd/module.h>
 #include <osd/hostmod_stmlogger.h>
 #include <osd/reg.h>
+#include <osd/stm.h>
+#include <osd/stm_printf.h>
+#include <osd/tracefile.h>
 #include "osd-private.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdbool.h>
 
+/** Number of write buffers used for each trace file */
+#define OUTPUT_NUM_BUFFERS 3
+
+/**
+ * Size of each write buffer used for the trace file(s)
+ *
+ * The buffer memory is shared between all traced STMs, but each trace file
+ * gets at least buffers of OUTPUT_BUFFER_SIZE_MIN bytes.
+ */
+#define OUTPUT_BUFFER_SIZE (4 * 1024 * 1024)
+#define OUTPUT_BUFFER_SIZE_MIN (256 * 1024)
+
+/** Number of trace events used to correlate the STM clock to host time */
+#define CLOCK_CORR_WINDOW 256
+
+/**
+ * Use at most one trace event per interval (in ns) for the clock correlation
+ *
+ * Keeps a burst of events from filling the whole window, which then covers
+ * at least 256 ms.
+ */
+#define CLOCK_CORR_SAMPLE_INTERVAL_NS (1000 * 1000)
+
+/** Width of the STM event timestamps in bit */
+#define STM_TIMESTAMP_BITS 32
+
+/**
+ * State of a single traced STM
+ */
+struct stm_state {
+    uint16_t diaddr;
+
+    /** Trace file the events are written to (NULL: dump to stdout) */
+    struct osd_tracefile_writer *output;
+
+    /**
+     * Flight recorder the events are kept in (instead of writing them to
+     * |output| or stdout)
+     */
+    struct osd_flightrec *flightrec;
+    /** Metadata of the trace files written from |flightrec| */
+    struct osd_tracefile_meta flightrec_meta;
+
+    /** Correlation of the STM timestamps to the host receive time */
+    struct osd_clock_corr *clock_corr;
+
+    /**
+     * Capture statistics. Written only by the event handler, read with
+     * relaxed atomics by osd_hostmod_stmlogger_get_stats().
+     */
+    struct osd_hostmod_stmlogger_stats stats;
+};
+
 /**
  * STM Logger context
  */
 struct osd_hostmod_stmlogger_ctx {
     struct osd_hostmod_ctx *hostmod_ctx;
     struct osd_log_ctx *log_ctx;
-    unsigned int stm_di_addr;
+
+    /** Traced STMs, sorted by DI address */
+    struct stm_state *stms;
+    size_t num_stms;
+    /** STM which sent the last event (only used by the event handler) */
+    struct stm_state *last_stm;
+
+    /**
+     * Lock protecting the |output|, |flightrec| and |clock_corr| of all
+     * STMs. Writing to the trace file never blocks on the storage, i.e.
+     * holding the lock in the event handler is cheap.
+     */
+    pthread_mutex_t output_lock;
+
+    /**
+     * Trace event which freezes the flight recorders. Only changed before
+     * tracing is started.
+     */
+    struct {
+        bool enabled;
+        uint16_t id;
+        bool match_value;
+        uint64_t value;
+    } flightrec_trigger;
+    /** The flight recorders have been frozen by the trigger event */
+    int flightrec_triggered;
+
+    /**
+     * Reconstruction of printf() output, NULL if disabled. Only accessed
+     * from the event handler (i.e. the hostmod I/O thread) once tracing has
+     * started.
+     */
+    struct osd_stm_printf *printf_ctx;
 };
 
-static osd_result handle_event_pkg(void* arg, struct osd_packet *pkg)
+static int stm_state_cmp(const void *a, const void *b)
+{
+    const struct stm_state *stm_a = a;
+    const struct stm_state *stm_b = b;
+    return (int)stm_a->diaddr - (int)stm_b->diaddr;
+}
+
+/**
+ * Find the state of a traced STM
+ *
+ * @return the STM state, or NULL if the STM is not traced by this logger
+ */
+static struct stm_state* get_stm(struct osd_hostmod_stmlogger_ctx *ctx,
+                                 uint16_t diaddr)
+{
+    struct stm_state key = { .diaddr = diaddr };
+    return bsearch(&key, ctx->stms, ctx->num_stms, sizeof(struct stm_state),
+                   stm_state_cmp);
+}
+
+/**
+ * Print a trace event to stdout
+ *
+ * @param pkg the event packet
+ * @param ev the decoded event, or NULL if |pkg| is no STM event packet
+ */
+static void print_event(const struct osd_packet *pkg,
+                        const struct osd_stm_event *ev)
+{
+    if (!ev) {
+        // not a STM event: print it as-is
+        osd_packet_dump(pkg, stdout);
+    } else if (ev->type == OSD_STM_EVENT_OVERFLOW) {
+        printf("%u: overflow, %" PRIu32 " events lost\n", ev->stm_diaddr,
+               ev->lost_events);
+    } else {
+        printf("%u: %010" PRIu32 " 0x%04x 0x%0*" PRIx64 "\n",
+               ev->stm_diaddr, ev->timestamp, ev->id, ev->value_width_bit / 4,
+               ev->value);
+    }
+    fflush(stdout);
+}
+
+/**
+ * Print a line of printf() output reconstructed from the trace
+ */
+static void print_printf_line(void *arg, uint16_t stm_diaddr,
+                              const char *line, size_t len)
 {
-    osd_packet_dump(pkg, stdout);
+    printf("%u: %s\n", stm_diaddr, line);
     fflush(stdout);
+}
+
+/**
+ * Check if an event is the flight recorder trigger
+ */
+static bool is_flightrec_trigger(struct osd_hostmod_stmlogger_ctx *ctx,
+                                 const struct osd_stm_event *ev)
+{
+    return ctx->flightrec_trigger.enabled &&
+           ev->type == OSD_STM_EVENT_TRACE &&
+           ev->id == ctx->flightrec_trigger.id &&
+           (!ctx->flightrec_trigger.match_value ||
+            ev->value == ctx->flightrec_trigger.value);
+}
+
+/**
+ * Freeze the flight recorders of all STMs
+ *
+ * The event handler freezes them without waiting, as it is the only thread
+ * adding packets.
+ */
+static void freeze_flightrecs(struct osd_hostmod_stmlogger_ctx *ctx)
+{
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        if (ctx->stms[i].flightrec) {
+            osd_flightrec_freeze(ctx->stms[i].flightrec);
+        }
+    }
+}
+
+static osd_result handle_event_pkg(void* arg, struct osd_packet *pkg)
+{
+    struct osd_hostmod_stmlogger_ctx *ctx = arg;
+    osd_result rv = OSD_OK;
+
+    // taken by the host module before the packet was decoded
+    uint64_t rx_time_ns = osd_hostmod_get_event_rx_time_ns();
+
+    // demultiplex by source; consecutive events often come from the same STM
+    uint16_t src = osd_packet_get_src(pkg);
+    struct stm_state *stm = ctx->last_stm;
+    if (!stm || stm->diaddr != src) {
+        stm = get_stm(ctx, src);
+        if (!stm) {
+            dbg(ctx->log_ctx, "Ignoring event packet from module %u, which "
+                "is not traced.\n", src);
+            osd_packet_free(&pkg);
+            return OSD_OK;
+        }
+        ctx->last_stm = stm;
+    }
+
+    struct osd_stm_event ev;
+    bool is_stm_event = OSD_SUCCEEDED(osd_stm_event_decode(pkg, &ev));
+
+    __atomic_fetch_add(&stm->stats.packets, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stm->stats.bytes,
+                       (pkg->data_size_words + 1) * sizeof(uint16_t),
+                       __ATOMIC_RELAXED);
+    if (is_stm_event && ev.type == OSD_STM_EVENT_OVERFLOW) {
+        __atomic_fetch_add(&stm->stats.overflows, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stm->stats.events_lost, ev.lost_events,
+                           __ATOMIC_RELAXED);
+    }
+
+    bool is_printf_event = ctx->printf_ctx && is_stm_event &&
+                           OSD_STM_PRINTF_IS_PRINTF_EVENT(&ev);
+    if (is_printf_event) {
+        osd_stm_printf_handle_event(ctx->printf_ctx, &ev);
+    }
+
+    pthread_mutex_lock(&ctx->output_lock);
+    if (is_stm_event && ev.type == OSD_STM_EVENT_TRACE) {
+        osd_clock_corr_add(stm->clock_corr, ev.timestamp, rx_time_ns);
+    }
+    if (stm->flightrec) {
+        // events received while the recorders are frozen (i.e. triggered or
+        // being dumped) are dropped and cannot trigger again
+        bool recording = !osd_flightrec_is_frozen(stm->flightrec);
+        rv = osd_flightrec_add(stm->flightrec, pkg, rx_time_ns);
+
+        // keep the trigger event itself in the recording
+        if (recording && is_stm_event && is_flightrec_trigger(ctx, &ev)) {
+            freeze_flightrecs(ctx);
+            __atomic_store_n(&ctx->flightrec_triggered, 1, __ATOMIC_RELEASE);
+            info(ctx->log_ctx, "Flight recorder triggered by event 0x%04x "
+                 "from STM %u.\n", ev.id, stm->diaddr);
+        }
+    } else if (stm->output) {
+        rv = osd_tracefile_writer_add(stm->output, pkg, rx_time_ns);
+    } else if (!is_printf_event) {
+        print_event(pkg, is_stm_event ? &ev : NULL);
+    }
+    pthread_mutex_unlock(&ctx->output_lock);
 
     osd_packet_free(&pkg);
 
-    return OSD_OK;
+    return rv;
 }
 
 
@@ -61,14 +293,64 @@ osd_result osd_hostmod_stmlogger_new(struct osd_hostmod_stmlogger_ctx **ctx,
                                      struct osd_log_ctx *log_ctx,
                                      const char* host_controller_address,
                                      unsigned int stm_di_addr)
+{
+    return osd_hostmod_stmlogger_new_multi(ctx, log_ctx,
+                                           host_controller_address,
+                                           &stm_di_addr, 1);
+}
+
+/**
+ * Create a STM logger tracing multiple STMs
+ *
+ * All STMs are handled by a single host module: the events are demultiplexed
+ * by their source address, and tracing is started and stopped on all STMs
+ * at once.
+ *
+ * @param[out] ctx the STM logger context
+ * @param log_ctx the log context to be used
+ * @param host_controller_address ZeroMQ endpoint of the host controller
+ * @param stm_di_addrs DI addresses of the STMs
+ * @param num_stms number of entries in @p stm_di_addrs
+ * @return OSD_OK on success, any other value indicates an error
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_new_multi(struct osd_hostmod_stmlogger_ctx **ctx,
+                                           struct osd_log_ctx *log_ctx,
+                                           const char* host_controller_address,
+                                           const unsigned int *stm_di_addrs,
+                                           size_t num_stms)
 {
     osd_result rv;
 
+    assert(num_stms > 0);
+
     struct osd_hostmod_stmlogger_ctx *c = calloc(1, sizeof(struct osd_hostmod_stmlogger_ctx));
     assert(c);
 
     c->log_ctx = log_ctx;
-    c->stm_di_addr = stm_di_addr;
+    pthread_mutex_init(&c->output_lock, NULL);
+
+    c->stms = calloc(num_stms, sizeof(struct stm_state));
+    assert(c->stms);
+    for (size_t i = 0; i < num_stms; i++) {
+        c->stms[i].diaddr = stm_di_addrs[i];
+    }
+    qsort(c->stms, num_stms, sizeof(struct stm_state), stm_state_cmp);
+    // drop duplicates
+    c->num_stms = 1;
+    for (size_t i = 1; i < num_stms; i++) {
+        if (c->stms[i].diaddr != c->stms[c->num_stms - 1].diaddr) {
+            c->stms[c->num_stms++] = c->stms[i];
+        }
+    }
+
+    for (size_t i = 0; i < c->num_stms; i++) {
+        rv = osd_clock_corr_new(&c->stms[i].clock_corr, log_ctx,
+                                CLOCK_CORR_WINDOW, STM_TIMESTAMP_BITS);
+        assert(OSD_SUCCEEDED(rv));
+        osd_clock_corr_set_sample_interval(c->stms[i].clock_corr,
+                                           CLOCK_CORR_SAMPLE_INTERVAL_NS);
+    }
 
     struct osd_hostmod_ctx *hostmod_ctx;
     rv = osd_hostmod_new(&hostmod_ctx, log_ctx, host_controller_address,
@@ -81,16 +363,17 @@ osd_result osd_hostmod_stmlogger_new(struct osd_hostmod_stmlogger_ctx **ctx,
     return OSD_OK;
 }
 
-static bool is_stm_module(struct osd_hostmod_stmlogger_ctx *ctx)
+static bool is_stm_module(struct osd_hostmod_stmlogger_ctx *ctx,
+                          uint16_t stm_di_addr)
 {
     osd_result rv;
 
     struct osd_module_desc desc;
 
-    rv = osd_hostmod_describe_module(ctx->hostmod_ctx, ctx->stm_di_addr, &desc);
+    rv = osd_hostmod_describe_module(ctx->hostmod_ctx, stm_di_addr, &desc);
     if (OSD_FAILED(rv)) {
         err(ctx->log_ctx, "Unable to check if module %u is a STM. "
-            "Assuming it is not.\n", ctx->stm_di_addr);
+            "Assuming it is not.\n", stm_di_addr);
         return false;
     }
 
@@ -103,57 +386,664 @@ static bool is_stm_module(struct osd_hostmod_stmlogger_ctx *ctx)
     return true;
 }
 
+/**
+ * Set the CS register of all traced STMs
+ *
+ * @param event_dest if not 0, set the event destination of all STMs first
+ */
+static osd_result write_stm_cs(struct osd_hostmod_stmlogger_ctx *ctx,
+                               uint16_t event_dest, uint16_t cs)
+{
+    struct osd_hostmod_reg_write_req *reqs =
+        calloc(2 * ctx->num_stms, sizeof(struct osd_hostmod_reg_write_req));
+    assert(reqs);
+
+    // writes to the same module are executed in order, i.e. the event
+    // destination is set before the STM is activated
+    size_t num_reqs = 0;
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        if (event_dest) {
+            reqs[num_reqs++] = (struct osd_hostmod_reg_write_req) {
+                .diaddr = ctx->stms[i].diaddr,
+                .reg_addr = OSD_REG_BASE_MOD_EVENT_DEST,
+                .reg_size_bit = 16,
+                .data = &event_dest,
+            };
+        }
+        reqs[num_reqs++] = (struct osd_hostmod_reg_write_req) {
+            .diaddr = ctx->stms[i].diaddr,
+            .reg_addr = OSD_REG_BASE_MOD_CS,
+            .reg_size_bit = 16,
+            .data = &cs,
+        };
+    }
+
+    osd_result rv = osd_hostmod_reg_write_batch(ctx->hostmod_ctx, reqs,
+                                                num_reqs, 0);
+    for (size_t i = 0; i < num_reqs; i++) {
+        if (OSD_FAILED(reqs[i].result)) {
+            err(ctx->log_ctx, "Unable to write register 0x%x of STM %u "
+                "(rv=%d).\n", reqs[i].reg_addr, reqs[i].diaddr,
+                reqs[i].result);
+        }
+    }
+
+    free(reqs);
+    return rv;
+}
+
 /**
  * Start tracing
  *
- * Instruct the STM module to start sending traces to us.
+ * Instruct all STM modules to start sending traces to us.
  */
 API_EXPORT
 osd_result osd_hostmod_stmlogger_tracestart(struct osd_hostmod_stmlogger_ctx *ctx)
 {
-    osd_result rv;
-    if (!is_stm_module(ctx)) {
-        err(ctx->log_ctx, "Unable to start tracing: module %u is no STM.\n",
-            ctx->stm_di_addr);
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        if (!is_stm_module(ctx, ctx->stms[i].diaddr)) {
+            err(ctx->log_ctx, "Unable to start tracing: module %u is no "
+                "STM.\n", ctx->stms[i].diaddr);
+            return OSD_ERROR_FAILURE;
+        }
+    }
+
+    // the STM timestamps of a new trace are unrelated to earlier ones
+    pthread_mutex_lock(&ctx->output_lock);
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        osd_clock_corr_reset(ctx->stms[i].clock_corr);
     }
+    pthread_mutex_unlock(&ctx->output_lock);
 
     uint16_t event_dest = osd_hostmod_get_diaddr(ctx->hostmod_ctx);
-    rv = osd_hostmod_reg_write(ctx->hostmod_ctx, &event_dest, ctx->stm_di_addr,
-                               OSD_REG_BASE_MOD_EVENT_DEST, 16, 0);
+    return write_stm_cs(ctx, event_dest, OSD_REG_BASE_MOD_CS_ACTIVE);
+}
+
+/**
+ * Get statistics about the events received from a STM
+ *
+ * The statistics cover the lifetime of the logger object and can be queried
+ * at any time, also while tracing.
+ *
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if the STM is not traced by
+ *         this logger
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_get_stats(struct osd_hostmod_stmlogger_ctx *ctx,
+                                           unsigned int stm_di_addr,
+                                           struct osd_hostmod_stmlogger_stats *stats)
+{
+    struct stm_state *stm = get_stm(ctx, stm_di_addr);
+    if (!stm) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    stats->packets = __atomic_load_n(&stm->stats.packets, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&stm->stats.bytes, __ATOMIC_RELAXED);
+    stats->overflows = __atomic_load_n(&stm->stats.overflows,
+                                       __ATOMIC_RELAXED);
+    stats->events_lost = __atomic_load_n(&stm->stats.events_lost,
+                                         __ATOMIC_RELAXED);
+    return OSD_OK;
+}
+
+/**
+ * Stop tracing
+ *
+ * Instruct all STM modules to stop sending traces. All STMs are stopped,
+ * even if stopping one of them fails.
+ *
+ * @return OSD_OK on success, the error of the first failed register write
+ *         otherwise
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_tracestop(struct osd_hostmod_stmlogger_ctx *ctx)
+{
+    return write_stm_cs(ctx, 0, 0);
+}
+
+API_EXPORT
+osd_result osd_hostmod_stmlogger_connect(struct osd_hostmod_stmlogger_ctx *ctx)
+{
+    return osd_hostmod_connect(ctx->hostmod_ctx);
+}
+
+API_EXPORT
+osd_result osd_hostmod_stmlogger_disconnect(struct osd_hostmod_stmlogger_ctx *ctx)
+{
+    return osd_hostmod_disconnect(ctx->hostmod_ctx);
+}
+
+/**
+ * Read the trace file metadata of a STM from the device
+ */
+static osd_result read_stm_meta(struct osd_hostmod_stmlogger_ctx *ctx,
+                                uint16_t stm_di_addr,
+                                struct osd_tracefile_meta *meta)
+{
+    osd_result rv;
+    memset(meta, 0, sizeof(*meta));
+
+    unsigned int scm_di_addr = osd_diaddr_build(
+        osd_diaddr_subnet(stm_di_addr), 0);
+    rv = osd_hostmod_reg_read(ctx->hostmod_ctx, &meta->system_vendor_id,
+                              scm_di_addr, OSD_REG_SCM_SYSTEM_VENDOR_ID, 16, 0);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    rv = osd_hostmod_reg_read(ctx->hostmod_ctx, &meta->system_device_id,
+                              scm_di_addr, OSD_REG_SCM_SYSTEM_DEVICE_ID, 16, 0);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    rv = osd_hostmod_describe_module(ctx->hostmod_ctx, stm_di_addr,
+                                     &meta->module);
     if (OSD_FAILED(rv)) {
         return rv;
     }
+    meta->module.addr = stm_di_addr;
+
+    return OSD_OK;
+}
+
+/**
+ * Open a trace file for a single STM
+ */
+static osd_result open_stm_output(struct osd_hostmod_stmlogger_ctx *ctx,
+                                  uint16_t stm_di_addr, const char *path,
+                                  size_t buffer_size,
+                                  unsigned int sync_interval_ms,
+                                  enum osd_tracefile_compression compression,
+                                  struct osd_tracefile_writer **output)
+{
+    osd_result rv;
+    struct osd_tracefile_meta meta;
 
-    uint16_t cs = OSD_REG_BASE_MOD_CS_ACTIVE;
-    rv = osd_hostmod_reg_write(ctx->hostmod_ctx, &cs, ctx->stm_di_addr,
-                               OSD_REG_BASE_MOD_CS, 16, 0);
+    rv = read_stm_meta(ctx, stm_di_addr, &meta);
     if (OSD_FAILED(rv)) {
         return rv;
     }
 
+    return osd_tracefile_writer_new_async(output, ctx->log_ctx, path, &meta,
+                                          OUTPUT_NUM_BUFFERS, buffer_size,
+                                          sync_interval_ms, compression);
+}
+
+/**
+ * Get the path of the trace file of a STM
+ *
+ * @return the path; free it after use
+ */
+static char* get_stm_path(struct osd_hostmod_stmlogger_ctx *ctx,
+                          const char *path, uint16_t stm_di_addr)
+{
+    char *stm_path;
+    int irv;
+    if (ctx->num_stms == 1) {
+        irv = asprintf(&stm_path, "%s", path);
+    } else {
+        irv = asprintf(&stm_path, "%s.%u", path, stm_di_addr);
+    }
+    assert(irv != -1);
+    return stm_path;
+}
+
+/**
+ * Write all received trace events into trace files
+ *
+ * The events of each STM are written into a separate file. If the logger
+ * traces a single STM, the file is named @p path; otherwise the DI address
+ * of the STM is appended, i.e. the files are named "<path>.<diaddr>".
+ *
+ * The file header is filled with information about the traced system and
+ * the STM module, which is read from the device. The logger must therefore
+ * be connected to the host controller.
+ *
+ * The files are written by separate writer threads, i.e. receiving events
+ * never waits for the storage. If the storage cannot keep up, events are
+ * dropped; see osd_hostmod_stmlogger_get_output_stats().
+ *
+ * @param ctx the STM logger context
+ * @param path the trace file
+ * @param sync_interval_ms minimum time between two fdatasync() calls on the
+ *                         trace file. Set to 0 to never sync explicitly.
+ * @param compression compression of the trace file. Compression runs on the
+ *                    writer thread as well.
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_open_output(struct osd_hostmod_stmlogger_ctx *ctx,
+                                             const char *path,
+                                             unsigned int sync_interval_ms,
+                                             enum osd_tracefile_compression compression)
+{
+    osd_result rv = OSD_OK;
+
+    size_t buffer_size = OUTPUT_BUFFER_SIZE / ctx->num_stms;
+    if (buffer_size < OUTPUT_BUFFER_SIZE_MIN) {
+        buffer_size = OUTPUT_BUFFER_SIZE_MIN;
+    }
+
+    struct osd_tracefile_writer **outputs =
+        calloc(ctx->num_stms, sizeof(struct osd_tracefile_writer *));
+    assert(outputs);
+
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        char *stm_path = get_stm_path(ctx, path, ctx->stms[i].diaddr);
+        rv = open_stm_output(ctx, ctx->stms[i].diaddr, stm_path, buffer_size,
+                             sync_interval_ms, compression, &outputs[i]);
+        if (OSD_FAILED(rv)) {
+            err(ctx->log_ctx, "Unable to open trace file %s for STM %u.\n",
+                stm_path, ctx->stms[i].diaddr);
+            free(stm_path);
+            goto free_return;
+        }
+        free(stm_path);
+    }
+
+    pthread_mutex_lock(&ctx->output_lock);
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        struct osd_tracefile_writer *old_output = ctx->stms[i].output;
+        ctx->stms[i].output = outputs[i];
+        outputs[i] = old_output;
+    }
+    pthread_mutex_unlock(&ctx->output_lock);
+
+free_return:
+    // the previous outputs on success, the new ones on failure
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        osd_tracefile_writer_free(&outputs[i]);
+    }
+    free(outputs);
+
+    return rv;
+}
+
+/**
+ * Close the trace files opened with osd_hostmod_stmlogger_open_output()
+ *
+ * Events received afterwards are printed to stdout again.
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_close_output(struct osd_hostmod_stmlogger_ctx *ctx)
+{
+    osd_result rv = OSD_OK;
+
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        struct stm_state *stm = &ctx->stms[i];
+
+        pthread_mutex_lock(&ctx->output_lock);
+        struct osd_tracefile_writer *output = stm->output;
+        stm->output = NULL;
+        pthread_mutex_unlock(&ctx->output_lock);
+
+        if (!output) {
+            continue;
+        }
+
+        osd_result flush_rv = osd_tracefile_writer_flush(output);
+        if (OSD_FAILED(flush_rv)) {
+            rv = flush_rv;
+        }
+
+        struct osd_tracefile_writer_stats stats;
+        osd_tracefile_writer_get_stats(output, &stats);
+        info(ctx->log_ctx, "STM %u: wrote %" PRIu64 " trace events (%" PRIu64
+             " bytes, %" PRIu64 " bytes uncompressed), dropped %" PRIu64
+             " trace events.\n", stm->diaddr, stats.packets_written,
+             stats.bytes_written, stats.bytes_uncompressed,
+             stats.packets_dropped);
+
+        osd_tracefile_writer_free(&output);
+    }
+
+    return rv;
+}
+
+/**
+ * Get the statistics of the trace file writer of a STM
+ *
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if no trace file is open or
+ *         the STM is not traced by this logger
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_get_output_stats(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                  unsigned int stm_di_addr,
+                                                  struct osd_tracefile_writer_stats *stats)
+{
+    osd_result rv = OSD_ERROR_FAILURE;
+
+    struct stm_state *stm = get_stm(ctx, stm_di_addr);
+    if (!stm) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    pthread_mutex_lock(&ctx->output_lock);
+    if (stm->output) {
+        osd_tracefile_writer_get_stats(stm->output, stats);
+        rv = OSD_OK;
+    }
+    pthread_mutex_unlock(&ctx->output_lock);
+
+    return rv;
+}
+
+/**
+ * Keep the received trace events in flight recorders
+ *
+ * Instead of writing the events to a trace file or printing them, the most
+ * recent events of each STM are kept in a ring buffer in memory. Nothing is
+ * written to disk until the recorded events are dumped with
+ * osd_hostmod_stmlogger_dump_flightrec(), e.g. when a failure was detected.
+ * The dump can also be triggered by a trace event, see
+ * osd_hostmod_stmlogger_set_flightrec_trigger().
+ *
+ * Metadata about the traced system and STMs is read from the device when
+ * opening the flight recorders. The logger must therefore be connected to
+ * the host controller.
+ *
+ * @param ctx the STM logger context
+ * @param size memory used for the recorded events in bytes. It is shared
+ *             between all traced STMs, but each STM gets at least
+ *             OSD_FLIGHTREC_SIZE_MIN bytes.
+ * @return OSD_OK on success, any other value indicates an error
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_open_flightrec(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                size_t size)
+{
+    osd_result rv = OSD_OK;
+
+    size_t stm_size = size / ctx->num_stms;
+    if (stm_size < OSD_FLIGHTREC_SIZE_MIN) {
+        stm_size = OSD_FLIGHTREC_SIZE_MIN;
+    }
+
+    struct osd_flightrec **recs =
+        calloc(ctx->num_stms, sizeof(struct osd_flightrec *));
+    assert(recs);
+    struct osd_tracefile_meta *metas =
+        calloc(ctx->num_stms, sizeof(struct osd_tracefile_meta));
+    assert(metas);
+
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        rv = read_stm_meta(ctx, ctx->stms[i].diaddr, &metas[i]);
+        if (OSD_FAILED(rv)) {
+            err(ctx->log_ctx, "Unable to read the metadata of STM %u.\n",
+                ctx->stms[i].diaddr);
+            goto free_return;
+        }
+        rv = osd_flightrec_new(&recs[i], ctx->log_ctx, stm_size);
+        if (OSD_FAILED(rv)) {
+            goto free_return;
+        }
+    }
+
+    pthread_mutex_lock(&ctx->output_lock);
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        struct osd_flightrec *old_rec = ctx->stms[i].flightrec;
+        ctx->stms[i].flightrec = recs[i];
+        ctx->stms[i].flightrec_meta = metas[i];
+        recs[i] = old_rec;
+    }
+    __atomic_store_n(&ctx->flightrec_triggered, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ctx->output_lock);
+
+free_return:
+    // the previous flight recorders on success, the new ones on failure
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        osd_flightrec_free(&recs[i]);
+    }
+    free(recs);
+    free(metas);
+
+    return rv;
+}
+
+/**
+ * Stop recording and free the flight recorders
+ *
+ * The recorded events are discarded. Events received afterwards are written
+ * to the trace file(s) or printed to stdout again.
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_close_flightrec(struct osd_hostmod_stmlogger_ctx *ctx)
+{
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        pthread_mutex_lock(&ctx->output_lock);
+        struct osd_flightrec *rec = ctx->stms[i].flightrec;
+        ctx->stms[i].flightrec = NULL;
+        pthread_mutex_unlock(&ctx->output_lock);
+
+        osd_flightrec_free(&rec);
+    }
+
     return OSD_OK;
 }
 
+/**
+ * Freeze the flight recorders when a trace event is received
+ *
+ * When the STM logger receives a trace event with the ID @p event_id (and
+ * the value @p value, if given), it freezes the flight recorders of all STMs.
+ * The recorded events up to and including the trigger event are kept until
+ * they are dumped with osd_hostmod_stmlogger_dump_flightrec(); events
+ * received in the meantime are dropped.
+ *
+ * Must be called before tracing is started.
+ *
+ * @param ctx the STM logger context
+ * @param event_id ID of the trigger event
+ * @param value value of the trigger event, or NULL to trigger on any value
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see osd_hostmod_stmlogger_flightrec_triggered()
+ */
 API_EXPORT
-osd_result osd_hostmod_stmlogger_tracestop(struct osd_hostmod_stmlogger_ctx *ctx)
+osd_result osd_hostmod_stmlogger_set_flightrec_trigger(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                       uint16_t event_id,
+                                                       const uint64_t *value)
 {
-    uint16_t cs = 0;
-    osd_hostmod_reg_write(ctx->hostmod_ctx, &cs, ctx->stm_di_addr,
-                          OSD_REG_BASE_MOD_CS, 16, 0);
+    ctx->flightrec_trigger.enabled = true;
+    ctx->flightrec_trigger.id = event_id;
+    ctx->flightrec_trigger.match_value = (value != NULL);
+    ctx->flightrec_trigger.value = value ? *value : 0;
 
     return OSD_OK;
 }
 
+/**
+ * Check if the flight recorders have been frozen by the trigger event
+ *
+ * The state is reset by osd_hostmod_stmlogger_dump_flightrec().
+ */
 API_EXPORT
-osd_result osd_hostmod_stmlogger_connect(struct osd_hostmod_stmlogger_ctx *ctx)
+bool osd_hostmod_stmlogger_flightrec_triggered(struct osd_hostmod_stmlogger_ctx *ctx)
 {
-    return osd_hostmod_connect(ctx->hostmod_ctx);
+    return __atomic_load_n(&ctx->flightrec_triggered, __ATOMIC_ACQUIRE);
 }
 
+/**
+ * Write the events recorded by the flight recorders into trace files
+ *
+ * The flight recorders are frozen while the trace files are written, i.e.
+ * events received in the meantime are dropped. Afterwards, the recorders are
+ * cleared and recording continues.
+ *
+ * The files are named as in osd_hostmod_stmlogger_open_output(). They are
+ * not compressed.
+ *
+ * @param ctx the STM logger context
+ * @param path the trace file
+ * @return OSD_OK on success, any other value indicates an error
+ */
 API_EXPORT
-osd_result osd_hostmod_stmlogger_disconnect(struct osd_hostmod_stmlogger_ctx *ctx)
+osd_result osd_hostmod_stmlogger_dump_flightrec(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                const char *path)
 {
-    return osd_hostmod_disconnect(ctx->hostmod_ctx);
+    osd_result rv = OSD_OK;
+
+    // The flight recorders are only replaced by the calling thread, i.e.
+    // they can be used without holding the output lock.
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        if (!ctx->stms[i].flightrec) {
+            err(ctx->log_ctx, "No flight recorder is open.\n");
+            return OSD_ERROR_FAILURE;
+        }
+        osd_flightrec_freeze(ctx->stms[i].flightrec);
+    }
+
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        struct stm_state *stm = &ctx->stms[i];
+
+        char *stm_path = get_stm_path(ctx, path, stm->diaddr);
+        struct osd_tracefile_writer *writer;
+        osd_result stm_rv = osd_tracefile_writer_new(&writer, ctx->log_ctx,
+                                                     stm_path,
+                                                     &stm->flightrec_meta);
+        if (OSD_SUCCEEDED(stm_rv)) {
+            stm_rv = osd_flightrec_write(stm->flightrec, writer);
+            osd_tracefile_writer_free(&writer);
+        }
+        if (OSD_FAILED(stm_rv)) {
+            err(ctx->log_ctx, "Unable to write flight recorder of STM %u to "
+                "%s.\n", stm->diaddr, stm_path);
+            rv = stm_rv;
+        } else {
+            struct osd_flightrec_stats stats;
+            osd_flightrec_get_stats(stm->flightrec, &stats);
+            info(ctx->log_ctx, "STM %u: dumped %" PRIu64 " trace events to "
+                 "%s.\n", stm->diaddr, stats.packets, stm_path);
+        }
+        free(stm_path);
+    }
+
+    __atomic_store_n(&ctx->flightrec_triggered, 0, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        osd_flightrec_clear(ctx->stms[i].flightrec);
+        osd_flightrec_resume(ctx->stms[i].flightrec);
+    }
+
+    return rv;
+}
+
+/**
+ * Get the statistics of the flight recorder of a STM
+ *
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if no flight recorder is open
+ *         or the STM is not traced by this logger
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_get_flightrec_stats(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                     unsigned int stm_di_addr,
+                                                     struct osd_flightrec_stats *stats)
+{
+    struct stm_state *stm = get_stm(ctx, stm_di_addr);
+    if (!stm || !stm->flightrec) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    osd_flightrec_get_stats(stm->flightrec, stats);
+    return OSD_OK;
+}
+
+/**
+ * Convert a STM timestamp to host time
+ *
+ * The STM clock is continuously correlated to the time the trace events are
+ * received by the host, see @ref libosd-clock_corr. Converting the
+ * timestamps of multiple STMs (e.g. in different subnets) to host time
+ * allows merging their traces.
+ *
+ * @param ctx the STM logger context
+ * @param stm_di_addr DI address of the STM
+ * @param device_ts timestamp of a trace event of this STM
+ * @param[out] host_ns the corresponding host time (CLOCK_MONOTONIC, in ns)
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if the STM is not traced by
+ *         this logger or not enough trace events have been received yet
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_get_host_time(struct osd_hostmod_stmlogger_ctx *ctx,
+                                               unsigned int stm_di_addr,
+                                               uint32_t device_ts,
+                                               uint64_t *host_ns)
+{
+    struct stm_state *stm = get_stm(ctx, stm_di_addr);
+    if (!stm) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    pthread_mutex_lock(&ctx->output_lock);
+    osd_result rv = osd_clock_corr_to_host(stm->clock_corr, device_ts,
+                                           host_ns);
+    pthread_mutex_unlock(&ctx->output_lock);
+
+    return rv;
+}
+
+/**
+ * Get the current correlation of a STM clock to host time
+ *
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if the STM is not traced by
+ *         this logger or not enough trace events have been received yet
+ *
+ * @see osd_hostmod_stmlogger_get_host_time()
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_get_clock_fit(struct osd_hostmod_stmlogger_ctx *ctx,
+                                               unsigned int stm_di_addr,
+                                               struct osd_clock_corr_fit *fit)
+{
+    struct stm_state *stm = get_stm(ctx, stm_di_addr);
+    if (!stm) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    pthread_mutex_lock(&ctx->output_lock);
+    osd_result rv = osd_clock_corr_get_fit(stm->clock_corr, fit);
+    pthread_mutex_unlock(&ctx->output_lock);
+
+    return rv;
+}
+
+/**
+ * Enable the printf() reconstruction
+ *
+ * Events with the printf event IDs (see OSD_STM_PRINTF_IS_PRINTF_EVENT) are
+ * then printed as reconstructed text lines instead of raw events. Without
+ * the printf() reconstruction, these IDs are not treated differently from
+ * any other event.
+ *
+ * Must be called before tracing is started.
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_enable_printf(struct osd_hostmod_stmlogger_ctx *ctx)
+{
+    if (ctx->printf_ctx) {
+        return OSD_OK;
+    }
+    return osd_stm_printf_new(&ctx->printf_ctx, ctx->log_ctx,
+                              print_printf_line, ctx);
+}
+
+/**
+ * Register a format string for the printf() reconstruction
+ *
+ * Enables the printf() reconstruction. Must be called before tracing is
+ * started.
+ *
+ * @see osd_hostmod_stmlogger_enable_printf()
+ * @see osd_stm_printf_set_format()
+ */
+API_EXPORT
+osd_result osd_hostmod_stmlogger_set_printf_format(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                   uint32_t fmt_id,
+                                                   const char *fmt)
+{
+    osd_result rv = osd_hostmod_stmlogger_enable_printf(ctx);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return osd_stm_printf_set_format(ctx->printf_ctx, fmt_id, fmt);
 }
 
 API_EXPORT
@@ -167,6 +1057,20 @@ void osd_hostmod_stmlogger_free(struct osd_hostmod_stmlogger_ctx **ctx_p)
 
     osd_hostmod_free(&ctx->hostmod_ctx);
 
+    // print incomplete lines; no more events are received at this point
+    if (ctx->printf_ctx) {
+        osd_stm_printf_flush(ctx->printf_ctx);
+        osd_stm_printf_free(&ctx->printf_ctx);
+    }
+
+    for (size_t i = 0; i < ctx->num_stms; i++) {
+        osd_tracefile_writer_free(&ctx->stms[i].output);
+        osd_flightrec_free(&ctx->stms[i].flightrec);
+        osd_clock_corr_free(&ctx->stms[i].clock_corr);
+    }
+    free(ctx->stms);
+    pthread_mutex_destroy(&ctx->output_lock);
+
     free(ctx);
     *ctx_p = NULL;
 }
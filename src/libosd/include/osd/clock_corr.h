@@ -0,0 +1,169 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+#ifndef OSD_CLOCK_CORR_H
+#define OSD_CLOCK_CORR_H
+
+#include <osd/osd.h>
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup libosd-clock_corr Clock Correlation
+ * @ingroup libosd
+ *
+ * Map device timestamps to host time
+ *
+ * Debug modules timestamp their events with a free-running device clock,
+ * which has an unknown offset to the host clock, runs at a (slightly)
+ * different rate, and differs between subnets. The clock correlation
+ * collects pairs of a device timestamp and the host time the corresponding
+ * packet was received, and fits a line through the most recent pairs
+ * (linear least squares regression over a sliding window). Device timestamps
+ * can then be converted to host time; events from different subnets can be
+ * merged on the common host time base.
+ *
+ * Device timestamps which are narrower than 64 bit are unwrapped: two
+ * consecutive timestamps must be less than half the counter range apart.
+ *
+ * The host receive time is always later than the time the event occurred on
+ * the device. The fit therefore maps device timestamps to the average receive
+ * time of an event, i.e. includes the average transfer latency.
+ *
+ * The functions of an object must not be called concurrently.
+ *
+ * @{
+ */
+
+/**
+ * Parameters of the fitted device-to-host clock mapping
+ *
+ * @see osd_clock_corr_get_fit()
+ */
+struct osd_clock_corr_fit {
+    /** number of samples the fit is based on */
+    unsigned int samples;
+    /** host time per device clock tick in ns */
+    double ns_per_tick;
+    /**
+     * standard deviation of the host time of the samples from the fitted
+     * line in ns, i.e. the jitter of the receive time
+     */
+    double residual_ns;
+};
+
+struct osd_clock_corr;
+
+/**
+ * Create a new clock correlation
+ *
+ * @param[out] corr the clock correlation object
+ * @param log_ctx the log context to be used
+ * @param window_size number of (most recent) samples used for the fit, at
+ *                    least 2
+ * @param device_ts_bits width of the device timestamps in bit (1 to 64)
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see osd_clock_corr_free()
+ */
+osd_result osd_clock_corr_new(struct osd_clock_corr **corr,
+                              struct osd_log_ctx *log_ctx,
+                              unsigned int window_size,
+                              unsigned int device_ts_bits);
+
+/**
+ * Use at most one sample per interval of host time
+ *
+ * Events are often received in bursts. Without decimation the sample window
+ * then covers only a short time, which is not enough to estimate the clock
+ * rate precisely. With an interval set, of all samples received within the
+ * same interval only the one with the lowest transfer latency (according to
+ * the current fit) is kept, and the window covers at least
+ * @p window_size intervals.
+ *
+ * @param corr the clock correlation object
+ * @param interval_ns length of the interval in ns, 0 to use all samples (the
+ *                    default)
+ */
+void osd_clock_corr_set_sample_interval(struct osd_clock_corr *corr,
+                                        uint64_t interval_ns);
+
+/**
+ * Add a sample
+ *
+ * @param corr the clock correlation object
+ * @param device_ts device timestamp of an event
+ * @param host_ns host time the event was received (CLOCK_MONOTONIC, in ns)
+ */
+void osd_clock_corr_add(struct osd_clock_corr *corr, uint64_t device_ts,
+                        uint64_t host_ns);
+
+/**
+ * Convert a device timestamp to host time
+ *
+ * The device timestamp is unwrapped relative to the most recent sample.
+ *
+ * @param corr the clock correlation object
+ * @param device_ts the device timestamp
+ * @param[out] host_ns the corresponding host time (CLOCK_MONOTONIC, in ns)
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if not enough (distinct)
+ *         samples are available for a fit
+ */
+osd_result osd_clock_corr_to_host(struct osd_clock_corr *corr,
+                                  uint64_t device_ts, uint64_t *host_ns);
+
+/**
+ * Get the parameters of the current fit
+ *
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if not enough (distinct)
+ *         samples are available for a fit
+ */
+osd_result osd_clock_corr_get_fit(struct osd_clock_corr *corr,
+                                  struct osd_clock_corr_fit *fit);
+
+/**
+ * Remove all samples, e.g. after the device was reset
+ */
+void osd_clock_corr_reset(struct osd_clock_corr *corr);
+
+/**
+ * Free (and NULL) the clock correlation object
+ */
+void osd_clock_corr_free(struct osd_clock_corr **corr);
+
+/**@}*/ /* end of doxygen group libosd-clock_corr */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OSD_CLOCK_CORR_H
@@ -0,0 +1,180 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+#ifndef OSD_FLIGHTREC_H
+#define OSD_FLIGHTREC_H
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <osd/tracefile.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup libosd-flightrec Flight Recorder
+ * @ingroup libosd
+ *
+ * Bounded in-memory history of trace packets
+ *
+ * A flight recorder keeps the most recently added packets in a ring buffer of
+ * fixed size, which is allocated (and touched) when the recorder is created.
+ * When the buffer is full, the oldest packets are overwritten. Adding a
+ * packet only copies it into the buffer: no memory is allocated, no lock is
+ * taken and no I/O is done.
+ *
+ * To read the recorded packets, e.g. after a failure was detected, the
+ * recorder is frozen first. While frozen, the buffer content is preserved and
+ * newly added packets are dropped. The content can then be written into a
+ * trace file before recording is resumed.
+ *
+ * Packets must be added from a single thread. Freezing and all other
+ * functions may be called from any (other) thread, but not concurrently
+ * with each other.
+ *
+ * @{
+ */
+
+/** Minimum size of the ring buffer in bytes */
+#define OSD_FLIGHTREC_SIZE_MIN (1024 * 1024)
+
+/**
+ * Statistics of a flight recorder
+ *
+ * @see osd_flightrec_get_stats()
+ */
+struct osd_flightrec_stats {
+    /** number of packets currently held in the buffer */
+    uint64_t packets;
+    /** number of bytes of the buffer currently used */
+    uint64_t bytes;
+    /** number of packets overwritten to make room for newer ones */
+    uint64_t packets_overwritten;
+    /** number of packets dropped because the recorder was frozen */
+    uint64_t packets_dropped;
+};
+
+struct osd_flightrec;
+
+/**
+ * Create a new flight recorder
+ *
+ * @param[out] rec the flight recorder object
+ * @param log_ctx the log context to be used
+ * @param size size of the ring buffer in bytes (at least
+ *             OSD_FLIGHTREC_SIZE_MIN)
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see osd_flightrec_free()
+ */
+osd_result osd_flightrec_new(struct osd_flightrec **rec,
+                             struct osd_log_ctx *log_ctx,
+                             size_t size);
+
+/**
+ * Add a packet to the flight recorder
+ *
+ * The oldest packets are overwritten if the buffer is full. If the recorder
+ * is frozen the packet is dropped.
+ *
+ * This function must always be called from the same thread.
+ *
+ * @param rec the flight recorder object
+ * @param packet the packet to add
+ * @param timestamp_ns host time the packet was received (CLOCK_MONOTONIC,
+ *                     in ns)
+ * @return OSD_OK on success (also if the packet was dropped), any other value
+ *         indicates an error
+ */
+osd_result osd_flightrec_add(struct osd_flightrec *rec,
+                             const struct osd_packet *packet,
+                             uint64_t timestamp_ns);
+
+/**
+ * Freeze the flight recorder
+ *
+ * Waits until a concurrent osd_flightrec_add() call has finished. Afterwards
+ * the buffer content does not change until osd_flightrec_resume() is called.
+ * Freezing a frozen recorder has no effect.
+ */
+void osd_flightrec_freeze(struct osd_flightrec *rec);
+
+/**
+ * Resume recording after osd_flightrec_freeze()
+ */
+void osd_flightrec_resume(struct osd_flightrec *rec);
+
+/**
+ * Check if the flight recorder is frozen
+ */
+bool osd_flightrec_is_frozen(struct osd_flightrec *rec);
+
+/**
+ * Write all packets in the buffer into a trace file, oldest first
+ *
+ * The recorder must be frozen.
+ *
+ * @param rec the flight recorder object
+ * @param writer the trace file writer
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_flightrec_write(struct osd_flightrec *rec,
+                               struct osd_tracefile_writer *writer);
+
+/**
+ * Remove all packets from the buffer
+ *
+ * The recorder must be frozen.
+ */
+void osd_flightrec_clear(struct osd_flightrec *rec);
+
+/**
+ * Get the statistics of a flight recorder
+ *
+ * This function may be called from any thread.
+ */
+void osd_flightrec_get_stats(struct osd_flightrec *rec,
+                             struct osd_flightrec_stats *stats);
+
+/**
+ * Free (and NULL) the flight recorder object
+ */
+void osd_flightrec_free(struct osd_flightrec **rec);
+
+/**@}*/ /* end of doxygen group libosd-flightrec */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OSD_FLIGHTREC_H
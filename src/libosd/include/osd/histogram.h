@@ -0,0 +1,145 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+#ifndef OSD_HISTOGRAM_H
+#define OSD_HISTOGRAM_H
+
+#include <osd/osd.h>
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup libosd-histogram Histogram
+ * @ingroup libosd
+ *
+ * @{
+ */
+
+/**
+ * Number of bits used to subdivide each power-of-two range of values
+ *
+ * Three bits result in 8 buckets per power of two, i.e. a relative error of
+ * at most 12.5% for every recorded value.
+ */
+#define OSD_HISTOGRAM_SUB_BUCKET_BITS 3
+#define OSD_HISTOGRAM_SUB_BUCKETS (1 << OSD_HISTOGRAM_SUB_BUCKET_BITS)
+
+/**
+ * Number of power-of-two ranges covered by the histogram
+ *
+ * Values larger than the covered range (2^41 for nanoseconds: ~36 minutes)
+ * are counted in the last bucket.
+ */
+#define OSD_HISTOGRAM_MAGNITUDES 40
+
+/** Total number of buckets in a histogram */
+#define OSD_HISTOGRAM_BUCKETS \
+    (OSD_HISTOGRAM_MAGNITUDES * OSD_HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Histogram with log-linear buckets (HDR-style)
+ *
+ * The histogram is a plain data structure without any dynamically allocated
+ * memory. Use osd_histogram_record() to add values; recording is lock-free
+ * and can be done from multiple threads concurrently.
+ */
+struct osd_histogram {
+    uint64_t count; //!< number of recorded values
+    uint64_t sum;   //!< sum of all recorded values
+    uint64_t min;   //!< smallest recorded value (UINT64_MAX if empty)
+    uint64_t max;   //!< largest recorded value
+    uint32_t buckets[OSD_HISTOGRAM_BUCKETS]; //!< number of values per bucket
+};
+
+/**
+ * Reset (or initialize) a histogram
+ *
+ * This function is not thread-safe: don't record values in parallel.
+ */
+void osd_histogram_reset(struct osd_histogram *hist);
+
+/**
+ * Record a value
+ *
+ * This function is thread-safe, lock-free and does not allocate memory.
+ */
+void osd_histogram_record(struct osd_histogram *hist, uint64_t value);
+
+/**
+ * Copy a histogram while values are being recorded into it
+ *
+ * @param dest destination histogram
+ * @param src source histogram
+ */
+void osd_histogram_copy(struct osd_histogram *dest,
+                        const struct osd_histogram *src);
+
+/**
+ * Get the value at a given percentile
+ *
+ * @param hist the histogram
+ * @param percentile percentile to get (0.0 - 100.0)
+ * @return the highest value equivalent to the bucket the percentile falls in,
+ *         or 0 if the histogram is empty
+ */
+uint64_t osd_histogram_percentile(const struct osd_histogram *hist,
+                                  double percentile);
+
+/**
+ * Get the bucket index a value is counted in
+ */
+unsigned int osd_histogram_bucket_idx(uint64_t value);
+
+/**
+ * Get the smallest value counted in a bucket
+ */
+uint64_t osd_histogram_bucket_lowest_value(unsigned int bucket_idx);
+
+/**
+ * Get the largest value counted in a bucket
+ */
+uint64_t osd_histogram_bucket_highest_value(unsigned int bucket_idx);
+
+/**
+ * Summarize a histogram as JSON object
+ *
+ * The object contains the count, min, max and mean values as well as
+ * a selection of percentiles. The resulting string is appended to @p str,
+ * which is (re-)allocated as necessary. Free it after use.
+ */
+void osd_histogram_to_json(const struct osd_histogram *hist, char **str);
+
+/**@}*/ /* end of doxygen group libosd-histogram */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OSD_HISTOGRAM_H
@@ -52,7 +52,10 @@ struct osd_hostctrl_ctx;
  *
  * @param ctx context object
  * @param log_ctx logging context
- * @param router_address ZeroMQ endpoint/URL the host controller will listen on
+ * @param router_address ZeroMQ endpoint/URL the host controller will listen on.
+ *                       Multiple endpoints can be given as comma-separated
+ *                       list, e.g. to additionally listen on an inproc
+ *                       endpoint for clients in the same process.
  * @return OSD_OK if initialization was successful,
  *         any other return code indicates an error
  */
@@ -67,10 +70,39 @@ osd_result osd_hostctrl_start(struct osd_hostctrl_ctx *ctx);
 
 /**
  * Stop host controller
+ *
+ * Messages to the connected clients which are still pending are sent out
+ * within the shutdown timeout.
+ *
+ * @see osd_hostctrl_set_shutdown_timeout()
  */
 osd_result osd_hostctrl_stop(struct osd_hostctrl_ctx *ctx);
 void osd_hostctrl_free(struct osd_hostctrl_ctx **ctx_p);
 
+/**
+ * Free the host controller and report the messages pending on shutdown
+ *
+ * @param ctx_p the host controller context; NULLed
+ * @param[out] stats incremented by the number of messages which were sent out
+ *                   or dropped when stopping and freeing the host controller.
+ *                   Can be NULL.
+ */
+void osd_hostctrl_free_with_stats(struct osd_hostctrl_ctx **ctx_p,
+                                  struct osd_shutdown_stats *stats);
+
+/**
+ * Set the time the host controller may spend sending out pending messages
+ *
+ * The timeout applies to osd_hostctrl_stop() and to freeing the host
+ * controller. Messages which cannot be sent out within this time are dropped.
+ * The default is OSD_SHUTDOWN_TIMEOUT_DEFAULT.
+ *
+ * @param ctx the host controller context
+ * @param timeout_ms the shutdown timeout (ms)
+ */
+void osd_hostctrl_set_shutdown_timeout(struct osd_hostctrl_ctx *ctx,
+                                       int timeout_ms);
+
 
 /**@}*/ /* end of doxygen group libosd-hostctrl */
 
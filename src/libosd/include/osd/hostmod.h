@@ -29,6 +29,7 @@
 
 
 #include <osd/osd.h>
+#include <osd/histogram.h>
 #include <osd/module.h>
 #include <osd/packet.h>
 
@@ -49,6 +50,82 @@ extern "C" {
 /** Flag: fully blocking operation (i.e. wait forever) */
 #define OSD_HOSTMOD_BLOCKING 1
 
+/**
+ * Number of modules for which access statistics are collected individually
+ *
+ * Accesses to all further modules are accumulated in
+ * osd_hostmod_stats.other_modules.
+ */
+#define OSD_HOSTMOD_STATS_MODULES_MAX 8
+
+/** Number of supported register sizes (16, 32, 64 and 128 bit) */
+#define OSD_HOSTMOD_STATS_REG_SIZES 4
+
+/**
+ * Register access operations tracked in the statistics
+ */
+enum osd_hostmod_stats_op {
+    OSD_HOSTMOD_STATS_OP_REG_READ = 0,
+    OSD_HOSTMOD_STATS_OP_REG_WRITE = 1,
+    OSD_HOSTMOD_STATS_OP_COUNT
+};
+
+/**
+ * Access statistics for a single module
+ *
+ * The histograms are indexed by operation (enum osd_hostmod_stats_op) and
+ * register size (0: 16 bit, 1: 32 bit, 2: 64 bit, 3: 128 bit). All times
+ * are in nanoseconds.
+ */
+struct osd_hostmod_stats_module {
+    /**
+     * DI address of the module, or -1 if the entry is unused
+     * (always -1 in osd_hostmod_stats.other_modules)
+     */
+    int diaddr;
+
+    /** Time from sending a request until the response was received */
+    struct osd_histogram round_trip[OSD_HOSTMOD_STATS_OP_COUNT]
+                                   [OSD_HOSTMOD_STATS_REG_SIZES];
+
+    /**
+     * Time a request spent in the queue between the calling thread and
+     * the I/O thread before being handed to the host controller socket
+     */
+    struct osd_histogram queueing[OSD_HOSTMOD_STATS_OP_COUNT]
+                                 [OSD_HOSTMOD_STATS_REG_SIZES];
+};
+
+/**
+ * Latency statistics of a host module
+ *
+ * @see osd_hostmod_get_stats()
+ */
+struct osd_hostmod_stats {
+    /** Statistics for the first OSD_HOSTMOD_STATS_MODULES_MAX modules */
+    struct osd_hostmod_stats_module modules[OSD_HOSTMOD_STATS_MODULES_MAX];
+
+    /** Statistics for all other modules */
+    struct osd_hostmod_stats_module other_modules;
+
+    /** Execution time of the event handler function */
+    struct osd_histogram event_handler;
+
+    /**
+     * Delay between the scheduled and the actual time a periodic register
+     * poll was issued
+     *
+     * @see osd_hostmod_poll_add()
+     */
+    struct osd_histogram poll_jitter;
+
+    /**
+     * Time the connection to the host controller was down before it could
+     * be re-established (count: number of reconnects)
+     */
+    struct osd_histogram link_downtime;
+};
+
 /**
  * Opaque context object
  *
@@ -64,6 +141,31 @@ struct osd_hostmod_ctx;
  */
 typedef osd_result (*osd_hostmod_event_handler_fn)(void */* arg */, struct osd_packet * /* packet */);
 
+/**
+ * Periodic register poll result handler function prototype
+ *
+ * The function is called from the I/O thread of the host module. It must
+ * return quickly and must not call any osd_hostmod_* functions. Copy the
+ * data to a ring buffer or similar if more processing is needed.
+ *
+ * @param arg the argument passed to osd_hostmod_poll_add()
+ * @param poll_id the ID of the poll, as returned by osd_hostmod_poll_add()
+ * @param result OSD_OK if the register was read successfully,
+ *               OSD_ERROR_TIMEDOUT if the module did not respond in time,
+ *               OSD_ERROR_DEVICE_ERROR if the module returned an error,
+ *               OSD_ERROR_CONNECTION_FAILED if the connection to the host
+ *               controller was lost while the read was outstanding,
+ *               OSD_ERROR_COM if the host controller reported the module as
+ *               unreachable
+ * @param data the register contents (reg_size_bit bits), or NULL if the read
+ *             failed. Only valid during the call.
+ * @param timestamp_ns the (monotonic) time in ns the poll was scheduled for
+ */
+typedef void (*osd_hostmod_poll_cb_fn)(void * /* arg */, int /* poll_id */,
+                                       osd_result /* result */,
+                                       const void * /* data */,
+                                       uint64_t /* timestamp_ns */);
+
 /**
  * Create new osd_hostmod instance
  *
@@ -86,9 +188,44 @@ osd_result osd_hostmod_new(struct osd_hostmod_ctx **ctx,
  * Call osd_hostmod_disconnect() before calling this function.
  *
  * @param ctx the osd_com context object
+ *
+ * @see osd_hostmod_free_all()
  */
 void osd_hostmod_free(struct osd_hostmod_ctx **ctx);
 
+/**
+ * Free and NULL multiple host module context objects
+ *
+ * All host modules are shut down in parallel, bounding the total time to the
+ * largest shutdown timeout (instead of the sum of all timeouts).
+ *
+ * Call osd_hostmod_disconnect() on all host modules before calling this
+ * function.
+ *
+ * @param ctxs array of @p count context objects. All entries are NULLed.
+ * @param count number of entries in @p ctxs
+ * @param[out] stats incremented by the number of messages which were sent out
+ *                   or dropped when disconnecting and shutting down the host
+ *                   modules. Can be NULL.
+ *
+ * @see osd_hostmod_set_shutdown_timeout()
+ */
+void osd_hostmod_free_all(struct osd_hostmod_ctx **ctxs, size_t count,
+                          struct osd_shutdown_stats *stats);
+
+/**
+ * Set the time the host module may spend sending out pending messages
+ *
+ * The timeout applies to osd_hostmod_disconnect() and to freeing the host
+ * module. Messages which cannot be sent out within this time are dropped.
+ * The default is OSD_SHUTDOWN_TIMEOUT_DEFAULT.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param timeout_ms the shutdown timeout (ms)
+ */
+void osd_hostmod_set_shutdown_timeout(struct osd_hostmod_ctx *ctx,
+                                      int timeout_ms);
+
 osd_result osd_hostmod_get_modules(struct osd_hostmod_ctx *ctx,
                                struct osd_module_desc **modules,
                                size_t *modules_len);
@@ -96,6 +233,12 @@ osd_result osd_hostmod_get_modules(struct osd_hostmod_ctx *ctx,
 /**
  * Connect to the host controller
  *
+ * Once connected, the host module monitors the connection with heartbeat
+ * messages. If the connection is lost (e.g. because the host controller was
+ * restarted), a new DI address is requested automatically as soon as the host
+ * controller is reachable again. Modules which were configured to send their
+ * events to this host module are redirected to the new address.
+ *
  * @param ctx the osd_hostmod_ctx context object
  * @return OSD_OK on success, any other value indicates an error
  *
@@ -142,6 +285,9 @@ bool osd_hostmod_is_connected(struct osd_hostmod_ctx *ctx);
  * @return OSD_OK on success, any other value indicates an error
  * @return OSD_ERROR_TIMEDOUT if the register read timed out (only if
  *         OSD_HOSTMOD_BLOCKING is not set)
+ * @return OSD_ERROR_CONNECTION_FAILED if the connection to the host
+ *         controller was lost
+ * @return OSD_ERROR_COM if the module is not reachable
  *
  * @see osd_hostmod_write()
  */
@@ -167,6 +313,9 @@ osd_result osd_hostmod_reg_read(struct osd_hostmod_ctx *ctx,
  * @return OSD_OK on success, any other value indicates an error
  * @return OSD_ERROR_TIMEDOUT if the register read timed out (only if
  *         OSD_HOSTMOD_BLOCKING is not set)
+ * @return OSD_ERROR_CONNECTION_FAILED if the connection to the host
+ *         controller was lost
+ * @return OSD_ERROR_COM if the module is not reachable
  */
 osd_result osd_hostmod_reg_write(struct osd_hostmod_ctx *ctx,
                                  const void *data,
@@ -174,6 +323,60 @@ osd_result osd_hostmod_reg_write(struct osd_hostmod_ctx *ctx,
                                  int reg_size_bit,
                                  int flags);
 
+/**
+ * A register write request, as used by osd_hostmod_reg_write_batch()
+ */
+struct osd_hostmod_reg_write_req {
+    /** DI address of the accessed module */
+    uint16_t diaddr;
+    /** address of the register */
+    uint16_t reg_addr;
+    /** size of the register in bit (16, 32, 64 or 128) */
+    int reg_size_bit;
+    /** the data to be written (reg_size_bit bits) */
+    const void *data;
+    /** [out] result of the write */
+    osd_result result;
+};
+
+/**
+ * Write multiple registers at once
+ *
+ * All write requests are sent before waiting for the first response, i.e.
+ * the writes take roughly one round trip to the device instead of one round
+ * trip per register. Writes to the same module are executed in the order
+ * they appear in @p reqs; there is no ordering guarantee between different
+ * modules.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param reqs the write requests. The result of each write is stored in its
+ *             result field.
+ * @param num_reqs number of entries in @p reqs
+ * @param flags flags. Set OSD_HOSTMOD_BLOCKING to block indefinitely until all
+ *              accesses succeed.
+ * @return OSD_OK if all writes succeeded, otherwise the result of the first
+ *         failed write in @p reqs
+ *
+ * @see osd_hostmod_reg_write()
+ */
+osd_result osd_hostmod_reg_write_batch(struct osd_hostmod_ctx *ctx,
+                                       struct osd_hostmod_reg_write_req *reqs,
+                                       size_t num_reqs, int flags);
+
+/**
+ * Get the time the current event packet was received by the host
+ *
+ * The time is taken in the I/O thread right after the message was read from
+ * the host controller connection, i.e. before the packet is decoded and the
+ * event handler is called. Queuing and handling delays within the host
+ * module therefore do not affect it.
+ *
+ * This function may only be called from within the event handler function.
+ *
+ * @return the receive time (CLOCK_MONOTONIC, in ns)
+ */
+uint64_t osd_hostmod_get_event_rx_time_ns(void);
+
 /**
  * Get the DI address assigned to this host debug module
  *
@@ -181,7 +384,8 @@ osd_result osd_hostmod_reg_write(struct osd_hostmod_ctx *ctx,
  * osd_hostmod_connect() before calling this function.
  *
  * @param ctx the osd_hostmod_ctx context object
- * @return the address assigned to this debug module
+ * @return the address assigned to this debug module. The address can change
+ *         if the connection to the host controller is re-established.
  */
 uint16_t osd_hostmod_get_diaddr(struct osd_hostmod_ctx *ctx);
 
@@ -192,6 +396,105 @@ osd_result osd_hostmod_describe_module(struct osd_hostmod_ctx *ctx,
                                        uint16_t di_addr,
                                        struct osd_module_desc *desc);
 
+/**
+ * Periodically read a register in the background
+ *
+ * The register is read by the I/O thread of the host module every
+ * @p interval_ms milliseconds, without involving the calling thread. The due
+ * times are derived from the time the poll was added, i.e. delays in issuing
+ * a single read do not accumulate. Reads to multiple registers which fall due
+ * at (nearly) the same time are issued together.
+ *
+ * If a read has not been answered by the time the next read falls due, this
+ * next read is skipped.
+ *
+ * All polls are removed when disconnecting from the host controller.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param diaddr the DI address of the module to read the register from
+ * @param reg_addr the address of the register to read
+ * @param reg_size_bit size of the register in bit.
+ *                     Supported values: 16, 32, 64 and 128.
+ * @param interval_ms polling interval (in ms)
+ * @param cb function called with the result of every read
+ * @param cb_arg argument passed to @p cb
+ * @param[out] poll_id ID of the poll, used for osd_hostmod_poll_remove()
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see osd_hostmod_poll_remove()
+ */
+osd_result osd_hostmod_poll_add(struct osd_hostmod_ctx *ctx,
+                                uint16_t diaddr, uint16_t reg_addr,
+                                int reg_size_bit, unsigned int interval_ms,
+                                osd_hostmod_poll_cb_fn cb, void *cb_arg,
+                                int *poll_id);
+
+/**
+ * Stop polling a register
+ *
+ * After this function returns the callback of the poll is not called any
+ * more.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param poll_id the ID of the poll as returned by osd_hostmod_poll_add()
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_hostmod_poll_remove(struct osd_hostmod_ctx *ctx, int poll_id);
+
+/**
+ * Add a filter rule to the device gateway of a subnet
+ *
+ * The rule is applied by the gateway to all packets it receives from the
+ * device, before they are sent to the host. Supported rules are
+ *
+ * - "src allow|deny <diaddr>|all": forward or drop packets by source
+ * - "type allow|deny <type>[.<subtype>]": forward or drop packets by type,
+ *   with type being one of "reg", "plain", "event", "res" or a number
+ * - "sample <diaddr>|all <n>": forward only every n-th packet of a source
+ * - "reset": remove all rules
+ *
+ * Register access packets are never dropped by source or sampling rules.
+ *
+ * The host controller rejects the rule if no gateway is registered for
+ * @p subnet. The rule itself is checked by the gateway; invalid rules are
+ * logged there, but not reported to the caller.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param subnet the subnet of the device gateway
+ * @param rule the filter rule
+ * @return OSD_OK if the rule has been forwarded to the gateway,
+ *         OSD_ERROR_FAILURE if the host controller rejected it,
+ *         OSD_ERROR_CONNECTION_FAILED if the connection to the host
+ *         controller is lost,
+ *         OSD_ERROR_TIMEDOUT if the host controller didn't answer in time
+ */
+osd_result osd_hostmod_gw_filter(struct osd_hostmod_ctx *ctx,
+                                 unsigned int subnet, const char *rule);
+
+/**
+ * Get the latency statistics of this host module
+ *
+ * Statistics are collected from the creation of the host module onwards.
+ * This function can be called while register accesses are in progress.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param[out] stats a copy of the current statistics
+ */
+void osd_hostmod_get_stats(struct osd_hostmod_ctx *ctx,
+                           struct osd_hostmod_stats *stats);
+
+/**
+ * Write host module statistics as JSON object
+ *
+ * Only modules and register sizes which have been accessed are included.
+ *
+ * @param stats the statistics, as obtained from osd_hostmod_get_stats()
+ * @param[out] str the JSON string. The string is allocated by this function;
+ *                 free it after use.
+ */
+void osd_hostmod_stats_to_json(const struct osd_hostmod_stats *stats,
+                               char **str);
+
 /**@}*/ /* end of doxygen group libosd-hostmod */
 
 #ifdef __cplusplus
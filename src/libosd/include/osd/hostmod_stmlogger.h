@@ -29,8 +29,13 @@
 
 
 #include <osd/osd.h>
+#include <osd/clock_corr.h>
+#include <osd/flightrec.h>
 #include <osd/hostmod.h>
+#include <osd/tracefile.h>
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #ifdef __cplusplus
@@ -46,10 +51,29 @@ extern "C" {
 
 struct osd_hostmod_stmlogger_ctx;
 
+/**
+ * Statistics about the trace events received from a STM
+ */
+struct osd_hostmod_stmlogger_stats {
+    /** number of received event packets */
+    uint64_t packets;
+    /** size of the received event packets in bytes (including headers) */
+    uint64_t bytes;
+    /** number of overflow packets, i.e. times the STM had to drop events */
+    uint64_t overflows;
+    /** number of events dropped by the STM */
+    uint64_t events_lost;
+};
+
 osd_result osd_hostmod_stmlogger_new(struct osd_hostmod_stmlogger_ctx **ctx,
                                      struct osd_log_ctx *log_ctx,
                                      const char* host_controller_address,
                                      unsigned int stm_di_addr);
+osd_result osd_hostmod_stmlogger_new_multi(struct osd_hostmod_stmlogger_ctx **ctx,
+                                           struct osd_log_ctx *log_ctx,
+                                           const char* host_controller_address,
+                                           const unsigned int *stm_di_addrs,
+                                           size_t num_stms);
 osd_result osd_hostmod_stmlogger_connect(struct osd_hostmod_stmlogger_ctx *ctx);
 osd_result osd_hostmod_stmlogger_disconnect(struct osd_hostmod_stmlogger_ctx *ctx);
 void osd_hostmod_stmlogger_free(struct osd_hostmod_stmlogger_ctx **ctx_p);
@@ -57,6 +81,40 @@ void osd_hostmod_stmlogger_free(struct osd_hostmod_stmlogger_ctx **ctx_p);
 struct osd_hostmod_ctx * osd_hostmod_stmlogger_get_hostmod_ctx(struct osd_hostmod_stmlogger_ctx *ctx);
 osd_result osd_hostmod_stmlogger_tracestart(struct osd_hostmod_stmlogger_ctx *ctx);
 osd_result osd_hostmod_stmlogger_tracestop(struct osd_hostmod_stmlogger_ctx *ctx);
+osd_result osd_hostmod_stmlogger_get_stats(struct osd_hostmod_stmlogger_ctx *ctx,
+                                           unsigned int stm_di_addr,
+                                           struct osd_hostmod_stmlogger_stats *stats);
+osd_result osd_hostmod_stmlogger_open_output(struct osd_hostmod_stmlogger_ctx *ctx,
+                                             const char *path,
+                                             unsigned int sync_interval_ms,
+                                             enum osd_tracefile_compression compression);
+osd_result osd_hostmod_stmlogger_close_output(struct osd_hostmod_stmlogger_ctx *ctx);
+osd_result osd_hostmod_stmlogger_enable_printf(struct osd_hostmod_stmlogger_ctx *ctx);
+osd_result osd_hostmod_stmlogger_set_printf_format(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                   uint32_t fmt_id,
+                                                   const char *fmt);
+osd_result osd_hostmod_stmlogger_get_output_stats(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                  unsigned int stm_di_addr,
+                                                  struct osd_tracefile_writer_stats *stats);
+osd_result osd_hostmod_stmlogger_open_flightrec(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                size_t size);
+osd_result osd_hostmod_stmlogger_close_flightrec(struct osd_hostmod_stmlogger_ctx *ctx);
+osd_result osd_hostmod_stmlogger_set_flightrec_trigger(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                       uint16_t event_id,
+                                                       const uint64_t *value);
+bool osd_hostmod_stmlogger_flightrec_triggered(struct osd_hostmod_stmlogger_ctx *ctx);
+osd_result osd_hostmod_stmlogger_dump_flightrec(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                const char *path);
+osd_result osd_hostmod_stmlogger_get_flightrec_stats(struct osd_hostmod_stmlogger_ctx *ctx,
+                                                     unsigned int stm_di_addr,
+                                                     struct osd_flightrec_stats *stats);
+osd_result osd_hostmod_stmlogger_get_host_time(struct osd_hostmod_stmlogger_ctx *ctx,
+                                               unsigned int stm_di_addr,
+                                               uint32_t device_ts,
+                                               uint64_t *host_ns);
+osd_result osd_hostmod_stmlogger_get_clock_fit(struct osd_hostmod_stmlogger_ctx *ctx,
+                                               unsigned int stm_di_addr,
+                                               struct osd_clock_corr_fit *fit);
 
 
 /**@}*/ /* end of doxygen group libosd-hostmod-stmlogger */
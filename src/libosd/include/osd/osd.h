@@ -74,6 +74,8 @@ typedef int osd_result;
 #define OSD_ERROR_CONNECTION_FAILED -9
 /** Return code: Out of memory */
 #define OSD_ERROR_OOM -11
+/** Return code: end of file reached */
+#define OSD_ERROR_EOF -12
 
 /**
  * Return true if |rv| is an error code
@@ -275,6 +277,32 @@ unsigned int osd_diaddr_subnet(unsigned int diaddr);
 unsigned int osd_diaddr_localaddr(unsigned int diaddr);
 unsigned int osd_diaddr_build(unsigned int subnet, unsigned int local_diaddr);
 
+/**
+ * Default time (in ms) a host module or host controller gets to send out its
+ * pending outbound messages when being stopped or freed
+ */
+#define OSD_SHUTDOWN_TIMEOUT_DEFAULT (1*1000) // 1 s
+
+/**
+ * Interval (in ms) of heartbeat (PING) messages sent from host modules and
+ * device gateways to the host controller
+ *
+ * The host controller considers a peer dead if it doesn't receive any message
+ * from it for a couple of intervals.
+ */
+#define OSD_HEARTBEAT_INTERVAL_MS (1*1000) // 1 s
+
+/**
+ * Messages still pending when stopping a host module or host controller
+ */
+struct osd_shutdown_stats {
+    /** Number of pending outbound messages which were sent out */
+    unsigned int flushed;
+
+    /** Number of pending outbound messages which had to be discarded */
+    unsigned int dropped;
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,141 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#ifndef OSD_STM_H
+#define OSD_STM_H
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup libosd-stm STM Event Decoder
+ * @ingroup libosd
+ *
+ * Decode trace events sent by a System Trace Module (STM)
+ *
+ * A STM sends each trace event as debug event packet. The payload of a trace
+ * event packet contains a 32 bit timestamp, a 16 bit ID and a value with the
+ * width of the CPU registers (32 or 64 bit), all in little endian word order.
+ * If the STM had to drop trace events it sends an overflow packet, which
+ * contains the number of lost events.
+ *
+ * None of the decoding functions allocate memory.
+ *
+ * @{
+ */
+
+/** TYPE_SUB of an event packet containing a complete trace event */
+#define OSD_STM_TYPE_SUB_EVENT 0
+/** TYPE_SUB of an event packet signaling lost trace events */
+#define OSD_STM_TYPE_SUB_OVERFLOW 5
+
+/**
+ * Type of a decoded STM event
+ */
+enum osd_stm_event_type {
+    OSD_STM_EVENT_TRACE = 0,    //!< a trace event (ID/value pair)
+    OSD_STM_EVENT_OVERFLOW = 1, //!< trace events were lost
+};
+
+/**
+ * A decoded STM event
+ */
+struct osd_stm_event {
+    enum osd_stm_event_type type; //!< event type
+    uint16_t stm_diaddr;          //!< DI address of the STM sending the event
+    uint32_t timestamp;           //!< device timestamp (trace events only)
+    uint16_t id;                  //!< trace ID (trace events only)
+    uint64_t value;               //!< trace value (trace events only)
+    uint8_t value_width_bit;      //!< width of value: 32 or 64 bit
+    uint32_t lost_events;         //!< lost events (overflow events only)
+};
+
+/**
+ * Decode a STM event packet
+ *
+ * @param packet the packet to decode
+ * @param[out] event the decoded event
+ * @return OSD_OK on success, OSD_ERROR_DEVICE_INVALID_DATA if the packet is
+ *         not a valid STM event packet
+ */
+osd_result osd_stm_event_decode(const struct osd_packet *packet,
+                                struct osd_stm_event *event);
+
+/**
+ * Decoded STM events in struct-of-arrays layout
+ *
+ * Each decoded event occupies one entry in every array. Overflow events
+ * store the number of lost events in |value|; |timestamp| and |id| are 0 for
+ * them.
+ *
+ * The arrays are owned by the caller and must hold |capacity| entries each.
+ */
+struct osd_stm_event_columns {
+    size_t capacity;    //!< number of entries in each array
+    size_t len;         //!< number of valid entries
+    uint8_t *type;      //!< enum osd_stm_event_type
+    uint32_t *timestamp;
+    uint16_t *id;
+    uint64_t *value;
+
+    /** number of packets which were not valid STM event packets */
+    uint64_t invalid_packets;
+};
+
+/**
+ * Decode multiple STM event packets into columns
+ *
+ * The decoded events are appended to |columns|, starting at index
+ * columns->len. Packets which are no valid STM event packets are skipped and
+ * counted in columns->invalid_packets.
+ *
+ * @param packets the packets to decode
+ * @param num_packets number of packets in |packets|
+ * @param columns the output columns
+ * @param[out] num_consumed number of packets consumed from |packets|. Less
+ *                          than num_packets if |columns| is full.
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_stm_event_decode_batch(const struct osd_packet *const *packets,
+                                      size_t num_packets,
+                                      struct osd_stm_event_columns *columns,
+                                      size_t *num_consumed);
+
+/**@}*/ /* end of doxygen group libosd-stm */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OSD_STM_H
@@ -0,0 +1,156 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#ifndef OSD_STM_PRINTF_H
+#define OSD_STM_PRINTF_H
+
+#include <osd/osd.h>
+#include <osd/stm.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup libosd-stm-printf STM printf Reconstruction
+ * @ingroup libosd
+ *
+ * Reassemble printf() output of software running on the target from STM
+ * trace events
+ *
+ * Software writes text through the STM in two ways:
+ *
+ * - Single characters: one event with ID OSD_STM_ID_PUTCHAR per character.
+ * - Formatted output: one event with ID OSD_STM_ID_PRINTF_FMT carrying the ID
+ *   of the format string, followed by one OSD_STM_ID_PRINTF_ARG event per
+ *   argument. The format strings are not sent over the trace interface, they
+ *   must be registered with osd_stm_printf_set_format() (e.g. extracted from
+ *   the software binary).
+ *
+ * Each STM (i.e. each CPU core) has its own output stream. The text is
+ * collected per STM and passed to a callback line by line.
+ *
+ * Handling an event takes amortized constant time and does not allocate
+ * memory (except for the first event of a previously unseen STM).
+ *
+ * @{
+ */
+
+/** STM event ID: print the character in the event value */
+#define OSD_STM_ID_PUTCHAR    0x0004
+/** STM event ID: start a formatted print, value is the format string ID */
+#define OSD_STM_ID_PRINTF_FMT 0x0005
+/** STM event ID: argument of the preceding formatted print */
+#define OSD_STM_ID_PRINTF_ARG 0x0006
+
+/** Maximum length of an output line; longer lines are split */
+#define OSD_STM_PRINTF_LINE_MAX 1024
+
+/** Maximum number of arguments of a format string */
+#define OSD_STM_PRINTF_ARGS_MAX 16
+
+/**
+ * Check if a STM event is handled by the printf reconstruction
+ */
+#define OSD_STM_PRINTF_IS_PRINTF_EVENT(ev) \
+    ((ev)->type == OSD_STM_EVENT_TRACE && \
+     (ev)->id >= OSD_STM_ID_PUTCHAR && (ev)->id <= OSD_STM_ID_PRINTF_ARG)
+
+/**
+ * Callback for a reconstructed output line
+ *
+ * @param arg the argument passed to osd_stm_printf_new()
+ * @param stm_diaddr DI address of the STM which produced the line
+ * @param line the line, without the line break. NUL-terminated.
+ * @param len length of |line| in characters
+ */
+typedef void (*osd_stm_printf_line_fn)(void *arg, uint16_t stm_diaddr,
+                                       const char *line, size_t len);
+
+struct osd_stm_printf;
+
+/**
+ * Create a new printf reconstruction context
+ *
+ * @param[out] ctx the context
+ * @param log_ctx the log context to be used
+ * @param line_fn function called for each complete output line
+ * @param line_fn_arg argument passed to line_fn
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_stm_printf_new(struct osd_stm_printf **ctx,
+                              struct osd_log_ctx *log_ctx,
+                              osd_stm_printf_line_fn line_fn,
+                              void *line_fn_arg);
+
+/**
+ * Register a format string
+ *
+ * Supported conversions are %d, %i, %u, %x, %X, %o, %c and %p, with the
+ * usual flags, field width and precision; length modifiers are accepted and
+ * ignored. %% prints a percent sign.
+ *
+ * @param ctx the context
+ * @param fmt_id the ID of the format string, as sent in the
+ *               OSD_STM_ID_PRINTF_FMT event
+ * @param fmt the format string
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if the format string contains
+ *         unsupported conversions or too many arguments
+ */
+osd_result osd_stm_printf_set_format(struct osd_stm_printf *ctx,
+                                     uint32_t fmt_id, const char *fmt);
+
+/**
+ * Handle a STM event
+ *
+ * Events which are not printf events are ignored.
+ *
+ * @see OSD_STM_PRINTF_IS_PRINTF_EVENT
+ */
+osd_result osd_stm_printf_handle_event(struct osd_stm_printf *ctx,
+                                       const struct osd_stm_event *ev);
+
+/**
+ * Pass all incomplete lines to the line callback
+ */
+osd_result osd_stm_printf_flush(struct osd_stm_printf *ctx);
+
+/**
+ * Free and NULL a printf reconstruction context
+ */
+void osd_stm_printf_free(struct osd_stm_printf **ctx_p);
+
+/**@}*/ /* end of doxygen group libosd-stm-printf */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OSD_STM_PRINTF_H
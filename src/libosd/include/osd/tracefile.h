@@ -0,0 +1,340 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#ifndef OSD_TRACEFILE_H
+#define OSD_TRACEFILE_H
+
+#include <osd/osd.h>
+#include <osd/histogram.h>
+#include <osd/module.h>
+#include <osd/packet.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup libosd-tracefile Trace File
+ * @ingroup libosd
+ *
+ * Compact binary container for trace packets
+ *
+ * A trace file stores the packets received from a trace module (e.g. a STM)
+ * together with the time they were received on the host. It consists of a
+ * header with metadata about the traced system and module, followed by one
+ * record per packet. Each record holds the packet length, the host timestamp
+ * (delta-encoded to the previous record) and the raw packet data. All values
+ * are little endian.
+ *
+ * Records are grouped into blocks, which are optionally compressed with LZ4 or
+ * zstd (if libosd was built with support for it). Each block can be
+ * decompressed and decoded independently of all other blocks.
+ *
+ * Writing is done through a large buffer, i.e. only one write system call is
+ * made for many packets. Writers created with osd_tracefile_writer_new_async()
+ * use multiple buffers, which are written to disk by a separate writer
+ * thread. Adding packets then never waits for the storage: if all buffers
+ * are full the packets are dropped, which is reported in the writer
+ * statistics.
+ *
+ * When the file is closed, an index with the file offset, the first timestamp
+ * and the first packet number of every block is appended. Readers map the
+ * file into memory and use the index to seek to a point in time or to a
+ * packet number without decoding the preceding blocks. Files without an
+ * index (e.g. written by a process which crashed) can still be read; the
+ * index is then rebuilt from the block headers when opening the file.
+ *
+ * @{
+ */
+
+/**
+ * Version of the trace file format
+ *
+ * - Version 1: flat list of packet records (not supported any more)
+ * - Version 2: records grouped into (optionally compressed) blocks
+ * - Version 3: block index appended when closing the file
+ */
+#define OSD_TRACEFILE_VERSION 3
+
+/** Default size of a write buffer in bytes */
+#define OSD_TRACEFILE_BUFFER_SIZE_DEFAULT (1024 * 1024)
+
+/** Maximum number of write buffers of an asynchronous writer */
+#define OSD_TRACEFILE_BUFFERS_MAX 8
+
+/**
+ * Compression of the packet records in a trace file
+ */
+enum osd_tracefile_compression {
+    OSD_TRACEFILE_COMPRESSION_NONE = 0, //!< no compression
+    OSD_TRACEFILE_COMPRESSION_LZ4 = 1,  //!< LZ4 (fast, moderate ratio)
+    OSD_TRACEFILE_COMPRESSION_ZSTD = 2, //!< zstd (good ratio)
+};
+
+/**
+ * Check if a compression method is supported by this build of libosd
+ */
+bool osd_tracefile_compression_supported(enum osd_tracefile_compression compression);
+
+/**
+ * Metadata stored in a trace file
+ */
+struct osd_tracefile_meta {
+    uint16_t system_vendor_id; //!< vendor of the traced system (from SCM)
+    uint16_t system_device_id; //!< device of the traced system (from SCM)
+
+    /** the traced module; addr is its DI address */
+    struct osd_module_desc module;
+
+    /**
+     * Time the trace file was created (CLOCK_REALTIME, in ns). Set by
+     * osd_tracefile_writer_new().
+     */
+    uint64_t start_time_realtime_ns;
+
+    /**
+     * Time the trace file was created (CLOCK_MONOTONIC, in ns). Set by
+     * osd_tracefile_writer_new(). Host timestamps of the packets use the
+     * same clock; together with start_time_realtime_ns they can be converted
+     * to wall clock time.
+     */
+    uint64_t start_time_monotonic_ns;
+};
+
+/**
+ * Statistics of a trace file writer
+ *
+ * @see osd_tracefile_writer_get_stats()
+ */
+struct osd_tracefile_writer_stats {
+    /** number of packets added to the file */
+    uint64_t packets_written;
+    /** number of packets dropped because all write buffers were full */
+    uint64_t packets_dropped;
+    /** number of times packets had to be dropped (drop bursts) */
+    uint64_t buffer_overflows;
+    /** number of bytes written to disk */
+    uint64_t bytes_written;
+    /** number of bytes written to disk if compression were disabled */
+    uint64_t bytes_uncompressed;
+    /** number of fdatasync() calls */
+    uint64_t syncs;
+    /** time needed to write a buffer to disk (including a sync) */
+    struct osd_histogram write_time_ns;
+    /** time needed to compress a buffer */
+    struct osd_histogram compress_time_ns;
+};
+
+struct osd_tracefile_writer;
+struct osd_tracefile_reader;
+
+/**
+ * Create a new trace file
+ *
+ * @param[out] writer the writer object
+ * @param log_ctx the log context to be used
+ * @param path path of the file. An existing file is overwritten.
+ * @param meta metadata stored in the file header
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see osd_tracefile_writer_free()
+ */
+osd_result osd_tracefile_writer_new(struct osd_tracefile_writer **writer,
+                                    struct osd_log_ctx *log_ctx,
+                                    const char *path,
+                                    const struct osd_tracefile_meta *meta);
+
+/**
+ * Create a new trace file written by a separate writer thread
+ *
+ * osd_tracefile_writer_add() fills one buffer, while the other buffers are
+ * compressed and written to disk by the writer thread. Packets are dropped if
+ * no free buffer is available.
+ *
+ * @param[out] writer the writer object
+ * @param log_ctx the log context to be used
+ * @param path path of the file. An existing file is overwritten.
+ * @param meta metadata stored in the file header
+ * @param num_buffers number of write buffers (2 to OSD_TRACEFILE_BUFFERS_MAX)
+ * @param buffer_size size of each write buffer in bytes. Set to 0 to use
+ *                    OSD_TRACEFILE_BUFFER_SIZE_DEFAULT.
+ * @param sync_interval_ms call fdatasync() after writing a buffer if the last
+ *                         sync is at least this long ago. Set to 0 to never
+ *                         sync explicitly.
+ * @param compression compression of the packet records. See
+ *                    osd_tracefile_compression_supported().
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see osd_tracefile_writer_free()
+ */
+osd_result osd_tracefile_writer_new_async(struct osd_tracefile_writer **writer,
+                                          struct osd_log_ctx *log_ctx,
+                                          const char *path,
+                                          const struct osd_tracefile_meta *meta,
+                                          unsigned int num_buffers,
+                                          size_t buffer_size,
+                                          unsigned int sync_interval_ms,
+                                          enum osd_tracefile_compression compression);
+
+/**
+ * Add a packet to the trace file
+ *
+ * The packet is copied into the write buffer; the buffer is written to disk
+ * when it is full.
+ *
+ * This function must not be called concurrently for the same writer.
+ *
+ * @param writer the writer object
+ * @param packet the packet to add
+ * @param timestamp_ns host time the packet was received (CLOCK_MONOTONIC,
+ *                     in ns)
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_tracefile_writer_add(struct osd_tracefile_writer *writer,
+                                    const struct osd_packet *packet,
+                                    uint64_t timestamp_ns);
+
+/**
+ * Write all buffered packets to the file
+ *
+ * For asynchronous writers this function waits until the writer thread has
+ * written all buffers. It must not be called concurrently with
+ * osd_tracefile_writer_add().
+ *
+ * @return OSD_OK on success, any other value indicates an error. For
+ *         asynchronous writers, errors of previous writes are returned.
+ */
+osd_result osd_tracefile_writer_flush(struct osd_tracefile_writer *writer);
+
+/**
+ * Get the number of packets added to the trace file
+ */
+uint64_t osd_tracefile_writer_get_packet_count(struct osd_tracefile_writer *writer);
+
+/**
+ * Get the statistics of a trace file writer
+ *
+ * This function may be called from any thread.
+ */
+void osd_tracefile_writer_get_stats(struct osd_tracefile_writer *writer,
+                                    struct osd_tracefile_writer_stats *stats);
+
+/**
+ * Flush and close the trace file, and free (and NULL) the writer object
+ */
+void osd_tracefile_writer_free(struct osd_tracefile_writer **writer);
+
+/**
+ * Open a trace file for reading
+ *
+ * @param[out] reader the reader object
+ * @param log_ctx the log context to be used
+ * @param path path of the file
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see osd_tracefile_reader_free()
+ */
+osd_result osd_tracefile_reader_new(struct osd_tracefile_reader **reader,
+                                    struct osd_log_ctx *log_ctx,
+                                    const char *path);
+
+/**
+ * Get the metadata of a trace file
+ */
+const struct osd_tracefile_meta*
+osd_tracefile_reader_get_meta(struct osd_tracefile_reader *reader);
+
+/**
+ * Read the next packet from a trace file
+ *
+ * @param reader the reader object
+ * @param[out] packet the packet. Free it with osd_packet_free() after use.
+ * @param[out] timestamp_ns host time the packet was received
+ *                          (CLOCK_MONOTONIC, in ns)
+ * @return OSD_OK on success, OSD_ERROR_EOF if all packets have been read,
+ *         any other value indicates an error
+ */
+osd_result osd_tracefile_reader_next(struct osd_tracefile_reader *reader,
+                                     struct osd_packet **packet,
+                                     uint64_t *timestamp_ns);
+
+/**
+ * Get the number of packets in a trace file
+ */
+uint64_t osd_tracefile_reader_get_packet_count(struct osd_tracefile_reader *reader);
+
+/**
+ * Seek to a packet number
+ *
+ * The next call to osd_tracefile_reader_next() returns the packet
+ * |packet_idx| (counting from 0).
+ *
+ * @param reader the reader object
+ * @param packet_idx number of the packet
+ * @return OSD_OK on success, OSD_ERROR_EOF if the file contains less packets,
+ *         any other value indicates an error
+ */
+osd_result osd_tracefile_reader_seek_packet(struct osd_tracefile_reader *reader,
+                                            uint64_t packet_idx);
+
+/**
+ * Seek to a point in time
+ *
+ * The next call to osd_tracefile_reader_next() returns the first packet with
+ * a host timestamp equal to or later than |timestamp_ns|. Packet timestamps
+ * are assumed to be monotonic.
+ *
+ * @param reader the reader object
+ * @param timestamp_ns host time (CLOCK_MONOTONIC, in ns)
+ * @return OSD_OK on success, OSD_ERROR_EOF if no such packet exists,
+ *         any other value indicates an error
+ */
+osd_result osd_tracefile_reader_seek_time(struct osd_tracefile_reader *reader,
+                                          uint64_t timestamp_ns);
+
+/**
+ * Get the number of the packet returned by the next
+ * osd_tracefile_reader_next() call
+ */
+uint64_t osd_tracefile_reader_tell(struct osd_tracefile_reader *reader);
+
+/**
+ * Close the trace file and free (and NULL) the reader object
+ */
+void osd_tracefile_reader_free(struct osd_tracefile_reader **reader);
+
+/**@}*/ /* end of doxygen group libosd-tracefile */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OSD_TRACEFILE_H
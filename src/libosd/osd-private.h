@@ -29,6 +29,8 @@
 
 #include <osd/osd.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <time.h>
 
 /*
  * Mark functions to be exported from the library as part of the API
@@ -108,6 +110,12 @@ void osd_log(struct osd_log_ctx *ctx,
              __attribute__((format(printf, 6, 7)));
 
 
+/**
+ * Append a printf()-formatted string to a dynamically allocated string
+ */
+void sprintf_append(char **strp, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
 static inline uint32_t __iter_div_u64_rem(uint64_t dividend, uint32_t divisor,
                                           uint64_t *remainder)
 {
@@ -131,6 +139,16 @@ static inline void timespec_add_ns(struct timespec *a, uint64_t ns)
     a->tv_nsec = ns;
 }
 
+/**
+ * Get the current time of the monotonic system clock in nanoseconds
+ */
+static inline uint64_t osd_clock_monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
 //#define BIT_MASK(x)           (1UL << ((x) % BITS_PER_LONG))
 
 /**
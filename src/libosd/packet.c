@@ -169,26 +169,6 @@ size_t osd_packet_sizeof(const struct osd_packet *packet)
     return packet->data_size_words * sizeof(uint16_t);
 }
 
-static void sprintf_append(char** strp, const char *fmt, ...)
-{
-    va_list ap;
-    char* append_str;
-
-    va_start(ap, fmt);
-    int append_size = vasprintf(&append_str, fmt, ap);
-    assert(append_size != 0);
-    va_end(ap);
-
-    if (*strp == NULL) {
-        *strp = append_str;
-    } else {
-        size_t cur_size = strlen(*strp);
-        *strp = realloc(*strp, cur_size + append_size + 1 /* \0 */);
-        strncat(*strp, append_str, append_size);
-        free(append_str);
-    }
-}
-
 API_EXPORT
 void osd_packet_to_string(const struct osd_packet *packet, char** str)
 {
@@ -0,0 +1,161 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <osd/stm.h>
+#include "osd-private.h"
+
+#include <assert.h>
+#include <string.h>
+
+/** Number of payload words of a trace event with a 32 bit value */
+#define PAYLOAD_WORDS_VALUE32 (2 + 1 + 2)
+/** Number of payload words of a trace event with a 64 bit value */
+#define PAYLOAD_WORDS_VALUE64 (2 + 1 + 4)
+/** Number of payload words of an overflow packet */
+#define PAYLOAD_WORDS_OVERFLOW 1
+
+/** Combine the packet type and subtype into a single value */
+#define TYPE_AND_SUB(type, type_sub) (((type) << 4) | (type_sub))
+
+static inline unsigned int packet_type_and_sub(const struct osd_packet *packet)
+{
+    return packet->data.flags >> DP_HEADER_TYPE_SUB_SHIFT;
+}
+
+static inline unsigned int packet_payload_words(const struct osd_packet *packet)
+{
+    return packet->data_size_words - 3;
+}
+
+API_EXPORT
+osd_result osd_stm_event_decode(const struct osd_packet *packet,
+                                struct osd_stm_event *event)
+{
+    assert(packet);
+    assert(event);
+
+    if (packet->data_size_words < 3) {
+        return OSD_ERROR_DEVICE_INVALID_DATA;
+    }
+
+    const uint16_t *payload = packet->data.payload;
+    unsigned int payload_words = packet_payload_words(packet);
+
+    switch (packet_type_and_sub(packet)) {
+    case TYPE_AND_SUB(OSD_PACKET_TYPE_EVENT, OSD_STM_TYPE_SUB_EVENT):
+        if (payload_words == PAYLOAD_WORDS_VALUE32) {
+            event->value = payload[3] | (uint32_t)payload[4] << 16;
+            event->value_width_bit = 32;
+        } else if (payload_words == PAYLOAD_WORDS_VALUE64) {
+            event->value = payload[3] | (uint32_t)payload[4] << 16 |
+                           (uint64_t)payload[5] << 32 |
+                           (uint64_t)payload[6] << 48;
+            event->value_width_bit = 64;
+        } else {
+            return OSD_ERROR_DEVICE_INVALID_DATA;
+        }
+        event->type = OSD_STM_EVENT_TRACE;
+        event->timestamp = payload[0] | (uint32_t)payload[1] << 16;
+        event->id = payload[2];
+        event->lost_events = 0;
+        break;
+
+    case TYPE_AND_SUB(OSD_PACKET_TYPE_EVENT, OSD_STM_TYPE_SUB_OVERFLOW):
+        if (payload_words != PAYLOAD_WORDS_OVERFLOW) {
+            return OSD_ERROR_DEVICE_INVALID_DATA;
+        }
+        event->type = OSD_STM_EVENT_OVERFLOW;
+        event->timestamp = 0;
+        event->id = 0;
+        event->value = 0;
+        event->value_width_bit = 0;
+        event->lost_events = payload[0];
+        break;
+
+    default:
+        return OSD_ERROR_DEVICE_INVALID_DATA;
+    }
+
+    event->stm_diaddr = packet->data.src;
+
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_stm_event_decode_batch(const struct osd_packet *const *packets,
+                                      size_t num_packets,
+                                      struct osd_stm_event_columns *columns,
+                                      size_t *num_consumed)
+{
+    assert(packets || num_packets == 0);
+    assert(columns);
+    assert(columns->len <= columns->capacity);
+
+    size_t out = columns->len;
+    size_t i;
+    for (i = 0; i < num_packets && out < columns->capacity; i++) {
+        const struct osd_packet *packet = packets[i];
+        const uint16_t *payload = packet->data.payload;
+
+        // The common case (a trace event) is decoded directly into the
+        // columns; everything else (including packets too short to hold a
+        // header) takes the slow path.
+        if (packet->data_size_words >= 3
+            && packet_type_and_sub(packet) ==
+               TYPE_AND_SUB(OSD_PACKET_TYPE_EVENT, OSD_STM_TYPE_SUB_EVENT)
+            && packet_payload_words(packet) == PAYLOAD_WORDS_VALUE32) {
+            columns->type[out] = OSD_STM_EVENT_TRACE;
+            columns->timestamp[out] = payload[0] | (uint32_t)payload[1] << 16;
+            columns->id[out] = payload[2];
+            columns->value[out] = payload[3] | (uint32_t)payload[4] << 16;
+            out++;
+            continue;
+        }
+
+        struct osd_stm_event event;
+        if (OSD_FAILED(osd_stm_event_decode(packet, &event))) {
+            columns->invalid_packets++;
+            continue;
+        }
+        columns->type[out] = event.type;
+        columns->timestamp[out] = event.timestamp;
+        columns->id[out] = event.id;
+        columns->value[out] = (event.type == OSD_STM_EVENT_OVERFLOW) ?
+                              event.lost_events : event.value;
+        out++;
+    }
+
+    columns->len = out;
+    if (num_consumed) {
+        *num_consumed = i;
+    }
+
+    return OSD_OK;
+}
@@ -0,0 +1,555 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+#include <osd/osd.h>
+#include <osd/stm_printf.h>
+#include "osd-private.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Initial capacity of the ID maps (log2) */
+#define ID_MAP_INITIAL_CAPACITY_LOG2 4
+
+/** Maximum length of a single printf conversion specification */
+#define SPEC_MAX 16
+
+/**
+ * Hash map from a 64 bit ID to a pointer (open addressing, linear probing)
+ */
+struct id_map {
+    uint64_t *keys;
+    void **values; //!< NULL for empty slots
+    unsigned int capacity_log2;
+    size_t count;
+};
+
+/**
+ * A segment of a parsed format string: either literal text or a conversion
+ */
+struct fmt_segment {
+    /** conversion character, or 0 for literal text */
+    char conv;
+    /** the argument is a signed integer */
+    bool is_signed;
+    /** literal text */
+    const char *text;
+    size_t text_len;
+    /** conversion specification passed to snprintf() */
+    char spec[SPEC_MAX];
+};
+
+/**
+ * A registered format string
+ */
+struct fmt_entry {
+    char *fmt;
+    struct fmt_segment *segments;
+    unsigned int num_segments;
+    unsigned int num_args;
+};
+
+/**
+ * Output state of a single STM (CPU core)
+ */
+struct core_state {
+    uint16_t stm_diaddr;
+
+    char line[OSD_STM_PRINTF_LINE_MAX + 1];
+    size_t line_len;
+
+    /** Format string of a formatted print waiting for its arguments */
+    const struct fmt_entry *fmt;
+    uint64_t args[OSD_STM_PRINTF_ARGS_MAX];
+    uint8_t args_width_bit[OSD_STM_PRINTF_ARGS_MAX];
+    unsigned int num_args;
+};
+
+struct osd_stm_printf {
+    struct osd_log_ctx *log_ctx;
+    osd_stm_printf_line_fn line_fn;
+    void *line_fn_arg;
+
+    /** struct core_state by STM DI address */
+    struct id_map cores;
+    /** Most recently used core (events typically come in bursts) */
+    struct core_state *last_core;
+
+    /** struct fmt_entry by format ID */
+    struct id_map formats;
+};
+
+static void id_map_init(struct id_map *m)
+{
+    m->capacity_log2 = ID_MAP_INITIAL_CAPACITY_LOG2;
+    m->keys = calloc(1 << m->capacity_log2, sizeof(uint64_t));
+    assert(m->keys);
+    m->values = calloc(1 << m->capacity_log2, sizeof(void*));
+    assert(m->values);
+    m->count = 0;
+}
+
+static size_t id_map_slot(const struct id_map *m, uint64_t key)
+{
+    // Fibonacci hashing: use the upper bits of the product
+    return (key * 11400714819323198485ull) >> (64 - m->capacity_log2);
+}
+
+static void* id_map_get(const struct id_map *m, uint64_t key)
+{
+    size_t mask = (1 << m->capacity_log2) - 1;
+    for (size_t i = id_map_slot(m, key); m->values[i]; i = (i + 1) & mask) {
+        if (m->keys[i] == key) {
+            return m->values[i];
+        }
+    }
+    return NULL;
+}
+
+static void id_map_put(struct id_map *m, uint64_t key, void *value);
+
+static void id_map_grow(struct id_map *m)
+{
+    uint64_t *old_keys = m->keys;
+    void **old_values = m->values;
+    size_t old_capacity = 1 << m->capacity_log2;
+
+    m->capacity_log2++;
+    m->keys = calloc(1 << m->capacity_log2, sizeof(uint64_t));
+    assert(m->keys);
+    m->values = calloc(1 << m->capacity_log2, sizeof(void*));
+    assert(m->values);
+    m->count = 0;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_values[i]) {
+            id_map_put(m, old_keys[i], old_values[i]);
+        }
+    }
+    free(old_keys);
+    free(old_values);
+}
+
+/**
+ * Insert or replace an entry
+ */
+static void id_map_put(struct id_map *m, uint64_t key, void *value)
+{
+    assert(value);
+
+    // keep the load factor below 50%
+    if ((m->count + 1) * 2 > ((size_t)1 << m->capacity_log2)) {
+        id_map_grow(m);
+    }
+
+    size_t mask = (1 << m->capacity_log2) - 1;
+    size_t i;
+    for (i = id_map_slot(m, key); m->values[i]; i = (i + 1) & mask) {
+        if (m->keys[i] == key) {
+            m->values[i] = value;
+            return;
+        }
+    }
+    m->keys[i] = key;
+    m->values[i] = value;
+    m->count++;
+}
+
+static void fmt_entry_free(struct fmt_entry *f)
+{
+    if (!f) {
+        return;
+    }
+    free(f->segments);
+    free(f->fmt);
+    free(f);
+}
+
+/**
+ * Parse a format string into literal and conversion segments
+ */
+static osd_result fmt_parse(struct osd_stm_printf *ctx, const char *fmt,
+                            struct fmt_entry **entry)
+{
+    struct fmt_entry *f = calloc(1, sizeof(*f));
+    assert(f);
+    f->fmt = strdup(fmt);
+    assert(f->fmt);
+
+    // every "%" starts at most one conversion and one literal segment
+    size_t max_segments = 1;
+    for (const char *p = fmt; *p; p++) {
+        if (*p == '%') {
+            max_segments += 2;
+        }
+    }
+    f->segments = calloc(max_segments, sizeof(struct fmt_segment));
+    assert(f->segments);
+
+    const char *p = f->fmt;
+    while (*p) {
+        struct fmt_segment *seg = &f->segments[f->num_segments];
+
+        if (p[0] == '%' && p[1] == '%') {
+            seg->text = p + 1;
+            seg->text_len = 1;
+            f->num_segments++;
+            p += 2;
+            continue;
+        }
+        if (p[0] != '%') {
+            // literal text up to the next conversion
+            const char *end = strchr(p, '%');
+            if (!end) {
+                end = p + strlen(p);
+            }
+            seg->text = p;
+            seg->text_len = end - p;
+            f->num_segments++;
+            p = end;
+            continue;
+        }
+
+        // conversion specification: %[flags][width][.precision][length]conv
+        const char *spec_start = p++;
+        p += strspn(p, "-+ #0");
+        p += strspn(p, "0123456789");
+        if (*p == '.') {
+            p++;
+            p += strspn(p, "0123456789");
+        }
+        size_t spec_len = p - spec_start;
+        p += strspn(p, "hljzt");
+        char conv = *p;
+        if (conv == '\0' || spec_len + 5 > SPEC_MAX) {
+            goto err_unsupported;
+        }
+        p++;
+
+        memcpy(seg->spec, spec_start, spec_len);
+        switch (conv) {
+        case 'd':
+        case 'i':
+            seg->is_signed = true;
+            // fall through
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            memcpy(seg->spec + spec_len, "ll", 2);
+            seg->spec[spec_len + 2] = conv;
+            break;
+        case 'c':
+            seg->spec[spec_len] = 'c';
+            break;
+        case 'p':
+            // "%<flags>..." -> "%#<flags>...llx"
+            seg->spec[1] = '#';
+            memcpy(seg->spec + 2, spec_start + 1, spec_len - 1);
+            memcpy(seg->spec + spec_len + 1, "llx", 3);
+            break;
+        default:
+            goto err_unsupported;
+        }
+        seg->conv = conv;
+
+        if (f->num_args == OSD_STM_PRINTF_ARGS_MAX) {
+            err(ctx->log_ctx, "Format string \"%s\" has more than %d "
+                "arguments.\n", fmt, OSD_STM_PRINTF_ARGS_MAX);
+            fmt_entry_free(f);
+            return OSD_ERROR_FAILURE;
+        }
+        f->num_args++;
+        f->num_segments++;
+    }
+
+    *entry = f;
+    return OSD_OK;
+
+err_unsupported:
+    err(ctx->log_ctx, "Format string \"%s\" contains an unsupported "
+        "conversion.\n", fmt);
+    fmt_entry_free(f);
+    return OSD_ERROR_FAILURE;
+}
+
+API_EXPORT
+osd_result osd_stm_printf_new(struct osd_stm_printf **ctx,
+                              struct osd_log_ctx *log_ctx,
+                              osd_stm_printf_line_fn line_fn,
+                              void *line_fn_arg)
+{
+    assert(line_fn);
+
+    struct osd_stm_printf *c = calloc(1, sizeof(*c));
+    assert(c);
+
+    c->log_ctx = log_ctx;
+    c->line_fn = line_fn;
+    c->line_fn_arg = line_fn_arg;
+    id_map_init(&c->cores);
+    id_map_init(&c->formats);
+
+    *ctx = c;
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_stm_printf_set_format(struct osd_stm_printf *ctx,
+                                     uint32_t fmt_id, const char *fmt)
+{
+    osd_result rv;
+    assert(ctx);
+    assert(fmt);
+
+    struct fmt_entry *f;
+    rv = fmt_parse(ctx, fmt, &f);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+
+    // Replacing a format string which is still referenced by a pending print
+    // is not supported: formats are registered before tracing starts.
+    fmt_entry_free(id_map_get(&ctx->formats, fmt_id));
+    id_map_put(&ctx->formats, fmt_id, f);
+
+    return OSD_OK;
+}
+
+static void emit_line(struct osd_stm_printf *ctx, struct core_state *core)
+{
+    core->line[core->line_len] = '\0';
+    ctx->line_fn(ctx->line_fn_arg, core->stm_diaddr, core->line,
+                 core->line_len);
+    core->line_len = 0;
+}
+
+static void append_char(struct osd_stm_printf *ctx, struct core_state *core,
+                        char c)
+{
+    if (c == '\n') {
+        emit_line(ctx, core);
+        return;
+    }
+    if (c == '\r') {
+        return;
+    }
+    if (core->line_len == OSD_STM_PRINTF_LINE_MAX) {
+        emit_line(ctx, core);
+    }
+    core->line[core->line_len++] = c;
+}
+
+static void append_text(struct osd_stm_printf *ctx, struct core_state *core,
+                        const char *text, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        append_char(ctx, core, text[i]);
+    }
+}
+
+/**
+ * Render the pending formatted print of a core
+ *
+ * Missing arguments (if the next print started before all arguments were
+ * received) are printed as "?".
+ */
+static void render_fmt(struct osd_stm_printf *ctx, struct core_state *core)
+{
+    const struct fmt_entry *f = core->fmt;
+    unsigned int arg_idx = 0;
+
+    for (unsigned int i = 0; i < f->num_segments; i++) {
+        const struct fmt_segment *seg = &f->segments[i];
+        if (!seg->conv) {
+            append_text(ctx, core, seg->text, seg->text_len);
+            continue;
+        }
+
+        if (arg_idx >= core->num_args) {
+            append_char(ctx, core, '?');
+            continue;
+        }
+
+        uint64_t value = core->args[arg_idx];
+        if (seg->is_signed && core->args_width_bit[arg_idx] == 32) {
+            value = (uint64_t)(int64_t)(int32_t)value;
+        }
+        arg_idx++;
+
+        char buf[64];
+        int len;
+        if (seg->conv == 'c') {
+            len = snprintf(buf, sizeof(buf), seg->spec, (int)(char)value);
+        } else if (seg->is_signed) {
+            len = snprintf(buf, sizeof(buf), seg->spec, (long long)value);
+        } else {
+            len = snprintf(buf, sizeof(buf), seg->spec,
+                           (unsigned long long)value);
+        }
+        if (len > 0) {
+            append_text(ctx, core, buf,
+                        (size_t)len < sizeof(buf) ? (size_t)len
+                                                  : sizeof(buf) - 1);
+        }
+    }
+
+    core->fmt = NULL;
+    core->num_args = 0;
+}
+
+static struct core_state* get_core(struct osd_stm_printf *ctx,
+                                   uint16_t stm_diaddr)
+{
+    if (ctx->last_core && ctx->last_core->stm_diaddr == stm_diaddr) {
+        return ctx->last_core;
+    }
+
+    struct core_state *core = id_map_get(&ctx->cores, stm_diaddr);
+    if (!core) {
+        core = calloc(1, sizeof(*core));
+        assert(core);
+        core->stm_diaddr = stm_diaddr;
+        id_map_put(&ctx->cores, stm_diaddr, core);
+    }
+    ctx->last_core = core;
+    return core;
+}
+
+API_EXPORT
+osd_result osd_stm_printf_handle_event(struct osd_stm_printf *ctx,
+                                       const struct osd_stm_event *ev)
+{
+    assert(ctx);
+    assert(ev);
+
+    if (!OSD_STM_PRINTF_IS_PRINTF_EVENT(ev)) {
+        return OSD_OK;
+    }
+
+    struct core_state *core = get_core(ctx, ev->stm_diaddr);
+
+    switch (ev->id) {
+    case OSD_STM_ID_PUTCHAR:
+        if (core->fmt) {
+            render_fmt(ctx, core);
+        }
+        append_char(ctx, core, (char)ev->value);
+        break;
+
+    case OSD_STM_ID_PRINTF_FMT: {
+        if (core->fmt) {
+            render_fmt(ctx, core);
+        }
+
+        const struct fmt_entry *f = id_map_get(&ctx->formats, ev->value);
+        if (!f) {
+            char buf[48];
+            int len = snprintf(buf, sizeof(buf), "<unknown format 0x%"
+                               PRIx64 ">", ev->value);
+            append_text(ctx, core, buf, len);
+            break;
+        }
+        core->fmt = f;
+        core->num_args = 0;
+        if (f->num_args == 0) {
+            render_fmt(ctx, core);
+        }
+        break;
+    }
+
+    case OSD_STM_ID_PRINTF_ARG:
+        if (!core->fmt) {
+            dbg(ctx->log_ctx, "Ignoring printf argument without format "
+                "string from STM %u.\n", ev->stm_diaddr);
+            break;
+        }
+        core->args[core->num_args] = ev->value;
+        core->args_width_bit[core->num_args] = ev->value_width_bit;
+        core->num_args++;
+        if (core->num_args == core->fmt->num_args) {
+            render_fmt(ctx, core);
+        }
+        break;
+    }
+
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_stm_printf_flush(struct osd_stm_printf *ctx)
+{
+    assert(ctx);
+
+    size_t capacity = (size_t)1 << ctx->cores.capacity_log2;
+    for (size_t i = 0; i < capacity; i++) {
+        struct core_state *core = ctx->cores.values[i];
+        if (!core) {
+            continue;
+        }
+        if (core->fmt) {
+            render_fmt(ctx, core);
+        }
+        if (core->line_len > 0) {
+            emit_line(ctx, core);
+        }
+    }
+
+    return OSD_OK;
+}
+
+API_EXPORT
+void osd_stm_printf_free(struct osd_stm_printf **ctx_p)
+{
+    assert(ctx_p);
+    struct osd_stm_printf *ctx = *ctx_p;
+    if (!ctx) {
+        return;
+    }
+
+    size_t capacity = (size_t)1 << ctx->cores.capacity_log2;
+    for (size_t i = 0; i < capacity; i++) {
+        free(ctx->cores.values[i]);
+    }
+    free(ctx->cores.keys);
+    free(ctx->cores.values);
+
+    capacity = (size_t)1 << ctx->formats.capacity_log2;
+    for (size_t i = 0; i < capacity; i++) {
+        fmt_entry_free(ctx->formats.values[i]);
+    }
+    free(ctx->formats.keys);
+    free(ctx->formats.values);
+
+    free(ctx);
+    *ctx_p = NULL;
+}
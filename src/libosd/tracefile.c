@@ -0,0 +1,1524 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#include <osd/osd.h>
+#include <osd/tracefile.h>
+#include "osd-private.h"
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBLZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+/** zstd compression level: favor speed, traces compress well anyway */
+#define ZSTD_COMPRESSION_LEVEL 1
+
+static const char TRACEFILE_MAGIC[8] = "OSDTRACE";
+static const char TRACEFILE_INDEX_MAGIC[8] = "OSDINDEX";
+
+/**
+ * Oldest version of the file format which can be read
+ *
+ * Version 1 files store the packet records without blocks.
+ */
+#define TRACEFILE_VERSION_MIN 2
+
+/**
+ * File header (little endian)
+ */
+struct tracefile_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint16_t system_vendor_id;
+    uint16_t system_device_id;
+    uint16_t module_addr;
+    uint16_t module_vendor;
+    uint16_t module_type;
+    uint16_t module_version;
+    uint64_t start_time_realtime_ns;
+    uint64_t start_time_monotonic_ns;
+    uint8_t compression; //!< enum osd_tracefile_compression
+    uint8_t reserved[19];
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct tracefile_header) == 64,
+               "unexpected trace file header size");
+
+/**
+ * Header of a block of records (little endian)
+ *
+ * The packet records following the file header are grouped into blocks.
+ * Each block is compressed independently, and the first record in each block
+ * carries an absolute timestamp. A block can therefore be decoded without
+ * reading any preceding block.
+ */
+struct tracefile_block_header {
+    /** size of the block data following this header in the file */
+    uint32_t data_size;
+    /** size of the block data after decompression */
+    uint32_t uncompressed_size;
+    /** number of packet records in the block */
+    uint32_t packet_count;
+    /** BLOCK_FLAG_* (0 in version 2 files) */
+    uint32_t flags;
+    /** timestamp of the first packet in the block */
+    uint64_t first_timestamp_ns;
+} __attribute__((packed));
+
+/**
+ * Block flag: the block holds the block index instead of packet records
+ *
+ * The index block is the last block in the file. Its data consists of one
+ * struct tracefile_index_entry per packet block, followed by a struct
+ * tracefile_index_footer. It is never compressed.
+ */
+#define BLOCK_FLAG_INDEX 0x1
+
+/**
+ * Entry of the block index (little endian in the file)
+ */
+struct tracefile_index_entry {
+    /** offset of the block header in the file */
+    uint64_t offset;
+    /** timestamp of the first packet in the block */
+    uint64_t first_timestamp_ns;
+    /** number of the first packet in the block (counting from 0) */
+    uint64_t first_packet;
+};
+
+_Static_assert(sizeof(struct tracefile_index_entry) == 24,
+               "unexpected trace file index entry size");
+
+/**
+ * Footer at the very end of the index block (little endian)
+ *
+ * The footer allows readers to locate the index without scanning the file.
+ */
+struct tracefile_index_footer {
+    /** offset of the header of the index block in the file */
+    uint64_t index_offset;
+    char magic[8];
+} __attribute__((packed));
+
+/**
+ * Record flag: the record header is followed by a 64 bit absolute timestamp
+ * instead of using the 32 bit delta to the previous record.
+ */
+#define RECORD_FLAG_ABS_TIMESTAMP 0x1
+
+/**
+ * Header of a single packet record (little endian)
+ *
+ * The record header is followed by an optional 64 bit absolute timestamp
+ * (if RECORD_FLAG_ABS_TIMESTAMP is set) and size_words 16 bit packet words.
+ */
+struct tracefile_record {
+    uint16_t size_words;
+    uint16_t flags;
+    uint32_t timestamp_delta_ns;
+} __attribute__((packed));
+
+/** Size of the largest possible record */
+#define RECORD_SIZE_MAX (sizeof(struct tracefile_record) + sizeof(uint64_t) \
+                         + UINT16_MAX * sizeof(uint16_t))
+
+/**
+ * A write buffer, holding one block
+ *
+ * The first bytes of |data| are reserved for the block header.
+ */
+struct tracefile_buf {
+    char *data;
+    size_t fill;
+    uint32_t packet_count;
+    uint64_t first_timestamp_ns;
+};
+
+struct osd_tracefile_writer {
+    struct osd_log_ctx *log_ctx;
+    int fd;
+
+    enum osd_tracefile_compression compression;
+    /** Output buffer for compressed blocks (including the block header) */
+    char *cbuf;
+    size_t cbuf_size;
+#ifdef HAVE_LIBZSTD
+    ZSTD_CCtx *zstd_cctx;
+#endif
+
+    /** Size of each write buffer in bytes */
+    size_t buf_size;
+    /** Buffer currently filled by osd_tracefile_writer_add() */
+    struct tracefile_buf *active;
+
+    uint64_t last_timestamp_ns;
+    /** Packets are currently dropped because all buffers are full */
+    bool dropping;
+
+    /** Minimum time between two calls to fdatasync() (0: never sync) */
+    uint64_t sync_interval_ns;
+    uint64_t last_sync_ns;
+
+    /**
+     * Statistics. Counters are written by a single thread and read with
+     * relaxed atomics.
+     */
+    uint64_t packets_written;
+    uint64_t packets_dropped;
+    uint64_t buffer_overflows;
+    uint64_t bytes_written;
+    uint64_t bytes_uncompressed;
+    uint64_t syncs;
+    struct osd_histogram write_time_ns;
+    struct osd_histogram compress_time_ns;
+
+    /**
+     * Index of all written blocks, appended to the file when it is closed.
+     * Only accessed by the thread writing the blocks.
+     */
+    struct tracefile_index_entry *index;
+    size_t index_len;
+    size_t index_alloc_len;
+    /** Current size of the file */
+    uint64_t file_size;
+    /** Number of packets in all written blocks */
+    uint64_t file_packet_count;
+
+    /** Write buffers are written by a separate writer thread */
+    bool async;
+
+    /*
+     * The remaining fields are only used for asynchronous writing. All
+     * buffers except for |active| are either free or queued for writing
+     * (full), access to them is protected by |lock|.
+     */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    /** Signalled when a buffer is queued for writing, or on shutdown */
+    pthread_cond_t cond_full;
+    /** Signalled when the writer thread returns a buffer */
+    pthread_cond_t cond_free;
+
+    unsigned int num_bufs;
+    struct tracefile_buf bufs[OSD_TRACEFILE_BUFFERS_MAX];
+    struct tracefile_buf *free_bufs[OSD_TRACEFILE_BUFFERS_MAX];
+    unsigned int free_count;
+    struct tracefile_buf *full_bufs[OSD_TRACEFILE_BUFFERS_MAX];
+    unsigned int full_head;
+    unsigned int full_count;
+    /** The writer thread is currently writing a buffer */
+    bool writing;
+    /** Stop the writer thread */
+    bool stop;
+    /** First error returned from a write in the writer thread */
+    osd_result write_rv;
+};
+
+struct osd_tracefile_reader {
+    struct osd_log_ctx *log_ctx;
+
+    /** The whole file, mapped into memory */
+    const char *map;
+    size_t map_size;
+
+    struct osd_tracefile_meta meta;
+    enum osd_tracefile_compression compression;
+
+    /** Index of all packet blocks (in host byte order) */
+    struct tracefile_index_entry *index;
+    size_t index_len;
+    /** Total number of packets in the file */
+    uint64_t packet_count;
+
+    /** Index of the block to be read next */
+    size_t next_block;
+
+    /**
+     * Uncompressed data of the current block. Points into the mapped file
+     * for uncompressed files, and to |dbuf| otherwise.
+     */
+    const char *block;
+    size_t block_len;
+    size_t block_pos;
+
+    /** Buffer for decompressed blocks */
+    char *dbuf;
+    size_t dbuf_alloc_size;
+
+    /** Number of the packet returned by the next osd_tracefile_reader_next() */
+    uint64_t next_packet;
+    uint64_t last_timestamp_ns;
+};
+
+API_EXPORT
+bool osd_tracefile_compression_supported(enum osd_tracefile_compression compression)
+{
+    switch (compression) {
+    case OSD_TRACEFILE_COMPRESSION_NONE:
+        return true;
+#ifdef HAVE_LIBLZ4
+    case OSD_TRACEFILE_COMPRESSION_LZ4:
+        return true;
+#endif
+#ifdef HAVE_LIBZSTD
+    case OSD_TRACEFILE_COMPRESSION_ZSTD:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+static uint64_t clock_realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void counter_add(uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static void buf_reset(struct tracefile_buf *buf)
+{
+    buf->fill = sizeof(struct tracefile_block_header);
+    buf->packet_count = 0;
+    buf->first_timestamp_ns = 0;
+}
+
+/**
+ * Write the full buffer |buf| of |len| bytes to the file
+ */
+static osd_result write_all(struct osd_tracefile_writer *w,
+                            const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t rv = write(w->fd, buf, len);
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err(w->log_ctx, "Unable to write to trace file: %s (%d)\n",
+                strerror(errno), errno);
+            return OSD_ERROR_FAILURE;
+        }
+        buf += rv;
+        len -= rv;
+    }
+    return OSD_OK;
+}
+
+/**
+ * Compress a block
+ *
+ * @param w the writer
+ * @param src uncompressed block data
+ * @param src_size size of |src| in bytes
+ * @param dst output buffer
+ * @param dst_capacity size of |dst| in bytes
+ * @param[out] dst_size size of the compressed data
+ */
+static osd_result compress_block(struct osd_tracefile_writer *w,
+                                 const char *src, size_t src_size,
+                                 char *dst, size_t dst_capacity,
+                                 size_t *dst_size)
+{
+    switch (w->compression) {
+#ifdef HAVE_LIBLZ4
+    case OSD_TRACEFILE_COMPRESSION_LZ4: {
+        int rv = LZ4_compress_default(src, dst, src_size, dst_capacity);
+        if (rv <= 0) {
+            err(w->log_ctx, "LZ4 compression failed.\n");
+            return OSD_ERROR_FAILURE;
+        }
+        *dst_size = rv;
+        return OSD_OK;
+    }
+#endif
+#ifdef HAVE_LIBZSTD
+    case OSD_TRACEFILE_COMPRESSION_ZSTD: {
+        size_t rv = ZSTD_compressCCtx(w->zstd_cctx, dst, dst_capacity,
+                                      src, src_size, ZSTD_COMPRESSION_LEVEL);
+        if (ZSTD_isError(rv)) {
+            err(w->log_ctx, "zstd compression failed: %s\n",
+                ZSTD_getErrorName(rv));
+            return OSD_ERROR_FAILURE;
+        }
+        *dst_size = rv;
+        return OSD_OK;
+    }
+#endif
+    default:
+        assert(0 && "unsupported compression");
+        return OSD_ERROR_FAILURE;
+    }
+}
+
+/**
+ * Compress (if enabled) and write a buffer as block to the file
+ *
+ * Called from the writer thread for asynchronous writers, and from the
+ * calling thread otherwise.
+ */
+static osd_result write_block(struct osd_tracefile_writer *w,
+                              struct tracefile_buf *buf)
+{
+    osd_result rv;
+    const size_t hdr_size = sizeof(struct tracefile_block_header);
+    size_t uncompressed_size = buf->fill - hdr_size;
+
+    uint64_t start_ns = osd_clock_monotonic_ns();
+
+    char *block = buf->data;
+    size_t data_size = uncompressed_size;
+    if (w->compression != OSD_TRACEFILE_COMPRESSION_NONE) {
+        rv = compress_block(w, buf->data + hdr_size, uncompressed_size,
+                            w->cbuf + hdr_size, w->cbuf_size - hdr_size,
+                            &data_size);
+        if (OSD_FAILED(rv)) {
+            return rv;
+        }
+        block = w->cbuf;
+
+        uint64_t compressed_ns = osd_clock_monotonic_ns();
+        osd_histogram_record(&w->compress_time_ns, compressed_ns - start_ns);
+        start_ns = compressed_ns;
+    }
+
+    struct tracefile_block_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.data_size = htole32(data_size);
+    hdr.uncompressed_size = htole32(uncompressed_size);
+    hdr.packet_count = htole32(buf->packet_count);
+    hdr.first_timestamp_ns = htole64(buf->first_timestamp_ns);
+    memcpy(block, &hdr, hdr_size);
+
+    rv = write_all(w, block, hdr_size + data_size);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+
+    if (w->index_len == w->index_alloc_len) {
+        w->index_alloc_len = w->index_alloc_len ? 2 * w->index_alloc_len : 64;
+        w->index = realloc(w->index, w->index_alloc_len
+                                     * sizeof(struct tracefile_index_entry));
+        assert(w->index);
+    }
+    struct tracefile_index_entry *entry = &w->index[w->index_len++];
+    entry->offset = w->file_size;
+    entry->first_timestamp_ns = buf->first_timestamp_ns;
+    entry->first_packet = w->file_packet_count;
+    w->file_size += hdr_size + data_size;
+    w->file_packet_count += buf->packet_count;
+
+    uint64_t now_ns = osd_clock_monotonic_ns();
+    if (w->sync_interval_ns &&
+        now_ns - w->last_sync_ns >= w->sync_interval_ns) {
+        if (fdatasync(w->fd) != 0) {
+            err(w->log_ctx, "Unable to sync trace file: %s (%d)\n",
+                strerror(errno), errno);
+            return OSD_ERROR_FAILURE;
+        }
+        now_ns = osd_clock_monotonic_ns();
+        w->last_sync_ns = now_ns;
+        counter_add(&w->syncs, 1);
+    }
+
+    osd_histogram_record(&w->write_time_ns, now_ns - start_ns);
+    counter_add(&w->bytes_written, hdr_size + data_size);
+    counter_add(&w->bytes_uncompressed, hdr_size + uncompressed_size);
+
+    return OSD_OK;
+}
+
+/**
+ * Writer thread: write all queued buffers to disk
+ */
+static void* writer_thread_main(void *arg)
+{
+    struct osd_tracefile_writer *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        while (w->full_count == 0 && !w->stop) {
+            pthread_cond_wait(&w->cond_full, &w->lock);
+        }
+        if (w->full_count == 0) {
+            break;
+        }
+
+        struct tracefile_buf *buf = w->full_bufs[w->full_head];
+        w->full_head = (w->full_head + 1) % w->num_bufs;
+        w->full_count--;
+        w->writing = true;
+        osd_result rv = w->write_rv;
+        pthread_mutex_unlock(&w->lock);
+
+        // after a write error the remaining data is discarded
+        if (OSD_SUCCEEDED(rv)) {
+            rv = write_block(w, buf);
+        }
+        buf_reset(buf);
+
+        pthread_mutex_lock(&w->lock);
+        if (OSD_FAILED(rv) && OSD_SUCCEEDED(w->write_rv)) {
+            w->write_rv = rv;
+        }
+        w->free_bufs[w->free_count++] = buf;
+        w->writing = false;
+        pthread_cond_broadcast(&w->cond_free);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+/**
+ * Queue the active buffer for writing and replace it with a free buffer
+ *
+ * Must be called with |w->lock| held.
+ *
+ * @return true if the active buffer was replaced, false if no free buffer
+ *         was available
+ */
+static bool swap_active_buf_locked(struct osd_tracefile_writer *w)
+{
+    if (w->free_count == 0) {
+        return false;
+    }
+
+    unsigned int tail = (w->full_head + w->full_count) % w->num_bufs;
+    w->full_bufs[tail] = w->active;
+    w->full_count++;
+    w->active = w->free_bufs[--w->free_count];
+    pthread_cond_signal(&w->cond_full);
+
+    return true;
+}
+
+/**
+ * Size of the output buffer needed to compress a block of |size| bytes
+ */
+static size_t compress_bound(enum osd_tracefile_compression compression,
+                             size_t size)
+{
+    switch (compression) {
+#ifdef HAVE_LIBLZ4
+    case OSD_TRACEFILE_COMPRESSION_LZ4:
+        return LZ4_compressBound(size);
+#endif
+#ifdef HAVE_LIBZSTD
+    case OSD_TRACEFILE_COMPRESSION_ZSTD:
+        return ZSTD_compressBound(size);
+#endif
+    default:
+        return 0;
+    }
+}
+
+static void writer_free_buffers(struct osd_tracefile_writer *w)
+{
+    for (unsigned int i = 0; i < w->num_bufs; i++) {
+        free(w->bufs[i].data);
+    }
+    free(w->cbuf);
+    free(w->index);
+#ifdef HAVE_LIBZSTD
+    ZSTD_freeCCtx(w->zstd_cctx);
+#endif
+}
+
+/**
+ * Append the block index to the file
+ *
+ * Called when closing the file, after all blocks have been written.
+ */
+static osd_result write_index(struct osd_tracefile_writer *w)
+{
+    size_t entries_size = w->index_len * sizeof(struct tracefile_index_entry);
+    size_t data_size = entries_size + sizeof(struct tracefile_index_footer);
+    size_t size = sizeof(struct tracefile_block_header) + data_size;
+
+    char *block = malloc(size);
+    assert(block);
+    char *p = block;
+
+    struct tracefile_block_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.data_size = htole32(data_size);
+    hdr.uncompressed_size = htole32(data_size);
+    hdr.flags = htole32(BLOCK_FLAG_INDEX);
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+
+    for (size_t i = 0; i < w->index_len; i++) {
+        struct tracefile_index_entry entry;
+        entry.offset = htole64(w->index[i].offset);
+        entry.first_timestamp_ns = htole64(w->index[i].first_timestamp_ns);
+        entry.first_packet = htole64(w->index[i].first_packet);
+        memcpy(p, &entry, sizeof(entry));
+        p += sizeof(entry);
+    }
+
+    struct tracefile_index_footer footer;
+    footer.index_offset = htole64(w->file_size);
+    memcpy(footer.magic, TRACEFILE_INDEX_MAGIC, sizeof(footer.magic));
+    memcpy(p, &footer, sizeof(footer));
+
+    osd_result rv = write_all(w, block, size);
+    free(block);
+    return rv;
+}
+
+static osd_result writer_new(struct osd_tracefile_writer **writer,
+                             struct osd_log_ctx *log_ctx,
+                             const char *path,
+                             const struct osd_tracefile_meta *meta,
+                             unsigned int num_buffers, size_t buffer_size,
+                             unsigned int sync_interval_ms,
+                             enum osd_tracefile_compression compression)
+{
+    osd_result rv;
+
+    assert(path);
+    assert(meta);
+    assert(num_buffers <= OSD_TRACEFILE_BUFFERS_MAX);
+
+    if (!osd_tracefile_compression_supported(compression)) {
+        err(log_ctx, "Trace file compression %d is not supported by this "
+            "build of libosd.\n", compression);
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct osd_tracefile_writer *w = calloc(1, sizeof(*w));
+    assert(w);
+    w->log_ctx = log_ctx;
+    w->async = (num_buffers > 0);
+    w->num_bufs = w->async ? num_buffers : 1;
+    w->buf_size = buffer_size;
+    w->sync_interval_ns = (uint64_t)sync_interval_ms * 1000 * 1000;
+    w->compression = compression;
+    osd_histogram_reset(&w->write_time_ns);
+    osd_histogram_reset(&w->compress_time_ns);
+
+    // a buffer must be able to hold the block header and the largest record
+    assert(w->buf_size >= sizeof(struct tracefile_block_header)
+           + RECORD_SIZE_MAX);
+
+    for (unsigned int i = 0; i < w->num_bufs; i++) {
+        w->bufs[i].data = malloc(w->buf_size);
+        assert(w->bufs[i].data);
+        buf_reset(&w->bufs[i]);
+    }
+    w->active = &w->bufs[0];
+    for (unsigned int i = 1; i < w->num_bufs; i++) {
+        w->free_bufs[w->free_count++] = &w->bufs[i];
+    }
+
+    if (compression != OSD_TRACEFILE_COMPRESSION_NONE) {
+        w->cbuf_size = sizeof(struct tracefile_block_header)
+                       + compress_bound(compression, w->buf_size);
+        w->cbuf = malloc(w->cbuf_size);
+        assert(w->cbuf);
+    }
+#ifdef HAVE_LIBZSTD
+    if (compression == OSD_TRACEFILE_COMPRESSION_ZSTD) {
+        w->zstd_cctx = ZSTD_createCCtx();
+        assert(w->zstd_cctx);
+    }
+#endif
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        err(log_ctx, "Unable to open trace file %s: %s (%d)\n", path,
+            strerror(errno), errno);
+        rv = OSD_ERROR_FAILURE;
+        goto free_return;
+    }
+    w->last_sync_ns = osd_clock_monotonic_ns();
+
+    struct tracefile_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACEFILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = htole32(OSD_TRACEFILE_VERSION);
+    hdr.header_size = htole32(sizeof(hdr));
+    hdr.system_vendor_id = htole16(meta->system_vendor_id);
+    hdr.system_device_id = htole16(meta->system_device_id);
+    hdr.module_addr = htole16(meta->module.addr);
+    hdr.module_vendor = htole16(meta->module.vendor);
+    hdr.module_type = htole16(meta->module.type);
+    hdr.module_version = htole16(meta->module.version);
+    hdr.start_time_realtime_ns = htole64(clock_realtime_ns());
+    hdr.start_time_monotonic_ns = htole64(osd_clock_monotonic_ns());
+    hdr.compression = compression;
+
+    rv = write_all(w, (const char*)&hdr, sizeof(hdr));
+    if (OSD_FAILED(rv)) {
+        close(w->fd);
+        goto free_return;
+    }
+    w->file_size = sizeof(hdr);
+
+    if (w->async) {
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond_full, NULL);
+        pthread_cond_init(&w->cond_free, NULL);
+
+        int prv = pthread_create(&w->thread, NULL, writer_thread_main, w);
+        if (prv != 0) {
+            err(log_ctx, "Unable to create trace file writer thread: %s\n",
+                strerror(prv));
+            pthread_cond_destroy(&w->cond_free);
+            pthread_cond_destroy(&w->cond_full);
+            pthread_mutex_destroy(&w->lock);
+            close(w->fd);
+            unlink(path);
+            rv = OSD_ERROR_FAILURE;
+            goto free_return;
+        }
+    }
+
+    *writer = w;
+    return OSD_OK;
+
+free_return:
+    writer_free_buffers(w);
+    free(w);
+    return rv;
+}
+
+API_EXPORT
+osd_result osd_tracefile_writer_new(struct osd_tracefile_writer **writer,
+                                    struct osd_log_ctx *log_ctx,
+                                    const char *path,
+                                    const struct osd_tracefile_meta *meta)
+{
+    return writer_new(writer, log_ctx, path, meta, 0,
+                      OSD_TRACEFILE_BUFFER_SIZE_DEFAULT, 0,
+                      OSD_TRACEFILE_COMPRESSION_NONE);
+}
+
+API_EXPORT
+osd_result osd_tracefile_writer_new_async(struct osd_tracefile_writer **writer,
+                                          struct osd_log_ctx *log_ctx,
+                                          const char *path,
+                                          const struct osd_tracefile_meta *meta,
+                                          unsigned int num_buffers,
+                                          size_t buffer_size,
+                                          unsigned int sync_interval_ms,
+                                          enum osd_tracefile_compression compression)
+{
+    assert(num_buffers >= 2);
+    if (buffer_size == 0) {
+        buffer_size = OSD_TRACEFILE_BUFFER_SIZE_DEFAULT;
+    }
+    return writer_new(writer, log_ctx, path, meta, num_buffers, buffer_size,
+                      sync_interval_ms, compression);
+}
+
+API_EXPORT
+osd_result osd_tracefile_writer_add(struct osd_tracefile_writer *writer,
+                                    const struct osd_packet *packet,
+                                    uint64_t timestamp_ns)
+{
+    osd_result rv;
+
+    assert(writer);
+    assert(packet);
+
+    size_t data_size_bytes = packet->data_size_words * sizeof(uint16_t);
+    size_t record_size = sizeof(struct tracefile_record) + sizeof(uint64_t)
+                         + data_size_bytes;
+
+    if (writer->active->fill + record_size > writer->buf_size) {
+        if (writer->async) {
+            // Never wait for the writer thread: if all buffers are still
+            // waiting to be written, drop the packet.
+            pthread_mutex_lock(&writer->lock);
+            bool swapped = swap_active_buf_locked(writer);
+            pthread_mutex_unlock(&writer->lock);
+            if (!swapped) {
+                if (!writer->dropping) {
+                    writer->dropping = true;
+                    counter_add(&writer->buffer_overflows, 1);
+                }
+                counter_add(&writer->packets_dropped, 1);
+                return OSD_OK;
+            }
+            writer->dropping = false;
+        } else {
+            rv = osd_tracefile_writer_flush(writer);
+            if (OSD_FAILED(rv)) {
+                return rv;
+            }
+        }
+    }
+
+    struct tracefile_buf *buf = writer->active;
+    char *p = buf->data + buf->fill;
+
+    struct tracefile_record rec;
+    rec.size_words = htole16(packet->data_size_words);
+    rec.flags = 0;
+    rec.timestamp_delta_ns = 0;
+
+    // Timestamps are stored as delta to the previous record. The first
+    // record in a block, and records which are too far apart (or out of
+    // order), carry an absolute timestamp.
+    uint64_t delta = timestamp_ns - writer->last_timestamp_ns;
+    if (buf->packet_count == 0
+        || timestamp_ns < writer->last_timestamp_ns || delta > UINT32_MAX) {
+        rec.flags = htole16(RECORD_FLAG_ABS_TIMESTAMP);
+        memcpy(p, &rec, sizeof(rec));
+        p += sizeof(rec);
+
+        uint64_t ts_le = htole64(timestamp_ns);
+        memcpy(p, &ts_le, sizeof(ts_le));
+        p += sizeof(ts_le);
+    } else {
+        rec.timestamp_delta_ns = htole32((uint32_t)delta);
+        memcpy(p, &rec, sizeof(rec));
+        p += sizeof(rec);
+    }
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    memcpy(p, packet->data_raw, data_size_bytes);
+    p += data_size_bytes;
+#else
+    for (unsigned int i = 0; i < packet->data_size_words; i++) {
+        uint16_t word_le = htole16(packet->data_raw[i]);
+        memcpy(p, &word_le, sizeof(word_le));
+        p += sizeof(word_le);
+    }
+#endif
+
+    if (buf->packet_count == 0) {
+        buf->first_timestamp_ns = timestamp_ns;
+    }
+    buf->packet_count++;
+    buf->fill = p - buf->data;
+    writer->last_timestamp_ns = timestamp_ns;
+    counter_add(&writer->packets_written, 1);
+
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_tracefile_writer_flush(struct osd_tracefile_writer *writer)
+{
+    assert(writer);
+
+    if (!writer->async) {
+        if (writer->active->packet_count == 0) {
+            return OSD_OK;
+        }
+        osd_result rv = write_block(writer, writer->active);
+        buf_reset(writer->active);
+        return rv;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    if (writer->active->packet_count > 0) {
+        while (writer->free_count == 0) {
+            pthread_cond_wait(&writer->cond_free, &writer->lock);
+        }
+        bool swapped = swap_active_buf_locked(writer);
+        assert(swapped);
+    }
+    while (writer->full_count > 0 || writer->writing) {
+        pthread_cond_wait(&writer->cond_free, &writer->lock);
+    }
+    osd_result rv = writer->write_rv;
+    pthread_mutex_unlock(&writer->lock);
+
+    return rv;
+}
+
+API_EXPORT
+uint64_t osd_tracefile_writer_get_packet_count(struct osd_tracefile_writer *writer)
+{
+    assert(writer);
+    return __atomic_load_n(&writer->packets_written, __ATOMIC_RELAXED);
+}
+
+API_EXPORT
+void osd_tracefile_writer_get_stats(struct osd_tracefile_writer *writer,
+                                    struct osd_tracefile_writer_stats *stats)
+{
+    assert(writer);
+    assert(stats);
+
+    stats->packets_written = __atomic_load_n(&writer->packets_written,
+                                             __ATOMIC_RELAXED);
+    stats->packets_dropped = __atomic_load_n(&writer->packets_dropped,
+                                             __ATOMIC_RELAXED);
+    stats->buffer_overflows = __atomic_load_n(&writer->buffer_overflows,
+                                              __ATOMIC_RELAXED);
+    stats->bytes_written = __atomic_load_n(&writer->bytes_written,
+                                           __ATOMIC_RELAXED);
+    stats->bytes_uncompressed = __atomic_load_n(&writer->bytes_uncompressed,
+                                                __ATOMIC_RELAXED);
+    stats->syncs = __atomic_load_n(&writer->syncs, __ATOMIC_RELAXED);
+    osd_histogram_copy(&stats->write_time_ns, &writer->write_time_ns);
+    osd_histogram_copy(&stats->compress_time_ns, &writer->compress_time_ns);
+}
+
+API_EXPORT
+void osd_tracefile_writer_free(struct osd_tracefile_writer **writer_p)
+{
+    assert(writer_p);
+    struct osd_tracefile_writer *writer = *writer_p;
+    if (!writer) {
+        return;
+    }
+
+    osd_tracefile_writer_flush(writer);
+
+    if (writer->async) {
+        pthread_mutex_lock(&writer->lock);
+        writer->stop = true;
+        pthread_cond_signal(&writer->cond_full);
+        pthread_mutex_unlock(&writer->lock);
+        pthread_join(writer->thread, NULL);
+
+        pthread_cond_destroy(&writer->cond_free);
+        pthread_cond_destroy(&writer->cond_full);
+        pthread_mutex_destroy(&writer->lock);
+    }
+
+    if (writer->packets_dropped) {
+        err(writer->log_ctx, "Dropped %" PRIu64 " packets in %" PRIu64
+            " buffer overflows while writing the trace file.\n",
+            writer->packets_dropped, writer->buffer_overflows);
+    }
+
+    // without the index, readers fall back to scanning the file
+    if (OSD_FAILED(write_index(writer))) {
+        err(writer->log_ctx, "Unable to write the trace file index.\n");
+    }
+
+    if (close(writer->fd) != 0) {
+        err(writer->log_ctx, "Unable to close trace file: %s (%d)\n",
+            strerror(errno), errno);
+    }
+
+    writer_free_buffers(writer);
+    free(writer);
+    *writer_p = NULL;
+}
+
+/**
+ * Load the block index from the end of the file
+ *
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if the file has no (valid)
+ *         index
+ */
+static osd_result load_index(struct osd_tracefile_reader *r,
+                             size_t data_offset)
+{
+    struct tracefile_index_footer footer;
+    if (r->map_size < data_offset + sizeof(struct tracefile_block_header)
+                      + sizeof(footer)) {
+        return OSD_ERROR_FAILURE;
+    }
+    memcpy(&footer, r->map + r->map_size - sizeof(footer), sizeof(footer));
+    if (memcmp(footer.magic, TRACEFILE_INDEX_MAGIC, sizeof(footer.magic))) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    uint64_t index_offset = le64toh(footer.index_offset);
+    struct tracefile_block_header hdr;
+    if (index_offset < data_offset ||
+        index_offset > r->map_size - sizeof(hdr) - sizeof(footer)) {
+        return OSD_ERROR_FAILURE;
+    }
+    memcpy(&hdr, r->map + index_offset, sizeof(hdr));
+    size_t data_size = le32toh(hdr.data_size);
+    if (!(le32toh(hdr.flags) & BLOCK_FLAG_INDEX) ||
+        index_offset + sizeof(hdr) + data_size != r->map_size ||
+        data_size < sizeof(footer) ||
+        (data_size - sizeof(footer)) % sizeof(struct tracefile_index_entry)) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    size_t len = (data_size - sizeof(footer))
+                 / sizeof(struct tracefile_index_entry);
+    struct tracefile_index_entry *index =
+        calloc(len ? len : 1, sizeof(struct tracefile_index_entry));
+    assert(index);
+
+    const char *p = r->map + index_offset + sizeof(hdr);
+    uint64_t packet_count = 0;
+    for (size_t i = 0; i < len; i++) {
+        struct tracefile_index_entry entry;
+        memcpy(&entry, p + i * sizeof(entry), sizeof(entry));
+        index[i].offset = le64toh(entry.offset);
+        index[i].first_timestamp_ns = le64toh(entry.first_timestamp_ns);
+        index[i].first_packet = le64toh(entry.first_packet);
+
+        // blocks are in file order, and each one lies before the index
+        uint64_t min_offset = i ? index[i - 1].offset + sizeof(hdr)
+                                : data_offset;
+        if (index[i].offset < min_offset ||
+            index[i].offset > index_offset - sizeof(hdr) ||
+            index[i].first_packet < packet_count) {
+            free(index);
+            return OSD_ERROR_FAILURE;
+        }
+        packet_count = index[i].first_packet;
+    }
+
+    if (len > 0) {
+        // the packet count of the last block is only in its header
+        memcpy(&hdr, r->map + index[len - 1].offset, sizeof(hdr));
+        packet_count += le32toh(hdr.packet_count);
+    }
+
+    r->index = index;
+    r->index_len = len;
+    r->packet_count = packet_count;
+    return OSD_OK;
+}
+
+/**
+ * Build the block index by walking over all block headers
+ *
+ * Used for files without an index, e.g. if the writer did not close the file
+ * properly. Only the block headers are read, not the block data.
+ */
+static void scan_index(struct osd_tracefile_reader *r, size_t data_offset)
+{
+    size_t alloc_len = 64;
+    r->index = malloc(alloc_len * sizeof(struct tracefile_index_entry));
+    assert(r->index);
+    r->index_len = 0;
+    r->packet_count = 0;
+
+    size_t pos = data_offset;
+    struct tracefile_block_header hdr;
+    while (pos + sizeof(hdr) <= r->map_size) {
+        memcpy(&hdr, r->map + pos, sizeof(hdr));
+        if (le32toh(hdr.flags) & BLOCK_FLAG_INDEX) {
+            break;
+        }
+        size_t data_size = le32toh(hdr.data_size);
+        if (pos + sizeof(hdr) + data_size > r->map_size) {
+            err(r->log_ctx, "Trace file is truncated, ignoring the last "
+                "block.\n");
+            break;
+        }
+
+        if (r->index_len == alloc_len) {
+            alloc_len *= 2;
+            r->index = realloc(r->index, alloc_len
+                                         * sizeof(struct tracefile_index_entry));
+            assert(r->index);
+        }
+        struct tracefile_index_entry *entry = &r->index[r->index_len++];
+        entry->offset = pos;
+        entry->first_timestamp_ns = le64toh(hdr.first_timestamp_ns);
+        entry->first_packet = r->packet_count;
+
+        r->packet_count += le32toh(hdr.packet_count);
+        pos += sizeof(hdr) + data_size;
+    }
+    if (pos + sizeof(hdr) > r->map_size && pos != r->map_size) {
+        err(r->log_ctx, "Trace file is truncated, ignoring the last "
+            "block.\n");
+    }
+}
+
+API_EXPORT
+osd_result osd_tracefile_reader_new(struct osd_tracefile_reader **reader,
+                                    struct osd_log_ctx *log_ctx,
+                                    const char *path)
+{
+    osd_result rv;
+
+    assert(path);
+
+    struct osd_tracefile_reader *r = calloc(1, sizeof(*r));
+    assert(r);
+    r->log_ctx = log_ctx;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        err(log_ctx, "Unable to open trace file %s: %s (%d)\n", path,
+            strerror(errno), errno);
+        rv = OSD_ERROR_FAILURE;
+        goto free_return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        err(log_ctx, "Unable to stat trace file %s: %s (%d)\n", path,
+            strerror(errno), errno);
+        close(fd);
+        rv = OSD_ERROR_FAILURE;
+        goto free_return;
+    }
+
+    struct tracefile_header hdr;
+    if ((size_t)st.st_size < sizeof(hdr)) {
+        err(log_ctx, "%s is not an OSD trace file.\n", path);
+        close(fd);
+        rv = OSD_ERROR_FAILURE;
+        goto free_return;
+    }
+
+    // The file is mapped instead of read: opening even huge files is cheap,
+    // and only the parts which are actually read are loaded from the disk.
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        err(log_ctx, "Unable to map trace file %s: %s (%d)\n", path,
+            strerror(errno), errno);
+        rv = OSD_ERROR_FAILURE;
+        goto free_return;
+    }
+    r->map = map;
+    r->map_size = st.st_size;
+
+    memcpy(&hdr, r->map, sizeof(hdr));
+    if (memcmp(hdr.magic, TRACEFILE_MAGIC, sizeof(hdr.magic)) != 0) {
+        err(log_ctx, "%s is not an OSD trace file.\n", path);
+        rv = OSD_ERROR_FAILURE;
+        goto free_return;
+    }
+    uint32_t version = le32toh(hdr.version);
+    if (version < TRACEFILE_VERSION_MIN || version > OSD_TRACEFILE_VERSION) {
+        err(log_ctx, "Unsupported trace file version %u in %s.\n",
+            version, path);
+        rv = OSD_ERROR_FAILURE;
+        goto free_return;
+    }
+
+    // skip header fields added in later revisions of the format
+    uint32_t header_size = le32toh(hdr.header_size);
+    if (header_size < sizeof(hdr) || header_size > r->map_size) {
+        err(log_ctx, "Invalid header in trace file %s.\n", path);
+        rv = OSD_ERROR_FAILURE;
+        goto free_return;
+    }
+
+    r->compression = hdr.compression;
+    if (!osd_tracefile_compression_supported(r->compression)) {
+        err(log_ctx, "Trace file %s uses compression %d, which is not "
+            "supported by this build of libosd.\n", path, r->compression);
+        rv = OSD_ERROR_FAILURE;
+        goto free_return;
+    }
+
+    r->meta.system_vendor_id = le16toh(hdr.system_vendor_id);
+    r->meta.system_device_id = le16toh(hdr.system_device_id);
+    r->meta.module.addr = le16toh(hdr.module_addr);
+    r->meta.module.vendor = le16toh(hdr.module_vendor);
+    r->meta.module.type = le16toh(hdr.module_type);
+    r->meta.module.version = le16toh(hdr.module_version);
+    r->meta.start_time_realtime_ns = le64toh(hdr.start_time_realtime_ns);
+    r->meta.start_time_monotonic_ns = le64toh(hdr.start_time_monotonic_ns);
+
+    if (OSD_FAILED(load_index(r, header_size))) {
+        dbg(log_ctx, "Trace file %s has no index, scanning it.\n", path);
+        scan_index(r, header_size);
+    }
+
+    *reader = r;
+    return OSD_OK;
+
+free_return:
+    if (r->map) {
+        munmap((void*)r->map, r->map_size);
+    }
+    free(r);
+    return rv;
+}
+
+API_EXPORT
+const struct osd_tracefile_meta*
+osd_tracefile_reader_get_meta(struct osd_tracefile_reader *reader)
+{
+    assert(reader);
+    return &reader->meta;
+}
+
+API_EXPORT
+uint64_t osd_tracefile_reader_get_packet_count(struct osd_tracefile_reader *reader)
+{
+    assert(reader);
+    return reader->packet_count;
+}
+
+/**
+ * Grow the buffer |buf| of |alloc_size| bytes to at least |size| bytes
+ */
+static void buf_ensure_size(char **buf, size_t *alloc_size, size_t size)
+{
+    if (*alloc_size >= size) {
+        return;
+    }
+    free(*buf);
+    *buf = malloc(size);
+    assert(*buf);
+    *alloc_size = size;
+}
+
+/**
+ * Load (and decompress) a block
+ *
+ * @param r the reader
+ * @param block_idx index of the block in the block index
+ * @return OSD_OK on success, any other value indicates an error
+ */
+static osd_result load_block(struct osd_tracefile_reader *r, size_t block_idx)
+{
+    const struct tracefile_index_entry *entry = &r->index[block_idx];
+
+    // the index guarantees that the block header lies within the file
+    struct tracefile_block_header hdr;
+    memcpy(&hdr, r->map + entry->offset, sizeof(hdr));
+    const char *data = r->map + entry->offset + sizeof(hdr);
+    size_t data_size = le32toh(hdr.data_size);
+    size_t uncompressed_size = le32toh(hdr.uncompressed_size);
+    if (data_size > r->map_size - entry->offset - sizeof(hdr)) {
+        goto err_corrupt;
+    }
+
+    if (r->compression == OSD_TRACEFILE_COMPRESSION_NONE) {
+        if (data_size != uncompressed_size) {
+            goto err_corrupt;
+        }
+        r->block = data;
+    } else {
+        buf_ensure_size(&r->dbuf, &r->dbuf_alloc_size, uncompressed_size);
+
+        size_t decompressed_size = 0;
+        switch (r->compression) {
+#ifdef HAVE_LIBLZ4
+        case OSD_TRACEFILE_COMPRESSION_LZ4: {
+            int rv = LZ4_decompress_safe(data, r->dbuf, data_size,
+                                         uncompressed_size);
+            if (rv < 0) {
+                goto err_corrupt;
+            }
+            decompressed_size = rv;
+            break;
+        }
+#endif
+#ifdef HAVE_LIBZSTD
+        case OSD_TRACEFILE_COMPRESSION_ZSTD: {
+            size_t rv = ZSTD_decompress(r->dbuf, uncompressed_size,
+                                        data, data_size);
+            if (ZSTD_isError(rv)) {
+                goto err_corrupt;
+            }
+            decompressed_size = rv;
+            break;
+        }
+#endif
+        default:
+            assert(0 && "unsupported compression");
+        }
+        if (decompressed_size != uncompressed_size) {
+            goto err_corrupt;
+        }
+        r->block = r->dbuf;
+    }
+
+    r->block_len = uncompressed_size;
+    r->block_pos = 0;
+    r->next_block = block_idx + 1;
+    r->next_packet = entry->first_packet;
+    return OSD_OK;
+
+err_corrupt:
+    err(r->log_ctx, "Trace file contains a corrupt block.\n");
+    return OSD_ERROR_FAILURE;
+}
+
+/**
+ * Read the next record from the file
+ *
+ * @param r the reader
+ * @param[out] data the packet data (little endian); points into the current
+ *                  block
+ * @param[out] size_words size of the packet in 16 bit words
+ * @param[out] timestamp_ns host timestamp of the packet
+ * @return OSD_OK on success, OSD_ERROR_EOF at the end of the file, any other
+ *         value indicates an error
+ */
+static osd_result read_record(struct osd_tracefile_reader *r,
+                              const char **data, uint16_t *size_words,
+                              uint64_t *timestamp_ns)
+{
+    osd_result rv;
+
+    while (r->block_pos == r->block_len) {
+        if (r->next_block >= r->index_len) {
+            return OSD_ERROR_EOF;
+        }
+        rv = load_block(r, r->next_block);
+        if (OSD_FAILED(rv)) {
+            return rv;
+        }
+    }
+
+    const char *p = r->block + r->block_pos;
+    const char *end = r->block + r->block_len;
+
+    struct tracefile_record rec;
+    if (p + sizeof(rec) > end) {
+        goto err_corrupt;
+    }
+    memcpy(&rec, p, sizeof(rec));
+    p += sizeof(rec);
+
+    uint64_t ts;
+    if (le16toh(rec.flags) & RECORD_FLAG_ABS_TIMESTAMP) {
+        uint64_t ts_le;
+        if (p + sizeof(ts_le) > end) {
+            goto err_corrupt;
+        }
+        memcpy(&ts_le, p, sizeof(ts_le));
+        p += sizeof(ts_le);
+        ts = le64toh(ts_le);
+    } else {
+        ts = r->last_timestamp_ns + le32toh(rec.timestamp_delta_ns);
+    }
+
+    *size_words = le16toh(rec.size_words);
+    size_t data_size_bytes = *size_words * sizeof(uint16_t);
+    if (p + data_size_bytes > end) {
+        goto err_corrupt;
+    }
+    *data = p;
+    p += data_size_bytes;
+
+    r->block_pos = p - r->block;
+    r->last_timestamp_ns = ts;
+    r->next_packet++;
+    *timestamp_ns = ts;
+    return OSD_OK;
+
+err_corrupt:
+    err(r->log_ctx, "Trace file contains a corrupt record.\n");
+    return OSD_ERROR_FAILURE;
+}
+
+API_EXPORT
+osd_result osd_tracefile_reader_next(struct osd_tracefile_reader *reader,
+                                     struct osd_packet **packet,
+                                     uint64_t *timestamp_ns)
+{
+    osd_result rv;
+
+    assert(reader);
+    assert(packet);
+
+    const char *data;
+    uint16_t size_words;
+    uint64_t ts;
+    rv = read_record(reader, &data, &size_words, &ts);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, size_words);
+    assert(OSD_SUCCEEDED(rv));
+    memcpy(pkg->data_raw, data, size_words * sizeof(uint16_t));
+#if __BYTE_ORDER != __LITTLE_ENDIAN
+    for (unsigned int i = 0; i < size_words; i++) {
+        pkg->data_raw[i] = le16toh(pkg->data_raw[i]);
+    }
+#endif
+
+    *packet = pkg;
+    if (timestamp_ns) {
+        *timestamp_ns = ts;
+    }
+    return OSD_OK;
+}
+
+/**
+ * Position the reader at the end of the file
+ */
+static void seek_end(struct osd_tracefile_reader *r)
+{
+    r->next_block = r->index_len;
+    r->block_len = 0;
+    r->block_pos = 0;
+    r->next_packet = r->packet_count;
+}
+
+API_EXPORT
+osd_result osd_tracefile_reader_seek_packet(struct osd_tracefile_reader *reader,
+                                            uint64_t packet_idx)
+{
+    osd_result rv;
+
+    assert(reader);
+
+    if (packet_idx >= reader->packet_count) {
+        seek_end(reader);
+        return OSD_ERROR_EOF;
+    }
+
+    // find the last block starting at or before the packet
+    size_t lo = 0, hi = reader->index_len;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (reader->index[mid].first_packet <= packet_idx) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    rv = load_block(reader, lo);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    while (reader->next_packet < packet_idx) {
+        const char *data;
+        uint16_t size_words;
+        uint64_t ts;
+        rv = read_record(reader, &data, &size_words, &ts);
+        if (OSD_FAILED(rv)) {
+            return rv;
+        }
+    }
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_tracefile_reader_seek_time(struct osd_tracefile_reader *reader,
+                                          uint64_t timestamp_ns)
+{
+    osd_result rv;
+
+    assert(reader);
+
+    if (reader->index_len == 0) {
+        seek_end(reader);
+        return OSD_ERROR_EOF;
+    }
+
+    // find the last block starting before the timestamp: it might contain
+    // the first packet at or after |timestamp_ns|
+    size_t lo = 0, hi = reader->index_len;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (reader->index[mid].first_timestamp_ns < timestamp_ns) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    rv = load_block(reader, lo);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+
+    // skip all earlier packets, without creating packet objects for them
+    while (1) {
+        size_t block_idx = reader->next_block;
+        size_t block_pos = reader->block_pos;
+        size_t block_len = reader->block_len;
+        uint64_t next_packet = reader->next_packet;
+        uint64_t last_timestamp_ns = reader->last_timestamp_ns;
+
+        const char *data;
+        uint16_t size_words;
+        uint64_t ts;
+        rv = read_record(reader, &data, &size_words, &ts);
+        if (rv == OSD_ERROR_EOF) {
+            seek_end(reader);
+            return rv;
+        }
+        if (OSD_FAILED(rv)) {
+            return rv;
+        }
+        if (ts < timestamp_ns) {
+            continue;
+        }
+
+        // step back to the found packet
+        if (reader->next_block != block_idx) {
+            // the packet is the first one of a new block
+            return load_block(reader, reader->next_block - 1);
+        }
+        reader->block_pos = block_pos;
+        reader->block_len = block_len;
+        reader->next_packet = next_packet;
+        reader->last_timestamp_ns = last_timestamp_ns;
+        return OSD_OK;
+    }
+}
+
+API_EXPORT
+uint64_t osd_tracefile_reader_tell(struct osd_tracefile_reader *reader)
+{
+    assert(reader);
+    return reader->next_packet;
+}
+
+API_EXPORT
+void osd_tracefile_reader_free(struct osd_tracefile_reader **reader_p)
+{
+    assert(reader_p);
+    struct osd_tracefile_reader *reader = *reader_p;
+    if (!reader) {
+        return;
+    }
+
+    munmap((void*)reader->map, reader->map_size);
+    free(reader->index);
+    free(reader->dbuf);
+    free(reader);
+    *reader_p = NULL;
+}
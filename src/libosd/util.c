@@ -1,6 +1,10 @@
 #include <osd/osd.h>
 #include "osd-private.h"
 #include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static const struct osd_version osd_version_internal = {OSD_VERSION_MAJOR,
     OSD_VERSION_MINOR, OSD_VERSION_MICRO, OSD_VERSION_SUFFIX};
@@ -46,3 +50,30 @@ unsigned int osd_diaddr_build(unsigned int subnet, unsigned int local_diaddr)
 
     return subnet << OSD_DIADDR_LOCAL_BITS | local_diaddr;
 }
+
+/**
+ * Append a printf()-formatted string to a dynamically allocated string
+ *
+ * @param strp string to append to. If *strp is NULL, a new string is
+ *             allocated. Free it after use.
+ * @param fmt  format string (as in printf())
+ */
+void sprintf_append(char** strp, const char *fmt, ...)
+{
+    va_list ap;
+    char* append_str;
+
+    va_start(ap, fmt);
+    int append_size = vasprintf(&append_str, fmt, ap);
+    assert(append_size != 0);
+    va_end(ap);
+
+    if (*strp == NULL) {
+        *strp = append_str;
+    } else {
+        size_t cur_size = strlen(*strp);
+        *strp = realloc(*strp, cur_size + append_size + 1 /* \0 */);
+        strncat(*strp, append_str, append_size);
+        free(append_str);
+    }
+}
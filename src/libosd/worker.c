@@ -2,8 +2,270 @@
 
 #include <osd/osd.h>
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
 #include "osd-private.h"
 
+/**
+ * Outbound message waiting in the tx backlog of a worker thread
+ */
+struct worker_tx_entry {
+    /** destination socket */
+    zsock_t *socket;
+
+    /** message to be sent */
+    zmsg_t *msg;
+};
+
+/**
+ * Additional time (in ms) the main thread waits for a worker thread to report
+ * its shutdown on top of the shutdown timeout before forcing it to end
+ */
+#define WORKER_SHUTDOWN_GRACE_MS (ZMQ_RCV_TIMEOUT * 3 / 2)
+
+/**
+ * Receive timeout (in ms) of the in-process socket on the main thread
+ *
+ * We need to use a slightly higher timeout for the internal communication
+ * than for the external communication: if an external communication fails,
+ * the I/O thread must be able to recognize this by the timeout, and then
+ * inform the main thread. If both threads follow the same timeout, the
+ * I/O thread cannot inform the main thread of timeouts.
+ */
+#define WORKER_INPROC_RCV_TIMEOUT_MS (ZMQ_RCV_TIMEOUT * 3 / 2)
+
+/**
+ * Interval (in ms) after which sending the tx backlog is first retried
+ *
+ * The interval is doubled up to WORKER_TX_RETRY_INTERVAL_MAX_MS for every
+ * retry which cannot send anything, and reset once a message went out.
+ * Polling the sockets for writability is no alternative: ROUTER sockets
+ * always report to be writable, even if sending to a peer would block.
+ */
+#define WORKER_TX_RETRY_INTERVAL_MIN_MS 1
+
+/**
+ * Maximum interval (in ms) in which sending the tx backlog is retried
+ */
+#define WORKER_TX_RETRY_INTERVAL_MAX_MS 64
+
+static int tx_retry_timer(zloop_t *loop, int timer_id, void *thread_ctx_void);
+
+int worker_send_nowait(zsock_t *socket, zmsg_t **msg_p)
+{
+    assert(socket);
+    assert(msg_p && *msg_p);
+
+    // Send frame by frame instead of using zmsg_send(), which loses the
+    // first frame if sending fails. Once ZeroMQ accepted the first frame of
+    // a message it also accepts the remaining ones.
+    size_t frames_left = zmsg_size(*msg_p);
+    zframe_t *frame = zmsg_first(*msg_p);
+    while (frame) {
+        frames_left--;
+        int flags = ZFRAME_REUSE | ZFRAME_DONTWAIT;
+        if (frames_left) {
+            flags |= ZFRAME_MORE;
+        }
+        if (zframe_send(&frame, socket, flags) != 0) {
+            return -1;
+        }
+        frame = zmsg_next(*msg_p);
+    }
+
+    zmsg_destroy(msg_p);
+    return 0;
+}
+
+static void tx_retry_timer_arm(struct worker_thread_ctx *thread_ctx)
+{
+    if (thread_ctx->tx_retry_timer_id != -1) {
+        return;
+    }
+    thread_ctx->tx_retry_timer_id = zloop_timer(thread_ctx->zloop,
+                                                thread_ctx->tx_retry_interval_ms,
+                                                1, tx_retry_timer, thread_ctx);
+    assert(thread_ctx->tx_retry_timer_id != -1);
+}
+
+static void tx_retry_timer_cancel(struct worker_thread_ctx *thread_ctx)
+{
+    if (thread_ctx->tx_retry_timer_id == -1) {
+        return;
+    }
+    zloop_timer_end(thread_ctx->zloop, thread_ctx->tx_retry_timer_id);
+    thread_ctx->tx_retry_timer_id = -1;
+    thread_ctx->tx_retry_interval_ms = WORKER_TX_RETRY_INTERVAL_MIN_MS;
+}
+
+/**
+ * Send out messages from the tx backlog until a socket blocks
+ *
+ * Messages are kept in order: once a message cannot be sent, all following
+ * messages stay in the backlog as well. Messages which fail to send for any
+ * other reason are dropped.
+ *
+ * @return the number of messages sent
+ */
+static unsigned int tx_backlog_send(struct worker_thread_ctx *thread_ctx)
+{
+    unsigned int sent = 0;
+    struct worker_tx_entry *entry;
+    while ((entry = zlist_first(thread_ctx->tx_backlog))) {
+        if (worker_send_nowait(entry->socket, &entry->msg) == 0) {
+            sent++;
+        } else if (errno == EAGAIN) {
+            break;
+        } else {
+            err(thread_ctx->log_ctx, "Unable to send queued message (%s), "
+                "dropping it.", strerror(errno));
+            zmsg_destroy(&entry->msg);
+        }
+        zlist_pop(thread_ctx->tx_backlog);
+        free(entry);
+    }
+    return sent;
+}
+
+/**
+ * Timer handler: retry sending the messages in the tx backlog
+ */
+static int tx_retry_timer(zloop_t *loop, int timer_id, void *thread_ctx_void)
+{
+    struct worker_thread_ctx *thread_ctx = thread_ctx_void;
+    assert(thread_ctx);
+
+    // one-shot timer, removed by zloop after this handler returns
+    thread_ctx->tx_retry_timer_id = -1;
+
+    if (tx_backlog_send(thread_ctx) > 0) {
+        thread_ctx->tx_retry_interval_ms = WORKER_TX_RETRY_INTERVAL_MIN_MS;
+    } else if (thread_ctx->tx_retry_interval_ms <
+               WORKER_TX_RETRY_INTERVAL_MAX_MS) {
+        thread_ctx->tx_retry_interval_ms *= 2;
+    }
+
+    if (zlist_size(thread_ctx->tx_backlog) == 0) {
+        thread_ctx->tx_retry_interval_ms = WORKER_TX_RETRY_INTERVAL_MIN_MS;
+    } else {
+        tx_retry_timer_arm(thread_ctx);
+    }
+    return 0;
+}
+
+osd_result worker_tx(struct worker_thread_ctx *thread_ctx, zsock_t *socket,
+                     zmsg_t **msg_p)
+{
+    assert(thread_ctx);
+    assert(socket);
+    assert(msg_p && *msg_p);
+
+    int rv;
+
+    // fast path: nothing queued and the socket accepts the message
+    if (zlist_size(thread_ctx->tx_backlog) == 0) {
+        rv = worker_send_nowait(socket, msg_p);
+        if (rv == 0) {
+            return OSD_OK;
+        }
+        if (errno != EAGAIN) {
+            err(thread_ctx->log_ctx, "Unable to send message (%s), dropping "
+                "it.", strerror(errno));
+            zmsg_destroy(msg_p);
+            return OSD_ERROR_COM;
+        }
+    }
+
+    if (zlist_size(thread_ctx->tx_backlog) >= WORKER_TX_BACKLOG_MAX) {
+        err(thread_ctx->log_ctx, "Outbound message backlog is full, dropping "
+            "message.");
+        zmsg_destroy(msg_p);
+        return OSD_ERROR_COM;
+    }
+
+    struct worker_tx_entry *entry = calloc(1, sizeof(struct worker_tx_entry));
+    assert(entry);
+    entry->socket = socket;
+    entry->msg = *msg_p;
+    *msg_p = NULL;
+
+    rv = zlist_append(thread_ctx->tx_backlog, entry);
+    assert(rv == 0);
+
+    tx_retry_timer_arm(thread_ctx);
+
+    return OSD_OK;
+}
+
+void worker_tx_flush(struct worker_thread_ctx *thread_ctx, zsock_t *socket,
+                     int timeout_ms, struct osd_shutdown_stats *stats)
+{
+    assert(thread_ctx);
+
+    struct osd_shutdown_stats s = { 0, 0 };
+    int64_t deadline = zclock_mono() + timeout_ms;
+
+    zlist_t *remaining = zlist_new();
+    assert(remaining);
+
+    struct worker_tx_entry *entry;
+    while ((entry = zlist_pop(thread_ctx->tx_backlog))) {
+        if (socket && entry->socket != socket) {
+            zlist_append(remaining, entry);
+            continue;
+        }
+
+        // retry until the socket accepts the message or the deadline passes
+        int retry_interval_ms = WORKER_TX_RETRY_INTERVAL_MIN_MS;
+        bool sent;
+        while (!(sent = (worker_send_nowait(entry->socket,
+                                            &entry->msg) == 0))) {
+            int64_t time_left = deadline - zclock_mono();
+            if (errno != EAGAIN || time_left <= 0) {
+                break;
+            }
+            zclock_sleep(time_left < retry_interval_ms ? time_left :
+                         retry_interval_ms);
+            if (retry_interval_ms < WORKER_TX_RETRY_INTERVAL_MAX_MS) {
+                retry_interval_ms *= 2;
+            }
+        }
+
+        if (sent) {
+            s.flushed++;
+        } else {
+            zmsg_destroy(&entry->msg);
+            s.dropped++;
+        }
+        free(entry);
+    }
+    zlist_destroy(&thread_ctx->tx_backlog);
+    thread_ctx->tx_backlog = remaining;
+
+    if (zlist_size(thread_ctx->tx_backlog) == 0) {
+        tx_retry_timer_cancel(thread_ctx);
+    }
+
+    // Give ZeroMQ the remaining time to push out its own queue when the
+    // socket is destroyed.
+    if (socket) {
+        int64_t time_left = deadline - zclock_mono();
+        zsock_set_linger(socket, time_left > 0 ? time_left : 0);
+    }
+
+    if (s.flushed || s.dropped) {
+        dbg(thread_ctx->log_ctx, "Flushed %u queued messages, dropped %u.",
+            s.flushed, s.dropped);
+    }
+
+    thread_ctx->tx_flush_stats.flushed += s.flushed;
+    thread_ctx->tx_flush_stats.dropped += s.dropped;
+    if (stats) {
+        stats->flushed += s.flushed;
+        stats->dropped += s.dropped;
+    }
+}
+
 /**
  * Handler: Message from main thread received in worker thread
  */
@@ -28,6 +290,11 @@ static int thread_inproc_rcv(zloop_t *loop, zsock_t *reader,
     assert(type_str);
 
     if (!strcmp(type_str, "I-SHUTDOWN")) {
+        // Drain: send out everything still waiting in the backlog within
+        // the deadline given by the main thread.
+        int64_t deadline = worker_msg_get_deadline(msg);
+        worker_tx_flush(thread_ctx, NULL, worker_time_left(deadline), NULL);
+
         // End thread by returning -1, which will terminate zloop
         retval = -1;
         zmsg_destroy(&msg);
@@ -55,8 +322,15 @@ static void* thread_main(void *thread_ctx_void)
     osd_result osd_rv;
 
     // create new PAIR socket for the communication of the main thread
-    thread_ctx->inproc_socket = zsock_new_pair(">inproc://threadcom");
+    thread_ctx->inproc_socket = zsock_new_pair(thread_ctx->inproc_endpoint);
     assert(thread_ctx->inproc_socket);
+    free(thread_ctx->inproc_endpoint);
+    thread_ctx->inproc_endpoint = NULL;
+
+    thread_ctx->tx_backlog = zlist_new();
+    assert(thread_ctx->tx_backlog);
+    thread_ctx->tx_retry_timer_id = -1;
+    thread_ctx->tx_retry_interval_ms = WORKER_TX_RETRY_INTERVAL_MIN_MS;
 
     // extension point: thread init
     if (thread_ctx->init_fn) {
@@ -66,6 +340,7 @@ static void* thread_main(void *thread_ctx_void)
                                osd_rv);
 
             zsock_destroy(&thread_ctx->inproc_socket);
+            zlist_destroy(&thread_ctx->tx_backlog);
             return NULL;
         }
     }
@@ -92,12 +367,20 @@ static void* thread_main(void *thread_ctx_void)
         err(thread_ctx->log_ctx, "ZeroMQ zloop did not shut down properly.");
     }
 
+    // Sockets with queued messages might be destroyed in the destroy_fn; make
+    // sure nothing is left behind referencing them (only happens if zloop was
+    // interrupted before the I-SHUTDOWN message was processed).
+    worker_tx_flush(thread_ctx, NULL, 0, NULL);
+    zlist_destroy(&thread_ctx->tx_backlog);
+
     // extension point: thread destruction
     if (thread_ctx->destroy_fn) {
         thread_ctx->destroy_fn(thread_ctx);
     }
 
-    worker_send_status(thread_ctx->inproc_socket, "I-SHUTDOWN-DONE", OSD_OK);
+    worker_send_data(thread_ctx->inproc_socket, "I-SHUTDOWN-DONE",
+                     &thread_ctx->tx_flush_stats,
+                     sizeof(struct osd_shutdown_stats));
 
     assert(thread_ctx->usr == NULL &&
            "You need to free() and NULL the user context in a thread function "
@@ -120,23 +403,32 @@ osd_result worker_new(struct worker_ctx **ctx, struct osd_log_ctx *log_ctx,
                       void* thread_ctx_usr)
 {
     int rv;
+    char *bind_endpoint;
 
     struct worker_ctx *c = calloc(1, sizeof(struct worker_ctx));
     assert(c);
 
-    c->inproc_socket = zsock_new_pair("@inproc://threadcom");
+    c->log_ctx = log_ctx;
+    c->shutdown_timeout_ms = OSD_SHUTDOWN_TIMEOUT_DEFAULT;
+
+    // Every worker needs its own in-process endpoint, otherwise only one
+    // worker can exist in a process. The main thread binds to it, the worker
+    // thread connects.
+    char inproc_endpoint[64];
+    snprintf(inproc_endpoint, sizeof(inproc_endpoint),
+             "inproc://worker-%p", (void*)c);
+
+    rv = asprintf(&bind_endpoint, "@%s", inproc_endpoint);
+    assert(rv != -1);
+    c->inproc_socket = zsock_new_pair(bind_endpoint);
     assert(c->inproc_socket);
+    free(bind_endpoint);
 
     // To support I/O with timeouts (e.g. reading a register with a timeout)
     // we need the ZeroMQ receive functions to time out as well.
     // If fully blocking behavior is required, manually loop on the zmsg_recv()
     // calls.
-    // We need to use a slightly higher timeout for the internal communication
-    // than for the external communication: if an external communication fails,
-    // the I/O thread must be able to recognize this by the timeout, and then
-    // inform the main thread. If both threads follow the same timeout, the
-    // I/O thread cannot inform the main thread of timeouts.
-    zsock_set_rcvtimeo(c->inproc_socket, 1.5 * ZMQ_RCV_TIMEOUT);
+    zsock_set_rcvtimeo(c->inproc_socket, WORKER_INPROC_RCV_TIMEOUT_MS);
 
     struct worker_thread_ctx *thread_ctx = calloc(
             1, sizeof(struct worker_thread_ctx));
@@ -147,6 +439,10 @@ osd_result worker_new(struct worker_ctx **ctx, struct osd_log_ctx *log_ctx,
     thread_ctx->destroy_fn = thread_destroy_fn;
     thread_ctx->cmd_handler_fn = cmd_handler_fn;
 
+    // the endpoint string is prefixed with '>' to connect (instead of bind)
+    rv = asprintf(&thread_ctx->inproc_endpoint, ">%s", inproc_endpoint);
+    assert(rv != -1);
+
     rv = pthread_create(&c->thread, 0, thread_main, (void*) thread_ctx);
     assert(rv == 0);
 
@@ -157,7 +453,7 @@ osd_result worker_new(struct worker_ctx **ctx, struct osd_log_ctx *log_ctx,
         pthread_join(c->thread, NULL);
         zsock_destroy(&c->inproc_socket);
         free(c);
-        return rv;
+        return retval;
     }
 
     *ctx = c;
@@ -165,26 +461,97 @@ osd_result worker_new(struct worker_ctx **ctx, struct osd_log_ctx *log_ctx,
     return OSD_OK;
 }
 
-void worker_free(struct worker_ctx **ctx_p)
+void worker_set_shutdown_timeout(struct worker_ctx *ctx, int timeout_ms)
 {
-    osd_result osd_rv;
+    assert(ctx);
+    assert(timeout_ms >= 0);
+    ctx->shutdown_timeout_ms = timeout_ms;
+}
 
-    assert(ctx_p);
-    struct worker_ctx *ctx = *ctx_p;
-    if (!ctx) {
-        return;
-    }
+osd_result worker_request_with_deadline(struct worker_ctx *ctx,
+                                        const char *name,
+                                        const char *done_name,
+                                        int *retvalue)
+{
+    assert(ctx);
 
-    // shut down thread
-    worker_send_status(ctx->inproc_socket, "I-SHUTDOWN", 0);
+    osd_result rv;
+
+    // The worker thread might use up all of the shutdown timeout; wait
+    // a bit longer for its answer.
+    zsock_set_rcvtimeo(ctx->inproc_socket,
+                       ctx->shutdown_timeout_ms + WORKER_SHUTDOWN_GRACE_MS);
+
+    worker_send_status(ctx->inproc_socket, name, ctx->shutdown_timeout_ms);
+    rv = worker_wait_for_status(ctx->inproc_socket, done_name, retvalue);
 
-    // wait for shutdown to happen
-    int retvalue;
-    osd_rv = worker_wait_for_status(ctx->inproc_socket, "I-SHUTDOWN-DONE",
-                                    &retvalue);
+    zsock_set_rcvtimeo(ctx->inproc_socket, WORKER_INPROC_RCV_TIMEOUT_MS);
+
+    return rv;
+}
+
+int64_t worker_msg_get_deadline(zmsg_t *msg)
+{
+    zmsg_first(msg);
+    zframe_t *timeout_frame = zmsg_next(msg);
+    assert(timeout_frame && zframe_size(timeout_frame) == sizeof(int));
+    int timeout_ms;
+    memcpy(&timeout_ms, zframe_data(timeout_frame), sizeof(int));
+
+    return zclock_mono() + timeout_ms;
+}
+
+int worker_time_left(int64_t deadline)
+{
+    int64_t time_left = deadline - zclock_mono();
+    return time_left > 0 ? time_left : 0;
+}
+
+/**
+ * Ask the worker thread to shut down (without waiting for it)
+ *
+ * @see shutdown_finish()
+ */
+static void shutdown_begin(struct worker_ctx *ctx)
+{
+    // The worker thread takes up to shutdown_timeout_ms to drain; wait
+    // a bit longer for its answer.
+    zsock_set_rcvtimeo(ctx->inproc_socket,
+                       ctx->shutdown_timeout_ms + WORKER_SHUTDOWN_GRACE_MS);
+
+    worker_send_status(ctx->inproc_socket, "I-SHUTDOWN",
+                       ctx->shutdown_timeout_ms);
+}
+
+/**
+ * Wait for a worker thread to shut down and free the worker context
+ *
+ * @see shutdown_begin()
+ */
+static void shutdown_finish(struct worker_ctx **ctx_p,
+                            struct osd_shutdown_stats *stats)
+{
+    osd_result osd_rv;
+    struct worker_ctx *ctx = *ctx_p;
+
+    struct osd_shutdown_stats s;
+    osd_rv = worker_wait_for_data(ctx->inproc_socket, "I-SHUTDOWN-DONE",
+                                  &s, sizeof(s));
     if (OSD_FAILED(osd_rv)) {
-        // If the thread shutting down properly by itself, we force a shutdown
+        // If the thread isn't shutting down properly by itself (e.g. because
+        // it is blocked), we force a shutdown. Everything pending is lost.
+        err(ctx->log_ctx, "Worker thread did not shut down within %d ms, "
+            "forcing shutdown.", ctx->shutdown_timeout_ms);
         pthread_cancel(ctx->thread);
+    } else {
+        if (s.flushed || s.dropped) {
+            info(ctx->log_ctx, "Worker shut down: %u pending messages sent, "
+                 "%u dropped.", s.flushed, s.dropped);
+        }
+        if (stats) {
+            stats->flushed += s.flushed;
+            stats->dropped += s.dropped;
+        }
     }
 
     // wait until control I/O thread has finished its cleanup
@@ -196,6 +563,38 @@ void worker_free(struct worker_ctx **ctx_p)
     *ctx_p = NULL;
 }
 
+void worker_free(struct worker_ctx **ctx_p,
+                 struct osd_shutdown_stats *stats)
+{
+    assert(ctx_p);
+    struct worker_ctx *ctx = *ctx_p;
+    if (!ctx) {
+        return;
+    }
+
+    shutdown_begin(ctx);
+    shutdown_finish(ctx_p, stats);
+}
+
+void worker_free_all(struct worker_ctx **ctxs, size_t count,
+                     struct osd_shutdown_stats *stats)
+{
+    assert(ctxs);
+
+    // First notify all workers, then collect them: all workers drain their
+    // queues concurrently.
+    for (size_t i = 0; i < count; i++) {
+        if (ctxs[i]) {
+            shutdown_begin(ctxs[i]);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (ctxs[i]) {
+            shutdown_finish(&ctxs[i], stats);
+        }
+    }
+}
+
 
 void worker_send_data(zsock_t *socket, const char* name, const void* data,
                       size_t size)
@@ -221,32 +620,43 @@ void worker_send_status(zsock_t *socket, const char* name, int value)
     worker_send_data(socket, name, &value, sizeof(int));
 }
 
-osd_result worker_wait_for_status(zsock_t *socket, const char* name,
-                                  int *retvalue)
+osd_result worker_wait_for_data(zsock_t *socket, const char* name,
+                                void *data, size_t size)
 {
-    zmsg_t *msg = zmsg_recv(socket);
-    if (!msg) {
-        if (errno == EAGAIN) {
-            return OSD_ERROR_TIMEDOUT;
-        } else {
-            return OSD_ERROR_FAILURE;
+    zmsg_t *msg;
+    while (1) {
+        msg = zmsg_recv(socket);
+        if (!msg) {
+            if (errno == EAGAIN) {
+                return OSD_ERROR_TIMEDOUT;
+            } else {
+                return OSD_ERROR_FAILURE;
+            }
         }
-    }
 
-    zframe_t *name_frame = zmsg_pop(msg);
-    if (!zframe_streq(name_frame, name)) {
+        // Skip stale messages, e.g. replies to earlier requests which timed
+        // out while waiting for them.
+        zframe_t *name_frame = zmsg_pop(msg);
+        bool is_expected = zframe_streq(name_frame, name);
         zframe_destroy(&name_frame);
+        if (is_expected) {
+            break;
+        }
         zmsg_destroy(&msg);
-        return OSD_ERROR_FAILURE;
     }
-    zframe_destroy(&name_frame);
 
     zframe_t *data_frame = zmsg_pop(msg);
-    assert(zframe_size(data_frame) == sizeof(int));
-    memcpy(retvalue, zframe_data(data_frame), sizeof(int));
+    assert(zframe_size(data_frame) == size);
+    memcpy(data, zframe_data(data_frame), size);
     zframe_destroy(&data_frame);
 
     zmsg_destroy(&msg);
 
     return OSD_OK;
 }
+
+osd_result worker_wait_for_status(zsock_t *socket, const char* name,
+                                  int *retvalue)
+{
+    return worker_wait_for_data(socket, name, retvalue, sizeof(int));
+}
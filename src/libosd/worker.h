@@ -12,6 +12,12 @@
  * communicate with the thread in a safe and easy manner.
  */
 
+/**
+ * Maximum number of outbound messages queued in a worker thread if the
+ * destination socket is not ready to accept them
+ */
+#define WORKER_TX_BACKLOG_MAX 1000
+
 /**
  * Worker context object (to be used on main thread)
  */
@@ -21,6 +27,15 @@ struct worker_ctx {
 
     /** In-process socket for communication with the worker thread */
     zsock_t *inproc_socket;
+
+    /** Logging context */
+    struct osd_log_ctx *log_ctx;
+
+    /**
+     * Time (in ms) the worker thread may spend sending out pending messages
+     * during shutdown
+     */
+    int shutdown_timeout_ms;
 };
 
 // forward declaration for typedefs below
@@ -51,6 +66,9 @@ struct worker_thread_ctx {
     /** Event processing zloop */
     zloop_t* zloop;
 
+    /** Endpoint of the in-process socket (only used during thread startup) */
+    char *inproc_endpoint;
+
     /** In-process socket for communication with main thread */
     zsock_t *inproc_socket;
 
@@ -60,6 +78,21 @@ struct worker_thread_ctx {
     /** User-specific extensions to the structure */
     void *usr;
 
+    /**
+     * Outbound messages waiting for their destination socket to accept them
+     * (list of struct worker_tx_entry)
+     */
+    zlist_t *tx_backlog;
+
+    /** zloop timer retrying to send the tx_backlog; -1 if not running */
+    int tx_retry_timer_id;
+
+    /** Time (in ms) until the next retry to send the tx_backlog */
+    int tx_retry_interval_ms;
+
+    /** Statistics of all backlog flushes (collected for the shutdown report) */
+    struct osd_shutdown_stats tx_flush_stats;
+
     worker_thread_init_fn init_fn;
     worker_thread_init_fn destroy_fn;
     worker_cmd_handler_fn cmd_handler_fn;
@@ -90,8 +123,129 @@ osd_result worker_new(struct worker_ctx **ctx, struct osd_log_ctx *log_ctx,
 
 /**
  * Free all resources
+ *
+ * The worker thread is given up to ctx->shutdown_timeout_ms to send out all
+ * pending outbound messages before it is stopped.
+ *
+ * @param ctx_p the worker context; set to NULL after the function returns
+ * @param stats statistics about flushed and dropped messages. Set to NULL if
+ *              you're not interested in this information.
+ *
+ * @see worker_free_all()
+ */
+void worker_free(struct worker_ctx **ctx_p,
+                 struct osd_shutdown_stats *stats);
+
+/**
+ * Shut down and free multiple workers in parallel
+ *
+ * All workers are asked to shut down at the same time, bounding the total
+ * time to the largest shutdown timeout of all workers (instead of the sum).
+ *
+ * @param ctxs array of @p count worker contexts. All entries are NULLed.
+ * @param count number of entries in @p ctxs
+ * @param stats accumulated statistics of all workers, or NULL
+ */
+void worker_free_all(struct worker_ctx **ctxs, size_t count,
+                     struct osd_shutdown_stats *stats);
+
+/**
+ * Set the time a worker may use to send out pending messages on shutdown
+ *
+ * @param ctx the worker context
+ * @param timeout_ms shutdown deadline (in ms). Pending messages which cannot
+ *                   be sent out within this time are dropped.
  */
-void worker_free(struct worker_ctx **ctx_p);
+void worker_set_shutdown_timeout(struct worker_ctx *ctx, int timeout_ms);
+
+/**
+ * Send a request to the worker thread which is bound by the shutdown timeout
+ *
+ * Use this function for requests which make the worker thread flush its
+ * outbound messages, e.g. before closing a socket. The shutdown timeout is
+ * sent along as value of the request; get the resulting deadline in the
+ * worker thread with worker_msg_get_deadline(). The wait for the response is
+ * extended accordingly.
+ *
+ * @param ctx the worker context
+ * @param name name of the request message
+ * @param done_name name of the status message answering the request
+ * @param[out] retvalue value of the status message
+ * @return see worker_wait_for_status()
+ */
+osd_result worker_request_with_deadline(struct worker_ctx *ctx,
+                                        const char *name,
+                                        const char *done_name,
+                                        int *retvalue);
+
+/**
+ * Get the deadline of a request (in the worker thread)
+ *
+ * @param msg a request sent with worker_request_with_deadline(), or the
+ *            I-SHUTDOWN request
+ * @return the deadline as zclock_mono() timestamp (ms)
+ *
+ * @see worker_time_left()
+ */
+int64_t worker_msg_get_deadline(zmsg_t *msg);
+
+/**
+ * Time left (in ms) until @p deadline; 0 if it has passed already
+ *
+ * @param deadline zclock_mono() timestamp (ms)
+ */
+int worker_time_left(int64_t deadline);
+
+/**
+ * Send a message to an external socket from within the worker thread
+ *
+ * The message is sent without blocking the worker thread: if @p socket cannot
+ * accept the message right away (EAGAIN) it is queued and sending it is
+ * retried periodically. Messages sent through this function are delivered
+ * in order.
+ *
+ * @param thread_ctx the worker thread context
+ * @param socket the destination socket
+ * @param msg_p message to send. The ownership of the message is passed on to
+ *              this function, @p msg_p is NULLed.
+ * @return OSD_OK if the message was sent or queued,
+ *         OSD_ERROR_COM if the backlog is full or sending failed for another
+ *         reason than the socket blocking, and the message was dropped
+ *
+ * @see worker_tx_flush()
+ */
+osd_result worker_tx(struct worker_thread_ctx *thread_ctx, zsock_t *socket,
+                     zmsg_t **msg_p);
+
+/**
+ * Send a message to a socket without blocking
+ *
+ * Unlike zmsg_send(), the message is left intact if it cannot be sent, e.g.
+ * to queue it and try again later.
+ *
+ * @param socket the destination socket
+ * @param msg_p message to send. Destroyed and NULLed if it was sent.
+ * @return 0 if the message was sent, -1 otherwise with errno set (EAGAIN if
+ *         the socket would block)
+ */
+int worker_send_nowait(zsock_t *socket, zmsg_t **msg_p);
+
+/**
+ * Send out all messages queued for a socket
+ *
+ * Call this function before destroying a socket which has been used with
+ * worker_tx(). Messages which cannot be sent within @p timeout_ms are
+ * discarded. The linger period of @p socket is set to the remaining time,
+ * giving ZeroMQ the chance to transmit its internal queue on destruction.
+ *
+ * @param thread_ctx the worker thread context
+ * @param socket socket to flush. Pass NULL to flush all queued messages.
+ * @param timeout_ms maximum time to spend on sending (in ms)
+ * @param stats updated with the number of flushed and dropped messages.
+ *              Can be NULL.
+ */
+void worker_tx_flush(struct worker_thread_ctx *thread_ctx, zsock_t *socket,
+                     int timeout_ms, struct osd_shutdown_stats *stats);
 
 /**
  * Send a data message to another thread over a ZeroMQ socket
@@ -127,4 +281,24 @@ void worker_send_status(zsock_t *socket, const char* name, int value);
 osd_result worker_wait_for_status(zsock_t *socket, const char* name,
                                   int *retvalue);
 
+/**
+ * Wait for a data message of a given name and copy its data
+ *
+ * Messages with a different name received in the meantime are discarded.
+ *
+ * @param socket socket to receive from
+ * @param name expected message name
+ * @param data buffer receiving the message data
+ * @param size size of @p data (bytes). The message must carry exactly
+ *             @p size bytes of data.
+ *
+ * @return OSD_ERROR_FAILURE if an unexpected error happened,
+ *         OSD_ERROR_TIMEDOUT if the wait timeout was exceeded
+ *         OSD_OK if operation was successful.
+ *
+ * @see worker_wait_for_status()
+ */
+osd_result worker_wait_for_data(zsock_t *socket, const char* name,
+                                void *data, size_t size);
+
 #endif // WORKER_H
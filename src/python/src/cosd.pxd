@@ -1,9 +1,12 @@
 from cutil cimport va_list
-from libc.stdint cimport uint16_t
+from libc.stdint cimport uint8_t, uint16_t, uint32_t, uint64_t
 
 cdef extern from "osd/osd.h":
     ctypedef int osd_result
 
+    int OSD_OK
+    int OSD_ERROR_EOF
+
     struct osd_log_ctx:
         pass
 
@@ -79,3 +82,46 @@ cdef extern from "osd/hostmod.h":
                                      int reg_size_bit, int flags)
 
     uint16_t osd_hostmod_get_diaddr(osd_hostmod_ctx *ctx)
+
+cdef extern from "osd/stm.h":
+    cdef enum osd_stm_event_type:
+        OSD_STM_EVENT_TRACE
+        OSD_STM_EVENT_OVERFLOW
+
+    struct osd_stm_event_columns:
+        size_t capacity
+        size_t len
+        uint8_t *type
+        uint32_t *timestamp
+        uint16_t *id
+        uint64_t *value
+        uint64_t invalid_packets
+
+    osd_result osd_stm_event_decode_batch(const osd_packet *const *packets,
+                                          size_t num_packets,
+                                          osd_stm_event_columns *columns,
+                                          size_t *num_consumed)
+
+cdef extern from "osd/tracefile.h":
+    struct osd_tracefile_reader:
+        pass
+
+    osd_result osd_tracefile_reader_new(osd_tracefile_reader **reader,
+                                        osd_log_ctx *log_ctx,
+                                        const char *path)
+
+    osd_result osd_tracefile_reader_next(osd_tracefile_reader *reader,
+                                         osd_packet **packet,
+                                         uint64_t *timestamp_ns)
+
+    uint64_t osd_tracefile_reader_get_packet_count(osd_tracefile_reader *reader)
+
+    osd_result osd_tracefile_reader_seek_packet(osd_tracefile_reader *reader,
+                                                uint64_t packet_idx)
+
+    osd_result osd_tracefile_reader_seek_time(osd_tracefile_reader *reader,
+                                              uint64_t timestamp_ns)
+
+    uint64_t osd_tracefile_reader_tell(osd_tracefile_reader *reader)
+
+    void osd_tracefile_reader_free(osd_tracefile_reader **reader)
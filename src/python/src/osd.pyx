@@ -1,7 +1,9 @@
 cimport cosd
 from cutil cimport va_list, vasprintf
 from libc.stdlib cimport free
-from libc.stdint cimport uint16_t
+from libc.stdint cimport uint16_t, uint64_t
+from cpython cimport array
+import array
 import logging
 
 cdef void log_cb(cosd.osd_log_ctx *ctx, int priority, const char *file,
@@ -166,3 +168,106 @@ cdef class Hostmod:
     def reg_write(self, data, diaddr, reg_addr, reg_size_bit = 16, flags = 0):
         cosd.osd_hostmod_reg_write(self._cself, data, diaddr, reg_addr,
                                    reg_size_bit, flags)
+
+cdef class TraceFile:
+    """
+    A trace file, as written by osd-systrace-log --output
+    """
+    cdef cosd.osd_tracefile_reader* _cself
+
+    def __cinit__(self, Log log, path):
+        py_byte_string = path.encode('UTF-8')
+        cdef char* c_path = py_byte_string
+        rv = cosd.osd_tracefile_reader_new(&self._cself, log._cself, c_path)
+        if rv != 0:
+            raise IOError("Unable to open trace file %s (rv=%d)" % (path, rv))
+
+    def __dealloc__(self):
+        if self._cself is not NULL:
+            cosd.osd_tracefile_reader_free(&self._cself)
+
+    @property
+    def packet_count(self):
+        """Number of packets in the file"""
+        return cosd.osd_tracefile_reader_get_packet_count(self._cself)
+
+    def tell(self):
+        """Number of the next packet to be read"""
+        return cosd.osd_tracefile_reader_tell(self._cself)
+
+    def seek_packet(self, packet_idx):
+        """
+        Continue reading at packet number packet_idx
+
+        Returns False if the file contains less packets.
+        """
+        return cosd.osd_tracefile_reader_seek_packet(self._cself,
+                                                     packet_idx) == 0
+
+    def seek_time(self, timestamp_ns):
+        """
+        Continue reading at the first packet received at or after timestamp_ns
+
+        Returns False if no such packet exists.
+        """
+        return cosd.osd_tracefile_reader_seek_time(self._cself,
+                                                   timestamp_ns) == 0
+
+    def read_stm_events(self, max_events = 1 << 20):
+        """
+        Read and decode up to max_events STM events
+
+        Returns a dictionary of columns (array.array objects) with the keys
+        'type', 'timestamp', 'id' and 'value', one entry per event. Overflow
+        events (type 1) store the number of lost events in 'value'. All
+        columns are empty when the end of the file has been reached.
+        'invalid_packets' is the number of packets which were skipped
+        because they could not be decoded as STM event.
+
+        Raises IOError if the trace file cannot be read.
+        """
+        cdef array.array type_col = array.array('B', [0]) * max_events
+        cdef array.array timestamp_col = array.array('I', [0]) * max_events
+        cdef array.array id_col = array.array('H', [0]) * max_events
+        cdef array.array value_col = array.array('Q', [0]) * max_events
+
+        cdef cosd.osd_stm_event_columns cols
+        cols.capacity = max_events
+        cols.len = 0
+        cols.type = type_col.data.as_uchars
+        cols.timestamp = timestamp_col.data.as_uints
+        cols.id = id_col.data.as_ushorts
+        cols.value = <uint64_t*>value_col.data.as_ulonglongs
+        cols.invalid_packets = 0
+
+        # read packets in chunks and decode each chunk at once
+        cdef cosd.osd_packet* pkgs[1024]
+        cdef size_t num_pkgs, num_consumed, i
+        cdef int rv = 0
+        while rv == 0 and cols.len < cols.capacity:
+            num_pkgs = 0
+            while num_pkgs < 1024 and num_pkgs < cols.capacity - cols.len:
+                rv = cosd.osd_tracefile_reader_next(self._cself,
+                                                    &pkgs[num_pkgs], NULL)
+                if rv != 0:
+                    break
+                num_pkgs += 1
+
+            if num_pkgs > 0:
+                cosd.osd_stm_event_decode_batch(
+                    <const cosd.osd_packet* const*>pkgs, num_pkgs, &cols,
+                    &num_consumed)
+            for i in range(num_pkgs):
+                cosd.osd_packet_free(&pkgs[i])
+
+        # OSD_ERROR_EOF only ends the read
+        if rv != cosd.OSD_OK and rv != cosd.OSD_ERROR_EOF:
+            raise IOError("Unable to read trace file (rv=%d)" % rv)
+
+        array.resize(type_col, cols.len)
+        array.resize(timestamp_col, cols.len)
+        array.resize(id_col, cols.len)
+        array.resize(value_col, cols.len)
+
+        return {'type': type_col, 'timestamp': timestamp_col, 'id': id_col,
+                'value': value_col, 'invalid_packets': cols.invalid_packets}
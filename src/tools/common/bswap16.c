@@ -0,0 +1,175 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#include "bswap16.h"
+
+#include <assert.h>
+#include <byteswap.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef void (*bswap16_fn)(uint16_t *buf, size_t size_words);
+
+static void bswap16_scalar(uint16_t *buf, size_t size_words)
+{
+    for (size_t i = 0; i < size_words; i++) {
+        buf[i] = bswap_16(buf[i]);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static void bswap16_sse2(uint16_t *buf, size_t size_words)
+{
+    size_t i = 0;
+    for (; i + 8 <= size_words; i += 8) {
+        __m128i *p = (__m128i*)&buf[i];
+        __m128i v = _mm_loadu_si128(p);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128(p, v);
+    }
+    bswap16_scalar(&buf[i], size_words - i);
+}
+
+__attribute__((target("ssse3")))
+static void bswap16_ssse3(uint16_t *buf, size_t size_words)
+{
+    const __m128i shuf = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                       9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 16 <= size_words; i += 16) {
+        __m128i *p = (__m128i*)&buf[i];
+        __m128i v0 = _mm_loadu_si128(p);
+        __m128i v1 = _mm_loadu_si128(p + 1);
+        _mm_storeu_si128(p, _mm_shuffle_epi8(v0, shuf));
+        _mm_storeu_si128(p + 1, _mm_shuffle_epi8(v1, shuf));
+    }
+    for (; i + 8 <= size_words; i += 8) {
+        __m128i *p = (__m128i*)&buf[i];
+        _mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), shuf));
+    }
+    bswap16_scalar(&buf[i], size_words - i);
+}
+
+__attribute__((target("avx2")))
+static void bswap16_avx2(uint16_t *buf, size_t size_words)
+{
+    const __m256i shuf = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                          9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6,
+                                          9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 32 <= size_words; i += 32) {
+        __m256i *p = (__m256i*)&buf[i];
+        __m256i v0 = _mm256_loadu_si256(p);
+        __m256i v1 = _mm256_loadu_si256(p + 1);
+        _mm256_storeu_si256(p, _mm256_shuffle_epi8(v0, shuf));
+        _mm256_storeu_si256(p + 1, _mm256_shuffle_epi8(v1, shuf));
+    }
+    for (; i + 16 <= size_words; i += 16) {
+        __m256i *p = (__m256i*)&buf[i];
+        _mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), shuf));
+    }
+    bswap16_scalar(&buf[i], size_words - i);
+}
+#endif // HAVE_X86_SIMD
+
+static const bswap16_fn bswap16_impls[BSWAP16_IMPL_COUNT] = {
+    [BSWAP16_IMPL_SCALAR] = bswap16_scalar,
+#ifdef HAVE_X86_SIMD
+    [BSWAP16_IMPL_SSE2] = bswap16_sse2,
+    [BSWAP16_IMPL_SSSE3] = bswap16_ssse3,
+    [BSWAP16_IMPL_AVX2] = bswap16_avx2,
+#endif
+};
+
+/** Implementation selected for this CPU (set on first use) */
+static bswap16_fn bswap16_selected;
+
+bool bswap16_impl_supported(enum bswap16_impl impl)
+{
+    switch (impl) {
+    case BSWAP16_IMPL_SCALAR:
+        return true;
+#ifdef HAVE_X86_SIMD
+    case BSWAP16_IMPL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case BSWAP16_IMPL_SSSE3:
+        return __builtin_cpu_supports("ssse3");
+    case BSWAP16_IMPL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* bswap16_impl_name(enum bswap16_impl impl)
+{
+    static const char *names[BSWAP16_IMPL_COUNT] = {
+        [BSWAP16_IMPL_SCALAR] = "scalar",
+        [BSWAP16_IMPL_SSE2] = "sse2",
+        [BSWAP16_IMPL_SSSE3] = "ssse3",
+        [BSWAP16_IMPL_AVX2] = "avx2",
+    };
+    assert(impl < BSWAP16_IMPL_COUNT);
+    return names[impl];
+}
+
+void bswap16_buf_impl(enum bswap16_impl impl, uint16_t *buf,
+                      size_t size_words)
+{
+    assert(impl < BSWAP16_IMPL_COUNT);
+    assert(bswap16_impls[impl]);
+    bswap16_impls[impl](buf, size_words);
+}
+
+static bswap16_fn bswap16_select(void)
+{
+    for (int impl = BSWAP16_IMPL_COUNT - 1; impl > BSWAP16_IMPL_SCALAR;
+         impl--) {
+        if (bswap16_impls[impl] && bswap16_impl_supported(impl)) {
+            return bswap16_impls[impl];
+        }
+    }
+    return bswap16_scalar;
+}
+
+void bswap16_buf(uint16_t *buf, size_t size_words)
+{
+    // Selecting the implementation is idempotent; a race between threads on
+    // the first call is harmless.
+    bswap16_fn fn = __atomic_load_n(&bswap16_selected, __ATOMIC_RELAXED);
+    if (!fn) {
+        fn = bswap16_select();
+        __atomic_store_n(&bswap16_selected, fn, __ATOMIC_RELAXED);
+    }
+    fn(buf, size_words);
+}
@@ -0,0 +1,103 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+/**
+ * Byte order conversion of 16 bit word buffers
+ *
+ * Data on the debug link (GLIP) is big endian, the host is (usually) little
+ * endian. These functions convert whole buffers in place, using SIMD
+ * instructions if the CPU supports them.
+ */
+
+#ifndef OSD_TOOLS_BSWAP16_H
+#define OSD_TOOLS_BSWAP16_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Implementations of the byte swapping kernel
+ */
+enum bswap16_impl {
+    BSWAP16_IMPL_SCALAR = 0,
+    BSWAP16_IMPL_SSE2,
+    BSWAP16_IMPL_SSSE3,
+    BSWAP16_IMPL_AVX2,
+    BSWAP16_IMPL_COUNT
+};
+
+/**
+ * Swap the bytes of all 16 bit words in a buffer (in place)
+ *
+ * The fastest implementation supported by the CPU is used.
+ *
+ * @param buf the buffer. No alignment is required.
+ * @param size_words number of 16 bit words in @p buf
+ */
+void bswap16_buf(uint16_t *buf, size_t size_words);
+
+/**
+ * Swap the bytes of all 16 bit words in a buffer using a given implementation
+ *
+ * Use this function only for testing and benchmarking, and only with
+ * implementations for which bswap16_impl_supported() returns true.
+ */
+void bswap16_buf_impl(enum bswap16_impl impl, uint16_t *buf,
+                      size_t size_words);
+
+/**
+ * Is an implementation supported by the CPU we're running on?
+ */
+bool bswap16_impl_supported(enum bswap16_impl impl);
+
+/**
+ * Get a human-readable name of an implementation
+ */
+const char* bswap16_impl_name(enum bswap16_impl impl);
+
+/**
+ * Convert a buffer of big endian words to native byte order (in place)
+ */
+static inline void be16_to_cpu_buf(uint16_t *buf, size_t size_words)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    bswap16_buf(buf, size_words);
+#endif
+}
+
+/**
+ * Convert a buffer of words in native byte order to big endian (in place)
+ */
+static inline void cpu_to_be16_buf(uint16_t *buf, size_t size_words)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    bswap16_buf(buf, size_words);
+#endif
+}
+
+#endif // OSD_TOOLS_BSWAP16_H
@@ -0,0 +1,1128 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+#define LOG_CATEGORY "gateway"
+
+#include "device_gateway.h"
+#include "bswap16.h"
+#include "device_transport.h"
+#include "dtd_capture.h"
+#include "dtd_filter.h"
+#include "dtd_queue.h"
+#include "tool-log.h"
+
+#include <osd/packet.h>
+
+#include <assert.h>
+#include <czmq.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * Size of the receive buffer (in 16 bit words)
+ *
+ * The buffer must be able to hold at least one DTD of maximum size (the
+ * length word plus 2^16 - 1 data words). Larger buffers allow to read more
+ * data with a single read call.
+ */
+#define RX_BUF_SIZE_WORDS (4 * 64 * 1024)
+
+/**
+ * Size of the transmit buffer (in 16 bit words)
+ *
+ * All messages pending from the host are collected in this buffer and written
+ * to the device with a single write call. Like the receive buffer it must be
+ * able to hold at least one DTD of maximum size.
+ */
+#define TX_BUF_SIZE_WORDS (4 * 64 * 1024)
+
+/**
+ * Size of the queue between a device reader thread and the host socket (in
+ * 16 bit words, a power of two)
+ */
+#define RX_QUEUE_SIZE_WORDS (4 * 64 * 1024)
+
+/**
+ * Log the statistics summary
+ *
+ * The summary is logged with warning priority, which is printed without
+ * prefix and already enabled by a single -v.
+ */
+#define stats_log(arg...) cli_log(LOG_WARNING, "stats", ## arg)
+
+/** Configuration of the running gateway */
+static const struct device_gateway_config *gw_config;
+
+/**
+ * Connection to the device
+ */
+static struct device_transport *device_transport;
+
+/**
+ * Socket to the host controller
+ *
+ * Only used from the zloop thread; the device reader threads hand over
+ * received data through a struct dtd_queue.
+ */
+static zsock_t *host_com_sock;
+
+/**
+ * Device channel used for control traffic (register accesses)
+ */
+#define DEVICE_CHANNEL_CTRL 0
+
+/**
+ * Throughput and timing counters of a device channel
+ *
+ * Every counter has a single writer: the rx_* counters are written by the
+ * reader thread of the channel, all others by the zloop thread. They can be
+ * read from any thread. All times are in microseconds.
+ */
+struct device_channel_stats {
+    /** bytes read from the device */
+    uint64_t rx_bytes;
+    /** number of read calls */
+    uint64_t rx_reads;
+    /** time spent in read calls (i.e. waiting for the device) */
+    uint64_t rx_read_us;
+    /** DTDs written to the capture */
+    uint64_t rx_captured_dtds;
+
+    /** DTDs sent to the host */
+    uint64_t host_dtds;
+    /** time spent creating and sending messages to the host */
+    uint64_t host_send_us;
+
+    /** DTDs received from the host */
+    uint64_t tx_dtds;
+    /** bytes written to the device */
+    uint64_t tx_bytes;
+    /** number of write calls */
+    uint64_t tx_writes;
+    /** time spent in write calls (i.e. waiting for the device) */
+    uint64_t tx_write_us;
+};
+
+/**
+ * A channel to the device
+ *
+ * Control and trace traffic can be mapped to different channels of the
+ * transport, each with its own buffers and reader thread. Control packets
+ * then don't have to wait behind trace data.
+ */
+struct device_channel {
+    /** channel number in the transport */
+    unsigned int channel;
+
+    /**
+     * Transmit buffer: DTDs waiting to be written to the device
+     *
+     * Only accessed from the zloop (host -> device) thread.
+     */
+    uint16_t *tx_buf;
+    /** Number of valid words in tx_buf */
+    size_t tx_fill_words;
+
+    /** Receive buffer (only accessed from rx_thread) */
+    uint16_t *rx_buf;
+    /** Thread reading data from this channel */
+    pthread_t rx_thread;
+    /** Error which made rx_thread stop (read after joining the thread) */
+    osd_result rx_thread_result;
+    /** DTDs received by rx_thread waiting to be sent to the host */
+    struct dtd_queue *rx_queue;
+    /** zloop poller item for rx_queue */
+    zmq_pollitem_t rx_queue_pollitem;
+
+    /** statistics */
+    struct device_channel_stats stats;
+    /** statistics at the time of the last summary (zloop thread only) */
+    struct device_channel_stats stats_last;
+    /** rx_queue statistics at the time of the last summary */
+    struct dtd_queue_stats rx_queue_stats_last;
+};
+
+/**
+ * All used device channels
+ *
+ * The first entry carries control traffic, the last entry event (trace)
+ * traffic. Both are the same if only one channel is used.
+ */
+static struct device_channel dev_channels[2];
+static unsigned int dev_channels_len;
+
+/**
+ * Filter for packets sent from the device to the host
+ *
+ * Configured with the --filter argument and at runtime with "FILTER <rule>"
+ * management messages (see rx_filter_add_rule()). Only used from the zloop
+ * thread.
+ */
+static struct dtd_filter *rx_filter;
+
+/**
+ * Filter for captured packets, or NULL if not capturing
+ *
+ * A separate instance with the same rules as rx_filter, only used by the
+ * reader thread of the trace channel. Rules added while the thread is running
+ * are queued in capture_filter_rules and applied by the thread itself, so
+ * that it doesn't need to take a lock for every packet.
+ */
+static struct dtd_filter *capture_filter;
+/** Rules waiting to be applied to capture_filter */
+static zlist_t *capture_filter_rules;
+/** Is capture_filter_rules non-empty? */
+static bool capture_filter_rules_pending;
+/** Protects capture_filter_rules */
+static pthread_mutex_t capture_filter_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Raw capture of event packets, or NULL if not capturing
+ *
+ * Only used by the reader thread of the trace channel.
+ */
+static struct dtd_capture *capture;
+
+/**
+ * Signalled (an eventfd) when a reader thread stops because of an error
+ *
+ * Polled by the zloop, which then ends the gateway.
+ */
+static int rx_thread_error_fd = -1;
+
+/** Time of the last statistics summary (zloop thread only) */
+static int64_t stats_last_us;
+
+/**
+ * Are we registered as gateway with the host controller?
+ *
+ * Cleared if the host controller doesn't know us any more; the registration
+ * is then retried with every heartbeat until it succeeds (zloop thread only).
+ */
+static bool gw_registered;
+
+
+/**
+ * Add to a statistics counter
+ *
+ * Must only be called by the thread owning the counter.
+ */
+static inline void stats_add(uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Write data to the device
+ *
+ * @param buf data to write in native endianness. The buffer is converted to
+ *            big endian in place, i.e. its contents are changed by this call.
+ * @param size_words number of words in @p buf
+ * @return number of words written, or -1 on error
+ */
+static ssize_t device_write(struct device_channel *ch, uint16_t *buf,
+                            size_t size_words)
+{
+    // OSD is big endian on the wire
+    cpu_to_be16_buf(buf, size_words);
+
+    int64_t t_start = zclock_usecs();
+    ssize_t bytes_written = device_transport_write(device_transport,
+                                                   ch->channel,
+                                                   (uint8_t*)buf,
+                                                   size_words * sizeof(uint16_t));
+    stats_add(&ch->stats.tx_write_us, zclock_usecs() - t_start);
+    stats_add(&ch->stats.tx_writes, 1);
+    if (bytes_written < 0) {
+        return -1;
+    }
+    stats_add(&ch->stats.tx_bytes, bytes_written);
+
+    size_t words_written = bytes_written / sizeof(uint16_t);
+    return words_written;
+}
+
+/**
+ * Connect to the device through the selected transport
+ */
+static osd_result open_device_transport(void)
+{
+    osd_result rv;
+    const char *transport = gw_config->transport;
+    char *options;
+
+    if (!strcmp(transport, "glip")) {
+        // GLIP options are configured separately
+        if (gw_config->glip_backend_options &&
+            gw_config->glip_backend_options[0]) {
+            options = zsys_sprintf("backend=%s,%s", gw_config->glip_backend,
+                                   gw_config->glip_backend_options);
+        } else {
+            options = zsys_sprintf("backend=%s", gw_config->glip_backend);
+        }
+    } else {
+        options = strdup(gw_config->transport_options ?
+                         gw_config->transport_options : "");
+    }
+
+    unsigned int num_channels = dev_channels[dev_channels_len - 1].channel + 1;
+    rv = device_transport_open(&device_transport, transport, options,
+                               num_channels, gw_config->log_level);
+    free(options);
+    if (OSD_FAILED(rv)) {
+        err("Unable to connect to device through transport %s (rv=%d).\n",
+            transport, rv);
+        return rv;
+    }
+    dbg("Connection to device established.\n");
+
+    return OSD_OK;
+}
+
+/**
+ * Write all DTDs collected in the transmit buffer of a channel to the device
+ */
+static void tx_flush(struct device_channel *ch)
+{
+    if (ch->tx_fill_words == 0) {
+        return;
+    }
+
+    dbg("Writing %zu words of DTDs to device channel %u\n", ch->tx_fill_words,
+        ch->channel);
+    ssize_t size_words_written = device_write(ch, ch->tx_buf,
+                                              ch->tx_fill_words);
+    if (size_words_written != (ssize_t)ch->tx_fill_words) {
+        err("Unable to write data to device (%zd of %zu words written).\n",
+            size_words_written, ch->tx_fill_words);
+    }
+    ch->tx_fill_words = 0;
+}
+
+/**
+ * Append a packet as Debug Transport Datagram (DTD) to the transmit buffer
+ *
+ * A DTD is a length-value encoded version of the osd packet: the first word
+ * is the length of the packet (in 16 bit words), followed by the packet data.
+ * If the transmit buffer is full it is flushed first.
+ */
+static void tx_append_dtd(struct device_channel *ch, const uint16_t *data,
+                          size_t data_size_words)
+{
+    assert(data_size_words <= UINT16_MAX);
+    assert(1 + data_size_words <= TX_BUF_SIZE_WORDS);
+
+    if (ch->tx_fill_words + 1 + data_size_words > TX_BUF_SIZE_WORDS) {
+        tx_flush(ch);
+    }
+
+    ch->tx_buf[ch->tx_fill_words] = data_size_words;
+    memcpy(&ch->tx_buf[ch->tx_fill_words + 1], data,
+           data_size_words * sizeof(uint16_t));
+    ch->tx_fill_words += 1 + data_size_words;
+    stats_add(&ch->stats.tx_dtds, 1);
+}
+
+/**
+ * Select the device channel for a packet
+ *
+ * Event packets go to the trace channel, everything else to the control
+ * channel.
+ */
+static struct device_channel* device_channel_for_packet(const uint16_t *data,
+                                                        size_t data_size_words)
+{
+    if (data_size_words >= 3) {
+        unsigned int type = (data[2] >> DP_HEADER_TYPE_SHIFT) &
+                            DP_HEADER_TYPE_MASK;
+        if (type == OSD_PACKET_TYPE_EVENT) {
+            return &dev_channels[dev_channels_len - 1];
+        }
+    }
+    return &dev_channels[0];
+}
+
+/**
+ * Add a rule to the receive filter
+ *
+ * The rule is applied to rx_filter right away and, if capturing, queued for
+ * capture_filter.
+ */
+static osd_result rx_filter_add_rule(const char *rule)
+{
+    osd_result rv = dtd_filter_add_rule(rx_filter, rule);
+    if (OSD_FAILED(rv) || !capture_filter) {
+        return rv;
+    }
+
+    pthread_mutex_lock(&capture_filter_lock);
+    zlist_append(capture_filter_rules, (void*)rule);
+    __atomic_store_n(&capture_filter_rules_pending, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&capture_filter_lock);
+    return OSD_OK;
+}
+
+/**
+ * Number of packets dropped by the receive filter (zloop thread)
+ */
+static uint64_t rx_filter_get_dropped(void)
+{
+    uint64_t dropped = dtd_filter_get_dropped(rx_filter);
+    if (capture_filter) {
+        dropped += dtd_filter_get_dropped(capture_filter);
+    }
+    return dropped;
+}
+
+/**
+ * Process a management message received from the host controller
+ */
+static void process_mgmt_msg(zmsg_t *msg)
+{
+    char *payload = zmsg_popstr(msg);
+    if (!payload) {
+        err("Received empty management message. Ignoring.\n");
+        return;
+    }
+
+    if (!strcmp(payload, "PONG")) {
+        // response to a heartbeat
+    } else if (!strcmp(payload, "ACK")) {
+        // response to a re-registration
+        if (!gw_registered) {
+            info("Registered again as gateway for subnet %u.\n",
+                 gw_config->subnet);
+            gw_registered = true;
+        }
+    } else if (!strcmp(payload, "NACK")) {
+        // response to a re-registration; retried with the next heartbeat
+        err("Host controller refused our registration as gateway for subnet "
+            "%u. Retrying.\n", gw_config->subnet);
+    } else if (!strcmp(payload, "UNKNOWN_PEER")) {
+        // The host controller doesn't know us (any more), most likely
+        // because it has been restarted. Register again with the next
+        // heartbeat.
+        if (gw_registered) {
+            info("Host controller lost our registration. Re-registering as "
+                 "gateway for subnet %u.\n", gw_config->subnet);
+            gw_registered = false;
+        }
+    } else if (!strncmp(payload, "DEST_UNREACHABLE",
+                        strlen("DEST_UNREACHABLE"))) {
+        dbg("Host controller reported %s\n", payload);
+    } else if (!strncmp(payload, "FILTER ", strlen("FILTER "))) {
+        const char *rule = payload + strlen("FILTER ");
+        osd_result rv = rx_filter_add_rule(rule);
+        if (OSD_FAILED(rv)) {
+            err("Ignoring invalid filter rule '%s'.\n", rule);
+        } else {
+            info("Applied filter rule '%s'.\n", rule);
+        }
+    } else {
+        err("Unknown management message '%s' received. Ignoring.\n",
+            payload);
+    }
+    free(payload);
+}
+
+/**
+ * Process a message received from the host controller
+ *
+ * Data messages are appended to the transmit buffer, management messages
+ * are handled immediately.
+ */
+static void process_host_msg(zmsg_t *msg)
+{
+    zframe_t *type_frame = zmsg_pop(msg);
+    if (zframe_streq(type_frame, "D")) {
+        zframe_t *data_frame = zmsg_pop(msg);
+        assert(data_frame);
+        uint16_t *data = (uint16_t*)zframe_data(data_frame);
+        size_t data_size_words = zframe_size(data_frame) / sizeof(uint16_t);
+        assert(data);
+
+        tx_append_dtd(device_channel_for_packet(data, data_size_words),
+                      data, data_size_words);
+        zframe_destroy(&data_frame);
+
+    } else if (zframe_streq(type_frame, "M")) {
+        process_mgmt_msg(msg);
+
+    } else {
+        err("Message of unknown type received. Ignoring.\n");
+    }
+
+    zframe_destroy(&type_frame);
+}
+
+/**
+ * Send packets received on the host to the device
+ *
+ * All messages which are pending on the host socket are collected into the
+ * transmit buffer and then written to the device with a single write call.
+ * This makes bursts of packets (e.g. memory loads) reach link bandwidth.
+ *
+ * This function is registered as zloop reactor.
+ */
+static int send_to_device(zloop_t *loop, zsock_t *reader, void *arg)
+{
+    zmsg_t *msg = zmsg_recv(reader);
+    if (!msg) {
+        return -1; // process interrupted
+    }
+
+    while (msg) {
+        process_host_msg(msg);
+        zmsg_destroy(&msg);
+
+        // drain all further messages available without blocking
+        if (!(zsock_events(reader) & ZMQ_POLLIN)) {
+            break;
+        }
+        msg = zmsg_recv(reader);
+    }
+
+    // control traffic first to keep its latency low
+    for (unsigned int i = 0; i < dev_channels_len; i++) {
+        tx_flush(&dev_channels[i]);
+    }
+
+    return 0;
+}
+
+/**
+ * Send a heartbeat message to the host controller
+ *
+ * If the host controller lost our registration, try to register again
+ * instead.
+ *
+ * This function is registered as zloop timer.
+ */
+static int send_heartbeat(zloop_t *loop, int timer_id, void *arg)
+{
+    zmsg_t *msg = zmsg_new();
+    zmsg_addstr(msg, "M");
+    if (gw_registered) {
+        zmsg_addstr(msg, "PING");
+    } else {
+        zmsg_addstrf(msg, "GW_REGISTER %u", gw_config->subnet);
+    }
+
+    zmsg_send(&msg, host_com_sock);
+    zmsg_destroy(&msg);
+
+    return 0;
+}
+
+/**
+ * Register this tool as gateway for a given subnet
+ */
+static osd_result osd_hostcom_register_subnet_gw(unsigned int subnet)
+{
+    osd_result rv = OSD_OK;
+    zmsg_t *msg;
+
+    msg = zmsg_new();
+    zmsg_addstrf(msg, "M");
+    zmsg_addstrf(msg, "GW_REGISTER %u", subnet);
+    zmsg_send(&msg, host_com_sock);
+    zmsg_destroy(&msg);
+
+    // process reply
+    msg = zmsg_recv(host_com_sock);
+    if (!msg) {
+        // process interrupted, e.g. the user pressed CTRL-C
+        return OSD_ERROR_ABORTED;
+    }
+
+    char* msg_type = zmsg_popstr(msg);
+    char* response = zmsg_popstr(msg);
+    if (!msg_type || strcmp(msg_type, "M") != 0) {
+        err("Received invalid response of type %s\n", msg_type);
+        rv = OSD_ERROR_FAILURE;
+    } else if (!response || strcmp(response, "ACK") != 0) {
+        err("Received %s when expecting 'ACK'.\n", response);
+        rv = OSD_ERROR_FAILURE;
+    } else {
+        dbg("Registered as gateway for subnet %u with host controller\n",
+            subnet);
+    }
+
+    free(msg_type);
+    free(response);
+    zmsg_destroy(&msg);
+    return rv;
+}
+
+/**
+ * Send DTDs received from the device to the host controller
+ *
+ * This function is registered as zloop poller on the receive queue of a
+ * device channel.
+ */
+static int send_to_host(zloop_t *loop, zmq_pollitem_t *item, void *arg)
+{
+    struct device_channel *ch = arg;
+
+    int64_t t_start = zclock_usecs();
+    size_t dtds_sent = dtd_queue_drain(ch->rx_queue, host_com_sock,
+                                       rx_filter);
+    stats_add(&ch->stats.host_send_us, zclock_usecs() - t_start);
+    stats_add(&ch->stats.host_dtds, dtds_sent);
+    dbg("Forwarded %zu DTDs received from device channel %u\n", dtds_sent,
+        ch->channel);
+
+    return 0;
+}
+
+/**
+ * Copy the statistics of a channel while they are being updated
+ */
+static void stats_snapshot(const struct device_channel_stats *src,
+                           struct device_channel_stats *dest)
+{
+    dest->rx_bytes = __atomic_load_n(&src->rx_bytes, __ATOMIC_RELAXED);
+    dest->rx_reads = __atomic_load_n(&src->rx_reads, __ATOMIC_RELAXED);
+    dest->rx_read_us = __atomic_load_n(&src->rx_read_us, __ATOMIC_RELAXED);
+    dest->rx_captured_dtds = __atomic_load_n(&src->rx_captured_dtds,
+                                             __ATOMIC_RELAXED);
+    dest->host_dtds = src->host_dtds;
+    dest->host_send_us = src->host_send_us;
+    dest->tx_dtds = src->tx_dtds;
+    dest->tx_bytes = src->tx_bytes;
+    dest->tx_writes = src->tx_writes;
+    dest->tx_write_us = src->tx_write_us;
+}
+
+/**
+ * Print a summary of the link utilization since the last summary
+ *
+ * For each channel the summary shows the throughput in both directions, the
+ * average size of read and write calls, and the fraction of time spent
+ * waiting for the device (in read/write calls), sending messages to the host,
+ * and blocked on a full receive queue. A reader thread which is mostly
+ * blocked on a full queue indicates a bottleneck on the host side, a reader
+ * thread which is mostly waiting in read calls a bottleneck on the device
+ * side.
+ *
+ * This function is registered as zloop timer.
+ */
+static int print_stats(zloop_t *loop, int timer_id, void *arg)
+{
+    int64_t now_us = zclock_usecs();
+    double interval_s = (now_us - stats_last_us) / 1e6;
+    double interval_us = now_us - stats_last_us;
+    stats_last_us = now_us;
+    if (interval_s <= 0) {
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < dev_channels_len; i++) {
+        struct device_channel *ch = &dev_channels[i];
+        struct device_channel_stats cur, d;
+        stats_snapshot(&ch->stats, &cur);
+        d.rx_bytes = cur.rx_bytes - ch->stats_last.rx_bytes;
+        d.rx_reads = cur.rx_reads - ch->stats_last.rx_reads;
+        d.rx_read_us = cur.rx_read_us - ch->stats_last.rx_read_us;
+        d.rx_captured_dtds = cur.rx_captured_dtds -
+                             ch->stats_last.rx_captured_dtds;
+        d.host_dtds = cur.host_dtds - ch->stats_last.host_dtds;
+        d.host_send_us = cur.host_send_us - ch->stats_last.host_send_us;
+        d.tx_dtds = cur.tx_dtds - ch->stats_last.tx_dtds;
+        d.tx_bytes = cur.tx_bytes - ch->stats_last.tx_bytes;
+        d.tx_writes = cur.tx_writes - ch->stats_last.tx_writes;
+        d.tx_write_us = cur.tx_write_us - ch->stats_last.tx_write_us;
+        ch->stats_last = cur;
+
+        struct dtd_queue_stats qstats;
+        dtd_queue_get_stats(ch->rx_queue, &qstats);
+        uint64_t blocked_us = qstats.producer_blocked_us -
+                              ch->rx_queue_stats_last.producer_blocked_us;
+        uint64_t dtds_pushed = qstats.dtds_pushed -
+                               ch->rx_queue_stats_last.dtds_pushed;
+        ch->rx_queue_stats_last = qstats;
+
+        stats_log("channel %u device -> host: %.2f MB/s, %.0f DTDs/s "
+                  "(%.0f/s sent to host), %.0f reads/s of %.0f bytes avg., "
+                  "%.1f%% waiting for device, %.1f%% blocked on full queue "
+                  "(max. %.1f%% full), %.1f%% sending to host",
+                  ch->channel,
+                  d.rx_bytes / interval_s / 1e6,
+                  dtds_pushed / interval_s,
+                  d.host_dtds / interval_s,
+                  d.rx_reads / interval_s,
+                  d.rx_reads ? (double)d.rx_bytes / d.rx_reads : 0.0,
+                  100.0 * d.rx_read_us / interval_us,
+                  100.0 * blocked_us / interval_us,
+                  100.0 * qstats.max_fill_words / qstats.size_words,
+                  100.0 * d.host_send_us / interval_us);
+        if (capture && ch == &dev_channels[dev_channels_len - 1]) {
+            stats_log("channel %u capture: %.0f DTDs/s", ch->channel,
+                      d.rx_captured_dtds / interval_s);
+        }
+        stats_log("channel %u host -> device: %.2f MB/s, %.0f DTDs/s, "
+                  "%.0f writes/s of %.0f bytes avg., %.1f%% waiting for "
+                  "device",
+                  ch->channel,
+                  d.tx_bytes / interval_s / 1e6,
+                  d.tx_dtds / interval_s,
+                  d.tx_writes / interval_s,
+                  d.tx_writes ? (double)d.tx_bytes / d.tx_writes : 0.0,
+                  100.0 * d.tx_write_us / interval_us);
+    }
+
+    uint64_t dropped = rx_filter_get_dropped();
+    if (dropped) {
+        stats_log("%" PRIu64 " packets dropped by the filter in total",
+                  dropped);
+    }
+
+    return 0;
+}
+
+/**
+ * Stop the gateway because a reader thread failed
+ *
+ * Called by the reader thread of @p ch before it exits.
+ */
+static void rx_thread_fail(struct device_channel *ch, osd_result result)
+{
+    ch->rx_thread_result = result;
+
+    uint64_t one = 1;
+    ssize_t rv;
+    do {
+        rv = write(rx_thread_error_fd, &one, sizeof(one));
+    } while (rv == -1 && errno == EINTR);
+}
+
+/**
+ * End the zloop after a reader thread failed
+ *
+ * This function is registered as zloop poller on rx_thread_error_fd.
+ */
+static int rx_thread_failed(zloop_t *loop, zmq_pollitem_t *item, void *arg)
+{
+    err("Data from the device can't be processed any more. Stopping.\n");
+    return -1;
+}
+
+/**
+ * Read data from a device channel encoded as Debug Transport Datagrams (DTDs)
+ *
+ * Data is read in large chunks into a receive buffer, from which all complete
+ * DTDs are pushed to the receive queue of the channel. The (incomplete) rest
+ * is moved to the beginning of the buffer and completed by the next read.
+ * The zloop thread sends the queued DTDs to the host controller.
+ *
+ * @param arg the struct device_channel to read from
+ */
+static void* thread_device_receive(void *arg)
+{
+    struct device_channel *ch = arg;
+    uint16_t *rx_buf = ch->rx_buf;
+
+    // number of valid bytes in rx_buf
+    size_t fill_bytes = 0;
+    // number of words in rx_buf already converted to native endianness
+    size_t swapped_words = 0;
+
+    while (1) {
+        int64_t t_start = zclock_usecs();
+        ssize_t bytes_read = device_transport_read(device_transport,
+                ch->channel, (uint8_t*)rx_buf + fill_bytes,
+                RX_BUF_SIZE_WORDS * sizeof(uint16_t) - fill_bytes);
+        stats_add(&ch->stats.rx_read_us, zclock_usecs() - t_start);
+        stats_add(&ch->stats.rx_reads, 1);
+        if (bytes_read < 0) {
+            err("Unable to receive data from device. Aborting.\n");
+            rx_thread_fail(ch, OSD_ERROR_DEVICE_ERROR);
+            break;
+        }
+        stats_add(&ch->stats.rx_bytes, bytes_read);
+        fill_bytes += bytes_read;
+
+        // GLIP and OSD are big endian; convert all complete words
+        size_t fill_words = fill_bytes / sizeof(uint16_t);
+        be16_to_cpu_buf(rx_buf + swapped_words, fill_words - swapped_words);
+        swapped_words = fill_words;
+
+        size_t consumed_words = dtd_queue_push(ch->rx_queue, rx_buf,
+                                               fill_words);
+
+        // move the remainder to the beginning of the buffer
+        if (consumed_words > 0) {
+            size_t consumed_bytes = consumed_words * sizeof(uint16_t);
+            memmove(rx_buf, (uint8_t*)rx_buf + consumed_bytes,
+                    fill_bytes - consumed_bytes);
+            fill_bytes -= consumed_bytes;
+            swapped_words -= consumed_words;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Is a DTD (in wire format) an event packet?
+ */
+static bool dtd_is_event(const uint16_t *dtd)
+{
+    if (be16toh(dtd[0]) < 3) {
+        return false;
+    }
+    unsigned int type = (be16toh(dtd[3]) >> DP_HEADER_TYPE_SHIFT) &
+                        DP_HEADER_TYPE_MASK;
+    return type == OSD_PACKET_TYPE_EVENT;
+}
+
+/**
+ * Apply the rules queued by rx_filter_add_rule() to capture_filter
+ *
+ * Only called from the capture thread.
+ */
+static void capture_filter_update(void)
+{
+    if (!__atomic_load_n(&capture_filter_rules_pending, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    pthread_mutex_lock(&capture_filter_lock);
+    char *rule;
+    while ((rule = zlist_pop(capture_filter_rules))) {
+        // the rule has already been validated on rx_filter
+        osd_result rv = dtd_filter_add_rule(capture_filter, rule);
+        assert(OSD_SUCCEEDED(rv));
+        free(rule);
+    }
+    __atomic_store_n(&capture_filter_rules_pending, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&capture_filter_lock);
+}
+
+/**
+ * Should a DTD (in wire format) be captured according to capture_filter?
+ */
+static bool dtd_capture_filter_match(const uint16_t *dtd)
+{
+    size_t pkg_size_words = be16toh(dtd[0]);
+    uint16_t hdr[3];
+    for (size_t i = 0; i < 3 && i < pkg_size_words; i++) {
+        hdr[i] = be16toh(dtd[1 + i]);
+    }
+
+    return dtd_filter_match(capture_filter, hdr, pkg_size_words);
+}
+
+/**
+ * Capture event packets from the trace channel
+ *
+ * Like thread_device_receive(), but event packets are written to the raw
+ * capture without decoding them or sending them to the host. If the trace
+ * channel is shared with control traffic all other packets are still
+ * forwarded to the host. Packets dropped by the receive filter are neither
+ * captured nor forwarded.
+ *
+ * @param arg the struct device_channel to read from
+ */
+static void* thread_device_capture(void *arg)
+{
+    struct device_channel *ch = arg;
+    uint16_t *rx_buf = ch->rx_buf;
+    bool shared = (dev_channels_len == 1);
+    osd_result rv;
+
+    // number of valid bytes in rx_buf
+    size_t fill_bytes = 0;
+
+    while (1) {
+        int64_t t_start = zclock_usecs();
+        ssize_t bytes_read = device_transport_read(device_transport,
+                ch->channel, (uint8_t*)rx_buf + fill_bytes,
+                RX_BUF_SIZE_WORDS * sizeof(uint16_t) - fill_bytes);
+        stats_add(&ch->stats.rx_read_us, zclock_usecs() - t_start);
+        stats_add(&ch->stats.rx_reads, 1);
+        if (bytes_read < 0) {
+            err("Unable to receive data from device. Aborting.\n");
+            rx_thread_fail(ch, OSD_ERROR_DEVICE_ERROR);
+            break;
+        }
+        stats_add(&ch->stats.rx_bytes, bytes_read);
+        fill_bytes += bytes_read;
+        size_t fill_words = fill_bytes / sizeof(uint16_t);
+
+        capture_filter_update();
+
+        // Walk the complete DTDs (still big endian). Runs of event packets
+        // are captured as they are; everything else is converted and
+        // forwarded to the host.
+        size_t pos = 0;
+        size_t run_start = 0;
+        size_t run_dtds = 0;
+        while (pos < fill_words) {
+            size_t dtd_size_words = 1 + be16toh(rx_buf[pos]);
+            if (fill_words - pos < dtd_size_words) {
+                break;
+            }
+            // forwarded packets are filtered when sending them to the host
+            bool forward = shared && !dtd_is_event(&rx_buf[pos]);
+            if (forward || !dtd_capture_filter_match(&rx_buf[pos])) {
+                // end the current run of captured packets
+                if (run_dtds) {
+                    rv = dtd_capture_write(capture,
+                                           (uint8_t*)&rx_buf[run_start],
+                                           (pos - run_start) * sizeof(uint16_t),
+                                           run_dtds);
+                    if (OSD_FAILED(rv)) {
+                        err("Unable to write capture. Aborting.\n");
+                        rx_thread_fail(ch, rv);
+                        return NULL;
+                    }
+                    stats_add(&ch->stats.rx_captured_dtds, run_dtds);
+                }
+                if (forward) {
+                    be16_to_cpu_buf(&rx_buf[pos], dtd_size_words);
+                    size_t pushed_words = 0;
+                    while (pushed_words < dtd_size_words) {
+                        pushed_words += dtd_queue_push(ch->rx_queue,
+                                &rx_buf[pos + pushed_words],
+                                dtd_size_words - pushed_words);
+                    }
+                }
+                run_start = pos + dtd_size_words;
+                run_dtds = 0;
+            } else {
+                run_dtds++;
+            }
+            pos += dtd_size_words;
+        }
+        if (run_dtds) {
+            rv = dtd_capture_write(capture, (uint8_t*)&rx_buf[run_start],
+                                   (pos - run_start) * sizeof(uint16_t),
+                                   run_dtds);
+            if (OSD_FAILED(rv)) {
+                err("Unable to write capture. Aborting.\n");
+                rx_thread_fail(ch, rv);
+                return NULL;
+            }
+            stats_add(&ch->stats.rx_captured_dtds, run_dtds);
+        }
+
+        // move the remainder to the beginning of the buffer
+        if (pos > 0) {
+            size_t consumed_bytes = pos * sizeof(uint16_t);
+            memmove(rx_buf, (uint8_t*)rx_buf + consumed_bytes,
+                    fill_bytes - consumed_bytes);
+            fill_bytes -= consumed_bytes;
+        }
+    }
+
+    return NULL;
+}
+
+osd_result device_gateway_run(const struct device_gateway_config *config)
+{
+    osd_result retval;
+    osd_result rv;
+    int rc;
+
+    assert(config);
+    gw_config = config;
+
+    // map traffic to device channels
+    dev_channels[0].channel = DEVICE_CHANNEL_CTRL;
+    dev_channels_len = 1;
+    if (config->trace_channel != DEVICE_CHANNEL_CTRL) {
+        dev_channels[1].channel = config->trace_channel;
+        dev_channels_len = 2;
+    }
+    for (unsigned int i = 0; i < dev_channels_len; i++) {
+        dev_channels[i].tx_buf = malloc(TX_BUF_SIZE_WORDS * sizeof(uint16_t));
+        dev_channels[i].rx_buf = malloc(RX_BUF_SIZE_WORDS * sizeof(uint16_t));
+        assert(dev_channels[i].tx_buf && dev_channels[i].rx_buf);
+        dev_channels[i].tx_fill_words = 0;
+        dev_channels[i].rx_thread_result = OSD_OK;
+        rv = dtd_queue_new(&dev_channels[i].rx_queue, RX_QUEUE_SIZE_WORDS);
+        assert(OSD_SUCCEEDED(rv));
+    }
+
+    rv = dtd_filter_new(&rx_filter);
+    assert(OSD_SUCCEEDED(rv));
+    if (config->capture_path) {
+        rv = dtd_filter_new(&capture_filter);
+        assert(OSD_SUCCEEDED(rv));
+        capture_filter_rules = zlist_new();
+        assert(capture_filter_rules);
+        zlist_autofree(capture_filter_rules);
+    }
+    for (size_t i = 0; i < config->filter_rules_len; i++) {
+        rv = rx_filter_add_rule(config->filter_rules[i]);
+        if (OSD_FAILED(rv)) {
+            err("Invalid filter rule '%s'.\n", config->filter_rules[i]);
+            retval = rv;
+            goto free_return;
+        }
+    }
+
+    if (config->capture_path) {
+        rv = dtd_capture_new(&capture, config->capture_path,
+                             config->capture_rotate_size_bytes,
+                             config->capture_direct);
+        if (OSD_FAILED(rv)) {
+            retval = rv;
+            goto free_return;
+        }
+        info("Capturing event packets to %s\n", config->capture_path);
+    }
+
+    // connect to device
+    rv = open_device_transport();
+    if (OSD_FAILED(rv)) {
+        retval = rv;
+        goto free_return;
+    }
+
+    // initialize communication with host controller
+    host_com_sock = zsock_new_dealer(config->host_controller_address);
+    if (!host_com_sock) {
+        err("Unable to connect to host controller at %s.\n",
+            config->host_controller_address);
+        retval = OSD_ERROR_CONNECTION_FAILED;
+        goto free_return;
+    }
+
+    rv = osd_hostcom_register_subnet_gw(config->subnet);
+    if (OSD_FAILED(rv)) {
+        retval = rv;
+        goto free_return;
+    }
+    gw_registered = true;
+
+    rx_thread_error_fd = eventfd(0, EFD_CLOEXEC);
+    if (rx_thread_error_fd == -1) {
+        err("Unable to create eventfd: %s\n", strerror(errno));
+        retval = OSD_ERROR_FAILURE;
+        goto free_return;
+    }
+
+    // connect data path between host controller and device
+    // device -> host: one reader thread per channel
+    for (unsigned int i = 0; i < dev_channels_len; i++) {
+        void* (*thread_fn)(void*) = thread_device_receive;
+        if (capture && i == dev_channels_len - 1) {
+            thread_fn = thread_device_capture;
+        }
+        rc = pthread_create(&dev_channels[i].rx_thread, 0, thread_fn,
+                            &dev_channels[i]);
+        if (rc) {
+            err("Unable to create thread_device_receive: %d\n", rc);
+            dev_channels_len = i;
+            retval = OSD_ERROR_FAILURE;
+            goto stop_threads;
+        }
+    }
+
+    // The zloop owns the host socket: it sends data from the device to the
+    // host (handed over by the reader threads), and host -> device
+    zloop_t* loop = zloop_new();
+    for (unsigned int i = 0; i < dev_channels_len; i++) {
+        zmq_pollitem_t *item = &dev_channels[i].rx_queue_pollitem;
+        item->socket = NULL;
+        item->fd = dtd_queue_get_fd(dev_channels[i].rx_queue);
+        item->events = ZMQ_POLLIN;
+        rc = zloop_poller(loop, item, send_to_host, &dev_channels[i]);
+        assert(rc == 0);
+    }
+    zmq_pollitem_t rx_thread_error_item = {
+        .socket = NULL,
+        .fd = rx_thread_error_fd,
+        .events = ZMQ_POLLIN,
+    };
+    rc = zloop_poller(loop, &rx_thread_error_item, rx_thread_failed, NULL);
+    assert(rc == 0);
+    rc = zloop_reader(loop, host_com_sock, send_to_device, NULL);
+    assert(rc == 0);
+    zloop_reader_set_tolerant(loop, host_com_sock);
+    rc = zloop_timer(loop, OSD_HEARTBEAT_INTERVAL_MS, 0, send_heartbeat, NULL);
+    assert(rc != -1);
+    if (config->stats_interval_s > 0 && config->log_level >= LOG_WARNING) {
+        stats_last_us = zclock_usecs();
+        rc = zloop_timer(loop, config->stats_interval_s * 1000, 0,
+                         print_stats, NULL);
+        assert(rc != -1);
+    }
+    zloop_start(loop);
+
+    zloop_destroy(&loop);
+    retval = OSD_OK;
+
+stop_threads:
+    // clean up device -> host path
+    for (unsigned int i = 0; i < dev_channels_len; i++) {
+        pthread_cancel(dev_channels[i].rx_thread);
+        pthread_join(dev_channels[i].rx_thread, NULL);
+        if (OSD_SUCCEEDED(retval) &&
+            OSD_FAILED(dev_channels[i].rx_thread_result)) {
+            retval = dev_channels[i].rx_thread_result;
+        }
+    }
+
+free_return:
+    if (rx_thread_error_fd != -1) {
+        close(rx_thread_error_fd);
+        rx_thread_error_fd = -1;
+    }
+    zsock_destroy(&host_com_sock);
+    device_transport_close(&device_transport);
+    dtd_capture_free(&capture);
+    for (unsigned int i = 0; i < 2; i++) {
+        free(dev_channels[i].tx_buf);
+        dev_channels[i].tx_buf = NULL;
+        free(dev_channels[i].rx_buf);
+        dev_channels[i].rx_buf = NULL;
+        dtd_queue_free(&dev_channels[i].rx_queue);
+    }
+    if (rx_filter && rx_filter_get_dropped()) {
+        info("%" PRIu64 " packets from the device were dropped by the "
+             "filter.\n", rx_filter_get_dropped());
+    }
+    dtd_filter_free(&rx_filter);
+    dtd_filter_free(&capture_filter);
+    zlist_destroy(&capture_filter_rules);
+    capture_filter_rules_pending = false;
+    gw_registered = false;
+    gw_config = NULL;
+
+    return retval;
+}
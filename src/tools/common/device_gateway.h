@@ -0,0 +1,131 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+/**
+ * Device gateway: connect a device to a host controller
+ *
+ * The gateway forwards packets between a device, reached through a
+ * struct device_transport, and a host controller. It registers as gateway
+ * for a subnet with the host controller, which then routes all packets for
+ * this subnet to it.
+ *
+ * Device -> host: one reader thread per device channel reads large chunks
+ * of Debug Transport Datagrams (DTDs) and hands them over to the gateway
+ * thread through a lock-free struct dtd_queue. The gateway thread filters
+ * them (see struct dtd_filter) and sends them to the host controller.
+ *
+ * Host -> device: all packets pending from the host controller are
+ * collected per device channel and written to the device with a single
+ * write call.
+ *
+ * The gateway is used by osd-device-gateway, which connects to a separate
+ * host controller, and by osd-daemon, which runs the host controller in the
+ * same process and connects to it through an inproc endpoint. Only one
+ * gateway can run in a process at a time.
+ */
+
+#ifndef OSD_TOOLS_DEVICE_GATEWAY_H
+#define OSD_TOOLS_DEVICE_GATEWAY_H
+
+#include <osd/osd.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Configuration of a device gateway
+ */
+struct device_gateway_config {
+    /** ZeroMQ endpoint of the host controller */
+    const char *host_controller_address;
+    /** subnet the gateway is responsible for */
+    unsigned int subnet;
+
+    /** transport to the device (see device_transport_open()) */
+    const char *transport;
+    /**
+     * Transport options (ignored for the glip transport, which uses
+     * glip_backend and glip_backend_options instead)
+     */
+    const char *transport_options;
+    /** GLIP backend name */
+    const char *glip_backend;
+    /** GLIP backend options (may be empty) */
+    const char *glip_backend_options;
+
+    /**
+     * Device channel for event (trace) packets. If this is the control
+     * channel (0), all traffic shares one channel.
+     */
+    unsigned int trace_channel;
+
+    /** initial filter rules for packets from the device (see dtd_filter) */
+    const char * const *filter_rules;
+    /** number of entries in filter_rules */
+    size_t filter_rules_len;
+
+    /**
+     * Interval of the throughput summary (in s), 0 to disable. The summary
+     * is logged with warning priority.
+     */
+    unsigned int stats_interval_s;
+
+    /**
+     * Raw capture file for trace data, or NULL to send it to the host
+     *
+     * All packets received on the trace channel are written to this file
+     * (see dtd_capture.h) instead of being sent to the host controller. If
+     * the trace channel is shared with control traffic only event packets
+     * are captured, and all other packets are forwarded as usual.
+     */
+    const char *capture_path;
+    /** maximum size of a capture file before rotating, 0 for no limit */
+    uint64_t capture_rotate_size_bytes;
+    /** write the capture with O_DIRECT */
+    bool capture_direct;
+
+    /** log level (as in syslog.h) */
+    int log_level;
+};
+
+/**
+ * Run a device gateway
+ *
+ * Connects to the device and the host controller and forwards packets
+ * between them until the process is interrupted (SIGINT or SIGTERM, see
+ * zsys_interrupted), or until reading from the device or writing the capture
+ * fails.
+ *
+ * @param config configuration of the gateway
+ * @return OSD_OK if the gateway was shut down regularly, any other value
+ *         indicates an error
+ */
+osd_result device_gateway_run(const struct device_gateway_config *config);
+
+#endif // OSD_TOOLS_DEVICE_GATEWAY_H
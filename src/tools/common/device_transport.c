@@ -0,0 +1,114 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#define LOG_CATEGORY "device-transport"
+
+#include "device_transport.h"
+#include "tool-log.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct device_transport_ops *transports[] = {
+    &device_transport_glip_ops,
+    &device_transport_sim_ops,
+    &device_transport_replay_ops,
+};
+
+osd_result device_transport_open(struct device_transport **transport,
+                                 const char *name, const char *options,
+                                 unsigned int num_channels, int log_level)
+{
+    osd_result rv;
+
+    assert(num_channels >= 1);
+
+    const struct device_transport_ops *ops = NULL;
+    for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]); i++) {
+        if (!strcmp(transports[i]->name, name)) {
+            ops = transports[i];
+            break;
+        }
+    }
+    if (!ops) {
+        err("Unknown device transport '%s'.\n", name);
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct device_transport *t = calloc(1, sizeof(struct device_transport));
+    if (!t) {
+        return OSD_ERROR_OOM;
+    }
+    t->ops = ops;
+    t->num_channels = num_channels;
+
+    dbg("Opening device transport %s (%s) with %u channel(s)\n", ops->name,
+        ops->description, num_channels);
+    rv = ops->open(&t->priv, options ? options : "", num_channels, log_level);
+    if (OSD_FAILED(rv)) {
+        free(t);
+        return rv;
+    }
+
+    *transport = t;
+    return OSD_OK;
+}
+
+void device_transport_close(struct device_transport **transport)
+{
+    assert(transport);
+    struct device_transport *t = *transport;
+    if (!t) {
+        return;
+    }
+
+    t->ops->close(t->priv);
+    free(t);
+    *transport = NULL;
+}
+
+char* device_transport_option_get(const char *options, const char *key,
+                                  const char *default_value)
+{
+    size_t key_len = strlen(key);
+    const char *pos = options;
+
+    while (pos && *pos) {
+        const char *end = strchr(pos, ',');
+        size_t len = end ? (size_t)(end - pos) : strlen(pos);
+
+        if (len > key_len && !strncmp(pos, key, key_len) &&
+            pos[key_len] == '=') {
+            return strndup(pos + key_len + 1, len - key_len - 1);
+        }
+
+        pos = end ? end + 1 : NULL;
+    }
+
+    return default_value ? strdup(default_value) : NULL;
+}
@@ -0,0 +1,171 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+/**
+ * Transport layer to the device
+ *
+ * A transport moves the raw byte stream of Debug Transport Datagrams (DTDs)
+ * between the host and the device. The stream is big endian, exactly as it
+ * is found on the physical link. Multiple transports are available: "glip"
+ * talks to real hardware through libglip, "sim" is a simulated device
+ * running inside the process, and "replay" plays back a raw capture.
+ *
+ * A transport can provide multiple independent channels (e.g. GLIP channels),
+ * which allows to separate control traffic from high-rate trace data.
+ */
+
+#ifndef OSD_TOOLS_DEVICE_TRANSPORT_H
+#define OSD_TOOLS_DEVICE_TRANSPORT_H
+
+#include <osd/osd.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Operations implemented by a transport
+ */
+struct device_transport_ops {
+    /** name of the transport, as used in device_transport_open() */
+    const char *name;
+
+    /** short human-readable description */
+    const char *description;
+
+    /**
+     * Connect to the device
+     *
+     * @param[out] priv transport-private data, passed to all other functions
+     * @param options transport options "key1=value1,key2=value2,..."
+     * @param num_channels number of channels to open
+     * @param log_level log level (as in syslog.h) of the transport
+     */
+    osd_result (*open)(void **priv, const char *options,
+                       unsigned int num_channels, int log_level);
+
+    /**
+     * Disconnect from the device and free all resources
+     */
+    void (*close)(void *priv);
+
+    /**
+     * Read as much data as available from the device
+     *
+     * Blocks until at least one word (two bytes) is available. Different
+     * channels may be read concurrently from different threads.
+     *
+     * @return number of bytes read, or -1 on error
+     */
+    ssize_t (*read)(void *priv, unsigned int channel, uint8_t *buf,
+                    size_t size_bytes);
+
+    /**
+     * Write data to the device
+     *
+     * Blocks until all data has been written.
+     *
+     * @return number of bytes written, or -1 on error
+     */
+    ssize_t (*write)(void *priv, unsigned int channel, const uint8_t *buf,
+                     size_t size_bytes);
+};
+
+/**
+ * A connection to the device through a transport
+ */
+struct device_transport {
+    const struct device_transport_ops *ops;
+    void *priv;
+    unsigned int num_channels;
+};
+
+extern const struct device_transport_ops device_transport_glip_ops;
+extern const struct device_transport_ops device_transport_sim_ops;
+extern const struct device_transport_ops device_transport_replay_ops;
+
+/**
+ * Connect to a device using a transport
+ *
+ * @param[out] transport the newly created transport object
+ * @param name name of the transport, e.g. "glip" or "sim"
+ * @param options transport options "key1=value1,key2=value2,..."
+ * @param num_channels number of channels to open (at least 1)
+ * @param log_level log level (as in syslog.h) of the transport
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see device_transport_close()
+ */
+osd_result device_transport_open(struct device_transport **transport,
+                                 const char *name, const char *options,
+                                 unsigned int num_channels, int log_level);
+
+/**
+ * Disconnect from the device and free (and NULL) the transport object
+ */
+void device_transport_close(struct device_transport **transport);
+
+/**
+ * Read as much data as available from the device
+ *
+ * @see device_transport_ops.read
+ */
+static inline ssize_t device_transport_read(struct device_transport *transport,
+                                            unsigned int channel,
+                                            uint8_t *buf, size_t size_bytes)
+{
+    assert(channel < transport->num_channels);
+    return transport->ops->read(transport->priv, channel, buf, size_bytes);
+}
+
+/**
+ * Write data to the device
+ *
+ * @see device_transport_ops.write
+ */
+static inline ssize_t device_transport_write(struct device_transport *transport,
+                                             unsigned int channel,
+                                             const uint8_t *buf,
+                                             size_t size_bytes)
+{
+    assert(channel < transport->num_channels);
+    return transport->ops->write(transport->priv, channel, buf, size_bytes);
+}
+
+/**
+ * Get the value of an option from an option string
+ *
+ * @param options option string "key1=value1,key2=value2,..."
+ * @param key the key to look up
+ * @param default_value value returned if the option is not given
+ * @return the value (allocated, free after use), or NULL if no value was
+ *         found and @p default_value is NULL
+ */
+char* device_transport_option_get(const char *options, const char *key,
+                                  const char *default_value);
+
+#endif // OSD_TOOLS_DEVICE_TRANSPORT_H
@@ -0,0 +1,183 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+/**
+ * Device transport through GLIP (real hardware)
+ *
+ * Options: "backend=<GLIP backend>" selects the GLIP backend (default:
+ * GLIP_DEFAULT_BACKEND), all other options are passed to the backend.
+ */
+
+#define LOG_CATEGORY "libglip"
+
+#include "device_transport.h"
+#include "tool-log.h"
+
+#include <libglip.h>
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GLIP_DEFAULT_BACKEND "tcp"
+
+/**
+ * Log handler for GLIP
+ */
+static void glip_log_handler(struct glip_ctx *ctx, int priority,
+                             const char *file, int line, const char *fn,
+                             const char *format, va_list args)
+{
+    char msg[1024];
+    vsnprintf(msg, sizeof(msg), format, args);
+    cli_log(priority, LOG_CATEGORY, "%s", msg);
+}
+
+static osd_result glip_transport_open(void **priv, const char *options,
+                                      unsigned int num_channels,
+                                      int log_level)
+{
+    int rv;
+    struct glip_ctx *glip_ctx;
+
+    struct glip_option* glip_options;
+    size_t glip_options_len;
+    rv = glip_parse_option_string(options, &glip_options, &glip_options_len);
+    if (rv != 0) {
+        err("Unable to parse GLIP backend options.\n");
+        return OSD_ERROR_FAILURE;
+    }
+
+    // extract the backend name, pass all other options to the backend
+    const char *backend = GLIP_DEFAULT_BACKEND;
+    size_t backend_options_len = 0;
+    for (size_t i = 0; i < glip_options_len; i++) {
+        if (!strcmp(glip_options[i].name, "backend")) {
+            backend = glip_options[i].value;
+        } else {
+            glip_options[backend_options_len++] = glip_options[i];
+        }
+    }
+
+    dbg("Creating GLIP device context for backend %s\n", backend);
+    rv = glip_new(&glip_ctx, backend, glip_options, backend_options_len,
+                  &glip_log_handler);
+    if (rv < 0) {
+        err("Unable to create new GLIP context (rv=%d).\n", rv);
+        return OSD_ERROR_FAILURE;
+    }
+
+    // route log messages to our log handler
+    glip_set_log_priority(glip_ctx, log_level);
+
+    dbg("Attempting physical connection to device.\n");
+    rv = glip_open(glip_ctx, num_channels);
+    if (rv < 0) {
+        err("Unable to open connection to device.\n");
+        glip_free(glip_ctx);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+    dbg("Physical connection established.\n");
+
+    if (glip_get_channel_count(glip_ctx) < num_channels) {
+        err("Device provides %u GLIP channel(s), %u are required.\n",
+            glip_get_channel_count(glip_ctx), num_channels);
+        glip_close(glip_ctx);
+        glip_free(glip_ctx);
+        return OSD_ERROR_DEVICE_ERROR;
+    }
+
+    if (glip_get_fifo_width(glip_ctx) != 2) {
+        err("FIFO width of GLIP channel must be 16 bit, not %d bit.\n",
+            glip_get_fifo_width(glip_ctx) * 8);
+        glip_close(glip_ctx);
+        glip_free(glip_ctx);
+        return OSD_ERROR_DEVICE_ERROR;
+    }
+
+    *priv = glip_ctx;
+    return OSD_OK;
+}
+
+static void glip_transport_close(void *priv)
+{
+    struct glip_ctx *glip_ctx = priv;
+
+    glip_close(glip_ctx);
+    glip_free(glip_ctx);
+}
+
+static ssize_t glip_transport_read(void *priv, unsigned int channel,
+                                   uint8_t *buf, size_t size_bytes)
+{
+    struct glip_ctx *glip_ctx = priv;
+    int rv;
+    size_t bytes_read;
+
+    rv = glip_read(glip_ctx, channel, size_bytes, buf, &bytes_read);
+    if (rv != 0) {
+        return -1;
+    }
+    if (bytes_read > 0) {
+        return bytes_read;
+    }
+
+    // nothing available: wait for the next word to arrive
+    rv = glip_read_b(glip_ctx, channel, sizeof(uint16_t), buf, &bytes_read,
+                     0 /* timeout [ms]; 0 == never */);
+    if (rv != 0) {
+        return -1;
+    }
+    return bytes_read;
+}
+
+static ssize_t glip_transport_write(void *priv, unsigned int channel,
+                                    const uint8_t *buf, size_t size_bytes)
+{
+    struct glip_ctx *glip_ctx = priv;
+    int rv;
+    size_t bytes_written;
+
+    rv = glip_write_b(glip_ctx, channel, size_bytes, (uint8_t*)buf,
+                      &bytes_written,
+                      0 /* timeout [ms]; 0 == never */);
+    if (rv != 0) {
+        return -1;
+    }
+    return bytes_written;
+}
+
+const struct device_transport_ops device_transport_glip_ops = {
+    .name = "glip",
+    .description = "Hardware device connected through GLIP",
+    .open = glip_transport_open,
+    .close = glip_transport_close,
+    .read = glip_transport_read,
+    .write = glip_transport_write,
+};
@@ -0,0 +1,330 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+/**
+ * Replay of a raw capture
+ *
+ * This transport plays back a capture recorded with struct dtd_capture (see
+ * dtd_capture.h) as if the data was coming from the device. All data written
+ * to the device is discarded, i.e. register accesses are not answered.
+ *
+ * Options:
+ * - file=<path>: path of the (first) capture file. Rotated captures are
+ *   replayed completely.
+ * - speed=<full|original|factor>: replay as fast as possible (default), at
+ *   the speed the data was captured, or at a multiple of that speed.
+ *
+ * The captured data is returned on the last opened channel, i.e. on the
+ * trace channel if separate channels for control and trace traffic are
+ * used. Reads on all other channels and reads after the end of the capture
+ * block forever.
+ */
+
+#define LOG_CATEGORY "replay"
+
+#include "device_transport.h"
+#include "dtd_capture.h"
+#include "tool-log.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Maximum number of bytes returned by a single read when pacing the replay
+ *
+ * Smaller chunks result in a smoother data rate.
+ */
+#define REPLAY_PACED_READ_MAX_BYTES (64 * 1024)
+
+struct replay_ctx {
+    /** path of the first capture file */
+    char *path;
+    /** channel the data is returned on */
+    unsigned int data_channel;
+    /** speed factor, 0 for full speed */
+    double speed;
+
+    /** currently replayed file, -1 after the end of the replay */
+    int fd;
+    /** header of fd */
+    struct dtd_capture_header hdr;
+    /** number of data bytes in fd */
+    uint64_t data_size_bytes;
+    /** next data offset to be read from fd */
+    uint64_t data_offset;
+
+    /** capture time of the start of the replay (CLOCK_REALTIME, in ns) */
+    uint64_t capture_start_ns;
+    /** time the replay started (CLOCK_MONOTONIC, in ns) */
+    uint64_t replay_start_ns;
+};
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+/**
+ * Block the calling thread until it is cancelled
+ */
+static void block_forever(void)
+{
+    while (1) {
+        sleep(1);
+    }
+}
+
+/**
+ * Open a file of the capture
+ */
+static osd_result open_file(struct replay_ctx *ctx, unsigned int sequence)
+{
+    osd_result rv;
+
+    char *path = dtd_capture_get_path(ctx->path, sequence);
+    ctx->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (ctx->fd == -1) {
+        if (sequence == 0) {
+            err("Unable to open capture file %s: %s\n", path,
+                strerror(errno));
+        }
+        free(path);
+        return OSD_ERROR_FAILURE;
+    }
+
+    rv = dtd_capture_read_header(ctx->fd, &ctx->hdr);
+    if (OSD_FAILED(rv)) {
+        err("Unable to replay %s.\n", path);
+        free(path);
+        close(ctx->fd);
+        ctx->fd = -1;
+        return rv;
+    }
+
+    ctx->data_size_bytes = ctx->hdr.data_size_bytes;
+    if (ctx->data_size_bytes == 0) {
+        // aborted capture: use everything up to the end of the file
+        struct stat st;
+        if (fstat(ctx->fd, &st) == 0 && st.st_size > ctx->hdr.header_size) {
+            ctx->data_size_bytes = st.st_size - ctx->hdr.header_size;
+        }
+    }
+    ctx->data_offset = 0;
+
+    dbg("Replaying %s (%" PRIu64 " bytes)\n", path, ctx->data_size_bytes);
+    free(path);
+    return OSD_OK;
+}
+
+/**
+ * Get the capture time of a data offset in the current file
+ *
+ * The time is interpolated between the index entries.
+ */
+static uint64_t capture_time_ns(struct replay_ctx *ctx, uint64_t data_offset)
+{
+    uint64_t prev_offset = 0;
+    uint64_t prev_time_ns = ctx->hdr.start_time_ns;
+
+    for (unsigned int i = 0; i < ctx->hdr.index_len; i++) {
+        const struct dtd_capture_index_entry *e = &ctx->hdr.index[i];
+        if (e->data_offset >= data_offset) {
+            if (e->data_offset == prev_offset || e->time_ns < prev_time_ns) {
+                return e->time_ns;
+            }
+            return prev_time_ns + (double)(e->time_ns - prev_time_ns) *
+                   (data_offset - prev_offset) /
+                   (e->data_offset - prev_offset);
+        }
+        prev_offset = e->data_offset;
+        prev_time_ns = e->time_ns;
+    }
+    return prev_time_ns;
+}
+
+/**
+ * Wait until data captured at a given time is due in the replay
+ */
+static void pace(struct replay_ctx *ctx, uint64_t capture_ns)
+{
+    if (capture_ns <= ctx->capture_start_ns) {
+        return;
+    }
+    uint64_t due_ns = ctx->replay_start_ns +
+                      (capture_ns - ctx->capture_start_ns) / ctx->speed;
+    uint64_t now_ns = monotonic_ns();
+    if (due_ns > now_ns) {
+        uint64_t wait_ns = due_ns - now_ns;
+        struct timespec ts = {
+            .tv_sec = wait_ns / (1000 * 1000 * 1000),
+            .tv_nsec = wait_ns % (1000 * 1000 * 1000),
+        };
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        }
+    }
+}
+
+static osd_result replay_open(void **priv, const char *options,
+                              unsigned int num_channels, int log_level)
+{
+    osd_result rv;
+
+    struct replay_ctx *ctx = calloc(1, sizeof(struct replay_ctx));
+    if (!ctx) {
+        return OSD_ERROR_OOM;
+    }
+    ctx->fd = -1;
+    ctx->data_channel = num_channels - 1;
+
+    ctx->path = device_transport_option_get(options, "file", NULL);
+    if (!ctx->path) {
+        err("No capture file given (option file=<path>).\n");
+        rv = OSD_ERROR_FAILURE;
+        goto err_free;
+    }
+
+    char *speed = device_transport_option_get(options, "speed", "full");
+    if (!strcmp(speed, "full")) {
+        ctx->speed = 0;
+    } else if (!strcmp(speed, "original")) {
+        ctx->speed = 1;
+    } else {
+        char *end;
+        ctx->speed = strtod(speed, &end);
+        if (*end || ctx->speed <= 0) {
+            err("Invalid replay speed '%s'.\n", speed);
+            free(speed);
+            rv = OSD_ERROR_FAILURE;
+            goto err_free;
+        }
+    }
+    free(speed);
+
+    rv = open_file(ctx, 0);
+    if (OSD_FAILED(rv)) {
+        goto err_free;
+    }
+    ctx->capture_start_ns = ctx->hdr.start_time_ns;
+    ctx->replay_start_ns = monotonic_ns();
+
+    *priv = ctx;
+    return OSD_OK;
+
+err_free:
+    free(ctx->path);
+    free(ctx);
+    return rv;
+}
+
+static void replay_close(void *priv)
+{
+    struct replay_ctx *ctx = priv;
+
+    if (ctx->fd != -1) {
+        close(ctx->fd);
+    }
+    free(ctx->path);
+    free(ctx);
+}
+
+static ssize_t replay_read(void *priv, unsigned int channel, uint8_t *buf,
+                           size_t size_bytes)
+{
+    struct replay_ctx *ctx = priv;
+
+    if (channel != ctx->data_channel) {
+        block_forever();
+    }
+
+    // continue with the next file of a rotated capture
+    while (ctx->fd != -1 && ctx->data_offset == ctx->data_size_bytes) {
+        unsigned int sequence = ctx->hdr.sequence + 1;
+        close(ctx->fd);
+        ctx->fd = -1;
+        if (OSD_FAILED(open_file(ctx, sequence))) {
+            info("Replay finished.\n");
+        }
+    }
+    if (ctx->fd == -1) {
+        block_forever();
+    }
+
+    size_t len = ctx->data_size_bytes - ctx->data_offset;
+    if (len > size_bytes) {
+        len = size_bytes;
+    }
+    if (ctx->speed > 0) {
+        if (len > REPLAY_PACED_READ_MAX_BYTES) {
+            len = REPLAY_PACED_READ_MAX_BYTES;
+        }
+        pace(ctx, capture_time_ns(ctx, ctx->data_offset + len));
+    }
+
+    ssize_t bytes_read;
+    do {
+        bytes_read = pread(ctx->fd, buf, len,
+                           ctx->hdr.header_size + ctx->data_offset);
+    } while (bytes_read == -1 && errno == EINTR);
+    if (bytes_read < 0) {
+        err("Unable to read from capture file: %s\n", strerror(errno));
+        return -1;
+    }
+    if (bytes_read == 0) {
+        // file is shorter than announced
+        ctx->data_size_bytes = ctx->data_offset;
+    }
+    ctx->data_offset += bytes_read;
+
+    return bytes_read;
+}
+
+static ssize_t replay_write(void *priv, unsigned int channel,
+                            const uint8_t *buf, size_t size_bytes)
+{
+    // there is no device to talk to
+    return size_bytes;
+}
+
+const struct device_transport_ops device_transport_replay_ops = {
+    .name = "replay",
+    .description = "Replay of a raw capture",
+    .open = replay_open,
+    .close = replay_close,
+    .read = replay_read,
+    .write = replay_write,
+};
@@ -0,0 +1,741 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+/**
+ * Simulated device
+ *
+ * A software model of an Open SoC Debug system running inside the process,
+ * which allows to run (and benchmark) the full host stack without hardware.
+ * The simulated debug system in subnet 0 consists of
+ *
+ * - the Subnet Control Module (SCM) at DI address 0,
+ * - the host interface at DI address 1 (no registers),
+ * - a System Trace Module (STM) at DI address 2, which emits trace events at
+ *   a programmable rate while it is active, and
+ * - a configurable number of generic modules starting at DI address 3, each
+ *   having a register file of SIM_GENERIC_REGS 16 bit registers starting at
+ *   SIM_REG_USER_BASE.
+ *
+ * Options:
+ * - modules=<n>: number of generic modules (default: 4)
+ * - stm_rate=<n>: events per second emitted by the STM (default: 1000). The
+ *   rate can also be changed at runtime through the 32 bit register
+ *   SIM_STM_REG_RATE.
+ *
+ * The device provides up to SIM_CHANNELS_MAX channels. If more than one
+ * channel is opened, STM events are sent on the last channel, all other
+ * traffic on channel 0.
+ *
+ * STM events carry a 32 bit timestamp (in cycles of a simulated 100 MHz
+ * clock), a 16 bit id and a 64 bit value (an event counter), in this order
+ * and with the least significant word first.
+ */
+
+#define LOG_CATEGORY "simdev"
+
+#include "bswap16.h"
+#include "device_transport.h"
+#include "tool-log.h"
+
+#include <osd/module.h>
+#include <osd/packet.h>
+#include <osd/reg.h>
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** DI address of the SCM */
+#define SIM_DIADDR_SCM 0
+/** DI address of the host interface (no registers) */
+#define SIM_DIADDR_HIM 1
+/** DI address of the STM */
+#define SIM_DIADDR_STM 2
+/** DI address of the first generic module */
+#define SIM_DIADDR_GENERIC_FIRST 3
+
+/** Vendor ID of all simulated modules (not a registered vendor) */
+#define SIM_VENDOR_ID 0xffff
+/** Module type of the generic modules (in SIM_VENDOR_ID) */
+#define SIM_MODULE_TYPE_GENERIC 0x0001
+/** Device ID reported by the SCM */
+#define SIM_DEVICE_ID 0x0001
+
+/** First module-specific register */
+#define SIM_REG_USER_BASE 0x0200
+/** Number of registers in the register file of generic modules */
+#define SIM_GENERIC_REGS 256
+/** STM event rate (events per second, 32 bit) */
+#define SIM_STM_REG_RATE 0x0200
+
+/** Maximum packet length (in words) supported by the device */
+#define SIM_MAX_PKT_LEN 12
+
+/** Number of payload words in a STM event packet */
+#define SIM_STM_EVENT_PAYLOAD_WORDS 7
+
+/**
+ * Maximum amount of data queued for the host (in bytes)
+ *
+ * STM events are dropped if the host doesn't read fast enough to keep the
+ * queue below this size, like a real STM would overflow.
+ */
+#define SIM_RX_QUEUE_LIMIT_BYTES (1024 * 1024)
+
+/** Maximum number of channels */
+#define SIM_CHANNELS_MAX 2
+
+/** Maximum number of STM events generated at once */
+#define SIM_STM_EVENT_BURST_MAX 1024
+
+#define SIM_DEFAULT_GENERIC_MODULES 4
+#define SIM_DEFAULT_STM_RATE 1000
+
+struct sim_module {
+    uint16_t type;
+    uint16_t cs;
+    uint16_t event_dest;
+
+    /** module-specific registers, starting at SIM_REG_USER_BASE */
+    uint16_t *regs;
+    size_t regs_len;
+};
+
+/**
+ * Data from the device to the host on one channel (big endian DTD stream)
+ */
+struct sim_rx_queue {
+    uint8_t *buf;
+    size_t size;
+    size_t start;
+    size_t end;
+};
+
+struct sim_device {
+    pthread_mutex_t lock;
+    /** signaled when data for the host is available */
+    pthread_cond_t rx_cond;
+
+    unsigned int num_channels;
+    /** channel STM events are sent on */
+    unsigned int stm_channel;
+
+    /** all modules, indexed by DI address */
+    struct sim_module *modules;
+    size_t modules_len;
+
+    /** next time an STM event is due */
+    uint64_t stm_next_event_ns;
+    /** number of STM events generated so far */
+    uint64_t stm_event_cnt;
+    /** number of STM events lost due to overflows */
+    uint64_t stm_events_dropped;
+
+    /** data from the device to the host, one queue per channel */
+    struct sim_rx_queue rx[SIM_CHANNELS_MAX];
+
+    /** data from the host to the device not processed yet, per channel */
+    uint8_t *tx_buf[SIM_CHANNELS_MAX];
+    size_t tx_fill[SIM_CHANNELS_MAX];
+};
+
+static uint64_t clock_monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+/**
+ * Size of the TX buffer: enough to hold one DTD of maximum size
+ */
+#define SIM_TX_BUF_SIZE ((1 + UINT16_MAX) * sizeof(uint16_t))
+
+/**
+ * Queue a packet as DTD for the host
+ *
+ * @param channel channel to send the packet on
+ * @param pkt packet data (in native endianness)
+ * @param pkt_size_words number of words in @p pkt
+ * @param limit drop the packet if the queue would grow beyond
+ *              SIM_RX_QUEUE_LIMIT_BYTES
+ * @return true if the packet was queued
+ */
+static bool sim_queue_packet(struct sim_device *dev, unsigned int channel,
+                             const uint16_t *pkt, size_t pkt_size_words,
+                             bool limit)
+{
+    struct sim_rx_queue *q = &dev->rx[channel];
+    size_t dtd_size_bytes = (1 + pkt_size_words) * sizeof(uint16_t);
+    size_t fill = q->end - q->start;
+
+    if (limit && fill + dtd_size_bytes > SIM_RX_QUEUE_LIMIT_BYTES) {
+        return false;
+    }
+
+    if (q->end + dtd_size_bytes > q->size) {
+        memmove(q->buf, q->buf + q->start, fill);
+        q->start = 0;
+        q->end = fill;
+    }
+    if (q->end + dtd_size_bytes > q->size) {
+        size_t new_size = 2 * (q->end + dtd_size_bytes);
+        uint8_t *new_buf = realloc(q->buf, new_size);
+        if (!new_buf) {
+            return false;
+        }
+        q->buf = new_buf;
+        q->size = new_size;
+    }
+
+    uint16_t *dtd = (uint16_t*)(q->buf + q->end);
+    dtd[0] = pkt_size_words;
+    memcpy(&dtd[1], pkt, pkt_size_words * sizeof(uint16_t));
+    cpu_to_be16_buf(dtd, 1 + pkt_size_words);
+    q->end += dtd_size_bytes;
+
+    pthread_cond_broadcast(&dev->rx_cond);
+    return true;
+}
+
+static uint16_t sim_packet_flags(enum osd_packet_type type,
+                                 unsigned int type_sub)
+{
+    return (type & DP_HEADER_TYPE_MASK) << DP_HEADER_TYPE_SHIFT |
+           (type_sub & DP_HEADER_TYPE_SUB_MASK) << DP_HEADER_TYPE_SUB_SHIFT;
+}
+
+/**
+ * Period between two STM events (in ns), or 0 if no events are generated
+ */
+static uint64_t sim_stm_period_ns(struct sim_device *dev)
+{
+    struct sim_module *stm = &dev->modules[SIM_DIADDR_STM];
+    uint32_t rate = stm->regs[0] | (uint32_t)stm->regs[1] << 16;
+
+    if (!(stm->cs & OSD_REG_BASE_MOD_CS_ACTIVE) || rate == 0) {
+        return 0;
+    }
+    uint64_t period_ns = 1000ULL * 1000 * 1000 / rate;
+    return period_ns ? period_ns : 1;
+}
+
+/**
+ * Generate all STM events which are due
+ */
+static void sim_stm_generate(struct sim_device *dev, uint64_t now_ns)
+{
+    struct sim_module *stm = &dev->modules[SIM_DIADDR_STM];
+    uint64_t period_ns = sim_stm_period_ns(dev);
+    if (!period_ns) {
+        return;
+    }
+
+    unsigned int n = 0;
+    while (dev->stm_next_event_ns <= now_ns && n < SIM_STM_EVENT_BURST_MAX) {
+        uint32_t timestamp = dev->stm_next_event_ns / 10;
+        uint64_t value = dev->stm_event_cnt;
+
+        uint16_t pkt[3 + SIM_STM_EVENT_PAYLOAD_WORDS];
+        pkt[0] = stm->event_dest;
+        pkt[1] = SIM_DIADDR_STM;
+        pkt[2] = sim_packet_flags(OSD_PACKET_TYPE_EVENT, 0);
+        pkt[3] = timestamp & 0xffff;
+        pkt[4] = timestamp >> 16;
+        pkt[5] = dev->stm_event_cnt & 0xff;
+        for (int i = 0; i < 4; i++) {
+            pkt[6 + i] = (value >> (16 * i)) & 0xffff;
+        }
+
+        if (!sim_queue_packet(dev, dev->stm_channel, pkt,
+                              sizeof(pkt) / sizeof(pkt[0]), true)) {
+            dev->stm_events_dropped++;
+        }
+        dev->stm_event_cnt++;
+        dev->stm_next_event_ns += period_ns;
+        n++;
+    }
+
+    // we're falling behind: skip all events we cannot catch up with
+    if (dev->stm_next_event_ns <= now_ns) {
+        uint64_t missed = (now_ns - dev->stm_next_event_ns) / period_ns + 1;
+        dev->stm_events_dropped += missed;
+        dev->stm_event_cnt += missed;
+        dev->stm_next_event_ns += missed * period_ns;
+    }
+}
+
+/**
+ * Read a register
+ *
+ * @return true on success, false if the register doesn't exist or doesn't
+ *         support accesses of the given size
+ */
+static bool sim_reg_read(struct sim_device *dev, uint16_t diaddr,
+                         uint16_t reg_addr, size_t size_words, uint16_t *value)
+{
+    struct sim_module *mod = &dev->modules[diaddr];
+
+    if (reg_addr < SIM_REG_USER_BASE) {
+        if (size_words != 1) {
+            return false;
+        }
+        switch (reg_addr) {
+        case OSD_REG_BASE_MOD_VENDOR:
+            *value = mod->type == SIM_MODULE_TYPE_GENERIC ?
+                     SIM_VENDOR_ID : OSD_MODULE_VENDOR_OSD;
+            return true;
+        case OSD_REG_BASE_MOD_TYPE:
+            *value = mod->type;
+            return true;
+        case OSD_REG_BASE_MOD_VERSION:
+            *value = 0;
+            return true;
+        case OSD_REG_BASE_MOD_CS:
+            *value = mod->cs;
+            return true;
+        case OSD_REG_BASE_MOD_EVENT_DEST:
+            *value = mod->event_dest;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    if (diaddr == SIM_DIADDR_SCM) {
+        if (size_words != 1) {
+            return false;
+        }
+        switch (reg_addr) {
+        case OSD_REG_SCM_SYSTEM_VENDOR_ID:
+            *value = SIM_VENDOR_ID;
+            return true;
+        case OSD_REG_SCM_SYSTEM_DEVICE_ID:
+            *value = SIM_DEVICE_ID;
+            return true;
+        case OSD_REG_SCM_NUM_MOD:
+            *value = dev->modules_len;
+            return true;
+        case OSD_REG_SCM_MAX_PKT_LEN:
+            *value = SIM_MAX_PKT_LEN;
+            return true;
+        case OSD_REG_SCM_SYSRST:
+            *value = mod->regs[0];
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    if (diaddr == SIM_DIADDR_STM &&
+        (reg_addr != SIM_STM_REG_RATE || size_words != 2)) {
+        return false;
+    }
+
+    size_t idx = reg_addr - SIM_REG_USER_BASE;
+    if (idx + size_words > mod->regs_len) {
+        return false;
+    }
+    memcpy(value, &mod->regs[idx], size_words * sizeof(uint16_t));
+    return true;
+}
+
+/**
+ * Write a register
+ *
+ * @return true on success, false if the register doesn't exist, is read-only
+ *         or doesn't support accesses of the given size
+ */
+static bool sim_reg_write(struct sim_device *dev, uint16_t diaddr,
+                          uint16_t reg_addr, size_t size_words,
+                          const uint16_t *value)
+{
+    struct sim_module *mod = &dev->modules[diaddr];
+
+    if (reg_addr < SIM_REG_USER_BASE) {
+        if (size_words != 1) {
+            return false;
+        }
+        switch (reg_addr) {
+        case OSD_REG_BASE_MOD_CS:
+            if (diaddr == SIM_DIADDR_STM &&
+                !(mod->cs & OSD_REG_BASE_MOD_CS_ACTIVE) &&
+                (value[0] & OSD_REG_BASE_MOD_CS_ACTIVE)) {
+                dev->stm_next_event_ns = clock_monotonic_ns();
+                pthread_cond_signal(&dev->rx_cond);
+            }
+            mod->cs = value[0];
+            return true;
+        case OSD_REG_BASE_MOD_EVENT_DEST:
+            mod->event_dest = value[0];
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    if (diaddr == SIM_DIADDR_SCM) {
+        if (reg_addr != OSD_REG_SCM_SYSRST || size_words != 1) {
+            return false;
+        }
+        mod->regs[0] = value[0];
+        return true;
+    }
+
+    if (diaddr == SIM_DIADDR_STM) {
+        if (reg_addr != SIM_STM_REG_RATE || size_words != 2) {
+            return false;
+        }
+        memcpy(mod->regs, value, 2 * sizeof(uint16_t));
+        dev->stm_next_event_ns = clock_monotonic_ns();
+        pthread_cond_signal(&dev->rx_cond);
+        return true;
+    }
+
+    size_t idx = reg_addr - SIM_REG_USER_BASE;
+    if (idx + size_words > mod->regs_len) {
+        return false;
+    }
+    memcpy(&mod->regs[idx], value, size_words * sizeof(uint16_t));
+    return true;
+}
+
+/**
+ * Process a packet sent by the host to the device
+ *
+ * @param pkt packet data (in native endianness)
+ */
+static void sim_process_packet(struct sim_device *dev, const uint16_t *pkt,
+                               size_t pkt_size_words)
+{
+    if (pkt_size_words < 3 || pkt_size_words > SIM_MAX_PKT_LEN) {
+        err("Dropping packet of invalid size %zu words.\n", pkt_size_words);
+        return;
+    }
+
+    uint16_t dest = pkt[0];
+    uint16_t src = pkt[1];
+    unsigned int type = (pkt[2] >> DP_HEADER_TYPE_SHIFT) & DP_HEADER_TYPE_MASK;
+    unsigned int type_sub = (pkt[2] >> DP_HEADER_TYPE_SUB_SHIFT) &
+                            DP_HEADER_TYPE_SUB_MASK;
+
+    if (dest >= dev->modules_len || dest == SIM_DIADDR_HIM) {
+        dbg("Dropping packet to unknown module %u.\n", dest);
+        return;
+    }
+    if (type != OSD_PACKET_TYPE_REG || (type_sub & 0b1000)) {
+        dbg("Dropping packet of type %u.%u to module %u.\n", type, type_sub,
+            dest);
+        return;
+    }
+
+    bool is_write = type_sub & 0b0100;
+    size_t size_words = 1 << (type_sub & 0b11);
+    size_t exp_size_words = 4 + (is_write ? size_words : 0);
+    uint16_t reg_addr = pkt[3];
+
+    uint16_t resp[3 + 8];
+    size_t resp_size_words = 3;
+    unsigned int resp_type_sub;
+
+    if (pkt_size_words != exp_size_words) {
+        err("Register access with %zu words, expected %zu. Ignoring.\n",
+            pkt_size_words, exp_size_words);
+        resp_type_sub = is_write ? RESP_WRITE_REG_ERROR : RESP_READ_REG_ERROR;
+    } else if (is_write) {
+        bool ok = sim_reg_write(dev, dest, reg_addr, size_words, &pkt[4]);
+        resp_type_sub = ok ? RESP_WRITE_REG_SUCCESS : RESP_WRITE_REG_ERROR;
+    } else {
+        bool ok = sim_reg_read(dev, dest, reg_addr, size_words, &resp[3]);
+        if (ok) {
+            resp_type_sub = RESP_READ_REG_SUCCESS_16 | (type_sub & 0b11);
+            resp_size_words += size_words;
+        } else {
+            resp_type_sub = RESP_READ_REG_ERROR;
+        }
+    }
+
+    resp[0] = src;
+    resp[1] = dest;
+    resp[2] = sim_packet_flags(OSD_PACKET_TYPE_REG, resp_type_sub);
+    sim_queue_packet(dev, 0, resp, resp_size_words, false);
+}
+
+static osd_result sim_parse_uint_option(const char *options, const char *key,
+                                        unsigned long default_value,
+                                        unsigned long max_value,
+                                        unsigned long *value)
+{
+    char *str = device_transport_option_get(options, key, NULL);
+    if (!str) {
+        *value = default_value;
+        return OSD_OK;
+    }
+
+    char *end;
+    errno = 0;
+    *value = strtoul(str, &end, 0);
+    bool valid = (errno == 0 && *str && !*end && *value <= max_value);
+    if (!valid) {
+        err("Invalid value '%s' for option %s.\n", str, key);
+    }
+    free(str);
+    return valid ? OSD_OK : OSD_ERROR_FAILURE;
+}
+
+static void sim_free(struct sim_device *dev)
+{
+    if (dev->modules) {
+        for (size_t i = 0; i < dev->modules_len; i++) {
+            free(dev->modules[i].regs);
+        }
+    }
+    free(dev->modules);
+    for (unsigned int c = 0; c < SIM_CHANNELS_MAX; c++) {
+        free(dev->rx[c].buf);
+        free(dev->tx_buf[c]);
+    }
+    pthread_cond_destroy(&dev->rx_cond);
+    pthread_mutex_destroy(&dev->lock);
+    free(dev);
+}
+
+static osd_result sim_open(void **priv, const char *options,
+                           unsigned int num_channels, int log_level)
+{
+    osd_result rv;
+    unsigned long generic_modules, stm_rate;
+
+    if (num_channels > SIM_CHANNELS_MAX) {
+        err("The simulated device provides at most %u channels, %u "
+            "requested.\n", SIM_CHANNELS_MAX, num_channels);
+        return OSD_ERROR_FAILURE;
+    }
+
+    rv = sim_parse_uint_option(options, "modules",
+                               SIM_DEFAULT_GENERIC_MODULES,
+                               OSD_DIADDR_LOCAL_MAX + 1 -
+                               SIM_DIADDR_GENERIC_FIRST,
+                               &generic_modules);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    rv = sim_parse_uint_option(options, "stm_rate", SIM_DEFAULT_STM_RATE,
+                               UINT32_MAX, &stm_rate);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+
+    struct sim_device *dev = calloc(1, sizeof(struct sim_device));
+    if (!dev) {
+        return OSD_ERROR_OOM;
+    }
+    pthread_mutex_init(&dev->lock, NULL);
+    pthread_cond_init(&dev->rx_cond, NULL);
+    dev->num_channels = num_channels;
+    dev->stm_channel = num_channels - 1;
+
+    dev->modules_len = SIM_DIADDR_GENERIC_FIRST + generic_modules;
+    dev->modules = calloc(dev->modules_len, sizeof(struct sim_module));
+    if (!dev->modules) {
+        rv = OSD_ERROR_OOM;
+        goto err_free;
+    }
+    for (unsigned int c = 0; c < num_channels; c++) {
+        dev->tx_buf[c] = malloc(SIM_TX_BUF_SIZE);
+        if (!dev->tx_buf[c]) {
+            rv = OSD_ERROR_OOM;
+            goto err_free;
+        }
+    }
+
+    dev->modules[SIM_DIADDR_SCM].type = OSD_MODULE_TYPE_STD_SCM;
+    dev->modules[SIM_DIADDR_SCM].regs_len = 1; // SYSRST
+    dev->modules[SIM_DIADDR_STM].type = OSD_MODULE_TYPE_STD_STM;
+    dev->modules[SIM_DIADDR_STM].regs_len = 2; // RATE
+    for (size_t i = SIM_DIADDR_GENERIC_FIRST; i < dev->modules_len; i++) {
+        dev->modules[i].type = SIM_MODULE_TYPE_GENERIC;
+        dev->modules[i].regs_len = SIM_GENERIC_REGS;
+    }
+    for (size_t i = 0; i < dev->modules_len; i++) {
+        if (i == SIM_DIADDR_HIM) {
+            continue;
+        }
+        dev->modules[i].regs = calloc(dev->modules[i].regs_len,
+                                      sizeof(uint16_t));
+        if (!dev->modules[i].regs) {
+            rv = OSD_ERROR_OOM;
+            goto err_free;
+        }
+    }
+    dev->modules[SIM_DIADDR_STM].regs[0] = stm_rate & 0xffff;
+    dev->modules[SIM_DIADDR_STM].regs[1] = stm_rate >> 16;
+
+    info("Simulated device with %lu generic modules, STM rate %lu "
+         "events/s on channel %u.\n", generic_modules, stm_rate,
+         dev->stm_channel);
+
+    *priv = dev;
+    return OSD_OK;
+
+err_free:
+    sim_free(dev);
+    return rv;
+}
+
+static void sim_close(void *priv)
+{
+    struct sim_device *dev = priv;
+
+    if (dev->stm_events_dropped) {
+        info("Simulated STM dropped %" PRIu64 " of %" PRIu64 " events.\n",
+             dev->stm_events_dropped, dev->stm_event_cnt);
+    }
+    sim_free(dev);
+}
+
+static void sim_unlock(void *lock)
+{
+    pthread_mutex_unlock(lock);
+}
+
+static ssize_t sim_read(void *priv, unsigned int channel, uint8_t *buf,
+                        size_t size_bytes)
+{
+    struct sim_device *dev = priv;
+    struct sim_rx_queue *q = &dev->rx[channel];
+    size_t bytes_read;
+
+    assert(size_bytes >= sizeof(uint16_t));
+
+    pthread_mutex_lock(&dev->lock);
+    pthread_cleanup_push(sim_unlock, &dev->lock);
+
+    while (1) {
+        uint64_t now_ns = clock_monotonic_ns();
+        bool is_stm_channel = (channel == dev->stm_channel);
+        if (is_stm_channel) {
+            sim_stm_generate(dev, now_ns);
+        }
+
+        if (q->end > q->start) {
+            break;
+        }
+
+        if (is_stm_channel && sim_stm_period_ns(dev)) {
+            struct timespec abstime;
+            clock_gettime(CLOCK_REALTIME, &abstime);
+            uint64_t wait_ns = dev->stm_next_event_ns - now_ns;
+            abstime.tv_sec += wait_ns / (1000 * 1000 * 1000);
+            abstime.tv_nsec += wait_ns % (1000 * 1000 * 1000);
+            if (abstime.tv_nsec >= 1000 * 1000 * 1000) {
+                abstime.tv_sec++;
+                abstime.tv_nsec -= 1000 * 1000 * 1000;
+            }
+            pthread_cond_timedwait(&dev->rx_cond, &dev->lock, &abstime);
+        } else {
+            pthread_cond_wait(&dev->rx_cond, &dev->lock);
+        }
+    }
+
+    bytes_read = q->end - q->start;
+    if (bytes_read > size_bytes) {
+        bytes_read = size_bytes & ~(size_t)1;
+    }
+    memcpy(buf, q->buf + q->start, bytes_read);
+    q->start += bytes_read;
+    if (q->start == q->end) {
+        q->start = q->end = 0;
+    }
+
+    pthread_cleanup_pop(1);
+
+    return bytes_read;
+}
+
+static ssize_t sim_write(void *priv, unsigned int channel,
+                         const uint8_t *buf, size_t size_bytes)
+{
+    struct sim_device *dev = priv;
+    size_t pos = 0;
+
+    pthread_mutex_lock(&dev->lock);
+
+    uint8_t *tx_buf = dev->tx_buf[channel];
+    size_t *tx_fill = &dev->tx_fill[channel];
+
+    while (pos < size_bytes) {
+        // append as much as possible to the TX buffer
+        size_t len = SIM_TX_BUF_SIZE - *tx_fill;
+        if (len > size_bytes - pos) {
+            len = size_bytes - pos;
+        }
+        memcpy(tx_buf + *tx_fill, buf + pos, len);
+        *tx_fill += len;
+        pos += len;
+
+        // process all complete DTDs
+        uint16_t *words = (uint16_t*)tx_buf;
+        size_t fill_words = *tx_fill / sizeof(uint16_t);
+        size_t consumed_words = 0;
+        while (consumed_words < fill_words) {
+            size_t pkt_size_words = be16toh(words[consumed_words]);
+            if (fill_words - consumed_words - 1 < pkt_size_words) {
+                break;
+            }
+
+            uint16_t *pkt = &words[consumed_words + 1];
+            be16_to_cpu_buf(pkt, pkt_size_words);
+            sim_process_packet(dev, pkt, pkt_size_words);
+            consumed_words += 1 + pkt_size_words;
+        }
+
+        size_t consumed_bytes = consumed_words * sizeof(uint16_t);
+        memmove(tx_buf, tx_buf + consumed_bytes,
+                *tx_fill - consumed_bytes);
+        *tx_fill -= consumed_bytes;
+    }
+
+    pthread_mutex_unlock(&dev->lock);
+
+    return size_bytes;
+}
+
+const struct device_transport_ops device_transport_sim_ops = {
+    .name = "sim",
+    .description = "Simulated device (for testing and benchmarking)",
+    .open = sim_open,
+    .close = sim_close,
+    .read = sim_read,
+    .write = sim_write,
+};
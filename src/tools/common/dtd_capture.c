@@ -0,0 +1,376 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+#define LOG_CATEGORY "capture"
+
+#include "dtd_capture.h"
+#include "tool-log.h"
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(struct dtd_capture_header) <= DTD_CAPTURE_HEADER_SIZE,
+               "capture header doesn't fit into the header block");
+
+/**
+ * Size of the write buffer (in bytes)
+ *
+ * Data is written to disk in blocks of this size. It must be a multiple of
+ * the block size of the file system for O_DIRECT.
+ */
+#define CAPTURE_BUF_SIZE (4 * 1024 * 1024)
+
+/** Alignment of the buffers for O_DIRECT */
+#define CAPTURE_BUF_ALIGN 4096
+
+struct dtd_capture {
+    /** path of the first capture file */
+    char *path;
+    /** maximum file size (0: no limit) */
+    uint64_t rotate_size_bytes;
+    /** use O_DIRECT */
+    bool direct;
+
+    /** currently open file */
+    int fd;
+    /** header of the current file (native endianness) */
+    struct dtd_capture_header hdr;
+    /** header block buffer (aligned) */
+    uint8_t *hdr_block;
+
+    /** write buffer (aligned) */
+    uint8_t *buf;
+    /** number of valid bytes in buf */
+    size_t buf_fill;
+};
+
+static uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+char* dtd_capture_get_path(const char *path, unsigned int sequence)
+{
+    char *seq_path;
+    int rv;
+    if (sequence == 0) {
+        rv = asprintf(&seq_path, "%s", path);
+    } else {
+        rv = asprintf(&seq_path, "%s.%u", path, sequence);
+    }
+    assert(rv != -1);
+    return seq_path;
+}
+
+/**
+ * Write the header of the current file
+ */
+static osd_result write_header(struct dtd_capture *c)
+{
+    struct dtd_capture_header *le = (struct dtd_capture_header*)c->hdr_block;
+
+    memset(c->hdr_block, 0, DTD_CAPTURE_HEADER_SIZE);
+    memcpy(le->magic, c->hdr.magic, sizeof(le->magic));
+    le->version = htole32(c->hdr.version);
+    le->header_size = htole32(c->hdr.header_size);
+    le->sequence = htole32(c->hdr.sequence);
+    le->index_len = htole32(c->hdr.index_len);
+    le->start_time_ns = htole64(c->hdr.start_time_ns);
+    le->data_size_bytes = htole64(c->hdr.data_size_bytes);
+    le->dtd_count = htole64(c->hdr.dtd_count);
+    for (unsigned int i = 0; i < c->hdr.index_len; i++) {
+        le->index[i].data_offset = htole64(c->hdr.index[i].data_offset);
+        le->index[i].time_ns = htole64(c->hdr.index[i].time_ns);
+    }
+
+    ssize_t rv = pwrite(c->fd, c->hdr_block, DTD_CAPTURE_HEADER_SIZE, 0);
+    if (rv != DTD_CAPTURE_HEADER_SIZE) {
+        err("Unable to write capture header: %s\n", strerror(errno));
+        return OSD_ERROR_FAILURE;
+    }
+    return OSD_OK;
+}
+
+/**
+ * Open the next file of the capture
+ */
+static osd_result open_file(struct dtd_capture *c, unsigned int sequence)
+{
+    char *path = dtd_capture_get_path(c->path, sequence);
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if (c->direct) {
+        flags |= O_DIRECT;
+    }
+    c->fd = open(path, flags, 0644);
+    if (c->fd == -1) {
+        err("Unable to open capture file %s: %s\n", path, strerror(errno));
+        free(path);
+        return OSD_ERROR_FAILURE;
+    }
+    dbg("Capturing to %s\n", path);
+    free(path);
+
+    memset(&c->hdr, 0, sizeof(c->hdr));
+    strcpy(c->hdr.magic, DTD_CAPTURE_MAGIC);
+    c->hdr.version = DTD_CAPTURE_VERSION;
+    c->hdr.header_size = DTD_CAPTURE_HEADER_SIZE;
+    c->hdr.sequence = sequence;
+    c->hdr.start_time_ns = realtime_ns();
+
+    return write_header(c);
+}
+
+/**
+ * Write the contents of the write buffer to the current file
+ *
+ * All but the last write of a file are full (aligned) buffers.
+ */
+static osd_result flush_buf(struct dtd_capture *c)
+{
+    if (c->buf_fill == 0) {
+        return OSD_OK;
+    }
+
+    off_t offset = c->hdr.header_size + c->hdr.data_size_bytes;
+    size_t written = 0;
+    while (written < c->buf_fill) {
+        ssize_t rv = pwrite(c->fd, c->buf + written, c->buf_fill - written,
+                            offset + written);
+        if (rv == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rv <= 0) {
+            err("Unable to write to capture file: %s\n", strerror(errno));
+            return OSD_ERROR_FAILURE;
+        }
+        written += rv;
+    }
+
+    c->hdr.data_size_bytes += c->buf_fill;
+    c->buf_fill = 0;
+
+    if (c->hdr.index_len < DTD_CAPTURE_INDEX_LEN) {
+        struct dtd_capture_index_entry *e = &c->hdr.index[c->hdr.index_len++];
+        e->data_offset = c->hdr.data_size_bytes;
+        e->time_ns = realtime_ns();
+    }
+
+    return OSD_OK;
+}
+
+/**
+ * Write all remaining data and complete the header of the current file
+ */
+static osd_result close_file(struct dtd_capture *c)
+{
+    osd_result rv;
+
+    if (c->direct && c->buf_fill % CAPTURE_BUF_ALIGN) {
+        // the last block is only partially filled and cannot be written
+        // with O_DIRECT
+        int flags = fcntl(c->fd, F_GETFL);
+        fcntl(c->fd, F_SETFL, flags & ~O_DIRECT);
+    }
+    rv = flush_buf(c);
+    if (OSD_SUCCEEDED(rv)) {
+        rv = write_header(c);
+    }
+
+    close(c->fd);
+    c->fd = -1;
+    return rv;
+}
+
+osd_result dtd_capture_new(struct dtd_capture **capture, const char *path,
+                           uint64_t rotate_size_bytes, bool direct)
+{
+    osd_result rv;
+
+    assert(rotate_size_bytes == 0 ||
+           rotate_size_bytes >= DTD_CAPTURE_HEADER_SIZE + CAPTURE_BUF_SIZE);
+
+    struct dtd_capture *c = calloc(1, sizeof(struct dtd_capture));
+    if (!c) {
+        return OSD_ERROR_OOM;
+    }
+    c->fd = -1;
+    c->path = strdup(path);
+    c->rotate_size_bytes = rotate_size_bytes;
+    c->direct = direct;
+
+    if (posix_memalign((void**)&c->buf, CAPTURE_BUF_ALIGN, CAPTURE_BUF_SIZE) ||
+        posix_memalign((void**)&c->hdr_block, CAPTURE_BUF_ALIGN,
+                       DTD_CAPTURE_HEADER_SIZE)) {
+        rv = OSD_ERROR_OOM;
+        goto err_free;
+    }
+
+    rv = open_file(c, 0);
+    if (OSD_FAILED(rv)) {
+        goto err_free;
+    }
+
+    *capture = c;
+    return OSD_OK;
+
+err_free:
+    if (c->fd != -1) {
+        close(c->fd);
+    }
+    free(c->buf);
+    free(c->hdr_block);
+    free(c->path);
+    free(c);
+    return rv;
+}
+
+/**
+ * Does the current file need to be rotated before adding data to it?
+ */
+static bool need_rotation(struct dtd_capture *c, size_t size_bytes)
+{
+    if (c->hdr.data_size_bytes == 0 && c->buf_fill == 0) {
+        // never rotate an empty file
+        return false;
+    }
+    if (c->hdr.index_len == DTD_CAPTURE_INDEX_LEN) {
+        return true;
+    }
+    return c->rotate_size_bytes &&
+           c->hdr.header_size + c->hdr.data_size_bytes + c->buf_fill +
+           size_bytes > c->rotate_size_bytes;
+}
+
+osd_result dtd_capture_write(struct dtd_capture *capture, const uint8_t *buf,
+                             size_t size_bytes, size_t dtd_count)
+{
+    struct dtd_capture *c = capture;
+    osd_result rv;
+
+    if (need_rotation(c, size_bytes)) {
+        unsigned int sequence = c->hdr.sequence + 1;
+        rv = close_file(c);
+        if (OSD_FAILED(rv)) {
+            return rv;
+        }
+        rv = open_file(c, sequence);
+        if (OSD_FAILED(rv)) {
+            return rv;
+        }
+    }
+
+    c->hdr.dtd_count += dtd_count;
+
+    while (size_bytes > 0) {
+        size_t len = CAPTURE_BUF_SIZE - c->buf_fill;
+        if (len > size_bytes) {
+            len = size_bytes;
+        }
+        memcpy(c->buf + c->buf_fill, buf, len);
+        c->buf_fill += len;
+        buf += len;
+        size_bytes -= len;
+
+        if (c->buf_fill == CAPTURE_BUF_SIZE) {
+            rv = flush_buf(c);
+            if (OSD_FAILED(rv)) {
+                return rv;
+            }
+        }
+    }
+
+    return OSD_OK;
+}
+
+void dtd_capture_free(struct dtd_capture **capture)
+{
+    assert(capture);
+    struct dtd_capture *c = *capture;
+    if (!c) {
+        return;
+    }
+
+    if (c->fd != -1) {
+        close_file(c);
+    }
+    free(c->buf);
+    free(c->hdr_block);
+    free(c->path);
+    free(c);
+    *capture = NULL;
+}
+
+osd_result dtd_capture_read_header(int fd, struct dtd_capture_header *header)
+{
+    struct dtd_capture_header le;
+
+    ssize_t rv = pread(fd, &le, sizeof(le), 0);
+    if (rv != sizeof(le)) {
+        err("Unable to read capture header.\n");
+        return OSD_ERROR_FAILURE;
+    }
+    if (memcmp(le.magic, DTD_CAPTURE_MAGIC, sizeof(DTD_CAPTURE_MAGIC))) {
+        err("Not a DTD capture file.\n");
+        return OSD_ERROR_FAILURE;
+    }
+    if (le32toh(le.version) != DTD_CAPTURE_VERSION) {
+        err("Unsupported capture file version %u.\n", le32toh(le.version));
+        return OSD_ERROR_FAILURE;
+    }
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, le.magic, sizeof(header->magic));
+    header->version = le32toh(le.version);
+    header->header_size = le32toh(le.header_size);
+    header->sequence = le32toh(le.sequence);
+    header->index_len = le32toh(le.index_len);
+    header->start_time_ns = le64toh(le.start_time_ns);
+    header->data_size_bytes = le64toh(le.data_size_bytes);
+    header->dtd_count = le64toh(le.dtd_count);
+    if (header->index_len > DTD_CAPTURE_INDEX_LEN ||
+        header->header_size < sizeof(struct dtd_capture_header)) {
+        err("Invalid capture header.\n");
+        return OSD_ERROR_FAILURE;
+    }
+    for (unsigned int i = 0; i < header->index_len; i++) {
+        header->index[i].data_offset = le64toh(le.index[i].data_offset);
+        header->index[i].time_ns = le64toh(le.index[i].time_ns);
+    }
+
+    return OSD_OK;
+}
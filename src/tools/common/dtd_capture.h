@@ -0,0 +1,169 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+/**
+ * Raw capture of the Debug Transport Datagram (DTD) stream
+ *
+ * A capture file holds the DTD byte stream exactly as it was received from
+ * the device (big endian, complete DTDs only), preceded by a header block.
+ * No packet is decoded or routed while capturing, which makes capturing
+ * cheap enough to keep up with the device link for long trace runs.
+ *
+ * Captures can be split into multiple files of limited size ("rotation"):
+ * the first file is named as given, the following files get the suffix
+ * ".1", ".2", etc. Every file starts at a DTD boundary.
+ *
+ * File layout:
+ * - struct dtd_capture_header, padded to DTD_CAPTURE_HEADER_SIZE bytes. All
+ *   header fields are little endian.
+ * - data_size_bytes bytes of DTDs
+ *
+ * The header contains a small index which maps data offsets to the time the
+ * data was received, which allows to replay a capture at its original speed.
+ * The header is completed when the file is closed; if data_size_bytes is 0
+ * the capture was aborted and all data up to the end of the file is valid
+ * (up to the last complete DTD).
+ */
+
+#ifndef OSD_TOOLS_DTD_CAPTURE_H
+#define OSD_TOOLS_DTD_CAPTURE_H
+
+#include <osd/osd.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Magic bytes at the start of a capture file */
+#define DTD_CAPTURE_MAGIC "OSDDTDC"
+
+/** Version of the capture file format */
+#define DTD_CAPTURE_VERSION 1
+
+/**
+ * Size of the header block
+ *
+ * The data starts at a block boundary, which allows to write it with
+ * O_DIRECT.
+ */
+#define DTD_CAPTURE_HEADER_SIZE 4096
+
+/** Maximum number of index entries in a capture file */
+#define DTD_CAPTURE_INDEX_LEN 250
+
+/**
+ * Index entry: all data up to a given offset was received at a given time
+ */
+struct dtd_capture_index_entry {
+    /** data offset (in bytes from the end of the header) */
+    uint64_t data_offset;
+    /** time of reception (CLOCK_REALTIME, in ns) */
+    uint64_t time_ns;
+};
+
+/**
+ * Header of a capture file
+ */
+struct dtd_capture_header {
+    /** DTD_CAPTURE_MAGIC (zero terminated) */
+    char magic[8];
+    /** DTD_CAPTURE_VERSION */
+    uint32_t version;
+    /** size of the header block (data offset in the file) */
+    uint32_t header_size;
+    /** number of this file in a rotated capture, starting at 0 */
+    uint32_t sequence;
+    /** number of valid entries in index */
+    uint32_t index_len;
+    /** time the file was started (CLOCK_REALTIME, in ns) */
+    uint64_t start_time_ns;
+    /** number of valid data bytes, 0 if the file wasn't closed properly */
+    uint64_t data_size_bytes;
+    /** number of DTDs in the file */
+    uint64_t dtd_count;
+    uint8_t reserved[16];
+    /** index, ordered by data_offset */
+    struct dtd_capture_index_entry index[DTD_CAPTURE_INDEX_LEN];
+};
+
+struct dtd_capture;
+
+/**
+ * Start a new capture
+ *
+ * @param[out] capture the new capture object
+ * @param path path of the (first) capture file. Existing files are
+ *             overwritten.
+ * @param rotate_size_bytes maximum size of a file before the capture
+ *                          continues in the next file, 0 for no limit
+ * @param direct write data with O_DIRECT, bypassing the page cache
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result dtd_capture_new(struct dtd_capture **capture, const char *path,
+                           uint64_t rotate_size_bytes, bool direct);
+
+/**
+ * Append DTDs to the capture
+ *
+ * Data is collected in a large buffer and written to disk in aligned blocks.
+ *
+ * @param buf complete DTDs in wire format (big endian)
+ * @param size_bytes number of bytes in @p buf
+ * @param dtd_count number of DTDs in @p buf
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result dtd_capture_write(struct dtd_capture *capture, const uint8_t *buf,
+                             size_t size_bytes, size_t dtd_count);
+
+/**
+ * Finish the capture and free (and NULL) the capture object
+ *
+ * All buffered data is written and the header of the current file is
+ * completed.
+ */
+void dtd_capture_free(struct dtd_capture **capture);
+
+/**
+ * Get the path of a file in a rotated capture
+ *
+ * @param path path of the first capture file
+ * @param sequence number of the file
+ * @return the path (free after use)
+ */
+char* dtd_capture_get_path(const char *path, unsigned int sequence);
+
+/**
+ * Read and check the header of a capture file
+ *
+ * @param fd file descriptor of the capture file
+ * @param[out] header the header (in native endianness)
+ * @return OSD_OK if the header is valid, any other value indicates an error
+ */
+osd_result dtd_capture_read_header(int fd, struct dtd_capture_header *header);
+
+#endif // OSD_TOOLS_DTD_CAPTURE_H
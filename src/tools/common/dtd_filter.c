@@ -0,0 +1,337 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#include "dtd_filter.h"
+
+#include <osd/packet.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+struct dtd_filter_sample_rule {
+    uint16_t src;
+    uint32_t n;
+    uint32_t cnt;
+};
+
+struct dtd_filter {
+    /** any rules configured? */
+    bool active;
+
+    /** denied source addresses (one bit per DI address) */
+    uint64_t src_deny[(UINT16_MAX + 1) / 64];
+
+    /** denied types (bit type * 16 + subtype) */
+    uint64_t type_deny;
+
+    /** sampling rules for specific sources */
+    struct dtd_filter_sample_rule sample[DTD_FILTER_SAMPLE_RULES_MAX];
+    size_t sample_len;
+
+    /** sampling rule for all other sources (n == 1: disabled) */
+    struct dtd_filter_sample_rule sample_all;
+
+    uint64_t dropped;
+};
+
+osd_result dtd_filter_new(struct dtd_filter **filter)
+{
+    struct dtd_filter *f = calloc(1, sizeof(struct dtd_filter));
+    if (!f) {
+        return OSD_ERROR_OOM;
+    }
+    f->sample_all.n = 1;
+
+    *filter = f;
+    return OSD_OK;
+}
+
+void dtd_filter_free(struct dtd_filter **filter)
+{
+    assert(filter);
+    free(*filter);
+    *filter = NULL;
+}
+
+static bool parse_uint(const char *str, unsigned long max,
+                       unsigned long *value)
+{
+    char *end;
+    if (!str || !*str) {
+        return false;
+    }
+    *value = strtoul(str, &end, 0);
+    return !*end && *value <= max;
+}
+
+/**
+ * Parse a DI address or "all" (returned as -1)
+ */
+static bool parse_diaddr(const char *str, long *diaddr)
+{
+    unsigned long value;
+
+    if (str && !strcasecmp(str, "all")) {
+        *diaddr = -1;
+        return true;
+    }
+    if (!parse_uint(str, UINT16_MAX, &value)) {
+        return false;
+    }
+    *diaddr = value;
+    return true;
+}
+
+/**
+ * Parse "<type>[.<subtype>]" into a mask of (type, subtype) combinations
+ */
+static bool parse_type_mask(const char *str, uint64_t *mask)
+{
+    static const char *type_names[] = { "reg", "plain", "event", "res" };
+    unsigned long type, subtype;
+
+    if (!str) {
+        return false;
+    }
+
+    char *type_str = strdup(str);
+    char *subtype_str = strchr(type_str, '.');
+    if (subtype_str) {
+        *subtype_str++ = '\0';
+    }
+
+    bool valid = false;
+    for (type = 0; type < 4; type++) {
+        if (!strcasecmp(type_str, type_names[type])) {
+            valid = true;
+            break;
+        }
+    }
+    if (!valid) {
+        valid = parse_uint(type_str, DP_HEADER_TYPE_MASK, &type);
+    }
+
+    if (valid && subtype_str) {
+        valid = parse_uint(subtype_str, DP_HEADER_TYPE_SUB_MASK, &subtype);
+        *mask = 1ULL << (type * 16 + subtype);
+    } else if (valid) {
+        *mask = 0xffffULL << (type * 16);
+    }
+
+    free(type_str);
+    return valid;
+}
+
+static void update_active(struct dtd_filter *f)
+{
+    bool src_deny = false;
+    for (size_t i = 0; i < sizeof(f->src_deny) / sizeof(f->src_deny[0]); i++) {
+        if (f->src_deny[i]) {
+            src_deny = true;
+            break;
+        }
+    }
+    f->active = src_deny || f->type_deny || f->sample_len ||
+                f->sample_all.n != 1;
+}
+
+static bool add_sample_rule(struct dtd_filter *f, long src, unsigned long n)
+{
+    if (src == -1) {
+        f->sample_all.n = n;
+        f->sample_all.cnt = 0;
+        return true;
+    }
+
+    size_t i;
+    for (i = 0; i < f->sample_len; i++) {
+        if (f->sample[i].src == src) {
+            break;
+        }
+    }
+    if (n == 1) {
+        // remove rule
+        if (i < f->sample_len) {
+            f->sample[i] = f->sample[--f->sample_len];
+        }
+        return true;
+    }
+    if (i == f->sample_len) {
+        if (f->sample_len == DTD_FILTER_SAMPLE_RULES_MAX) {
+            return false;
+        }
+        f->sample_len++;
+    }
+    f->sample[i].src = src;
+    f->sample[i].n = n;
+    f->sample[i].cnt = 0;
+    return true;
+}
+
+osd_result dtd_filter_add_rule(struct dtd_filter *filter, const char *rule)
+{
+    struct dtd_filter *f = filter;
+    char *argv[4] = { NULL };
+    int argc = 0;
+    bool valid = false;
+
+    char *rule_copy = strdup(rule);
+    if (!rule_copy) {
+        return OSD_ERROR_OOM;
+    }
+    char *saveptr;
+    for (char *tok = strtok_r(rule_copy, " \t", &saveptr); tok;
+         tok = strtok_r(NULL, " \t", &saveptr)) {
+        if (argc == 4) {
+            goto free_return;
+        }
+        argv[argc++] = tok;
+    }
+    if (argc == 0) {
+        goto free_return;
+    }
+
+    if (!strcasecmp(argv[0], "reset") && argc == 1) {
+        memset(f->src_deny, 0, sizeof(f->src_deny));
+        f->type_deny = 0;
+        f->sample_len = 0;
+        f->sample_all.n = 1;
+        valid = true;
+
+    } else if (!strcasecmp(argv[0], "src") && argc == 3) {
+        long diaddr;
+        bool deny = !strcasecmp(argv[1], "deny");
+        if ((!deny && strcasecmp(argv[1], "allow")) ||
+            !parse_diaddr(argv[2], &diaddr)) {
+            goto free_return;
+        }
+        if (diaddr == -1) {
+            memset(f->src_deny, deny ? 0xff : 0, sizeof(f->src_deny));
+        } else if (deny) {
+            f->src_deny[diaddr / 64] |= 1ULL << (diaddr % 64);
+        } else {
+            f->src_deny[diaddr / 64] &= ~(1ULL << (diaddr % 64));
+        }
+        valid = true;
+
+    } else if (!strcasecmp(argv[0], "type") && argc == 3) {
+        uint64_t mask;
+        bool deny = !strcasecmp(argv[1], "deny");
+        if ((!deny && strcasecmp(argv[1], "allow")) ||
+            !parse_type_mask(argv[2], &mask)) {
+            goto free_return;
+        }
+        if (deny) {
+            f->type_deny |= mask;
+        } else {
+            f->type_deny &= ~mask;
+        }
+        valid = true;
+
+    } else if (!strcasecmp(argv[0], "sample") && argc == 3) {
+        long diaddr;
+        unsigned long n;
+        if (!parse_diaddr(argv[1], &diaddr) ||
+            !parse_uint(argv[2], UINT32_MAX, &n) || n == 0) {
+            goto free_return;
+        }
+        valid = add_sample_rule(f, diaddr, n);
+    }
+
+    update_active(f);
+
+free_return:
+    free(rule_copy);
+    return valid ? OSD_OK : OSD_ERROR_FAILURE;
+}
+
+/**
+ * Apply a sampling rule: forward every n-th packet
+ */
+static bool sample(struct dtd_filter_sample_rule *rule)
+{
+    if (rule->n == 1) {
+        return true;
+    }
+    if (++rule->cnt >= rule->n) {
+        rule->cnt = 0;
+        return true;
+    }
+    return false;
+}
+
+bool dtd_filter_match(struct dtd_filter *filter, const uint16_t *hdr,
+                      size_t pkt_size_words)
+{
+    struct dtd_filter *f = filter;
+
+    if (!f->active || pkt_size_words < 3) {
+        return true;
+    }
+
+    uint16_t src = hdr[1];
+    unsigned int type = (hdr[2] >> DP_HEADER_TYPE_SHIFT) & DP_HEADER_TYPE_MASK;
+    unsigned int type_sub = (hdr[2] >> DP_HEADER_TYPE_SUB_SHIFT) &
+                            DP_HEADER_TYPE_SUB_MASK;
+
+    if (f->type_deny & (1ULL << (type * 16 + type_sub))) {
+        goto drop;
+    }
+
+    if (type == OSD_PACKET_TYPE_REG) {
+        return true;
+    }
+
+    if (f->src_deny[src / 64] & (1ULL << (src % 64))) {
+        goto drop;
+    }
+
+    for (size_t i = 0; i < f->sample_len; i++) {
+        if (f->sample[i].src == src) {
+            if (!sample(&f->sample[i])) {
+                goto drop;
+            }
+            return true;
+        }
+    }
+    if (!sample(&f->sample_all)) {
+        goto drop;
+    }
+    return true;
+
+drop:
+    // single writer: no atomic increment needed
+    __atomic_store_n(&f->dropped, f->dropped + 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+uint64_t dtd_filter_get_dropped(struct dtd_filter *filter)
+{
+    return __atomic_load_n(&filter->dropped, __ATOMIC_RELAXED);
+}
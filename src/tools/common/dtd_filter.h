@@ -0,0 +1,102 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+/**
+ * Filter for packets received from the device
+ *
+ * The filter decides based on the packet header alone if a packet is
+ * forwarded to the host, and is applied before any message is created for
+ * it. It is configured with textual rules (one rule per call to
+ * dtd_filter_add_rule()):
+ *
+ * - "src deny <diaddr|all>", "src allow <diaddr|all>": drop (or forward
+ *   again) packets from a given source DI address.
+ * - "type deny <type>[.<subtype>]", "type allow <type>[.<subtype>]": drop
+ *   (or forward again) packets of a given type and subtype. The type is one
+ *   of "reg", "plain", "event", "res" or a number, the subtype a number
+ *   (all subtypes if omitted).
+ * - "sample <diaddr|all> <n>": forward only every n-th packet from a source
+ *   (or all sources without a specific rule). n == 1 forwards all packets.
+ * - "reset": remove all rules.
+ *
+ * Source and sampling rules are not applied to register access packets, as
+ * dropping them would break register accesses of the host modules.
+ *
+ * A filter is not thread-safe: it must only be used from one thread at a
+ * time. The exception is dtd_filter_get_dropped(), which can be called from
+ * any thread.
+ */
+
+#ifndef OSD_TOOLS_DTD_FILTER_H
+#define OSD_TOOLS_DTD_FILTER_H
+
+#include <osd/osd.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Maximum number of per-source sampling rules */
+#define DTD_FILTER_SAMPLE_RULES_MAX 16
+
+struct dtd_filter;
+
+/**
+ * Create a new filter (which forwards all packets)
+ */
+osd_result dtd_filter_new(struct dtd_filter **filter);
+
+/**
+ * Free (and NULL) a filter
+ */
+void dtd_filter_free(struct dtd_filter **filter);
+
+/**
+ * Add a rule to the filter
+ *
+ * @param rule the rule, see the description of this file for the syntax
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if the rule is invalid
+ */
+osd_result dtd_filter_add_rule(struct dtd_filter *filter, const char *rule);
+
+/**
+ * Check if a packet should be forwarded
+ *
+ * @param hdr the first words of the packet (dest, src, flags; native
+ *            endianness)
+ * @param pkt_size_words size of the packet in words. If it is smaller than
+ *                       3, only this many words are valid in @p hdr.
+ * @return true if the packet should be forwarded, false if it is dropped
+ */
+bool dtd_filter_match(struct dtd_filter *filter, const uint16_t *hdr,
+                      size_t pkt_size_words);
+
+/**
+ * Number of packets dropped by the filter
+ */
+uint64_t dtd_filter_get_dropped(struct dtd_filter *filter);
+
+#endif // OSD_TOOLS_DTD_FILTER_H
@@ -0,0 +1,318 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#include "dtd_queue.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+struct dtd_queue {
+    /** ring buffer (size_words words) */
+    uint16_t *buf;
+    size_t size_words;
+
+    /**
+     * Write position (total number of words written), only modified by the
+     * producer
+     */
+    size_t head __attribute__((aligned(64)));
+
+    /**
+     * Read position (total number of words read), only modified by the
+     * consumer
+     */
+    size_t tail __attribute__((aligned(64)));
+
+    /** producer is waiting for space in the queue */
+    bool producer_waiting;
+
+    /** number of DTDs pushed (written by the producer) */
+    uint64_t dtds_pushed;
+    /** time the producer was blocked (in us, written by the producer) */
+    uint64_t producer_blocked_us;
+    /** high water mark of head - tail, reset by dtd_queue_get_stats() */
+    size_t max_fill_words;
+
+    /** signals the consumer that data is available */
+    int data_fd;
+    /** signals the producer that space is available */
+    int space_fd;
+};
+
+osd_result dtd_queue_new(struct dtd_queue **queue, size_t size_words)
+{
+    assert((size_words & (size_words - 1)) == 0);
+    assert(size_words >= 1 + UINT16_MAX);
+
+    struct dtd_queue *q = calloc(1, sizeof(struct dtd_queue));
+    if (!q) {
+        return OSD_ERROR_OOM;
+    }
+    q->data_fd = -1;
+    q->space_fd = -1;
+
+    q->buf = malloc(size_words * sizeof(uint16_t));
+    if (!q->buf) {
+        goto err_free;
+    }
+    q->size_words = size_words;
+
+    q->data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    q->space_fd = eventfd(0, EFD_CLOEXEC);
+    if (q->data_fd == -1 || q->space_fd == -1) {
+        goto err_free;
+    }
+
+    *queue = q;
+    return OSD_OK;
+
+err_free:
+    dtd_queue_free(&q);
+    return OSD_ERROR_FAILURE;
+}
+
+void dtd_queue_free(struct dtd_queue **queue)
+{
+    assert(queue);
+    struct dtd_queue *q = *queue;
+    if (!q) {
+        return;
+    }
+
+    if (q->data_fd != -1) {
+        close(q->data_fd);
+    }
+    if (q->space_fd != -1) {
+        close(q->space_fd);
+    }
+    free(q->buf);
+    free(q);
+    *queue = NULL;
+}
+
+int dtd_queue_get_fd(struct dtd_queue *queue)
+{
+    return queue->data_fd;
+}
+
+static void eventfd_signal(int fd)
+{
+    uint64_t one = 1;
+    ssize_t rv;
+    do {
+        rv = write(fd, &one, sizeof(one));
+    } while (rv == -1 && errno == EINTR);
+}
+
+static void eventfd_clear(int fd)
+{
+    uint64_t cnt;
+    ssize_t rv;
+    do {
+        rv = read(fd, &cnt, sizeof(cnt));
+    } while (rv == -1 && errno == EINTR);
+}
+
+/**
+ * Wait until at least @p size_words words are free in the queue
+ */
+static size_t wait_for_space(struct dtd_queue *q, size_t size_words)
+{
+    size_t head = q->head;
+
+    while (1) {
+        size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        size_t space = q->size_words - (head - tail);
+        if (space >= size_words) {
+            return space;
+        }
+
+        // Announce that we're waiting, then check again: the consumer
+        // might have made room in the meantime without seeing the flag.
+        __atomic_store_n(&q->producer_waiting, true, __ATOMIC_SEQ_CST);
+        tail = __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST);
+        space = q->size_words - (head - tail);
+        if (space >= size_words) {
+            __atomic_store_n(&q->producer_waiting, false, __ATOMIC_RELAXED);
+            return space;
+        }
+        int64_t t_start = zclock_usecs();
+        eventfd_clear(q->space_fd);
+        __atomic_store_n(&q->producer_blocked_us, q->producer_blocked_us +
+                         (zclock_usecs() - t_start), __ATOMIC_RELAXED);
+    }
+}
+
+size_t dtd_queue_push(struct dtd_queue *queue, const uint16_t *buf,
+                      size_t size_words)
+{
+    struct dtd_queue *q = queue;
+    size_t pos = 0;
+
+    while (pos < size_words) {
+        // the first word of a DTD is the size of the packet that follows
+        size_t dtd_size_words = 1 + buf[pos];
+        if (size_words - pos < dtd_size_words) {
+            break;
+        }
+
+        // collect as many complete DTDs as fit into the free space
+        size_t space = wait_for_space(q, dtd_size_words);
+        size_t end = pos + dtd_size_words;
+        uint64_t dtds = 1;
+        while (end < size_words) {
+            size_t next_size_words = 1 + buf[end];
+            if (size_words - end < next_size_words ||
+                end - pos + next_size_words > space) {
+                break;
+            }
+            end += next_size_words;
+            dtds++;
+        }
+
+        // copy to the ring (in up to two parts)
+        size_t len = end - pos;
+        size_t idx = q->head & (q->size_words - 1);
+        size_t len_first = q->size_words - idx;
+        if (len_first > len) {
+            len_first = len;
+        }
+        memcpy(&q->buf[idx], &buf[pos], len_first * sizeof(uint16_t));
+        memcpy(q->buf, &buf[pos + len_first],
+               (len - len_first) * sizeof(uint16_t));
+
+        __atomic_store_n(&q->head, q->head + len, __ATOMIC_RELEASE);
+        eventfd_signal(q->data_fd);
+
+        __atomic_store_n(&q->dtds_pushed, q->dtds_pushed + dtds,
+                         __ATOMIC_RELAXED);
+        // an upper bound: the consumer might have made room in the meantime
+        size_t fill_words = q->size_words - space + len;
+        size_t max_fill_words = __atomic_load_n(&q->max_fill_words,
+                                                __ATOMIC_RELAXED);
+        while (fill_words > max_fill_words &&
+               !__atomic_compare_exchange_n(&q->max_fill_words,
+                                            &max_fill_words, fill_words,
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+        }
+
+        pos = end;
+    }
+
+    return pos;
+}
+
+/**
+ * Copy words out of the ring buffer
+ */
+static void ring_copy_out(struct dtd_queue *q, size_t pos, uint16_t *dst,
+                          size_t len)
+{
+    size_t idx = pos & (q->size_words - 1);
+    size_t len_first = q->size_words - idx;
+    if (len_first > len) {
+        len_first = len;
+    }
+    memcpy(dst, &q->buf[idx], len_first * sizeof(uint16_t));
+    memcpy(dst + len_first, q->buf, (len - len_first) * sizeof(uint16_t));
+}
+
+size_t dtd_queue_drain(struct dtd_queue *queue, zsock_t *sock,
+                       struct dtd_filter *filter)
+{
+    struct dtd_queue *q = queue;
+    size_t dtds_sent = 0;
+
+    eventfd_clear(q->data_fd);
+
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    size_t tail = q->tail;
+
+    while (tail != head) {
+        size_t pkg_size_words = q->buf[tail & (q->size_words - 1)];
+
+        if (filter) {
+            uint16_t hdr[3];
+            size_t hdr_size_words = pkg_size_words < 3 ? pkg_size_words : 3;
+            ring_copy_out(q, tail + 1, hdr, hdr_size_words);
+            if (!dtd_filter_match(filter, hdr, pkg_size_words)) {
+                tail += 1 + pkg_size_words;
+                continue;
+            }
+        }
+
+        zframe_t *data_frame = zframe_new(NULL,
+                                          pkg_size_words * sizeof(uint16_t));
+        assert(data_frame);
+        ring_copy_out(q, tail + 1, (uint16_t*)zframe_data(data_frame),
+                      pkg_size_words);
+
+        zmsg_t *msg = zmsg_new();
+        zmsg_addstr(msg, "D");
+        zmsg_append(msg, &data_frame);
+        zmsg_send(&msg, sock);
+        zmsg_destroy(&msg);
+
+        tail += 1 + pkg_size_words;
+        dtds_sent++;
+    }
+
+    __atomic_store_n(&q->tail, tail, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->producer_waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&q->producer_waiting, false, __ATOMIC_RELAXED);
+        eventfd_signal(q->space_fd);
+    }
+
+    return dtds_sent;
+}
+
+void dtd_queue_get_stats(struct dtd_queue *queue,
+                         struct dtd_queue_stats *stats)
+{
+    struct dtd_queue *q = queue;
+
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    stats->size_words = q->size_words;
+    stats->fill_words = head - tail;
+    stats->max_fill_words = __atomic_exchange_n(&q->max_fill_words,
+                                                stats->fill_words,
+                                                __ATOMIC_RELAXED);
+    if (stats->max_fill_words < stats->fill_words) {
+        stats->max_fill_words = stats->fill_words;
+    }
+    stats->dtds_pushed = __atomic_load_n(&q->dtds_pushed, __ATOMIC_RELAXED);
+    stats->producer_blocked_us = __atomic_load_n(&q->producer_blocked_us,
+                                                 __ATOMIC_RELAXED);
+}
@@ -0,0 +1,129 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+/**
+ * Lock-free queue of Debug Transport Datagrams (DTDs)
+ *
+ * The queue hands DTDs received from the device over from a reader thread
+ * (the producer) to the thread owning the host socket (the consumer) without
+ * any locks. It is a single-producer/single-consumer ring buffer: exactly one
+ * thread may push, and exactly one (other) thread may drain the queue.
+ *
+ * The consumer is woken up through a file descriptor (an eventfd), which can
+ * be added to a zloop poller or any other poll() loop. If the queue is full
+ * the producer blocks until the consumer has made room, which propagates
+ * backpressure to the device.
+ */
+
+#ifndef OSD_TOOLS_DTD_QUEUE_H
+#define OSD_TOOLS_DTD_QUEUE_H
+
+#include "dtd_filter.h"
+
+#include <osd/osd.h>
+
+#include <czmq.h>
+#include <stdint.h>
+
+struct dtd_queue;
+
+/**
+ * Statistics of a DTD queue
+ *
+ * @see dtd_queue_get_stats()
+ */
+struct dtd_queue_stats {
+    /** capacity of the queue (in 16 bit words) */
+    size_t size_words;
+    /** number of words currently in the queue */
+    size_t fill_words;
+    /** highest number of words in the queue since the last call */
+    size_t max_fill_words;
+    /** number of DTDs pushed to the queue */
+    uint64_t dtds_pushed;
+    /** time the producer was blocked waiting for space (in us) */
+    uint64_t producer_blocked_us;
+};
+
+/**
+ * Create a new DTD queue
+ *
+ * @param[out] queue the new queue
+ * @param size_words capacity of the queue in 16 bit words. Must be a power of
+ *                   two and large enough to hold a DTD of maximum size.
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result dtd_queue_new(struct dtd_queue **queue, size_t size_words);
+
+/**
+ * Free (and NULL) a DTD queue
+ */
+void dtd_queue_free(struct dtd_queue **queue);
+
+/**
+ * File descriptor which becomes readable when DTDs are available
+ *
+ * The consumer must call dtd_queue_drain() when the descriptor is readable.
+ */
+int dtd_queue_get_fd(struct dtd_queue *queue);
+
+/**
+ * Push all complete DTDs in a buffer to the queue (producer side)
+ *
+ * Blocks while the queue is full.
+ *
+ * @param buf buffer holding DTDs (in native endianness)
+ * @param size_words number of valid words in @p buf
+ * @return number of words consumed from @p buf. All remaining words belong to
+ *         a DTD which hasn't been received completely yet.
+ */
+size_t dtd_queue_push(struct dtd_queue *queue, const uint16_t *buf,
+                      size_t size_words);
+
+/**
+ * Send all queued DTDs to a socket (consumer side)
+ *
+ * Each DTD is sent as data message ("D" frame followed by the packet data).
+ *
+ * @param filter filter deciding which packets are sent, or NULL to send all
+ *               packets. DTDs dropped by the filter are discarded without
+ *               creating a message for them.
+ * @return number of DTDs sent
+ */
+size_t dtd_queue_drain(struct dtd_queue *queue, zsock_t *sock,
+                       struct dtd_filter *filter);
+
+/**
+ * Get the statistics of a queue
+ *
+ * Can be called from any thread. The high water mark (max_fill_words) is
+ * reset by this call; call it only from one thread.
+ */
+void dtd_queue_get_stats(struct dtd_queue *queue,
+                         struct dtd_queue_stats *stats);
+
+#endif // OSD_TOOLS_DTD_QUEUE_H
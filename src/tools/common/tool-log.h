@@ -0,0 +1,52 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+/**
+ * Logging for code shared between the command line tools
+ *
+ * The log functions are provided by cli-util.h, which is included by the
+ * tool the shared code is linked into. Define LOG_CATEGORY before including
+ * this file to set the category of all log messages.
+ */
+
+#ifndef OSD_TOOLS_TOOL_LOG_H
+#define OSD_TOOLS_TOOL_LOG_H
+
+#include <syslog.h>
+
+#ifndef LOG_CATEGORY
+#error "Define LOG_CATEGORY before including tool-log.h"
+#endif
+
+void cli_log(int priority, const char* category,
+             const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+
+#define dbg(arg...) cli_log(LOG_DEBUG, LOG_CATEGORY, ## arg)
+#define info(arg...) cli_log(LOG_INFO, LOG_CATEGORY, ## arg)
+#define err(arg...) cli_log(LOG_ERR, LOG_CATEGORY, ## arg)
+
+#endif // OSD_TOOLS_TOOL_LOG_H
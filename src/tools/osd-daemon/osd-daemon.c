@@ -1,362 +1,217 @@
 /**
- * Open SoC Debug Communication Daemon
- */
-
-#include <osd/osd.h>
-#include "../cli-util.h"
-
-#include <libglip.h>
-#include <stdlib.h>
-#include <argp.h>
-#include <stdio.h>
-#include <unistd.h>
-#include <byteswap.h>
-#include <src/libosd/include/osd/hostmod.h>
-#include <zmq.h>
-
-/**
- * Default GLIP backend to be used when connecting to a device
+ * Open SoC Debug Daemon
+ *
+ * The daemon combines a host controller and a device gateway in a single
+ * process: it owns the connection to the device and serves any number of
+ * host modules on one endpoint. The gateway talks to the host controller
+ * through an inproc endpoint, which saves the TCP hop between a separate
+ * osd-host-controller and osd-device-gateway.
  */
-#define GLIP_DEFAULT_BACKEND "uart"
-
-const char *argp_program_bug_address =
-  "https://github.com/opensocdebug/software/issues";
-
-/* Program documentation. */
-static char doc[] =
-  "Open SoC Debug Daemon -- communicate with an Open SoC Debug enabled device";
 
-/* A description of the arguments we accept. */
-static char args_doc[] = "";
+#define CLI_TOOL_PROGNAME "osd-daemon"
+#define CLI_TOOL_SHORTDESC "Open SoC Debug daemon"
 
-/**
- * Command-line options for this program
- */
-static struct argp_option options[] = {
-    {"verbose",  'v', 0,      0,  "Produce verbose output" },
-    {"glip-backend",  'b', "BACKEND", 0,
-     "Use GLIP backend BACKEND to connect to the device (default: " GLIP_DEFAULT_BACKEND ")" },
-    {"glip-backend-options",  'o', "OPTIONS", 0,
-     "Comma-separated list of options to pass to the GLIP backend" },
-    { 0 }
-};
+#include "../cli-util.h"
+#include <osd/hostctrl.h>
+#include <czmq.h>
+#include "device_gateway.h"
 
 /**
- * Definition of arguments available to this daemon
+ * Default endpoint host modules connect to
  */
-struct arguments {
-    int verbose; //!< verbose output
-    int color_output; //!< use colors in the output
-    char* glip_backend; //!< name of the GLIP backend to be used
-    struct glip_option* glip_backend_options; //!< list of options passed to the GLIP backend
-    size_t glip_backend_options_len; //!< number of entries in glip_backend_options
-};
+#define DEFAULT_HOSTCTRL_BIND_EP "tcp://0.0.0.0:9537"
 
 /**
- * Argp callback: parse a single option
+ * Endpoint of the host controller used by the gateway
  */
-static error_t parse_opt(int key, char *arg, struct argp_state *state)
-{
-    int rv;
-
-    /* Get the input argument from argp_parse, which we
-     know is a pointer to our arguments structure. */
-    struct arguments *arguments = state->input;
-
-    switch (key) {
-    case 'v':
-        arguments->verbose = 1;
-        break;
-    case 'b':
-        arguments->glip_backend = arg;
-        break;
-    case 'o':
-        rv = glip_parse_option_string(arg, &arguments->glip_backend_options,
-                                      &arguments->glip_backend_options_len);
-        if (rv != 0) {
-            info("Unable to parse GLIP backend options.\n");
-            return ARGP_ERR_UNKNOWN;
-        }
-        break;
-
-    default:
-      return ARGP_ERR_UNKNOWN;
-    }
-    return 0;
-}
-
-static struct argp argp = { options, parse_opt, args_doc, doc };
+#define GATEWAY_HOSTCTRL_EP "inproc://osd-daemon-hostctrl"
 
 /**
- * Arguments passed to this daemon
+ * Default GLIP backend to be used when connecting to a device
  */
-struct arguments arguments;
+#define GLIP_DEFAULT_BACKEND "uart"
 
 /**
- * GLIP library context
+ * Default transport to the device
  */
-struct glip_ctx *glip_ctx;
+#define DEFAULT_TRANSPORT "glip"
 
 /**
- * Open SoC Debug communication library context
+ * Default interval (in s) of the statistics summary printed with -v
  */
-struct osd_com_ctx *osd_com_ctx;
+#define DEFAULT_STATS_INTERVAL_S 10
 
 /**
- * Log handler for GLIP
+ * Default maximum size of a capture file (in MiB)
  */
-static void glip_log_handler(struct glip_ctx *ctx, int priority,
-                             const char *file, int line, const char *fn,
-                             const char *format, va_list args)
+#define DEFAULT_CAPTURE_ROTATE_MIB 1024
+
+/** Subnet of the device */
+#define DEVICE_SUBNET 0
+
+
+// command line arguments
+struct arg_str *a_bind;
+struct arg_str *a_transport;
+struct arg_str *a_transport_options;
+struct arg_str *a_glip_backend;
+struct arg_str *a_glip_backend_options;
+struct arg_int *a_trace_channel;
+struct arg_str *a_filter;
+struct arg_int *a_stats_interval;
+struct arg_file *a_capture;
+struct arg_int *a_capture_rotate;
+struct arg_lit *a_capture_direct;
+
+osd_result setup(void)
 {
-    cli_vlog(priority, "libglip", format, args);
+    a_bind = arg_str0(NULL, "bind", "<endpoint>",
+                      "ZeroMQ endpoint host modules connect to (default: "
+                      DEFAULT_HOSTCTRL_BIND_EP ")");
+    a_bind->sval[0] = DEFAULT_HOSTCTRL_BIND_EP;
+    osd_tool_add_arg(a_bind);
+
+    a_transport = arg_str0(NULL, "transport", "<name>",
+                           "Transport to the device: glip (hardware) or sim "
+                           "(simulated device) (default: "DEFAULT_TRANSPORT")");
+    a_transport->sval[0] = DEFAULT_TRANSPORT;
+    osd_tool_add_arg(a_transport);
+
+    a_transport_options = arg_str0(NULL, "transport-options",
+                                   "<option1=value1,option2=value2,...>",
+                                   "Transport options (not for glip, use "
+                                   "--glip-backend-options instead)");
+    osd_tool_add_arg(a_transport_options);
+
+    a_glip_backend = arg_str0(NULL, "glip-backend", "<name>",
+                              "GLIP backend name (default: "
+                              GLIP_DEFAULT_BACKEND ")");
+    a_glip_backend->sval[0] = GLIP_DEFAULT_BACKEND;
+    osd_tool_add_arg(a_glip_backend);
+
+    a_glip_backend_options = arg_str0(NULL, "glip-backend-options",
+                                      "<option1=value1,option2=value2,...>",
+                                      "GLIP backend options");
+    osd_tool_add_arg(a_glip_backend_options);
+
+    a_trace_channel = arg_int0(NULL, "trace-channel", "<channel>",
+                               "Device channel for event (trace) packets "
+                               "(default: 0, i.e. shared with control "
+                               "traffic)");
+    a_trace_channel->ival[0] = 0;
+    osd_tool_add_arg(a_trace_channel);
+
+    a_filter = arg_strn(NULL, "filter", "<rule>", 0, 64,
+                        "Filter rule for packets sent from the device to the "
+                        "host, e.g. \"src deny 5\", \"type deny event\" or "
+                        "\"sample all 10\". Can be given multiple times.");
+    osd_tool_add_arg(a_filter);
+
+    a_stats_interval = arg_int0(NULL, "stats-interval", "<s>",
+                                "Interval of the throughput summary printed "
+                                "with -v (in s, 0 to disable, default: 10)");
+    a_stats_interval->ival[0] = DEFAULT_STATS_INTERVAL_S;
+    osd_tool_add_arg(a_stats_interval);
+
+    a_capture = arg_file0(NULL, "capture", "<file>",
+                          "Write trace data from the device to a raw capture "
+                          "file instead of sending it to the host");
+    osd_tool_add_arg(a_capture);
+
+    a_capture_rotate = arg_int0(NULL, "capture-rotate", "<MiB>",
+                                "Continue the capture in a new file after "
+                                "this size (0: no limit, default: 1024)");
+    a_capture_rotate->ival[0] = DEFAULT_CAPTURE_ROTATE_MIB;
+    osd_tool_add_arg(a_capture_rotate);
+
+    a_capture_direct = arg_lit0(NULL, "capture-direct",
+                                "Write the capture with O_DIRECT, bypassing "
+                                "the page cache");
+    osd_tool_add_arg(a_capture_direct);
+
+    return OSD_OK;
 }
 
-static ssize_t device_write(uint16_t *buf, size_t size_words, int flags)
+int run(void)
 {
-    size_t bytes_written;
-    int rv;
-
-    // GLIP and OSD are big endian, |buf| is in native endianness
-    uint16_t *buf_be;
-
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    buf_be = malloc(size_words * sizeof(uint16_t));
-    if (!buf_be) {
-        return -1;
-    }
+    osd_result rv;
+    int exitcode;
+    struct osd_hostctrl_ctx *hostctrl_ctx = NULL;
+    char *router_address = NULL;
 
-    for (size_t w = 0; w < size_words; w++) {
-        buf_be[w] = bswap_16(buf[w]);
-    }
-#else
-    buf_be = buf;
-#endif
-
-    if (flags & OSD_COM_NONBLOCK) {
-        rv = glip_write(glip_ctx, 0, size_words * sizeof(uint16_t), (uint8_t*)buf_be,
-                        &bytes_written);
-    } else {
-        rv = glip_write_b(glip_ctx, 0, size_words * sizeof(uint16_t), (uint8_t*)buf_be,
-                          &bytes_written, 0 /* timeout [ms]; 0 == never */);
+    if (a_trace_channel->ival[0] < 0) {
+        fatal("Invalid trace channel %d.\n", a_trace_channel->ival[0]);
+        return 1;
     }
-    if (rv != 0) {
-        return -1;
+    if (a_stats_interval->ival[0] < 0) {
+        fatal("Invalid statistics interval %d.\n", a_stats_interval->ival[0]);
+        return 1;
     }
-
-    size_t words_written = bytes_written / sizeof(uint16_t);
-    return words_written;
-}
-
-static ssize_t device_read(uint16_t *buf, size_t size_words, int flags)
-{
-    int rv;
-    size_t words_read;
-    size_t bytes_read;
-
-    uint16_t *buf_be;
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    buf_be = malloc(size_words * sizeof(uint16_t));
-    if (!buf_be) {
-        return -1;
+    if (a_capture_rotate->ival[0] < 0 ||
+        (a_capture_rotate->ival[0] > 0 && a_capture_rotate->ival[0] < 8)) {
+        fatal("Capture files must be at least 8 MiB large.\n");
+        return 1;
     }
-#else
-    buf_be = buf;
-#endif
-
-    if (flags & OSD_COM_NONBLOCK) {
-        rv = glip_read(glip_ctx, 0,
-                       size_words * sizeof(uint16_t), (uint8_t*)buf_be,
-                       &bytes_read);
-    } else {
-        rv = glip_read_b(glip_ctx, 0,
-                         size_words * sizeof(uint16_t), (uint8_t*)buf_be,
-                         &bytes_read, 0 /* timeout [ms]; 0 == never */);
-    }
-    if (rv != 0) {
-        return -1;
-    }
-    words_read = bytes_read / sizeof(uint16_t);
-
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    for (size_t w = 0; w < words_read; w++) {
-        buf[w] = bswap_16(buf_be[w]);
-    }
-#endif
-
-    return words_read;
-}
-
-static struct osd_com_device_if device_communication_functions = {
-    .write = &device_write,
-    .read = &device_read
-};
 
-/**
- * Initialize OSD Communication Library
- */
-static void init_osd_com(void)
-{
-    osd_result osd_rv;
+    zsys_init();
 
-    // prepare OSD logging system
     struct osd_log_ctx *osd_log_ctx;
-    int log_priority;
-    if (arguments.verbose) {
-        log_priority = LOG_DEBUG;
-    } else {
-        log_priority = LOG_ERR;
-    }
-    osd_rv = osd_log_new(&osd_log_ctx, log_priority, &osd_log_handler);
-    if (OSD_FAILED(osd_rv)) {
-        fatal("Unable to create osd_log_ctx (rv=%d).\n", osd_rv);
-    }
-
-    // create osd_com_ctx
-    osd_rv = osd_com_new(&osd_com_ctx, osd_log_ctx);
-    if (OSD_FAILED(osd_rv)) {
-        fatal("Unable to create osd_com_ctx (rv=%d).\n", osd_rv);
-    }
-
-    // connect the device read/write functions to the OSD communication API
-    // for now we use the same device connection for control and event data
-    osd_com_set_device_ctrl_if(osd_com_ctx, &device_communication_functions);
-    osd_com_set_device_event_if(osd_com_ctx, &device_communication_functions);
-}
-
-/**
- * Initialize GLIP for device communication
- */
-static void init_glip(void)
-{
-    int rv;
-
-    dbg("Creating GLIP device context for backend %s\n",
-        arguments.glip_backend);
-    rv = glip_new(&glip_ctx, arguments.glip_backend,
-                  arguments.glip_backend_options,
-                  arguments.glip_backend_options_len,
-                  &glip_log_handler);
-    if (rv < 0) {
-        fatal("Unable to create new GLIP context (rv=%d).\n", rv);
-    }
-
-    if (glip_get_fifo_width(glip_ctx) != 2) {
-        fatal("FIFO width of GLIP channel must be 16 bit, not %d bit.\n",
-              glip_get_fifo_width(glip_ctx) * 8);
-    }
-
-    // route log messages to our log handler
-    if (arguments.verbose) {
-        glip_set_log_priority(glip_ctx, LOG_DEBUG);
-    }
-}
-
-/**
- * Set the default values of |arguments|
- *
- * The defaults set in this function can be overwritten later, e.g. by command
- * line parameters.
- */
-static void arguments_set_default(void)
-{
-    arguments.verbose = 0;
-    arguments.color_output = isatty(STDOUT_FILENO) || isatty(STDERR_FILENO);
-    arguments.glip_backend = GLIP_DEFAULT_BACKEND;
-    arguments.glip_backend_options = NULL;
-    arguments.glip_backend_options_len = 0;
-}
-
-/**
- * Print the program version to a stream
- *
- * This function is registered as hook with argp to be invoked when calling the
- * application with --version.
- */
-static void print_version(FILE *stream, struct argp_state *state)
-{
-    const struct osd_version *libosd_version = osd_version_get();
-    const struct glip_version *libglip_version = glip_get_version();
-
-    int zmq_version_major, zmq_version_minor, zmq_version_patch;
-    zmq_version (&zmq_version_major, &zmq_version_minor, &zmq_version_patch);
-
-    fprintf(stream, "osd-daemon %d.%d.%d%s (using libosd %d.%d.%d%s, "
-            "libglip %d.%d.%d%s, libzmq %d.%d.%d)\n",
-            OSD_VERSION_MAJOR, OSD_VERSION_MINOR, OSD_VERSION_MICRO,
-            OSD_VERSION_SUFFIX,
-            libosd_version->major, libosd_version->minor, libosd_version->micro,
-            libosd_version->suffix,
-            libglip_version->major, libglip_version->minor,
-            libglip_version->micro, libglip_version->suffix,
-            zmq_version_major, zmq_version_minor, zmq_version_patch);
-}
-
-// register print_version with argp
-void (*argp_program_version_hook) (FILE *, struct argp_state *) = print_version;
-
-
-int main(int argc, char** argv)
-{
-    // read program arguments
-    arguments_set_default();
-    if (argp_parse(&argp, argc, argv, 0, 0, &arguments) != 0) {
-        fatal("Unable to parse program arguments.\n");
-    }
-
-    // prepare GLIP for device communication
-    init_glip();
-
-    // initialize OSD communication library
-    init_osd_com();
-
-    // connect to device
-    dbg("Attempting physical connection to device.\n");
-    int rv = glip_open(glip_ctx, 1);
-    if (rv < 0) {
-        fatal("Unable to open connection to device.\n");
-    }
-    dbg("Physical connection established.\n");
-
-    struct osd_module_desc *modules;
-    size_t modules_len;
-    osd_result osd_rv;
-
-    dbg("Connecting to debug system\n");
-    osd_rv = osd_com_connect(osd_com_ctx);
-    if (OSD_FAILED(osd_rv)) {
-        fatal("Unable to connect to debug system\n");
-    }
-    dbg("Connection to debug system established.\n");
-
-    dbg("Enumerating modules in debug system\n");
-    osd_rv = osd_com_get_modules(osd_com_ctx, &modules, &modules_len);
-    if (OSD_FAILED(osd_rv)) {
-        fatal("Unable to get a list of debug modules from the device\n")
-    }
-    dbg("Found %zu debug modules\n", modules_len);
-
-    for (size_t i = 0; i < modules_len; i++) {
-        dbg("[0x%04x] %u.%u (v%u)\n", modules[i].addr, modules[i].vendor,
-            modules[i].type, modules[i].version);
-    }
-
-    //  Socket to talk to clients
-    void *context = zmq_ctx_new ();
-    void *responder = zmq_socket (context, ZMQ_REP);
-    int rc = zmq_bind (responder, "tcp://*:5555");
-    assert (rc == 0);
-
-    while (1) {
-        char buffer [10];
-        zmq_recv (responder, buffer, 10, 0);
-        printf ("Received Hello\n");
-        sleep (1);          //  Do some 'work'
-        zmq_send (responder, "World", 5, 0);
-    }
-    return 0;
-
-
-
-    return 0;
+    rv = osd_log_new(&osd_log_ctx, cfg.log_level, &osd_log_handler);
+    assert(OSD_SUCCEEDED(rv));
+
+    // The host controller listens for host modules and for the gateway
+    router_address = zsys_sprintf("%s,%s", a_bind->sval[0],
+                                  GATEWAY_HOSTCTRL_EP);
+    rv = osd_hostctrl_new(&hostctrl_ctx, osd_log_ctx, router_address);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to initialize host controller (%d)", rv);
+        exitcode = 1;
+        goto free_return;
+    }
+
+    rv = osd_hostctrl_start(hostctrl_ctx);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to start host controller (%d)", rv);
+        exitcode = 1;
+        goto free_return;
+    }
+    info("Host controller listening on %s", a_bind->sval[0]);
+
+    struct device_gateway_config gw_config = {
+        .host_controller_address = GATEWAY_HOSTCTRL_EP,
+        .subnet = DEVICE_SUBNET,
+        .transport = a_transport->sval[0],
+        .transport_options = a_transport_options->sval[0],
+        .glip_backend = a_glip_backend->sval[0],
+        .glip_backend_options = a_glip_backend_options->sval[0],
+        .trace_channel = a_trace_channel->ival[0],
+        .filter_rules = a_filter->sval,
+        .filter_rules_len = a_filter->count,
+        .stats_interval_s = a_stats_interval->ival[0],
+        .capture_path = a_capture->count ? a_capture->filename[0] : NULL,
+        .capture_rotate_size_bytes = (uint64_t)a_capture_rotate->ival[0]
+                                     * 1024 * 1024,
+        .capture_direct = a_capture_direct->count > 0,
+        .log_level = cfg.log_level,
+    };
+
+    // runs until the daemon is interrupted
+    exitcode = 0;
+    rv = device_gateway_run(&gw_config);
+    if (OSD_FAILED(rv)) {
+        fatal("Device gateway failed (rv=%d).\n", rv);
+        exitcode = 1;
+    }
+    info("Shutting down.");
+
+    rv = osd_hostctrl_stop(hostctrl_ctx);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to stop host controller (%d)", rv);
+        exitcode = 1;
+    }
+
+free_return:
+    osd_hostctrl_free(&hostctrl_ctx);
+    free(router_address);
+    return exitcode;
 }
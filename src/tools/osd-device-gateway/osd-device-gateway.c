@@ -7,9 +7,7 @@
 
 #include "../cli-util.h"
 #include <czmq.h>
-#include <byteswap.h>
-#include "../../libosd/include/osd/hostmod.h"
-#include <libglip.h>
+#include "device_gateway.h"
 
 /**
  * Default GLIP backend to be used when connecting to a device
@@ -17,260 +15,55 @@
 #define GLIP_DEFAULT_BACKEND "tcp"
 
 /**
- * GLIP library context
+ * Default transport to the device
  */
-struct glip_ctx *glip_ctx;
+#define DEFAULT_TRANSPORT "glip"
 
 /**
- * Open SoC Debug communication library context
+ * Default interval (in s) of the statistics summary printed with -v
  */
-struct osd_com_ctx *osd_com_ctx;
-
-
-zsock_t *host_com_sock;
-pthread_mutex_t host_com_sock_lock = PTHREAD_MUTEX_INITIALIZER;
-
-
-
-// command line arguments
-struct arg_str *a_glip_backend;
-struct arg_str *a_glip_backend_options;
-
+#define DEFAULT_STATS_INTERVAL_S 10
 
 /**
- * Log handler for GLIP
+ * Default maximum size of a capture file (in MiB)
  */
-static void glip_log_handler(struct glip_ctx *ctx, int priority,
-                             const char *file, int line, const char *fn,
-                             const char *format, va_list args)
-{
-    cli_vlog(priority, "libglip", format, args);
-}
-
-static ssize_t device_read(uint16_t *buf, size_t size_words, int flags)
-{
-    int rv;
-    size_t words_read;
-    size_t bytes_read;
-
-    uint16_t *buf_be;
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    buf_be = malloc(size_words * sizeof(uint16_t));
-    if (!buf_be) {
-        return -1;
-    }
-#else
-    buf_be = buf;
-#endif
-
-    rv = glip_read_b(glip_ctx, 0,
-                     size_words * sizeof(uint16_t), (uint8_t*)buf_be,
-                     &bytes_read, 0 /* timeout [ms]; 0 == never */);
-    if (rv != 0) {
-        return -1;
-    }
-    words_read = bytes_read / sizeof(uint16_t);
-
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    for (size_t w = 0; w < words_read; w++) {
-        buf[w] = bswap_16(buf_be[w]);
-    }
-#endif
-
-    return words_read;
-}
-
-static ssize_t device_write(uint16_t *buf, size_t size_words, int flags)
-{
-    size_t bytes_written;
-    int rv;
-
-    // GLIP and OSD are big endian, |buf| is in native endianness
-    uint16_t *buf_be;
-
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    buf_be = malloc(size_words * sizeof(uint16_t));
-    if (!buf_be) {
-        return -1;
-    }
-
-    for (size_t w = 0; w < size_words; w++) {
-        buf_be[w] = bswap_16(buf[w]);
-    }
-#else
-    buf_be = buf;
-#endif
-
-    rv = glip_write_b(glip_ctx, 0, size_words * sizeof(uint16_t), (uint8_t*)buf_be,
-                      &bytes_written, 0 /* timeout [ms]; 0 == never */);
-    if (rv != 0) {
-        return -1;
-    }
-
-    size_t words_written = bytes_written / sizeof(uint16_t);
-    return words_written;
-}
+#define DEFAULT_CAPTURE_ROTATE_MIB 1024
 
 /**
- * Initialize GLIP for device communication
+ * Host controller to connect to
  */
-static void init_glip(void)
-{
-    int rv;
-
-    struct glip_option* glip_backend_options;
-    size_t glip_backend_options_len;
-    rv = glip_parse_option_string(a_glip_backend_options->sval[0],
-                                  &glip_backend_options,
-                                  &glip_backend_options_len);
-    if (rv != 0) {
-        fatal("Unable to parse GLIP backend options.\n");
-    }
-
-    dbg("Creating GLIP device context for backend %s\n",
-        a_glip_backend->sval[0]);
-    rv = glip_new(&glip_ctx, a_glip_backend->sval[0],
-                  glip_backend_options,
-                  glip_backend_options_len,
-                  &glip_log_handler);
-    if (rv < 0) {
-        fatal("Unable to create new GLIP context (rv=%d).\n", rv);
-    }
-
-    if (glip_get_fifo_width(glip_ctx) != 2) {
-        fatal("FIFO width of GLIP channel must be 16 bit, not %d bit.\n",
-              glip_get_fifo_width(glip_ctx) * 8);
-    }
-
-    // route log messages to our log handler
-    glip_set_log_priority(glip_ctx, cfg.log_level);
-}
-
-/**
- * Send a packet received on the host to the device
- *
- * This function is registered as zloop reactor.
- */
-static int send_to_device(zloop_t *loop, zsock_t *reader, void *arg)
-{
-    zmsg_t *msg = zmsg_recv(reader);
-    if (!msg) {
-        return -1; // process interrupted
-    }
-
-    zframe_t *type_frame = zmsg_pop(msg);
-    if (zframe_streq(type_frame, "D")) {
-        dbg("Forwarding data message to device\n");
+#define HOSTCTRL_ADDRESS "tcp://127.0.0.1:9990"
 
-        zframe_t *data_frame = zmsg_pop(msg);
-        assert(data_frame);
-        uint16_t *data = (uint16_t*)zframe_data(data_frame);
-        size_t data_size_words = zframe_size(data_frame) / sizeof(uint16_t);
-        assert(data);
+/** Subnet this gateway is responsible for */
+#define GW_SUBNET 0
 
-        size_t size_words_written;
 
-        // data is sent as Debug Transport Datagram (DTD) -- a length-value
-        // encoded version of the osd packet.
-
-        // length (in uint16_t words)
-        uint16_t dtd_size = data_size_words;
-        size_words_written = device_write(&dtd_size, 1, 0);
-        assert(size_words_written == 1);
-
-        // value (the packet data)
-        size_words_written = device_write(data, data_size_words, 0);
-        assert(size_words_written == data_size_words);
-
-    } else if (zframe_streq(type_frame, "M")) {
-        // TODO: handle incoming management messages
-        err("XXX: management messages are not yet handled by this client.\n");
-        goto ret;
-
-    } else {
-        err("Message of unknown type received. Ignoring.\n");
-        goto ret;
-    }
-
-ret:
-    zmsg_destroy(&msg);
-    return 0;
-}
-
-/**
- * Register this tool as gateway for a given subnet
- */
-static osd_result osd_hostcom_register_subnet_gw(unsigned int subnet)
-{
-    zmsg_t *msg;
-
-    msg = zmsg_new();
-    zmsg_addstrf(msg, "M");
-    zmsg_addstrf(msg, "GW_REGISTER %u", subnet);
-    zmsg_send(&msg, host_com_sock);
-    zmsg_destroy(&msg);
-
-    // process reply
-    msg = zmsg_recv(host_com_sock);
-    if (!msg && errno == EINTR) {
-        // user pressed CTRL-C (SIGHUP)
-        return OSD_ERROR_ABORTED;
-    }
-    printf("Received message: \n");
-    zmsg_print(msg);
-
-    char* msg_type = zmsg_popstr(msg);
-    if (strcmp(msg_type, "M") != 0) {
-        err("Received invalid response of type %s\n", msg_type);
-    }
-    char* response = zmsg_popstr(msg);
-    if (strcmp(response, "ACK") != 0) {
-        err("Received %s when expecting 'ACK'.\n", response);
-    }
-
-    dbg("Registered as gateway for subnet %d with host controller\n", subnet);
-
-    return OSD_OK;
-}
-
-/**
- * Read data from the device encoded as Debug Transport Datagrams (DTDs)
- */
-static void* thread_ctrl_receive(void *unused)
-{
-    ssize_t rv;
-
-    while (1) {
-        // read packet size, which is transmitted as first word in a DTD
-        uint16_t pkg_size_words;
-        rv = device_read(&pkg_size_words, 1, 0);
-        if (rv != 1) {
-            err("Unable to receive data from device. Aborting.\n");
-            return NULL;
-        }
-
-        // read packet data
-        uint16_t* pkg_data = malloc(sizeof(uint16_t) * pkg_size_words);
-        rv = device_read(pkg_data, pkg_size_words, 0);
-        assert(rv == pkg_size_words);
-
-        // forward received packet to host controller
-        zmsg_t *msg;
-        msg = zmsg_new();
-        zmsg_addstrf(msg, "D");
-        zmsg_addmem(msg, pkg_data, pkg_size_words * sizeof(uint16_t));
-
-        pthread_mutex_lock(&host_com_sock_lock);
-        zmsg_send(&msg, host_com_sock);
-        pthread_mutex_unlock(&host_com_sock_lock);
-
-        dbg("Received packet from device\n");
-        free(pkg_data);
-    }
-}
+// command line arguments
+struct arg_str *a_transport;
+struct arg_str *a_transport_options;
+struct arg_str *a_glip_backend;
+struct arg_str *a_glip_backend_options;
+struct arg_int *a_trace_channel;
+struct arg_str *a_filter;
+struct arg_int *a_stats_interval;
+struct arg_file *a_capture;
+struct arg_int *a_capture_rotate;
+struct arg_lit *a_capture_direct;
 
 osd_result setup(void)
 {
+    a_transport = arg_str0(NULL, "transport", "<name>",
+                           "Transport to the device: glip (hardware) or sim "
+                           "(simulated device) (default: "DEFAULT_TRANSPORT")");
+    a_transport->sval[0] = DEFAULT_TRANSPORT;
+    osd_tool_add_arg(a_transport);
+
+    a_transport_options = arg_str0(NULL, "transport-options",
+                                   "<option1=value1,option2=value2,...>",
+                                   "Transport options (not for glip, use "
+                                   "--glip-backend-options instead)");
+    osd_tool_add_arg(a_transport_options);
+
     a_glip_backend = arg_str0(NULL, "glip-backend", "<name>",
                               "GLIP backend name");
     a_glip_backend->sval[0] = GLIP_DEFAULT_BACKEND;
@@ -281,58 +74,87 @@ osd_result setup(void)
                                       "GLIP backend options");
     osd_tool_add_arg(a_glip_backend_options);
 
+    a_trace_channel = arg_int0(NULL, "trace-channel", "<channel>",
+                               "Device channel for event (trace) packets "
+                               "(default: 0, i.e. shared with control "
+                               "traffic)");
+    a_trace_channel->ival[0] = 0;
+    osd_tool_add_arg(a_trace_channel);
+
+    a_filter = arg_strn(NULL, "filter", "<rule>", 0, 64,
+                        "Filter rule for packets sent from the device to the "
+                        "host, e.g. \"src deny 5\", \"type deny event\" or "
+                        "\"sample all 10\". Can be given multiple times.");
+    osd_tool_add_arg(a_filter);
+
+    a_stats_interval = arg_int0(NULL, "stats-interval", "<s>",
+                                "Interval of the throughput summary printed "
+                                "with -v (in s, 0 to disable, default: 10)");
+    a_stats_interval->ival[0] = DEFAULT_STATS_INTERVAL_S;
+    osd_tool_add_arg(a_stats_interval);
+
+    a_capture = arg_file0(NULL, "capture", "<file>",
+                          "Write trace data from the device to a raw capture "
+                          "file instead of sending it to the host");
+    osd_tool_add_arg(a_capture);
+
+    a_capture_rotate = arg_int0(NULL, "capture-rotate", "<MiB>",
+                                "Continue the capture in a new file after "
+                                "this size (0: no limit, default: 1024)");
+    a_capture_rotate->ival[0] = DEFAULT_CAPTURE_ROTATE_MIB;
+    osd_tool_add_arg(a_capture_rotate);
+
+    a_capture_direct = arg_lit0(NULL, "capture-direct",
+                                "Write the capture with O_DIRECT, bypassing "
+                                "the page cache");
+    osd_tool_add_arg(a_capture_direct);
+
     return 0;
 }
 
 int run(void)
 {
-    // prepare GLIP for device communication
-    init_glip();
+    osd_result rv;
 
-    // connect to device
-    dbg("Attempting physical connection to device.\n");
-    int rv = glip_open(glip_ctx, 1);
-    if (rv < 0) {
-        fatal("Unable to open connection to device.\n");
+    if (a_trace_channel->ival[0] < 0) {
+        fatal("Invalid trace channel %d.\n", a_trace_channel->ival[0]);
+        return -1;
+    }
+    if (a_stats_interval->ival[0] < 0) {
+        fatal("Invalid statistics interval %d.\n", a_stats_interval->ival[0]);
+        return -1;
+    }
+    if (a_capture_rotate->ival[0] < 0 ||
+        (a_capture_rotate->ival[0] > 0 && a_capture_rotate->ival[0] < 8)) {
+        fatal("Capture files must be at least 8 MiB large.\n");
+        return -1;
     }
-    dbg("Physical connection established.\n");
-
 
-    // initialize communication with host controller
     zsys_init();
-    host_com_sock = zsock_new_dealer("tcp://127.0.0.1:9990");
-
 
-    // register this tool as gateway for subnet 0
-    // XXX: make subnet dynamic
-    osd_hostcom_register_subnet_gw(0);
-
-    // connect data path between host controller and device
-    // device -> host
-    pthread_t rcv_thread;
-    rv = pthread_create(&rcv_thread, 0,
-                        thread_ctrl_receive, NULL);
-    if (rv) {
-        err("Unable to create thread_ctrl_receive: %d\n", rv);
-        return OSD_ERROR_FAILURE;
+    struct device_gateway_config gw_config = {
+        .host_controller_address = HOSTCTRL_ADDRESS,
+        .subnet = GW_SUBNET,
+        .transport = a_transport->sval[0],
+        .transport_options = a_transport_options->sval[0],
+        .glip_backend = a_glip_backend->sval[0],
+        .glip_backend_options = a_glip_backend_options->sval[0],
+        .trace_channel = a_trace_channel->ival[0],
+        .filter_rules = a_filter->sval,
+        .filter_rules_len = a_filter->count,
+        .stats_interval_s = a_stats_interval->ival[0],
+        .capture_path = a_capture->count ? a_capture->filename[0] : NULL,
+        .capture_rotate_size_bytes = (uint64_t)a_capture_rotate->ival[0]
+                                     * 1024 * 1024,
+        .capture_direct = a_capture_direct->count > 0,
+        .log_level = cfg.log_level,
+    };
+
+    rv = device_gateway_run(&gw_config);
+    if (OSD_FAILED(rv)) {
+        fatal("Device gateway failed (rv=%d).\n", rv);
+        return -1;
     }
 
-    // host -> device
-    zloop_t* dev_tx_loop = zloop_new();
-    //zloop_set_verbose(dev_tx_loop, 1);
-    int rc = zloop_reader(dev_tx_loop, host_com_sock, send_to_device, NULL);
-    assert(rc == 0);
-    zloop_reader_set_tolerant(dev_tx_loop, host_com_sock);
-    zloop_start(dev_tx_loop);
-
-    // clean up host -> device path
-    zloop_destroy(&dev_tx_loop);
-
-    // clean up device -> host path
-    pthread_cancel(rcv_thread);
-
-    // all remaining cleanups
-    zsock_destroy(&host_com_sock);
-
     return 0;
 }
@@ -34,9 +34,114 @@
 #include "../cli-util.h"
 #include <osd/hostmod_stmlogger.h>
 
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Maximum number of STMs traced at the same time */
+#define MAX_STMS 256
+
+/** Interval in which the stop conditions are checked */
+#define POLL_INTERVAL_MS 100
+
 // command line arguments
 struct arg_int *a_stm_diaddr;
+struct arg_int *a_duration;
+struct arg_int *a_count;
 struct arg_str *a_hostctrl_ep;
+struct arg_file *a_output;
+struct arg_int *a_sync_interval;
+struct arg_str *a_compress;
+struct arg_lit *a_printf;
+struct arg_file *a_printf_formats;
+struct arg_int *a_flightrec_size;
+struct arg_str *a_trigger;
+
+/** A flight recorder dump was requested with SIGUSR1 */
+static volatile sig_atomic_t dump_requested;
+
+static void handle_sigusr1(int signum)
+{
+    dump_requested = 1;
+}
+
+/**
+ * Replace the escape sequences \n, \t and \\ in a string in-place
+ */
+static void unescape(char *str)
+{
+    char *out = str;
+    for (char *in = str; *in; in++) {
+        if (*in == '\\' && in[1]) {
+            in++;
+            switch (*in) {
+            case 'n': *out++ = '\n'; break;
+            case 't': *out++ = '\t'; break;
+            default:  *out++ = *in; break;
+            }
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+}
+
+/**
+ * Register printf() format strings from a file
+ *
+ * Each line of the file has the form "<id> <format string>", with the ID
+ * being a decimal or hexadecimal (0x prefix) number. Empty lines and lines
+ * starting with "#" are ignored.
+ */
+static osd_result load_printf_formats(struct osd_hostmod_stmlogger_ctx *ctx,
+                                      const char *path)
+{
+    osd_result rv = OSD_OK;
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fatal("Unable to open printf format file %s: %s\n", path,
+              strerror(errno));
+        return OSD_ERROR_FAILURE;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    unsigned int lineno = 0;
+    while (getline(&line, &line_size, fp) != -1) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+
+        char *fmt;
+        errno = 0;
+        unsigned long fmt_id = strtoul(line, &fmt, 0);
+        if (errno || fmt == line || *fmt != ' ' || fmt_id > UINT32_MAX) {
+            fatal("%s:%u: expected \"<id> <format string>\".\n", path,
+                  lineno);
+            rv = OSD_ERROR_FAILURE;
+            goto free_return;
+        }
+        fmt++;
+        unescape(fmt);
+
+        rv = osd_hostmod_stmlogger_set_printf_format(ctx, fmt_id, fmt);
+        if (OSD_FAILED(rv)) {
+            fatal("%s:%u: invalid format string.\n", path, lineno);
+            goto free_return;
+        }
+    }
+
+free_return:
+    free(line);
+    fclose(fp);
+    return rv;
+}
 
 osd_result setup(void)
 {
@@ -44,40 +149,378 @@ osd_result setup(void)
     a_hostctrl_ep->sval[0] = DEFAULT_HOSTCTRL_EP;
     osd_tool_add_arg(a_hostctrl_ep);
 
-    a_stm_diaddr = arg_int1("a", "diaddr", "<diaddr>",
-                              "DI address of the STM module");
+    a_stm_diaddr = arg_intn("a", "diaddr", "<diaddr>", 1, MAX_STMS,
+                            "DI address of the STM module. Repeat to trace "
+                            "multiple STMs at once.");
     osd_tool_add_arg(a_stm_diaddr);
 
+    a_duration = arg_int0("d", "duration", "<s>",
+                          "Stop tracing after <s> seconds (default: 0, "
+                          "trace until CTRL-C is pressed)");
+    a_duration->ival[0] = 0;
+    osd_tool_add_arg(a_duration);
+
+    a_count = arg_int0("n", "count", "<n>",
+                       "Stop tracing after <n> event packets have been "
+                       "received from all STMs together (default: 0, no "
+                       "limit)");
+    a_count->ival[0] = 0;
+    osd_tool_add_arg(a_count);
+
+    a_output = arg_file0("o", "output", "<file>",
+                         "Write the trace into a binary trace file instead "
+                         "of printing it to stdout. With multiple STMs, "
+                         "one file <file>.<diaddr> is written per STM.");
+    osd_tool_add_arg(a_output);
+
+    a_sync_interval = arg_int0(NULL, "sync-interval", "<ms>",
+                               "Sync the output file to disk at most every "
+                               "<ms> milliseconds (default: 0, never sync "
+                               "explicitly)");
+    a_sync_interval->ival[0] = 0;
+    osd_tool_add_arg(a_sync_interval);
+
+    a_compress = arg_str0(NULL, "compress", "<none|lz4|zstd>",
+                          "Compress the output file (default: none)");
+    a_compress->sval[0] = "none";
+    osd_tool_add_arg(a_compress);
+
+    a_printf = arg_lit0(NULL, "printf",
+                        "Print the events with the IDs 0x4 (character), 0x5 "
+                        "(format string) and 0x6 (argument) as "
+                        "reconstructed printf() output");
+    osd_tool_add_arg(a_printf);
+
+    a_printf_formats = arg_file0(NULL, "printf-formats", "<file>",
+                                 "Read format strings for the printf() "
+                                 "reconstruction from <file>, one "
+                                 "\"<id> <format string>\" per line. "
+                                 "Implies --printf.");
+    osd_tool_add_arg(a_printf_formats);
+
+    a_flightrec_size = arg_int0(NULL, "flight-recorder", "<MiB>",
+                                "Keep the last <MiB> MiB of trace in memory "
+                                "instead of writing it to the output file. "
+                                "The trace is dumped to <file>.<n> when "
+                                "SIGUSR1 is received or the --trigger event "
+                                "occurs.");
+    osd_tool_add_arg(a_flightrec_size);
+
+    a_trigger = arg_str0(NULL, "trigger", "<id>[:<value>]",
+                         "Dump the flight recorder when a trace event with "
+                         "ID <id> (and value <value>) is received");
+    osd_tool_add_arg(a_trigger);
+
     return OSD_OK;
 }
 
+/**
+ * Print the capture statistics of all STMs to stderr
+ */
+static void print_stats(struct osd_hostmod_stmlogger_ctx *logger,
+                        bool have_output, int64_t duration_us)
+{
+    double duration_s = duration_us / 1e6;
+    struct osd_hostmod_stmlogger_stats total;
+    memset(&total, 0, sizeof(total));
+
+    fprintf(stderr, "Captured %.1f s of trace.\n", duration_s);
+    for (int i = 0; i < a_stm_diaddr->count; i++) {
+        unsigned int diaddr = a_stm_diaddr->ival[i];
+        struct osd_hostmod_stmlogger_stats stats;
+        osd_hostmod_stmlogger_get_stats(logger, diaddr, &stats);
+
+        fprintf(stderr, "STM %u: %" PRIu64 " packets (%.0f packets/s, "
+                "%.2f MiB/s), %" PRIu64 " events lost in %" PRIu64
+                " overflows", diaddr, stats.packets,
+                duration_s > 0 ? stats.packets / duration_s : 0,
+                duration_s > 0 ? stats.bytes / duration_s / (1 << 20) : 0,
+                stats.events_lost, stats.overflows);
+
+        struct osd_tracefile_writer_stats wstats;
+        if (have_output &&
+            OSD_SUCCEEDED(osd_hostmod_stmlogger_get_output_stats(logger,
+                                                                 diaddr,
+                                                                 &wstats))) {
+            fprintf(stderr, ", %" PRIu64 " packets written to disk, %" PRIu64
+                    " dropped", wstats.packets_written,
+                    wstats.packets_dropped);
+        }
+
+        struct osd_clock_corr_fit fit;
+        if (OSD_SUCCEEDED(osd_hostmod_stmlogger_get_clock_fit(logger, diaddr,
+                                                              &fit))) {
+            fprintf(stderr, ", clock %.4f ns/tick (receive jitter %.0f ns)",
+                    fit.ns_per_tick, fit.residual_ns);
+        }
+        fprintf(stderr, "\n");
+
+        total.packets += stats.packets;
+        total.bytes += stats.bytes;
+        total.events_lost += stats.events_lost;
+    }
+
+    if (a_stm_diaddr->count > 1) {
+        fprintf(stderr, "Total: %" PRIu64 " packets (%.0f packets/s, "
+                "%.2f MiB/s), %" PRIu64 " events lost\n", total.packets,
+                duration_s > 0 ? total.packets / duration_s : 0,
+                duration_s > 0 ? total.bytes / duration_s / (1 << 20) : 0,
+                total.events_lost);
+    }
+}
+
+/**
+ * Parse the --trigger argument and set the flight recorder trigger
+ */
+static osd_result set_trigger(struct osd_hostmod_stmlogger_ctx *ctx,
+                              const char *arg)
+{
+    char *end;
+    errno = 0;
+    unsigned long id = strtoul(arg, &end, 0);
+    if (errno || end == arg || id > UINT16_MAX ||
+        (*end != '\0' && *end != ':')) {
+        fatal("Invalid trigger %s, expected <id>[:<value>].\n", arg);
+        return OSD_ERROR_FAILURE;
+    }
+
+    if (*end == '\0') {
+        return osd_hostmod_stmlogger_set_flightrec_trigger(ctx, id, NULL);
+    }
+
+    const char *value_str = end + 1;
+    errno = 0;
+    uint64_t value = strtoull(value_str, &end, 0);
+    if (errno || end == value_str || *end != '\0') {
+        fatal("Invalid trigger %s, expected <id>[:<value>].\n", arg);
+        return OSD_ERROR_FAILURE;
+    }
+    return osd_hostmod_stmlogger_set_flightrec_trigger(ctx, id, &value);
+}
+
+/**
+ * Dump the flight recorder into the next output file
+ */
+static osd_result dump_flightrec(struct osd_hostmod_stmlogger_ctx *ctx,
+                                 unsigned int *dump_count)
+{
+    char *path;
+    (*dump_count)++;
+    int irv = asprintf(&path, "%s.%u", a_output->filename[0], *dump_count);
+    assert(irv != -1);
+
+    osd_result rv = osd_hostmod_stmlogger_dump_flightrec(ctx, path);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to dump the flight recorder to %s (rv=%d).\n", path,
+              rv);
+    }
+    free(path);
+    return rv;
+}
+
+/**
+ * Total number of event packets received from all STMs
+ */
+static uint64_t get_total_packets(struct osd_hostmod_stmlogger_ctx *logger)
+{
+    uint64_t packets = 0;
+    for (int i = 0; i < a_stm_diaddr->count; i++) {
+        struct osd_hostmod_stmlogger_stats stats;
+        osd_hostmod_stmlogger_get_stats(logger, a_stm_diaddr->ival[i],
+                                        &stats);
+        packets += stats.packets;
+    }
+    return packets;
+}
+
 int run(void)
 {
     int prog_ret = -1;
     osd_result osd_rv;
 
+    bool have_output = a_output->count > 0;
+    bool have_flightrec = a_flightrec_size->count > 0;
+    unsigned int dump_count = 0;
+    bool shutdown_failed = false;
+    bool tracing = false;
+    int64_t start_us = 0;
+
     struct osd_log_ctx *osd_log_ctx;
     osd_rv = osd_log_new(&osd_log_ctx, cfg.log_level, &osd_log_handler);
     assert(OSD_SUCCEEDED(osd_rv));
 
+    // a single logger (i.e. host module) traces all STMs
+    unsigned int stm_di_addrs[MAX_STMS];
+    for (int i = 0; i < a_stm_diaddr->count; i++) {
+        stm_di_addrs[i] = a_stm_diaddr->ival[i];
+    }
     struct osd_hostmod_stmlogger_ctx *hostmod_stmlogger_ctx;
-    osd_rv = osd_hostmod_stmlogger_new(&hostmod_stmlogger_ctx, osd_log_ctx,
-                                       a_hostctrl_ep->sval[0],
-                                       a_stm_diaddr->ival[0]);
+    osd_rv = osd_hostmod_stmlogger_new_multi(&hostmod_stmlogger_ctx,
+                                             osd_log_ctx,
+                                             a_hostctrl_ep->sval[0],
+                                             stm_di_addrs,
+                                             a_stm_diaddr->count);
     assert(OSD_SUCCEEDED(osd_rv));
 
     osd_rv = osd_hostmod_stmlogger_connect(hostmod_stmlogger_ctx);
     if (OSD_FAILED(osd_rv)) {
         fatal("Unable to connect to host controller at %s (rv=%d).\n",
               a_hostctrl_ep->sval[0], osd_rv);
-        prog_ret = -1;
         goto free_return;
     }
 
+    if (a_sync_interval->ival[0] < 0) {
+        fatal("The sync interval must not be negative.\n");
+        goto free_return;
+    }
+    if (a_duration->ival[0] < 0 || a_count->ival[0] < 0) {
+        fatal("The capture duration and count must not be negative.\n");
+        goto free_return;
+    }
+
+    enum osd_tracefile_compression compression;
+    if (!strcmp(a_compress->sval[0], "none")) {
+        compression = OSD_TRACEFILE_COMPRESSION_NONE;
+    } else if (!strcmp(a_compress->sval[0], "lz4")) {
+        compression = OSD_TRACEFILE_COMPRESSION_LZ4;
+    } else if (!strcmp(a_compress->sval[0], "zstd")) {
+        compression = OSD_TRACEFILE_COMPRESSION_ZSTD;
+    } else {
+        fatal("Unknown compression %s.\n", a_compress->sval[0]);
+        goto free_return;
+    }
+    if (!osd_tracefile_compression_supported(compression)) {
+        fatal("Compression %s is not supported by this build.\n",
+              a_compress->sval[0]);
+        goto free_return;
+    }
+
+    if (have_flightrec) {
+        if (!have_output) {
+            fatal("The flight recorder requires an output file.\n");
+            goto free_return;
+        }
+        if (a_flightrec_size->ival[0] <= 0) {
+            fatal("The flight recorder size must be positive.\n");
+            goto free_return;
+        }
+        if (compression != OSD_TRACEFILE_COMPRESSION_NONE) {
+            fatal("Flight recorder dumps cannot be compressed.\n");
+            goto free_return;
+        }
+
+        osd_rv = osd_hostmod_stmlogger_open_flightrec(
+            hostmod_stmlogger_ctx,
+            (size_t)a_flightrec_size->ival[0] * 1024 * 1024);
+        if (OSD_FAILED(osd_rv)) {
+            fatal("Unable to create the flight recorder (rv=%d).\n", osd_rv);
+            goto free_return;
+        }
+        if (a_trigger->count) {
+            osd_rv = set_trigger(hostmod_stmlogger_ctx, a_trigger->sval[0]);
+            if (OSD_FAILED(osd_rv)) {
+                goto free_return;
+            }
+        }
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = handle_sigusr1;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &sa, NULL);
+    } else if (a_trigger->count) {
+        fatal("--trigger requires --flight-recorder.\n");
+        goto free_return;
+    } else if (have_output) {
+        osd_rv = osd_hostmod_stmlogger_open_output(hostmod_stmlogger_ctx,
+                                                   a_output->filename[0],
+                                                   a_sync_interval->ival[0],
+                                                   compression);
+        if (OSD_FAILED(osd_rv)) {
+            fatal("Unable to open output file %s (rv=%d).\n",
+                  a_output->filename[0], osd_rv);
+            goto free_return;
+        }
+    }
+
+    if (a_printf->count) {
+        osd_rv = osd_hostmod_stmlogger_enable_printf(hostmod_stmlogger_ctx);
+        if (OSD_FAILED(osd_rv)) {
+            fatal("Unable to enable the printf() reconstruction (rv=%d).\n",
+                  osd_rv);
+            goto free_return;
+        }
+    }
+    if (a_printf_formats->count) {
+        osd_rv = load_printf_formats(hostmod_stmlogger_ctx,
+                                     a_printf_formats->filename[0]);
+        if (OSD_FAILED(osd_rv)) {
+            goto free_return;
+        }
+    }
+
+    // even if starting fails, some STMs might be tracing already
+    tracing = true;
+    osd_rv = osd_hostmod_stmlogger_tracestart(hostmod_stmlogger_ctx);
+    if (OSD_FAILED(osd_rv)) {
+        fatal("Unable to start tracing (rv=%d).\n", osd_rv);
+        goto stop_tracing;
+    }
+    start_us = zclock_usecs();
+
+    info("Tracing. Press CTRL-C to stop.\n");
+    int64_t duration_us = (int64_t)a_duration->ival[0] * 1000 * 1000;
+    uint64_t max_packets = a_count->ival[0];
+    while (!zsys_interrupted) {
+        zclock_sleep(POLL_INTERVAL_MS);
+
+        if (have_flightrec &&
+            (dump_requested ||
+             osd_hostmod_stmlogger_flightrec_triggered(hostmod_stmlogger_ctx))) {
+            dump_requested = 0;
+            dump_flightrec(hostmod_stmlogger_ctx, &dump_count);
+        }
+
+        if (duration_us && zclock_usecs() - start_us >= duration_us) {
+            break;
+        }
+        if (max_packets &&
+            get_total_packets(hostmod_stmlogger_ctx) >= max_packets) {
+            break;
+        }
+    }
+
     prog_ret = 0;
 
+stop_tracing:
+    if (tracing) {
+        osd_rv = osd_hostmod_stmlogger_tracestop(hostmod_stmlogger_ctx);
+        if (OSD_FAILED(osd_rv)) {
+            fatal("Unable to stop tracing (rv=%d).\n", osd_rv);
+            shutdown_failed = true;
+        }
+    }
+    // a dump requested or triggered since the last poll is not lost
+    if (have_flightrec &&
+        (dump_requested ||
+         osd_hostmod_stmlogger_flightrec_triggered(hostmod_stmlogger_ctx))) {
+        osd_rv = dump_flightrec(hostmod_stmlogger_ctx, &dump_count);
+        if (OSD_FAILED(osd_rv)) {
+            shutdown_failed = true;
+        }
+    }
+    if (prog_ret == 0) {
+        print_stats(hostmod_stmlogger_ctx, have_output && !have_flightrec,
+                    zclock_usecs() - start_us);
+    }
+    if (shutdown_failed) {
+        prog_ret = -1;
+    }
 
 free_return:
+    osd_hostmod_stmlogger_close_flightrec(hostmod_stmlogger_ctx);
+    osd_hostmod_stmlogger_close_output(hostmod_stmlogger_ctx);
     osd_hostmod_stmlogger_disconnect(hostmod_stmlogger_ctx);
     osd_hostmod_stmlogger_free(&hostmod_stmlogger_ctx);
 
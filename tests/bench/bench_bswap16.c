@@ -0,0 +1,135 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+/**
+ * Micro-benchmark of the 16 bit byte swapping kernels
+ *
+ * All implementations supported by the CPU are checked against the scalar
+ * implementation and timed on buffers of 4 KiB to 1 MiB.
+ */
+
+#include "bswap16.h"
+
+#include <byteswap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BUF_SIZE_MIN_BYTES (4 * 1024)
+#define BUF_SIZE_MAX_BYTES (1024 * 1024)
+
+/** Number of bytes to swap for each measurement */
+#define BYTES_PER_RUN (512 * 1024 * 1024)
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Check an implementation against the reference for all buffer sizes up to
+ * a few vectors, at all alignments
+ */
+static int verify(enum bswap16_impl impl)
+{
+    uint16_t in[128 + 1];
+    uint16_t buf[128 + 1];
+
+    for (size_t i = 0; i < sizeof(in) / sizeof(in[0]); i++) {
+        in[i] = (uint16_t)(i * 0x0102 + 0x1234);
+    }
+
+    for (size_t offset = 0; offset < 2; offset++) {
+        for (size_t size = 0; size <= 128; size++) {
+            memcpy(buf, in, sizeof(buf));
+            bswap16_buf_impl(impl, buf + offset, size);
+            for (size_t i = 0; i < sizeof(buf) / sizeof(buf[0]); i++) {
+                uint16_t exp = in[i];
+                if (i >= offset && i < offset + size) {
+                    exp = bswap_16(in[i]);
+                }
+                if (buf[i] != exp) {
+                    fprintf(stderr, "%s: mismatch at word %zu (size %zu, "
+                            "offset %zu)\n", bswap16_impl_name(impl), i, size,
+                            offset);
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    uint16_t *buf = malloc(BUF_SIZE_MAX_BYTES);
+    if (!buf) {
+        return 1;
+    }
+    for (size_t i = 0; i < BUF_SIZE_MAX_BYTES / sizeof(uint16_t); i++) {
+        buf[i] = (uint16_t)i;
+    }
+
+    printf("%-10s", "size");
+    for (int impl = 0; impl < BSWAP16_IMPL_COUNT; impl++) {
+        printf("%12s", bswap16_impl_name(impl));
+    }
+    printf("   [GB/s]\n");
+
+    for (int impl = 0; impl < BSWAP16_IMPL_COUNT; impl++) {
+        if (bswap16_impl_supported(impl) && verify(impl) != 0) {
+            free(buf);
+            return 1;
+        }
+    }
+
+    for (size_t size = BUF_SIZE_MIN_BYTES; size <= BUF_SIZE_MAX_BYTES;
+         size *= 4) {
+        printf("%6zu KiB", size / 1024);
+        for (int impl = 0; impl < BSWAP16_IMPL_COUNT; impl++) {
+            if (!bswap16_impl_supported(impl)) {
+                printf("%12s", "-");
+                continue;
+            }
+
+            size_t iterations = BYTES_PER_RUN / size;
+            double start = now_s();
+            for (size_t i = 0; i < iterations; i++) {
+                bswap16_buf_impl(impl, buf, size / sizeof(uint16_t));
+            }
+            double duration = now_s() - start;
+            printf("%12.2f", (double)size * iterations / duration / 1e9);
+        }
+        printf("\n");
+    }
+
+    free(buf);
+    return 0;
+}
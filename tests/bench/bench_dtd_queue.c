@@ -0,0 +1,172 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+/**
+ * Stress benchmark of the device -> host path in the device gateway
+ *
+ * A producer thread pushes bursts of DTDs into a dtd_queue (like the device
+ * reader thread), a consumer thread drains the queue into a ZeroMQ socket
+ * (like the zloop thread owning the host socket), and a sink thread receives
+ * the resulting messages. The packet rate is measured for bursts of 1, 4 and
+ * 16 KiB.
+ */
+
+#include "dtd_queue.h"
+
+#include <assert.h>
+#include <czmq.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** Packet size (in words), the size of a typical trace event packet */
+#define PKT_SIZE_WORDS 10
+
+/** Number of packets transferred for each burst size */
+#define PKTS_PER_RUN (2 * 1000 * 1000)
+
+#define QUEUE_SIZE_WORDS (4 * 64 * 1024)
+
+struct bench_ctx {
+    struct dtd_queue *queue;
+    zsock_t *tx_sock;
+    zsock_t *rx_sock;
+    size_t pkts_total;
+    bool stop;
+};
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* consumer_thread(void *arg)
+{
+    struct bench_ctx *ctx = arg;
+    struct pollfd pfd = {
+        .fd = dtd_queue_get_fd(ctx->queue),
+        .events = POLLIN
+    };
+
+    while (!__atomic_load_n(&ctx->stop, __ATOMIC_RELAXED)) {
+        if (poll(&pfd, 1, 100) > 0) {
+            dtd_queue_drain(ctx->queue, ctx->tx_sock, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void* sink_thread(void *arg)
+{
+    struct bench_ctx *ctx = arg;
+
+    for (size_t i = 0; i < ctx->pkts_total; i++) {
+        zmsg_t *msg = zmsg_recv(ctx->rx_sock);
+        if (!msg) {
+            break;
+        }
+        zmsg_destroy(&msg);
+    }
+    return NULL;
+}
+
+static int run_bench(size_t burst_size_bytes)
+{
+    struct bench_ctx ctx = { 0 };
+    osd_result rv;
+
+    rv = dtd_queue_new(&ctx.queue, QUEUE_SIZE_WORDS);
+    if (OSD_FAILED(rv)) {
+        return -1;
+    }
+    char endpoint[64];
+    snprintf(endpoint, sizeof(endpoint), "@inproc://bench-%zu",
+             burst_size_bytes);
+    ctx.rx_sock = zsock_new_pair(endpoint);
+    endpoint[0] = '>';
+    ctx.tx_sock = zsock_new_pair(endpoint);
+    assert(ctx.rx_sock && ctx.tx_sock);
+    zsock_set_sndhwm(ctx.tx_sock, 0);
+    zsock_set_rcvhwm(ctx.rx_sock, 0);
+
+    // one burst of DTDs, as read from the device
+    size_t dtd_size_words = 1 + PKT_SIZE_WORDS;
+    size_t pkts_per_burst = burst_size_bytes / sizeof(uint16_t) /
+                            dtd_size_words;
+    size_t burst_size_words = pkts_per_burst * dtd_size_words;
+    uint16_t *burst = calloc(burst_size_words, sizeof(uint16_t));
+    assert(burst);
+    for (size_t i = 0; i < pkts_per_burst; i++) {
+        burst[i * dtd_size_words] = PKT_SIZE_WORDS;
+    }
+
+    size_t bursts = PKTS_PER_RUN / pkts_per_burst;
+    ctx.pkts_total = bursts * pkts_per_burst;
+
+    pthread_t consumer, sink;
+    pthread_create(&sink, NULL, sink_thread, &ctx);
+    pthread_create(&consumer, NULL, consumer_thread, &ctx);
+
+    double start = now_s();
+    for (size_t b = 0; b < bursts; b++) {
+        size_t consumed = dtd_queue_push(ctx.queue, burst, burst_size_words);
+        assert(consumed == burst_size_words);
+    }
+    pthread_join(sink, NULL);
+    double duration = now_s() - start;
+
+    __atomic_store_n(&ctx.stop, true, __ATOMIC_RELAXED);
+    pthread_join(consumer, NULL);
+
+    printf("%6zu KiB %14.0f %12.1f\n", burst_size_bytes / 1024,
+           ctx.pkts_total / duration,
+           ctx.pkts_total * dtd_size_words * sizeof(uint16_t) / duration / 1e6);
+
+    free(burst);
+    zsock_destroy(&ctx.tx_sock);
+    zsock_destroy(&ctx.rx_sock);
+    dtd_queue_free(&ctx.queue);
+    return 0;
+}
+
+int main(void)
+{
+    static const size_t burst_sizes[] = { 1024, 4 * 1024, 16 * 1024 };
+
+    printf("%-10s %14s %12s\n", "burst", "packets/s", "MB/s");
+    for (size_t i = 0; i < sizeof(burst_sizes) / sizeof(burst_sizes[0]); i++) {
+        if (run_bench(burst_sizes[i]) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,242 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+#define TEST_SUITE_NAME "check_clock_corr"
+
+#include "testutil.h"
+
+#include <osd/osd.h>
+#include <osd/clock_corr.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+static struct osd_log_ctx *log_ctx;
+
+static void setup(void)
+{
+    log_ctx = testutil_get_log_ctx();
+}
+
+static void teardown(void)
+{
+    osd_log_free(&log_ctx);
+}
+
+/**
+ * Deterministic receive latency between 0 and 999 ns
+ */
+static uint64_t latency_ns(unsigned int *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 8) % 1000;
+}
+
+/**
+ * Fit a 100 MHz device clock with a 32 bit counter, which wraps around
+ */
+START_TEST(test_clock_corr_fit)
+{
+    osd_result rv;
+    struct osd_clock_corr *corr;
+    rv = osd_clock_corr_new(&corr, log_ctx, 256, 32);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // the counter wraps after 1.9 s, i.e. within the sample window
+    const uint64_t device_start = 0x100000000ULL - 1900 * 100000;
+    const uint64_t host_start = 5000000000ULL;
+    unsigned int state = 1;
+
+    // one sample every ms for two seconds
+    for (uint64_t i = 0; i < 2000; i++) {
+        uint64_t ticks = i * 100000;
+        uint64_t host = host_start + ticks * 10 + latency_ns(&state);
+        osd_clock_corr_add(corr, (device_start + ticks) & 0xffffffff, host);
+    }
+
+    struct osd_clock_corr_fit fit;
+    rv = osd_clock_corr_get_fit(corr, &fit);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(fit.samples, 256);
+    ck_assert(fit.ns_per_tick > 9.999 && fit.ns_per_tick < 10.001);
+    // uniform latency between 0 and 1 us: standard deviation ~290 ns
+    ck_assert(fit.residual_ns > 200 && fit.residual_ns < 400);
+
+    // an event between two samples after the counter wrapped, and one
+    // before; the host time includes the average latency of 500 ns
+    const uint64_t ticks[] = { 1999 * 100000 + 12345, 1800 * 100000 };
+    for (unsigned int i = 0; i < 2; i++) {
+        uint64_t host;
+        rv = osd_clock_corr_to_host(corr,
+                                    (device_start + ticks[i]) & 0xffffffff,
+                                    &host);
+        ck_assert_int_eq(rv, OSD_OK);
+        int64_t err = (int64_t)(host - (host_start + ticks[i] * 10 + 500));
+        ck_assert_int_lt(llabs(err), 100);
+    }
+
+    osd_clock_corr_free(&corr);
+    ck_assert_ptr_eq(corr, NULL);
+}
+END_TEST
+
+/**
+ * The fit follows a change of the device clock rate
+ */
+START_TEST(test_clock_corr_drift)
+{
+    osd_result rv;
+    struct osd_clock_corr *corr;
+    rv = osd_clock_corr_new(&corr, log_ctx, 64, 64);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    uint64_t device = 0;
+    uint64_t host = 1000;
+    for (unsigned int i = 0; i < 100; i++) {
+        device += 1000;
+        host += 2000;
+        osd_clock_corr_add(corr, device, host);
+    }
+
+    struct osd_clock_corr_fit fit;
+    rv = osd_clock_corr_get_fit(corr, &fit);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert(fit.ns_per_tick > 1.999 && fit.ns_per_tick < 2.001);
+
+    for (unsigned int i = 0; i < 64; i++) {
+        device += 1000;
+        host += 2500;
+        osd_clock_corr_add(corr, device, host);
+    }
+    rv = osd_clock_corr_get_fit(corr, &fit);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert(fit.ns_per_tick > 2.499 && fit.ns_per_tick < 2.501);
+    ck_assert(fit.residual_ns < 1);
+
+    uint64_t host_conv;
+    rv = osd_clock_corr_to_host(corr, device + 1000, &host_conv);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(host_conv, host + 2500);
+
+    osd_clock_corr_free(&corr);
+}
+END_TEST
+
+/**
+ * Only the sample with the lowest latency within an interval is used
+ */
+START_TEST(test_clock_corr_sample_interval)
+{
+    osd_result rv;
+    struct osd_clock_corr *corr;
+    rv = osd_clock_corr_new(&corr, log_ctx, 16, 32);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_clock_corr_set_sample_interval(corr, 1000000);
+
+    // 1 ns per tick, no latency: one sample every ms
+    for (uint64_t i = 0; i < 4; i++) {
+        osd_clock_corr_add(corr, i * 1000000, i * 1000000);
+    }
+
+    struct osd_clock_corr_fit fit;
+    rv = osd_clock_corr_get_fit(corr, &fit);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(fit.samples, 4);
+
+    // a burst within the next ms: the first event is delayed by 500 ns, the
+    // second one by 100 ns, the third one by 300 ns
+    osd_clock_corr_add(corr, 4000000, 4000500);
+    osd_clock_corr_add(corr, 4000100, 4000200);
+    osd_clock_corr_add(corr, 4000200, 4000500);
+    rv = osd_clock_corr_get_fit(corr, &fit);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(fit.samples, 5);
+
+    // the sample with 100 ns latency has been kept
+    uint64_t host;
+    rv = osd_clock_corr_to_host(corr, 6000000, &host);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_gt(host, 6000000);
+    ck_assert_uint_lt(host, 6000200);
+
+    osd_clock_corr_free(&corr);
+}
+END_TEST
+
+START_TEST(test_clock_corr_insufficient)
+{
+    osd_result rv;
+    struct osd_clock_corr *corr;
+    rv = osd_clock_corr_new(&corr, log_ctx, 16, 16);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    uint64_t host;
+    struct osd_clock_corr_fit fit;
+    rv = osd_clock_corr_to_host(corr, 0, &host);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    osd_clock_corr_add(corr, 100, 1000);
+    rv = osd_clock_corr_get_fit(corr, &fit);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // no fit with a single distinct device timestamp
+    osd_clock_corr_add(corr, 100, 1100);
+    rv = osd_clock_corr_get_fit(corr, &fit);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    osd_clock_corr_add(corr, 200, 2000);
+    rv = osd_clock_corr_get_fit(corr, &fit);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    osd_clock_corr_reset(corr);
+    rv = osd_clock_corr_to_host(corr, 300, &host);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    osd_clock_corr_free(&corr);
+}
+END_TEST
+
+Suite * suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+
+    tcase_add_test(tc_core, test_clock_corr_fit);
+    tcase_add_test(tc_core, test_clock_corr_drift);
+    tcase_add_test(tc_core, test_clock_corr_sample_interval);
+    tcase_add_test(tc_core, test_clock_corr_insufficient);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,279 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#define TEST_SUITE_NAME "check_dtd_capture"
+
+#include "testutil.h"
+
+#include "dtd_capture.h"
+
+#include <osd/osd.h>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Maximum size of a capture file
+ *
+ * The smallest allowed size: the header and one write buffer (4 MB).
+ */
+#define ROTATE_SIZE_BYTES (DTD_CAPTURE_HEADER_SIZE + 4 * 1024 * 1024)
+
+/** Number of DTDs captured (~10 MB, enough for three files) */
+#define CAPTURE_DTDS 150000
+
+/** Number of DTDs passed to a single dtd_capture_write() call */
+#define CAPTURE_DTDS_PER_WRITE 100
+
+static char tmpdir[64];
+static char *path;
+
+/**
+ * Log function of the command line tools, used by dtd_capture.c
+ */
+void cli_log(int priority, const char* category, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "[%s] ", category);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+static void setup(void)
+{
+    strcpy(tmpdir, "/tmp/check_dtd_capture.XXXXXX");
+    ck_assert_ptr_ne(mkdtemp(tmpdir), NULL);
+    int rv = asprintf(&path, "%s/capture.dtd", tmpdir);
+    ck_assert_int_ne(rv, -1);
+}
+
+static void teardown(void)
+{
+    for (unsigned int seq = 0; ; seq++) {
+        char *seq_path = dtd_capture_get_path(path, seq);
+        int rv = unlink(seq_path);
+        free(seq_path);
+        if (rv) {
+            break;
+        }
+    }
+    rmdir(tmpdir);
+    free(path);
+}
+
+/**
+ * Append a DTD in wire format (big endian) to @p buf
+ *
+ * The DTD has a size between 3 and 66 words, derived from @p seq, and
+ * carries @p seq as payload.
+ *
+ * @return number of bytes written
+ */
+static size_t build_dtd(uint8_t *buf, uint32_t seq)
+{
+    uint16_t size_words = 3 + seq % 64;
+    uint16_t *words = (uint16_t*)buf;
+
+    words[0] = htobe16(size_words);
+    words[1] = htobe16(0);
+    words[2] = htobe16(1);
+    words[3] = htobe16(0);
+    for (unsigned int i = 3; i < size_words; i++) {
+        words[1 + i] = htobe16(seq);
+    }
+    return (1 + size_words) * sizeof(uint16_t);
+}
+
+/**
+ * Capture DTDs to a rotated capture and read them back
+ */
+START_TEST(test_capture_rotate_replay)
+{
+    osd_result rv;
+
+    // the expected contents of the capture
+    uint8_t *data = malloc(CAPTURE_DTDS * 67 * sizeof(uint16_t));
+    ck_assert_ptr_ne(data, NULL);
+    size_t data_size_bytes = 0;
+
+    struct dtd_capture *capture;
+    rv = dtd_capture_new(&capture, path, ROTATE_SIZE_BYTES, false);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (uint32_t seq = 0; seq < CAPTURE_DTDS;
+         seq += CAPTURE_DTDS_PER_WRITE) {
+        size_t len = 0;
+        for (uint32_t i = 0; i < CAPTURE_DTDS_PER_WRITE; i++) {
+            len += build_dtd(data + data_size_bytes + len, seq + i);
+        }
+        rv = dtd_capture_write(capture, data + data_size_bytes, len,
+                               CAPTURE_DTDS_PER_WRITE);
+        ck_assert_int_eq(rv, OSD_OK);
+        data_size_bytes += len;
+    }
+    dtd_capture_free(&capture);
+    ck_assert_ptr_eq(capture, NULL);
+
+    // replay: read all files of the capture in sequence
+    size_t offset = 0;
+    uint64_t dtd_count = 0;
+    uint64_t prev_start_time_ns = 0;
+    unsigned int seq;
+    for (seq = 0; ; seq++) {
+        char *seq_path = dtd_capture_get_path(path, seq);
+        int fd = open(seq_path, O_RDONLY);
+        free(seq_path);
+        if (fd == -1) {
+            break;
+        }
+
+        struct dtd_capture_header hdr;
+        rv = dtd_capture_read_header(fd, &hdr);
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_uint_eq(hdr.sequence, seq);
+        ck_assert_uint_eq(hdr.header_size, DTD_CAPTURE_HEADER_SIZE);
+        ck_assert_uint_gt(hdr.data_size_bytes, 0);
+        ck_assert_uint_le(hdr.header_size + hdr.data_size_bytes,
+                          ROTATE_SIZE_BYTES);
+        ck_assert_uint_le(offset + hdr.data_size_bytes, data_size_bytes);
+        ck_assert_uint_ge(hdr.start_time_ns, prev_start_time_ns);
+        prev_start_time_ns = hdr.start_time_ns;
+
+        // the index ends at the end of the data
+        ck_assert_uint_gt(hdr.index_len, 0);
+        ck_assert_uint_eq(hdr.index[hdr.index_len - 1].data_offset,
+                          hdr.data_size_bytes);
+
+        uint8_t *file_data = malloc(hdr.data_size_bytes);
+        ck_assert_ptr_ne(file_data, NULL);
+        ssize_t len = pread(fd, file_data, hdr.data_size_bytes,
+                            hdr.header_size);
+        ck_assert_int_eq(len, (ssize_t)hdr.data_size_bytes);
+        ck_assert(!memcmp(file_data, data + offset, hdr.data_size_bytes));
+
+        // every file holds complete DTDs only
+        uint64_t file_dtds = 0;
+        size_t pos = 0;
+        while (pos < hdr.data_size_bytes) {
+            uint16_t size_words = be16toh(*(uint16_t*)(file_data + pos));
+            pos += (1 + size_words) * sizeof(uint16_t);
+            file_dtds++;
+        }
+        ck_assert_uint_eq(pos, hdr.data_size_bytes);
+        ck_assert_uint_eq(file_dtds, hdr.dtd_count);
+
+        free(file_data);
+        close(fd);
+
+        offset += hdr.data_size_bytes;
+        dtd_count += hdr.dtd_count;
+    }
+
+    ck_assert_uint_eq(seq, 3);
+    ck_assert_uint_eq(offset, data_size_bytes);
+    ck_assert_uint_eq(dtd_count, CAPTURE_DTDS);
+
+    free(data);
+}
+END_TEST
+
+/**
+ * Files which aren't captures are rejected
+ */
+START_TEST(test_capture_invalid_header)
+{
+    osd_result rv;
+    struct dtd_capture_header hdr;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ck_assert_int_ne(fd, -1);
+
+    // too short
+    rv = dtd_capture_read_header(fd, &hdr);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // no magic bytes
+    uint8_t *block = calloc(1, DTD_CAPTURE_HEADER_SIZE);
+    ck_assert_ptr_ne(block, NULL);
+    ck_assert_int_eq(pwrite(fd, block, DTD_CAPTURE_HEADER_SIZE, 0),
+                     DTD_CAPTURE_HEADER_SIZE);
+    rv = dtd_capture_read_header(fd, &hdr);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // unsupported version
+    struct dtd_capture_header *le = (struct dtd_capture_header*)block;
+    strcpy(le->magic, DTD_CAPTURE_MAGIC);
+    le->version = htole32(DTD_CAPTURE_VERSION + 1);
+    le->header_size = htole32(DTD_CAPTURE_HEADER_SIZE);
+    ck_assert_int_eq(pwrite(fd, block, DTD_CAPTURE_HEADER_SIZE, 0),
+                     DTD_CAPTURE_HEADER_SIZE);
+    rv = dtd_capture_read_header(fd, &hdr);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // index too long
+    le->version = htole32(DTD_CAPTURE_VERSION);
+    le->index_len = htole32(DTD_CAPTURE_INDEX_LEN + 1);
+    ck_assert_int_eq(pwrite(fd, block, DTD_CAPTURE_HEADER_SIZE, 0),
+                     DTD_CAPTURE_HEADER_SIZE);
+    rv = dtd_capture_read_header(fd, &hdr);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    le->index_len = 0;
+    ck_assert_int_eq(pwrite(fd, block, DTD_CAPTURE_HEADER_SIZE, 0),
+                     DTD_CAPTURE_HEADER_SIZE);
+    rv = dtd_capture_read_header(fd, &hdr);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    free(block);
+    close(fd);
+}
+END_TEST
+
+Suite * suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+
+    tcase_add_test(tc_core, test_capture_rotate_replay);
+    tcase_add_test(tc_core, test_capture_invalid_header);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,268 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#define TEST_SUITE_NAME "check_dtd_filter"
+
+#include "testutil.h"
+
+#include "dtd_filter.h"
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+
+#include <stdint.h>
+
+static struct dtd_filter *filter;
+
+static void setup(void)
+{
+    osd_result rv;
+    rv = dtd_filter_new(&filter);
+    ck_assert_int_eq(rv, OSD_OK);
+}
+
+static void teardown(void)
+{
+    dtd_filter_free(&filter);
+    ck_assert_ptr_eq(filter, NULL);
+}
+
+/**
+ * Match a packet header (dest 0) against the filter
+ */
+static bool match(unsigned int src, unsigned int type, unsigned int type_sub)
+{
+    uint16_t hdr[3] = {
+        0, src,
+        (type << DP_HEADER_TYPE_SHIFT) | (type_sub << DP_HEADER_TYPE_SUB_SHIFT)
+    };
+    return dtd_filter_match(filter, hdr, 3);
+}
+
+START_TEST(test_filter_parse_valid)
+{
+    const char *rules[] = {
+        "src deny 5",
+        "src allow 0x10",
+        "SRC DENY all",
+        "  src \tallow   all ",
+        "type deny event",
+        "type allow 2.3",
+        "type deny reg.15",
+        "type allow res",
+        "sample all 4",
+        "sample 7 2",
+        "sample 7 1",
+        "reset",
+    };
+
+    for (unsigned int i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+        ck_assert_msg(dtd_filter_add_rule(filter, rules[i]) == OSD_OK,
+                      "rule '%s' rejected", rules[i]);
+    }
+}
+END_TEST
+
+START_TEST(test_filter_parse_invalid)
+{
+    const char *rules[] = {
+        "",
+        " ",
+        "src",
+        "src deny",
+        "src block 5",
+        "src deny 65536",
+        "src deny 5x",
+        "src deny 5 6",
+        "type deny foo",
+        "type deny 4",
+        "type deny reg.16",
+        "type deny reg.",
+        "sample all",
+        "sample 5 0",
+        "sample 5 x",
+        "sample 5 2 3",
+        "reset now",
+        "drop 5",
+    };
+
+    for (unsigned int i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+        ck_assert_msg(dtd_filter_add_rule(filter, rules[i]) ==
+                      OSD_ERROR_FAILURE, "rule '%s' accepted", rules[i]);
+    }
+
+    // invalid rules don't change the filter
+    ck_assert(match(5, OSD_PACKET_TYPE_EVENT, 0));
+    ck_assert_uint_eq(dtd_filter_get_dropped(filter), 0);
+}
+END_TEST
+
+START_TEST(test_filter_sample_rules_max)
+{
+    osd_result rv;
+    char rule[32];
+
+    for (unsigned int i = 0; i < DTD_FILTER_SAMPLE_RULES_MAX; i++) {
+        snprintf(rule, sizeof(rule), "sample %u 2", i);
+        rv = dtd_filter_add_rule(filter, rule);
+        ck_assert_int_eq(rv, OSD_OK);
+    }
+    rv = dtd_filter_add_rule(filter, "sample 100 2");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // changing an existing rule and removing a rule still works
+    rv = dtd_filter_add_rule(filter, "sample 0 3");
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = dtd_filter_add_rule(filter, "sample 1 1");
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = dtd_filter_add_rule(filter, "sample 100 2");
+    ck_assert_int_eq(rv, OSD_OK);
+}
+END_TEST
+
+START_TEST(test_filter_src)
+{
+    osd_result rv;
+    rv = dtd_filter_add_rule(filter, "src deny 5");
+    ck_assert_int_eq(rv, OSD_OK);
+
+    ck_assert(!match(5, OSD_PACKET_TYPE_EVENT, 0));
+    ck_assert(!match(5, OSD_PACKET_TYPE_PLAIN, 0));
+    ck_assert(match(6, OSD_PACKET_TYPE_EVENT, 0));
+    // register accesses are never dropped by source
+    ck_assert(match(5, OSD_PACKET_TYPE_REG, 0));
+    ck_assert_uint_eq(dtd_filter_get_dropped(filter), 2);
+
+    rv = dtd_filter_add_rule(filter, "src deny all");
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = dtd_filter_add_rule(filter, "src allow 6");
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert(!match(5, OSD_PACKET_TYPE_EVENT, 0));
+    ck_assert(!match(65535, OSD_PACKET_TYPE_EVENT, 0));
+    ck_assert(match(6, OSD_PACKET_TYPE_EVENT, 0));
+
+    rv = dtd_filter_add_rule(filter, "reset");
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert(match(5, OSD_PACKET_TYPE_EVENT, 0));
+    ck_assert_uint_eq(dtd_filter_get_dropped(filter), 4);
+}
+END_TEST
+
+START_TEST(test_filter_type)
+{
+    osd_result rv;
+    rv = dtd_filter_add_rule(filter, "type deny event");
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = dtd_filter_add_rule(filter, "type allow event.3");
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = dtd_filter_add_rule(filter, "type deny 0.15");
+    ck_assert_int_eq(rv, OSD_OK);
+
+    ck_assert(!match(1, OSD_PACKET_TYPE_EVENT, 0));
+    ck_assert(!match(1, OSD_PACKET_TYPE_EVENT, 15));
+    ck_assert(match(1, OSD_PACKET_TYPE_EVENT, 3));
+    ck_assert(match(1, OSD_PACKET_TYPE_PLAIN, 0));
+    // type rules also apply to register accesses
+    ck_assert(!match(1, OSD_PACKET_TYPE_REG, 15));
+    ck_assert(match(1, OSD_PACKET_TYPE_REG, 0));
+    ck_assert_uint_eq(dtd_filter_get_dropped(filter), 3);
+}
+END_TEST
+
+START_TEST(test_filter_sample)
+{
+    osd_result rv;
+    unsigned int forwarded[3] = { 0 };
+
+    rv = dtd_filter_add_rule(filter, "sample all 4");
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = dtd_filter_add_rule(filter, "sample 2 2");
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (unsigned int i = 0; i < 100; i++) {
+        for (unsigned int src = 0; src < 3; src++) {
+            if (match(src, OSD_PACKET_TYPE_EVENT, 0)) {
+                forwarded[src]++;
+            }
+        }
+        // register accesses are never sampled
+        ck_assert(match(0, OSD_PACKET_TYPE_REG, 0));
+    }
+
+    // sources 0 and 1 share the default rule
+    ck_assert_uint_eq(forwarded[0] + forwarded[1], 50);
+    ck_assert_uint_eq(forwarded[2], 50);
+    ck_assert_uint_eq(dtd_filter_get_dropped(filter), 300 - 100);
+
+    // n == 1 removes the rule for a source: it falls back to the default
+    rv = dtd_filter_add_rule(filter, "sample 2 1");
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = dtd_filter_add_rule(filter, "sample all 1");
+    ck_assert_int_eq(rv, OSD_OK);
+    for (unsigned int i = 0; i < 10; i++) {
+        ck_assert(match(2, OSD_PACKET_TYPE_EVENT, 0));
+    }
+}
+END_TEST
+
+/**
+ * Packets too short to contain a header are always forwarded
+ */
+START_TEST(test_filter_short_packet)
+{
+    osd_result rv;
+    rv = dtd_filter_add_rule(filter, "src deny all");
+    ck_assert_int_eq(rv, OSD_OK);
+
+    uint16_t hdr[3] = { 0, 5, OSD_PACKET_TYPE_EVENT << DP_HEADER_TYPE_SHIFT };
+    ck_assert(dtd_filter_match(filter, hdr, 2));
+    ck_assert(!dtd_filter_match(filter, hdr, 3));
+}
+END_TEST
+
+Suite * suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+
+    tcase_add_test(tc_core, test_filter_parse_valid);
+    tcase_add_test(tc_core, test_filter_parse_invalid);
+    tcase_add_test(tc_core, test_filter_sample_rules_max);
+    tcase_add_test(tc_core, test_filter_src);
+    tcase_add_test(tc_core, test_filter_type);
+    tcase_add_test(tc_core, test_filter_sample);
+    tcase_add_test(tc_core, test_filter_short_packet);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,270 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#define TEST_SUITE_NAME "check_dtd_queue"
+
+#include "testutil.h"
+
+#include "dtd_queue.h"
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+
+#include <assert.h>
+#include <czmq.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Smallest possible queue size (in words) */
+#define QUEUE_SIZE_WORDS (1 + UINT16_MAX)
+
+static struct dtd_queue *queue;
+static zsock_t *sock_tx, *sock_rx;
+
+static void setup(void)
+{
+    osd_result rv;
+    rv = dtd_queue_new(&queue, QUEUE_SIZE_WORDS);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    sock_rx = zsock_new_pair("@inproc://dtd_queue");
+    ck_assert_ptr_ne(sock_rx, NULL);
+    zsock_set_rcvtimeo(sock_rx, 1000);
+    sock_tx = zsock_new_pair(">inproc://dtd_queue");
+    ck_assert_ptr_ne(sock_tx, NULL);
+}
+
+static void teardown(void)
+{
+    zsock_destroy(&sock_tx);
+    zsock_destroy(&sock_rx);
+    dtd_queue_free(&queue);
+    ck_assert_ptr_eq(queue, NULL);
+}
+
+/**
+ * Write a DTD of @p size_words packet words from @p src to @p buf
+ *
+ * All payload words are set to @p seq.
+ *
+ * @return number of words written (including the size word)
+ */
+static size_t build_dtd(uint16_t *buf, size_t size_words, uint16_t src,
+                        uint16_t seq)
+{
+    buf[0] = size_words;
+    buf[1] = 0;
+    buf[2] = src;
+    buf[3] = OSD_PACKET_TYPE_EVENT << DP_HEADER_TYPE_SHIFT;
+    for (size_t i = 3; i < size_words; i++) {
+        buf[1 + i] = seq;
+    }
+    return 1 + size_words;
+}
+
+/**
+ * Receive a DTD sent by dtd_queue_drain() and check its contents
+ */
+static void check_rcv_dtd(size_t size_words, uint16_t src, uint16_t seq)
+{
+    zmsg_t *msg = zmsg_recv(sock_rx);
+    ck_assert_ptr_ne(msg, NULL);
+    ck_assert_uint_eq(zmsg_size(msg), 2);
+
+    char *type = zmsg_popstr(msg);
+    ck_assert_str_eq(type, "D");
+    free(type);
+
+    zframe_t *data_frame = zmsg_pop(msg);
+    ck_assert_uint_eq(zframe_size(data_frame), size_words * sizeof(uint16_t));
+    uint16_t *data = (uint16_t*)zframe_data(data_frame);
+    ck_assert_uint_eq(data[1], src);
+    for (size_t i = 3; i < size_words; i++) {
+        ck_assert_uint_eq(data[i], seq);
+    }
+    zframe_destroy(&data_frame);
+    zmsg_destroy(&msg);
+}
+
+/**
+ * DTDs are only pushed if they have been received completely
+ */
+START_TEST(test_queue_partial_dtd)
+{
+    uint16_t buf[32];
+    size_t len = build_dtd(buf, 10, 1, 1);
+    len += build_dtd(&buf[len], 10, 1, 2);
+
+    size_t consumed = dtd_queue_push(queue, buf, len - 1);
+    ck_assert_uint_eq(consumed, 11);
+    ck_assert_uint_eq(dtd_queue_drain(queue, sock_tx, NULL), 1);
+    check_rcv_dtd(10, 1, 1);
+
+    consumed = dtd_queue_push(queue, &buf[consumed], len - consumed);
+    ck_assert_uint_eq(consumed, 11);
+    ck_assert_uint_eq(dtd_queue_drain(queue, sock_tx, NULL), 1);
+    check_rcv_dtd(10, 1, 2);
+
+    struct dtd_queue_stats stats;
+    dtd_queue_get_stats(queue, &stats);
+    ck_assert_uint_eq(stats.dtds_pushed, 2);
+    ck_assert_uint_eq(stats.fill_words, 0);
+}
+END_TEST
+
+/**
+ * DTDs (and their headers) which wrap around the end of the ring buffer
+ */
+START_TEST(test_queue_wraparound)
+{
+    uint16_t *buf = calloc(QUEUE_SIZE_WORDS, sizeof(uint16_t));
+    ck_assert_ptr_ne(buf, NULL);
+
+    struct dtd_filter *filter;
+    osd_result rv = dtd_filter_new(&filter);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = dtd_filter_add_rule(filter, "src deny 5");
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // leave two words at the end of the ring: the size word and the dest
+    // word of the next DTD are the last words in the buffer
+    size_t len = build_dtd(buf, QUEUE_SIZE_WORDS - 3, 1, 0x1111);
+    ck_assert_uint_eq(dtd_queue_push(queue, buf, len), len);
+    ck_assert_uint_eq(dtd_queue_drain(queue, sock_tx, filter), 1);
+    check_rcv_dtd(QUEUE_SIZE_WORDS - 3, 1, 0x1111);
+
+    // the filter needs to read a header which wraps around: the first DTD
+    // is dropped, the second one is sent
+    len = build_dtd(buf, 100, 5, 0x2222);
+    len += build_dtd(&buf[len], 40000, 6, 0x3333);
+    ck_assert_uint_eq(dtd_queue_push(queue, buf, len), len);
+    ck_assert_uint_eq(dtd_queue_drain(queue, sock_tx, filter), 1);
+    check_rcv_dtd(40000, 6, 0x3333);
+    ck_assert_uint_eq(dtd_filter_get_dropped(filter), 1);
+
+    // a DTD whose payload wraps around
+    len = build_dtd(buf, 40000, 7, 0x4444);
+    ck_assert_uint_eq(dtd_queue_push(queue, buf, len), len);
+    ck_assert_uint_eq(dtd_queue_drain(queue, sock_tx, filter), 1);
+    check_rcv_dtd(40000, 7, 0x4444);
+
+    struct dtd_queue_stats stats;
+    dtd_queue_get_stats(queue, &stats);
+    ck_assert_uint_eq(stats.size_words, QUEUE_SIZE_WORDS);
+    ck_assert_uint_eq(stats.fill_words, 0);
+    ck_assert_uint_eq(stats.dtds_pushed, 4);
+
+    dtd_filter_free(&filter);
+    free(buf);
+}
+END_TEST
+
+/** Number of DTDs pushed by the producer thread */
+#define PRODUCER_DTDS 64
+/** Size of the DTDs pushed by the producer thread (in words) */
+#define PRODUCER_DTD_SIZE_WORDS 4000
+
+static void* producer_thread(void *arg)
+{
+    size_t buf_size_words = PRODUCER_DTDS * (1 + PRODUCER_DTD_SIZE_WORDS);
+    uint16_t *buf = malloc(buf_size_words * sizeof(uint16_t));
+    assert(buf);
+
+    size_t len = 0;
+    for (unsigned int i = 0; i < PRODUCER_DTDS; i++) {
+        len += build_dtd(&buf[len], PRODUCER_DTD_SIZE_WORDS, 1, i);
+    }
+    size_t *consumed = arg;
+    *consumed = dtd_queue_push(queue, buf, len);
+
+    free(buf);
+    return NULL;
+}
+
+/**
+ * The producer blocks while the queue is full and continues once the
+ * consumer has made room
+ */
+START_TEST(test_queue_blocking_push)
+{
+    pthread_t thread;
+    size_t consumed = 0;
+    int rv = pthread_create(&thread, NULL, producer_thread, &consumed);
+    ck_assert_int_eq(rv, 0);
+
+    // let the producer fill up the queue (~4x its capacity is pushed)
+    zclock_sleep(100);
+    struct dtd_queue_stats stats;
+    dtd_queue_get_stats(queue, &stats);
+    ck_assert_uint_gt(stats.fill_words,
+                      QUEUE_SIZE_WORDS - (1 + PRODUCER_DTD_SIZE_WORDS));
+    ck_assert_uint_lt(stats.dtds_pushed, PRODUCER_DTDS);
+
+    struct pollfd pfd = { .fd = dtd_queue_get_fd(queue), .events = POLLIN };
+    unsigned int dtds_rcvd = 0;
+    while (dtds_rcvd < PRODUCER_DTDS) {
+        rv = poll(&pfd, 1, 1000);
+        ck_assert_int_eq(rv, 1);
+
+        size_t dtds = dtd_queue_drain(queue, sock_tx, NULL);
+        for (size_t i = 0; i < dtds; i++) {
+            check_rcv_dtd(PRODUCER_DTD_SIZE_WORDS, 1, dtds_rcvd++);
+        }
+    }
+
+    rv = pthread_join(thread, NULL);
+    ck_assert_int_eq(rv, 0);
+    ck_assert_uint_eq(consumed,
+                      PRODUCER_DTDS * (1 + PRODUCER_DTD_SIZE_WORDS));
+
+    dtd_queue_get_stats(queue, &stats);
+    ck_assert_uint_eq(stats.dtds_pushed, PRODUCER_DTDS);
+    ck_assert_uint_eq(stats.fill_words, 0);
+    ck_assert_uint_gt(stats.producer_blocked_us, 0);
+}
+END_TEST
+
+Suite * suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+
+    tcase_add_test(tc_core, test_queue_partial_dtd);
+    tcase_add_test(tc_core, test_queue_wraparound);
+    tcase_add_test(tc_core, test_queue_blocking_push);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
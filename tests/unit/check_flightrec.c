@@ -0,0 +1,282 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+
+#define TEST_SUITE_NAME "check_flightrec"
+
+#include "testutil.h"
+
+#include <osd/osd.h>
+#include <osd/flightrec.h>
+#include <osd/packet.h>
+#include <osd/tracefile.h>
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char tracefile_path[PATH_MAX];
+static struct osd_log_ctx *log_ctx;
+
+static void setup(void)
+{
+    log_ctx = testutil_get_log_ctx();
+
+    strcpy(tracefile_path, "/tmp/check_flightrec.XXXXXX");
+    int fd = mkstemp(tracefile_path);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+}
+
+static void teardown(void)
+{
+    unlink(tracefile_path);
+    osd_log_free(&log_ctx);
+}
+
+/**
+ * Add a packet with |size_words| words, all set to |seq|
+ */
+static void add_packet(struct osd_flightrec *rec, unsigned int size_words,
+                       uint64_t seq)
+{
+    osd_result rv;
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, size_words);
+    ck_assert_int_eq(rv, OSD_OK);
+    for (unsigned int i = 0; i < size_words; i++) {
+        pkg->data_raw[i] = (uint16_t)seq;
+    }
+
+    rv = osd_flightrec_add(rec, pkg, seq);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_free(&pkg);
+}
+
+/**
+ * Write the recorder content into a trace file and check it
+ *
+ * The recorder must contain consecutive packets added with add_packet().
+ *
+ * @param first_seq expected sequence number of the first packet, or -1 to
+ *                  accept any
+ * @return number of packets in the file
+ */
+static uint64_t check_content(struct osd_flightrec *rec, int64_t first_seq)
+{
+    osd_result rv;
+    struct osd_tracefile_meta meta = { 0 };
+
+    struct osd_tracefile_writer *writer;
+    rv = osd_tracefile_writer_new(&writer, log_ctx, tracefile_path, &meta);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_flightrec_write(rec, writer);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_tracefile_writer_free(&writer);
+
+    struct osd_tracefile_reader *reader;
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    uint64_t packets = 0;
+    uint64_t last_seq = 0;
+    struct osd_packet *pkg;
+    uint64_t seq;
+    while ((rv = osd_tracefile_reader_next(reader, &pkg, &seq)) == OSD_OK) {
+        if (packets == 0) {
+            if (first_seq >= 0) {
+                ck_assert_uint_eq(seq, (uint64_t)first_seq);
+            }
+        } else {
+            ck_assert_uint_eq(seq, last_seq + 1);
+        }
+        for (unsigned int i = 0; i < pkg->data_size_words; i++) {
+            ck_assert_uint_eq(pkg->data_raw[i], (uint16_t)seq);
+        }
+        last_seq = seq;
+        packets++;
+        osd_packet_free(&pkg);
+    }
+    ck_assert_int_eq(rv, OSD_ERROR_EOF);
+    osd_tracefile_reader_free(&reader);
+
+    return packets;
+}
+
+START_TEST(test_flightrec_basic)
+{
+    osd_result rv;
+    struct osd_flightrec *rec;
+    rv = osd_flightrec_new(&rec, log_ctx, OSD_FLIGHTREC_SIZE_MIN);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (unsigned int i = 0; i < 10; i++) {
+        add_packet(rec, 3 + i, i);
+    }
+
+    struct osd_flightrec_stats stats;
+    osd_flightrec_get_stats(rec, &stats);
+    ck_assert_uint_eq(stats.packets, 10);
+    ck_assert_uint_gt(stats.bytes, 0);
+    ck_assert_uint_eq(stats.packets_overwritten, 0);
+    ck_assert_uint_eq(stats.packets_dropped, 0);
+
+    osd_flightrec_freeze(rec);
+    ck_assert(osd_flightrec_is_frozen(rec));
+    ck_assert_uint_eq(check_content(rec, 0), 10);
+
+    // packets added while frozen are dropped
+    add_packet(rec, 3, 10);
+    osd_flightrec_get_stats(rec, &stats);
+    ck_assert_uint_eq(stats.packets, 10);
+    ck_assert_uint_eq(stats.packets_dropped, 1);
+
+    osd_flightrec_clear(rec);
+    osd_flightrec_get_stats(rec, &stats);
+    ck_assert_uint_eq(stats.packets, 0);
+    ck_assert_uint_eq(stats.bytes, 0);
+    ck_assert_uint_eq(check_content(rec, -1), 0);
+
+    osd_flightrec_resume(rec);
+    ck_assert(!osd_flightrec_is_frozen(rec));
+    add_packet(rec, 3, 11);
+    osd_flightrec_freeze(rec);
+    ck_assert_uint_eq(check_content(rec, 11), 1);
+
+    osd_flightrec_free(&rec);
+    ck_assert_ptr_eq(rec, NULL);
+}
+END_TEST
+
+/**
+ * Overwrite the buffer many times with packets of varying size
+ */
+START_TEST(test_flightrec_wrap)
+{
+    osd_result rv;
+    struct osd_flightrec *rec;
+    rv = osd_flightrec_new(&rec, log_ctx, OSD_FLIGHTREC_SIZE_MIN + 100);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    const unsigned int num_packets = 100000;
+    for (unsigned int i = 0; i < num_packets; i++) {
+        // an occasional packet of maximum size
+        unsigned int size_words = (i % 997 == 0) ? UINT16_MAX : 3 + i % 61;
+        add_packet(rec, size_words, i);
+    }
+
+    struct osd_flightrec_stats stats;
+    osd_flightrec_get_stats(rec, &stats);
+    ck_assert_uint_gt(stats.packets_overwritten, 0);
+    ck_assert_uint_eq(stats.packets + stats.packets_overwritten, num_packets);
+    ck_assert_uint_le(stats.bytes, OSD_FLIGHTREC_SIZE_MIN + 100);
+    // at most the largest record remains unused
+    ck_assert_uint_ge(stats.bytes, OSD_FLIGHTREC_SIZE_MIN / 2);
+
+    // the newest packets are kept
+    osd_flightrec_freeze(rec);
+    ck_assert_uint_eq(check_content(rec, num_packets - stats.packets),
+                      stats.packets);
+
+    osd_flightrec_free(&rec);
+}
+END_TEST
+
+struct producer {
+    struct osd_flightrec *rec;
+    int stop;
+};
+
+static void* producer_main(void *arg)
+{
+    struct producer *p = arg;
+    uint64_t seq = 0;
+    while (!__atomic_load_n(&p->stop, __ATOMIC_RELAXED)) {
+        add_packet(p->rec, 3 + seq % 17, seq);
+        seq++;
+    }
+    return NULL;
+}
+
+/**
+ * Freeze and dump the recorder while packets are added from another thread
+ */
+START_TEST(test_flightrec_concurrent)
+{
+    osd_result rv;
+    struct producer p = { 0 };
+    rv = osd_flightrec_new(&p.rec, log_ctx, OSD_FLIGHTREC_SIZE_MIN);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    pthread_t thread;
+    ck_assert_int_eq(pthread_create(&thread, NULL, producer_main, &p), 0);
+
+    for (unsigned int i = 0; i < 20; i++) {
+        usleep(1000);
+        osd_flightrec_freeze(p.rec);
+        check_content(p.rec, -1);
+        osd_flightrec_clear(p.rec);
+        osd_flightrec_resume(p.rec);
+    }
+
+    __atomic_store_n(&p.stop, 1, __ATOMIC_RELAXED);
+    pthread_join(thread, NULL);
+
+    osd_flightrec_free(&p.rec);
+}
+END_TEST
+
+START_TEST(test_flightrec_invalid)
+{
+    osd_result rv;
+    struct osd_flightrec *rec;
+    rv = osd_flightrec_new(&rec, log_ctx, OSD_FLIGHTREC_SIZE_MIN - 1);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+Suite * suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+
+    tcase_add_test(tc_core, test_flightrec_basic);
+    tcase_add_test(tc_core, test_flightrec_wrap);
+    tcase_add_test(tc_core, test_flightrec_concurrent);
+    tcase_add_test(tc_core, test_flightrec_invalid);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,144 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#define TEST_SUITE_NAME "check_histogram"
+
+#include "testutil.h"
+
+#include <osd/osd.h>
+#include <osd/histogram.h>
+
+#include <string.h>
+
+START_TEST(test_histogram_empty)
+{
+    struct osd_histogram hist;
+    osd_histogram_reset(&hist);
+
+    ck_assert_uint_eq(hist.count, 0);
+    ck_assert_uint_eq(osd_histogram_percentile(&hist, 50.0), 0);
+}
+END_TEST
+
+START_TEST(test_histogram_bucket_boundaries)
+{
+    // small values are recorded exactly
+    for (uint64_t v = 0; v < 2 * OSD_HISTOGRAM_SUB_BUCKETS; v++) {
+        unsigned int idx = osd_histogram_bucket_idx(v);
+        ck_assert_uint_eq(osd_histogram_bucket_lowest_value(idx), v);
+        ck_assert_uint_eq(osd_histogram_bucket_highest_value(idx), v);
+    }
+
+    // buckets are contiguous and each value falls into its bucket
+    for (unsigned int idx = 0; idx < OSD_HISTOGRAM_BUCKETS - 1; idx++) {
+        uint64_t low = osd_histogram_bucket_lowest_value(idx);
+        uint64_t high = osd_histogram_bucket_highest_value(idx);
+        ck_assert_uint_eq(osd_histogram_bucket_lowest_value(idx + 1), high + 1);
+        ck_assert_uint_eq(osd_histogram_bucket_idx(low), idx);
+        ck_assert_uint_eq(osd_histogram_bucket_idx(high), idx);
+    }
+
+    // values exceeding the range end up in the last bucket
+    ck_assert_uint_eq(osd_histogram_bucket_idx(UINT64_MAX),
+                      OSD_HISTOGRAM_BUCKETS - 1);
+}
+END_TEST
+
+START_TEST(test_histogram_record)
+{
+    struct osd_histogram hist;
+    osd_histogram_reset(&hist);
+
+    for (uint64_t v = 1; v <= 1000; v++) {
+        osd_histogram_record(&hist, v * 1000);
+    }
+
+    ck_assert_uint_eq(hist.count, 1000);
+    ck_assert_uint_eq(hist.min, 1000);
+    ck_assert_uint_eq(hist.max, 1000 * 1000);
+    ck_assert_uint_eq(hist.sum, 1000 * 500500);
+
+    // percentiles are accurate to the bucket resolution (12.5%)
+    uint64_t p50 = osd_histogram_percentile(&hist, 50.0);
+    ck_assert(p50 >= 500 * 1000 && p50 <= 500 * 1000 * 1.125);
+    uint64_t p99 = osd_histogram_percentile(&hist, 99.0);
+    ck_assert(p99 >= 990 * 1000 && p99 <= 1000 * 1000);
+    ck_assert_uint_eq(osd_histogram_percentile(&hist, 100.0), 1000 * 1000);
+}
+END_TEST
+
+START_TEST(test_histogram_copy)
+{
+    struct osd_histogram hist, copy;
+    osd_histogram_reset(&hist);
+    osd_histogram_record(&hist, 42);
+    osd_histogram_record(&hist, 4242);
+
+    osd_histogram_copy(&copy, &hist);
+    ck_assert_int_eq(memcmp(&copy, &hist, sizeof(hist)), 0);
+}
+END_TEST
+
+START_TEST(test_histogram_to_json)
+{
+    struct osd_histogram hist;
+    osd_histogram_reset(&hist);
+
+    char *str = NULL;
+    osd_histogram_to_json(&hist, &str);
+    ck_assert_str_eq(str, "{\"count\": 0}");
+    free(str);
+
+    osd_histogram_record(&hist, 5);
+    str = NULL;
+    osd_histogram_to_json(&hist, &str);
+    ck_assert_str_eq(str, "{\"count\": 1, \"min\": 5, \"mean\": 5, "
+                     "\"p50\": 5, \"p90\": 5, \"p99\": 5, \"p99.9\": 5, "
+                     "\"max\": 5}");
+    free(str);
+}
+END_TEST
+
+Suite * suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_histogram_empty);
+    tcase_add_test(tc_core, test_histogram_bucket_boundaries);
+    tcase_add_test(tc_core, test_histogram_record);
+    tcase_add_test(tc_core, test_histogram_copy);
+    tcase_add_test(tc_core, test_histogram_to_json);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,381 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+#define TEST_SUITE_NAME "check_hostctrl"
+
+#include "testutil.h"
+
+#include <osd/osd.h>
+#include <osd/hostctrl.h>
+#include <osd/hostmod.h>
+#include <osd/packet.h>
+#include <czmq.h>
+#include <pthread.h>
+
+#define HOSTCTRL_ADDRESS "inproc://testing-hostctrl"
+
+/**
+ * Time (in ms) after which the host controller has reclaimed the address of a
+ * peer which went silent (five heartbeat intervals, plus one interval of the
+ * reaper timer, plus some margin)
+ */
+#define PEER_RECLAIM_WAIT_MS (7 * 1000)
+
+struct osd_hostctrl_ctx *hostctrl_ctx;
+struct osd_hostmod_ctx *hostmod_ctx;
+struct osd_log_ctx* log_ctx;
+
+/**
+ * Test fixture: start a host controller and connect a host module to it
+ */
+void setup(void)
+{
+    osd_result rv;
+
+    log_ctx = testutil_get_log_ctx();
+
+    rv = osd_hostctrl_new(&hostctrl_ctx, log_ctx, HOSTCTRL_ADDRESS);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostctrl_start(hostctrl_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    rv = osd_hostmod_new(&hostmod_ctx, log_ctx, HOSTCTRL_ADDRESS, NULL, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_connect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+}
+
+/**
+ * Test fixture: tear down everything created in setup()
+ */
+void teardown(void)
+{
+    osd_result rv;
+
+    rv = osd_hostmod_disconnect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_hostmod_free(&hostmod_ctx);
+
+    rv = osd_hostctrl_stop(hostctrl_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_hostctrl_free(&hostctrl_ctx);
+    ck_assert_ptr_eq(hostctrl_ctx, NULL);
+
+    osd_log_free(&log_ctx);
+}
+
+/**
+ * Connect a peer to the host controller and obtain a DI address for it
+ *
+ * The peer stands in for a debug module which answers register reads. It
+ * sends no heartbeats.
+ */
+static zsock_t* peer_connect(unsigned int *diaddr)
+{
+    zsock_t *sock = zsock_new_dealer(HOSTCTRL_ADDRESS);
+    ck_assert_ptr_ne(sock, NULL);
+    zsock_set_rcvtimeo(sock, 1000);
+
+    zmsg_t *msg = zmsg_new();
+    zmsg_addstr(msg, "M");
+    zmsg_addstr(msg, "DIADDR_REQUEST");
+    int rv = zmsg_send(&msg, sock);
+    ck_assert_int_eq(rv, 0);
+
+    msg = zmsg_recv(sock);
+    ck_assert_ptr_ne(msg, NULL);
+    ck_assert(zframe_streq(zmsg_first(msg), "M"));
+    char *diaddr_str = zframe_strdup(zmsg_next(msg));
+    *diaddr = atoi(diaddr_str);
+    free(diaddr_str);
+    zmsg_destroy(&msg);
+
+    return sock;
+}
+
+/**
+ * Answer a single 16 bit register read received by a peer
+ *
+ * Used as thread function, the peer socket is passed as argument.
+ */
+static void* peer_answer_reg_read(void *sock_void)
+{
+    zsock_t *sock = sock_void;
+    osd_result rv;
+
+    zmsg_t *msg = zmsg_recv(sock);
+    ck_assert_ptr_ne(msg, NULL);
+    ck_assert(zframe_streq(zmsg_first(msg), "D"));
+
+    struct osd_packet *pkg_req;
+    rv = osd_packet_new_from_zframe(&pkg_req, zmsg_next(msg));
+    ck_assert_int_eq(rv, OSD_OK);
+    zmsg_destroy(&msg);
+    ck_assert_uint_eq(osd_packet_get_type_sub(pkg_req), REQ_READ_REG_16);
+
+    struct osd_packet *pkg_resp;
+    rv = osd_packet_new(&pkg_resp,
+                        osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg_resp, osd_packet_get_src(pkg_req),
+                          osd_packet_get_dest(pkg_req), OSD_PACKET_TYPE_REG,
+                          RESP_READ_REG_SUCCESS_16);
+    pkg_resp->data.payload[0] = pkg_req->data.payload[0] + 1;
+    osd_packet_free(&pkg_req);
+
+    msg = zmsg_new();
+    zmsg_addstr(msg, "D");
+    zmsg_addmem(msg, pkg_resp->data_raw, osd_packet_sizeof(pkg_resp));
+    osd_packet_free(&pkg_resp);
+    int zmq_rv = zmsg_send(&msg, sock);
+    ck_assert_int_eq(zmq_rv, 0);
+
+    return NULL;
+}
+
+/**
+ * Read a register of a peer, with the peer answering in a separate thread
+ */
+static void read_from_peer(zsock_t *peer, unsigned int peer_diaddr)
+{
+    osd_result rv;
+    pthread_t peer_thread;
+
+    rv = pthread_create(&peer_thread, NULL, peer_answer_reg_read, peer);
+    ck_assert_int_eq(rv, 0);
+
+    uint16_t reg_read_result;
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, peer_diaddr,
+                              0x0010, 16, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(reg_read_result, 0x0011);
+
+    pthread_join(peer_thread, NULL);
+}
+
+START_TEST(test_route_reg_read)
+{
+    unsigned int peer_diaddr;
+    zsock_t *peer = peer_connect(&peer_diaddr);
+
+    read_from_peer(peer, peer_diaddr);
+    read_from_peer(peer, peer_diaddr);
+
+    zsock_destroy(&peer);
+}
+END_TEST
+
+/**
+ * A peer disconnects before a request to it arrives
+ *
+ * The sender is told right away that the destination is unreachable, and the
+ * address of the peer is handed out again.
+ */
+START_TEST(test_peer_disconnected)
+{
+    osd_result rv;
+
+    unsigned int peer_diaddr;
+    zsock_t *peer = peer_connect(&peer_diaddr);
+    zsock_destroy(&peer);
+
+    // give ZeroMQ some time to notice the disconnect
+    zclock_sleep(100);
+
+    uint16_t reg_read_result;
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, peer_diaddr,
+                              0x0010, 16, OSD_HOSTMOD_BLOCKING);
+    ck_assert_int_eq(rv, OSD_ERROR_COM);
+
+    unsigned int new_peer_diaddr;
+    zsock_t *new_peer = peer_connect(&new_peer_diaddr);
+    ck_assert_uint_eq(new_peer_diaddr, peer_diaddr);
+
+    read_from_peer(new_peer, new_peer_diaddr);
+
+    zsock_destroy(&new_peer);
+}
+END_TEST
+
+/**
+ * A peer dies in the middle of a request without disconnecting
+ *
+ * The request times out. The host controller reclaims the address of the
+ * silent peer eventually, and requests to the new owner of the address work.
+ */
+START_TEST(test_peer_dead)
+{
+    osd_result rv;
+
+    unsigned int peer_diaddr;
+    zsock_t *peer = peer_connect(&peer_diaddr);
+
+    // the request is delivered to the peer, but never answered
+    uint16_t reg_read_result;
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, peer_diaddr,
+                              0x0010, 16, 0);
+    ck_assert_int_eq(rv, OSD_ERROR_TIMEDOUT);
+
+    zclock_sleep(PEER_RECLAIM_WAIT_MS);
+
+    // the host module sends heartbeats and is still registered
+    ck_assert_int_eq(osd_hostmod_is_connected(hostmod_ctx), 1);
+
+    unsigned int new_peer_diaddr;
+    zsock_t *new_peer = peer_connect(&new_peer_diaddr);
+    ck_assert_uint_eq(new_peer_diaddr, peer_diaddr);
+
+    read_from_peer(new_peer, new_peer_diaddr);
+
+    zsock_destroy(&new_peer);
+    zsock_destroy(&peer);
+}
+END_TEST
+
+/**
+ * Number of packets sent to a peer which does not receive them
+ *
+ * More than the ZeroMQ queues between the host controller and the peer can
+ * hold (the default high-water marks of 1000 messages on both sides), which
+ * makes the host controller queue packets on its side.
+ */
+#define SLOW_PEER_MSG_COUNT 2500
+
+/**
+ * A peer is slower than the sender of the packets routed to it
+ *
+ * The packets which the host controller cannot pass on right away are queued,
+ * and all packets are delivered in order once the peer receives them.
+ */
+START_TEST(test_peer_slow)
+{
+    osd_result rv;
+
+    unsigned int src_diaddr, dest_diaddr;
+    zsock_t *src = peer_connect(&src_diaddr);
+    zsock_t *dest = peer_connect(&dest_diaddr);
+
+    for (unsigned int i = 0; i < SLOW_PEER_MSG_COUNT; i++) {
+        struct osd_packet *pkg;
+        rv = osd_packet_new(&pkg,
+                            osd_packet_get_data_size_words_from_payload(1));
+        ck_assert_int_eq(rv, OSD_OK);
+        osd_packet_set_header(pkg, dest_diaddr, src_diaddr,
+                              OSD_PACKET_TYPE_EVENT, 0);
+        pkg->data.payload[0] = i;
+
+        zmsg_t *msg = zmsg_new();
+        zmsg_addstr(msg, "D");
+        zmsg_addmem(msg, pkg->data_raw, osd_packet_sizeof(pkg));
+        osd_packet_free(&pkg);
+        int zmq_rv = zmsg_send(&msg, src);
+        ck_assert_int_eq(zmq_rv, 0);
+    }
+
+    // let the host controller fill the queues to the peer
+    zclock_sleep(200);
+
+    for (unsigned int i = 0; i < SLOW_PEER_MSG_COUNT; i++) {
+        zmsg_t *msg = zmsg_recv(dest);
+        ck_assert_ptr_ne(msg, NULL);
+        ck_assert(zframe_streq(zmsg_first(msg), "D"));
+
+        struct osd_packet *pkg;
+        rv = osd_packet_new_from_zframe(&pkg, zmsg_next(msg));
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_uint_eq(pkg->data.payload[0], (uint16_t)i);
+        osd_packet_free(&pkg);
+        zmsg_destroy(&msg);
+    }
+
+    zsock_destroy(&dest);
+    zsock_destroy(&src);
+}
+END_TEST
+
+/**
+ * Filter rules are forwarded to the gateway of a subnet, or rejected if no
+ * gateway is registered for it
+ */
+START_TEST(test_gw_filter)
+{
+    osd_result rv;
+
+    rv = osd_hostmod_gw_filter(hostmod_ctx, 1, "src deny 5");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    zsock_t *gw = zsock_new_dealer(HOSTCTRL_ADDRESS);
+    ck_assert_ptr_ne(gw, NULL);
+    zsock_set_rcvtimeo(gw, 1000);
+
+    zmsg_t *msg = zmsg_new();
+    zmsg_addstr(msg, "M");
+    zmsg_addstr(msg, "GW_REGISTER 1");
+    int zmq_rv = zmsg_send(&msg, gw);
+    ck_assert_int_eq(zmq_rv, 0);
+    msg = zmsg_recv(gw);
+    ck_assert_ptr_ne(msg, NULL);
+    ck_assert(zframe_streq(zmsg_first(msg), "M"));
+    ck_assert(zframe_streq(zmsg_next(msg), "ACK"));
+    zmsg_destroy(&msg);
+
+    rv = osd_hostmod_gw_filter(hostmod_ctx, 1, "src deny 5");
+    ck_assert_int_eq(rv, OSD_OK);
+
+    msg = zmsg_recv(gw);
+    ck_assert_ptr_ne(msg, NULL);
+    ck_assert(zframe_streq(zmsg_first(msg), "M"));
+    ck_assert(zframe_streq(zmsg_next(msg), "FILTER src deny 5"));
+    zmsg_destroy(&msg);
+
+    zsock_destroy(&gw);
+}
+END_TEST
+
+Suite * suite(void)
+{
+    Suite *s;
+    TCase *tc_core, *tc_peers;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_route_reg_read);
+    tcase_add_test(tc_core, test_gw_filter);
+    suite_add_tcase(s, tc_core);
+
+    // Handling of disconnected, dead and slow peers
+    tc_peers = tcase_create("Peers");
+    tcase_add_checked_fixture(tc_peers, setup, teardown);
+    tcase_set_timeout(tc_peers, 20);
+    tcase_add_test(tc_peers, test_peer_disconnected);
+    tcase_add_test(tc_peers, test_peer_dead);
+    tcase_add_test(tc_peers, test_peer_slow);
+    suite_add_tcase(s, tc_peers);
+
+    return s;
+}
@@ -179,10 +179,335 @@ START_TEST(test_core_read_register_timeout)
 }
 END_TEST
 
+/**
+ * A response arriving after the read timed out is not mistaken for the
+ * response to the next read
+ */
+START_TEST(test_core_read_register_late_response)
+{
+    osd_result rv;
+
+    uint16_t reg_read_result;
+
+    // respond only after the main thread has given up waiting
+    mock_host_controller_stall(2000);
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr, 1, 0x0000,
+                                         0x0001);
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, 1, 0x0000, 16, 0);
+    ck_assert_int_eq(rv, OSD_ERROR_TIMEDOUT);
+
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr, 1, 0x0001,
+                                         0x0002);
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, 1, 0x0001, 16, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(reg_read_result, 0x0002);
+}
+END_TEST
+
+/**
+ * The host controller forgets about us while a register read is in flight
+ *
+ * The read fails right away, and the host module obtains a new address and
+ * continues to work.
+ */
+START_TEST(test_core_link_lost)
+{
+    osd_result rv;
+
+    uint16_t reg_read_result;
+    const unsigned int new_diaddr = mock_hostmod_diaddr + 1;
+
+    struct osd_packet *pkg_read_req;
+    rv = osd_packet_new(&pkg_read_req,
+                        osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg_read_req, 1, mock_hostmod_diaddr,
+                          OSD_PACKET_TYPE_REG, REQ_READ_REG_16);
+    pkg_read_req->data.payload[0] = 0x0000;
+    mock_host_controller_expect_data_req(pkg_read_req, NULL);
+    osd_packet_free(&pkg_read_req);
+
+    mock_host_controller_expect_diaddr_req(new_diaddr);
+    mock_host_controller_forget_hostmod();
+
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, 1, 0x0000, 16,
+                              OSD_HOSTMOD_BLOCKING);
+    ck_assert_int_eq(rv, OSD_ERROR_CONNECTION_FAILED);
+
+    // wait for the reconnect to complete
+    while (osd_hostmod_get_diaddr(hostmod_ctx) != new_diaddr) {
+        usleep(1000);
+    }
+
+    mock_host_controller_expect_reg_read(new_diaddr, 1, 0x0001, 0x0002);
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, 1, 0x0001, 16, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(reg_read_result, 0x0002);
+}
+END_TEST
+
+/**
+ * A rejected management message doesn't affect the connection
+ */
+START_TEST(test_core_mgmt_nack)
+{
+    osd_result rv;
+
+    uint16_t reg_read_result;
+
+    mock_host_controller_expect_mgmt_req("GW_FILTER 1 src deny 5", "NACK");
+    rv = osd_hostmod_gw_filter(hostmod_ctx, 1, "src deny 5");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr, 1, 0x0000,
+                                         0x0001);
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, 1, 0x0000, 16, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(reg_read_result, 0x0001);
+}
+END_TEST
+
+/**
+ * The destination of a register read has gone away
+ */
+START_TEST(test_core_dest_unreachable)
+{
+    osd_result rv;
+
+    uint16_t reg_read_result;
+
+    mock_host_controller_expect_reg_read_unreachable(mock_hostmod_diaddr, 1,
+                                                     0x0000);
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, 1, 0x0000, 16,
+                              OSD_HOSTMOD_BLOCKING);
+    ck_assert_int_eq(rv, OSD_ERROR_COM);
+
+    // requests to other modules are not affected
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr, 2, 0x0000,
+                                         0x0001);
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, 2, 0x0000, 16, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(reg_read_result, 0x0001);
+}
+END_TEST
+
+START_TEST(test_core_stats)
+{
+    osd_result rv;
+
+    uint16_t reg_read_result;
+
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr, 1, 0x0000, 0x0001);
+
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, 1, 0x0000, 16, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    struct osd_hostmod_stats *stats = malloc(sizeof(struct osd_hostmod_stats));
+    ck_assert_ptr_ne(stats, NULL);
+    osd_hostmod_get_stats(hostmod_ctx, stats);
+
+    ck_assert_int_eq(stats->modules[0].diaddr, 1);
+    ck_assert_int_eq(stats->modules[1].diaddr, -1);
+    ck_assert_uint_eq(
+        stats->modules[0].round_trip[OSD_HOSTMOD_STATS_OP_REG_READ][0].count, 1);
+    ck_assert_uint_eq(
+        stats->modules[0].queueing[OSD_HOSTMOD_STATS_OP_REG_READ][0].count, 1);
+    ck_assert_uint_eq(
+        stats->modules[0].round_trip[OSD_HOSTMOD_STATS_OP_REG_WRITE][0].count, 0);
+
+    char *json;
+    osd_hostmod_stats_to_json(stats, &json);
+    ck_assert_ptr_ne(strstr(json, "{\"diaddr\": 1, \"reg_read\": {\"16\": "),
+                     NULL);
+    free(json);
+    free(stats);
+}
+END_TEST
+
+static volatile int poll_cb_calls;
+static volatile uint16_t poll_cb_value;
+
+static void poll_cb(void *arg, int poll_id, osd_result result,
+                    const void *data, uint64_t timestamp_ns)
+{
+    ck_assert_int_eq(result, OSD_OK);
+    poll_cb_value = *(const uint16_t*)data;
+    poll_cb_calls++;
+}
+
+START_TEST(test_core_poll)
+{
+    osd_result rv;
+    int poll_id;
+
+    poll_cb_calls = 0;
+
+    // the first read is issued right away, the next one only after 10 s
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr, 1, 0x0000, 0x0042);
+
+    rv = osd_hostmod_poll_add(hostmod_ctx, 1, 0x0000, 16, 10 * 1000, poll_cb,
+                              NULL, &poll_id);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (int i = 0; i < 100 && poll_cb_calls == 0; i++) {
+        zclock_sleep(10);
+    }
+    ck_assert_int_eq(poll_cb_calls, 1);
+    ck_assert_uint_eq(poll_cb_value, 0x0042);
+
+    rv = osd_hostmod_poll_remove(hostmod_ctx, poll_id);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    rv = osd_hostmod_poll_remove(hostmod_ctx, poll_id);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+START_TEST(test_core_reg_write_batch)
+{
+    osd_result rv;
+
+    mock_host_controller_expect_reg_write(mock_hostmod_diaddr, 1, 0x0200,
+                                          0x1234);
+    mock_host_controller_expect_reg_write(mock_hostmod_diaddr, 2, 0x0200,
+                                          0x5678);
+    mock_host_controller_expect_reg_write(mock_hostmod_diaddr, 1, 0x0201,
+                                          0x9abc);
+
+    uint16_t data[] = { 0x1234, 0x5678, 0x9abc };
+    struct osd_hostmod_reg_write_req reqs[] = {
+        { .diaddr = 1, .reg_addr = 0x0200, .reg_size_bit = 16,
+          .data = &data[0] },
+        { .diaddr = 2, .reg_addr = 0x0200, .reg_size_bit = 16,
+          .data = &data[1] },
+        { .diaddr = 1, .reg_addr = 0x0201, .reg_size_bit = 16,
+          .data = &data[2] },
+    };
+    rv = osd_hostmod_reg_write_batch(hostmod_ctx, reqs, 3, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    for (unsigned int i = 0; i < 3; i++) {
+        ck_assert_int_eq(reqs[i].result, OSD_OK);
+    }
+}
+END_TEST
+
+START_TEST(test_core_gw_filter)
+{
+    osd_result rv;
+
+    mock_host_controller_expect_mgmt_req("GW_FILTER 1 src deny 5", "ACK");
+    rv = osd_hostmod_gw_filter(hostmod_ctx, 1, "src deny 5");
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // no gateway registered for the subnet
+    mock_host_controller_expect_mgmt_req("GW_FILTER 2 src deny 5", "NACK");
+    rv = osd_hostmod_gw_filter(hostmod_ctx, 2, "src deny 5");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    rv = osd_hostmod_gw_filter(hostmod_ctx, OSD_DIADDR_SUBNET_MAX + 1,
+                               "src deny 5");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+/**
+ * Number of messages sent to a stalled host controller
+ *
+ * Enough to fill the ZeroMQ queues (twice the default high-water mark of
+ * 1000 messages for inproc connections) and to build up a backlog of
+ * messages in the I/O thread.
+ */
+#define SHUTDOWN_TEST_MSG_COUNT 2500
+
+/**
+ * Queue SHUTDOWN_TEST_MSG_COUNT register writes to a stalled host controller
+ *
+ * The writes are issued as one non-blocking batch, which gives up waiting for
+ * the responses after a while; the requests stay queued for sending.
+ */
+static void shutdown_test_queue_writes(void)
+{
+    static struct osd_hostmod_reg_write_req reqs[SHUTDOWN_TEST_MSG_COUNT];
+    static const uint16_t value = 0x0001;
+
+    for (unsigned int i = 0; i < SHUTDOWN_TEST_MSG_COUNT; i++) {
+        reqs[i].diaddr = 1;
+        reqs[i].reg_addr = 0x0000;
+        reqs[i].reg_size_bit = 16;
+        reqs[i].data = &value;
+    }
+
+    osd_result rv = osd_hostmod_reg_write_batch(hostmod_ctx, reqs,
+                                                SHUTDOWN_TEST_MSG_COUNT, 0);
+    ck_assert_int_eq(rv, OSD_ERROR_TIMEDOUT);
+}
+
+/**
+ * Pending messages are sent out on disconnect if the host controller is able
+ * to receive them within the shutdown timeout
+ */
+START_TEST(test_shutdown_drain)
+{
+    osd_result rv;
+    struct osd_shutdown_stats stats = { 0, 0 };
+
+    setup_hostmod();
+
+    for (unsigned int i = 0; i < SHUTDOWN_TEST_MSG_COUNT; i++) {
+        mock_host_controller_expect_reg_write(mock_hostmod_diaddr, 1, 0x0000,
+                                              0x0001);
+    }
+
+    // The host controller resumes receiving shortly after the writes timed
+    // out, well before the shutdown timeout has passed.
+    mock_host_controller_stall(2000);
+    shutdown_test_queue_writes();
+
+    osd_hostmod_set_shutdown_timeout(hostmod_ctx, 3000);
+    rv = osd_hostmod_disconnect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    osd_hostmod_free_all(&hostmod_ctx, 1, &stats);
+    ck_assert_ptr_eq(hostmod_ctx, NULL);
+
+    ck_assert_uint_gt(stats.flushed, 0);
+    ck_assert_uint_eq(stats.dropped, 0);
+
+    mock_host_controller_wait_for_reqs();
+}
+END_TEST
+
+/**
+ * Pending messages are dropped once the shutdown timeout has expired
+ */
+START_TEST(test_shutdown_drop)
+{
+    osd_result rv;
+    struct osd_shutdown_stats stats = { 0, 0 };
+
+    setup_hostmod();
+
+    // The host controller doesn't receive anything until the end of the test.
+    mock_host_controller_stall(60 * 1000);
+    shutdown_test_queue_writes();
+
+    osd_hostmod_set_shutdown_timeout(hostmod_ctx, 100);
+    int64_t start = zclock_mono();
+    rv = osd_hostmod_disconnect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    osd_hostmod_free_all(&hostmod_ctx, 1, &stats);
+    ck_assert_ptr_eq(hostmod_ctx, NULL);
+
+    ck_assert_uint_gt(stats.dropped, 0);
+    ck_assert_int_lt(zclock_mono() - start, 1000);
+}
+END_TEST
+
 Suite * suite(void)
 {
     Suite *s;
-    TCase *tc_init, *tc_core;
+    TCase *tc_init, *tc_core, *tc_shutdown;
 
     s = suite_create(TEST_SUITE_NAME);
 
@@ -200,7 +525,23 @@ Suite * suite(void)
     tcase_add_checked_fixture(tc_core, setup, teardown);
     //tcase_add_test(tc_core, test_core_read_register);
     tcase_add_test(tc_core, test_core_read_register_timeout);
+    tcase_add_test(tc_core, test_core_read_register_late_response);
+    tcase_add_test(tc_core, test_core_link_lost);
+    tcase_add_test(tc_core, test_core_mgmt_nack);
+    tcase_add_test(tc_core, test_core_dest_unreachable);
+    tcase_add_test(tc_core, test_core_stats);
+    tcase_add_test(tc_core, test_core_poll);
+    tcase_add_test(tc_core, test_core_reg_write_batch);
+    tcase_add_test(tc_core, test_core_gw_filter);
     suite_add_tcase(s, tc_core);
 
+    // Draining of pending messages on shutdown
+    tc_shutdown = tcase_create("Shutdown");
+    tcase_add_checked_fixture(tc_shutdown, mock_host_controller_setup,
+                              mock_host_controller_teardown);
+    tcase_add_test(tc_shutdown, test_shutdown_drain);
+    tcase_add_test(tc_shutdown, test_shutdown_drop);
+    suite_add_tcase(s, tc_shutdown);
+
     return s;
 }
@@ -32,7 +32,11 @@
 #include <osd/hostmod_stmlogger.h>
 #include <osd/packet.h>
 #include <osd/reg.h>
+#include <osd/stm.h>
+#include <osd/tracefile.h>
 #include <czmq.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "mock_host_controller.h"
 
@@ -136,6 +140,324 @@ START_TEST(test_core_tracestart)
 }
 END_TEST
 
+/**
+ * Stopping fails if the STM rejects the register write
+ */
+START_TEST(test_core_tracestop_error)
+{
+    osd_result rv;
+
+    struct osd_packet *pkg_req;
+    rv = osd_packet_new(&pkg_req,
+                        osd_packet_get_data_size_words_from_payload(2));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg_req, mock_stm_diaddr, mock_hostmod_diaddr,
+                          OSD_PACKET_TYPE_REG, REQ_WRITE_REG_16);
+    pkg_req->data.payload[0] = OSD_REG_BASE_MOD_CS;
+    pkg_req->data.payload[1] = 0;
+
+    struct osd_packet *pkg_resp;
+    rv = osd_packet_new(&pkg_resp,
+                        osd_packet_get_data_size_words_from_payload(0));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg_resp, mock_hostmod_diaddr, mock_stm_diaddr,
+                          OSD_PACKET_TYPE_REG, RESP_WRITE_REG_ERROR);
+
+    mock_host_controller_expect_data_req(pkg_req, pkg_resp);
+    osd_packet_free(&pkg_req);
+    osd_packet_free(&pkg_resp);
+
+    rv = osd_hostmod_stmlogger_tracestop(mod_ctx);
+    ck_assert_int_eq(rv, OSD_ERROR_DEVICE_ERROR);
+}
+END_TEST
+
+START_TEST(test_core_stats)
+{
+    osd_result rv;
+    struct osd_hostmod_stmlogger_stats stats;
+    osd_hostmod_stmlogger_get_stats(mod_ctx, mock_stm_diaddr, &stats);
+    ck_assert_uint_eq(stats.packets, 0);
+
+    // overflow packet: 3 events were lost
+    struct osd_packet *event_pkg;
+    osd_packet_new(&event_pkg, osd_packet_get_data_size_words_from_payload(1));
+    osd_packet_set_header(event_pkg, mock_hostmod_diaddr, mock_stm_diaddr,
+                          OSD_PACKET_TYPE_EVENT, OSD_STM_TYPE_SUB_OVERFLOW);
+    event_pkg->data.payload[0] = 3;
+    mock_host_controller_queue_event_packet(event_pkg);
+    mock_host_controller_wait_for_event_tx();
+
+    // the packet is handled asynchronously in the I/O thread
+    for (int i = 0; i < 1000; i++) {
+        rv = osd_hostmod_stmlogger_get_stats(mod_ctx, mock_stm_diaddr,
+                                             &stats);
+        ck_assert_int_eq(rv, OSD_OK);
+        if (stats.packets) {
+            break;
+        }
+        usleep(1000);
+    }
+    ck_assert_uint_eq(stats.packets, 1);
+    ck_assert_uint_eq(stats.bytes,
+                      (event_pkg->data_size_words + 1) * sizeof(uint16_t));
+    ck_assert_uint_eq(stats.overflows, 1);
+    ck_assert_uint_eq(stats.events_lost, 3);
+
+    osd_packet_free(&event_pkg);
+}
+END_TEST
+
+/**
+ * Queue a STM trace event with a 32 bit value
+ */
+static void queue_trace_event(uint32_t timestamp, uint16_t id, uint32_t value)
+{
+    struct osd_packet *event_pkg;
+    osd_packet_new(&event_pkg, osd_packet_get_data_size_words_from_payload(5));
+    osd_packet_set_header(event_pkg, mock_hostmod_diaddr, mock_stm_diaddr,
+                          OSD_PACKET_TYPE_EVENT, OSD_STM_TYPE_SUB_EVENT);
+    event_pkg->data.payload[0] = timestamp & 0xffff;
+    event_pkg->data.payload[1] = timestamp >> 16;
+    event_pkg->data.payload[2] = id;
+    event_pkg->data.payload[3] = value & 0xffff;
+    event_pkg->data.payload[4] = value >> 16;
+    mock_host_controller_queue_event_packet(event_pkg);
+    osd_packet_free(&event_pkg);
+}
+
+START_TEST(test_core_flightrec)
+{
+    osd_result rv;
+
+    // metadata for the trace file
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr, 0,
+                                         OSD_REG_SCM_SYSTEM_VENDOR_ID, 0x1234);
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr, 0,
+                                         OSD_REG_SCM_SYSTEM_DEVICE_ID, 0x5678);
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr,
+                                         mock_stm_diaddr,
+                                         OSD_REG_BASE_MOD_VENDOR,
+                                         OSD_MODULE_VENDOR_OSD);
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr,
+                                         mock_stm_diaddr,
+                                         OSD_REG_BASE_MOD_TYPE,
+                                         OSD_MODULE_TYPE_STD_STM);
+    mock_host_controller_expect_reg_read(mock_hostmod_diaddr,
+                                         mock_stm_diaddr,
+                                         OSD_REG_BASE_MOD_VERSION,
+                                         0);
+    rv = osd_hostmod_stmlogger_open_flightrec(mod_ctx, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    rv = osd_hostmod_stmlogger_set_flightrec_trigger(mod_ctx, 0x42, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert(!osd_hostmod_stmlogger_flightrec_triggered(mod_ctx));
+
+    // three events, the trigger, and an event which is dropped
+    for (unsigned int i = 0; i < 3; i++) {
+        queue_trace_event(i, 0x10, i);
+    }
+    queue_trace_event(3, 0x42, 0);
+    queue_trace_event(4, 0x10, 3);
+    mock_host_controller_wait_for_event_tx();
+
+    struct osd_flightrec_stats stats;
+    for (int i = 0; i < 1000; i++) {
+        rv = osd_hostmod_stmlogger_get_flightrec_stats(mod_ctx,
+                                                       mock_stm_diaddr,
+                                                       &stats);
+        ck_assert_int_eq(rv, OSD_OK);
+        if (stats.packets + stats.packets_dropped == 5) {
+            break;
+        }
+        usleep(1000);
+    }
+    ck_assert_uint_eq(stats.packets, 4);
+    ck_assert_uint_eq(stats.packets_dropped, 1);
+    ck_assert(osd_hostmod_stmlogger_flightrec_triggered(mod_ctx));
+
+    char path[] = "/tmp/check_hostmod_stmlogger.XXXXXX";
+    int fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+
+    rv = osd_hostmod_stmlogger_dump_flightrec(mod_ctx, path);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert(!osd_hostmod_stmlogger_flightrec_triggered(mod_ctx));
+    rv = osd_hostmod_stmlogger_get_flightrec_stats(mod_ctx, mock_stm_diaddr,
+                                                   &stats);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(stats.packets, 0);
+
+    struct osd_tracefile_reader *reader;
+    rv = osd_tracefile_reader_new(&reader, log_ctx, path);
+    ck_assert_int_eq(rv, OSD_OK);
+    const struct osd_tracefile_meta *meta =
+        osd_tracefile_reader_get_meta(reader);
+    ck_assert_uint_eq(meta->system_vendor_id, 0x1234);
+    ck_assert_uint_eq(meta->module.addr, mock_stm_diaddr);
+    ck_assert_uint_eq(osd_tracefile_reader_get_packet_count(reader), 4);
+
+    for (unsigned int i = 0; i < 4; i++) {
+        struct osd_packet *pkg;
+        rv = osd_tracefile_reader_next(reader, &pkg, NULL);
+        ck_assert_int_eq(rv, OSD_OK);
+        struct osd_stm_event ev;
+        rv = osd_stm_event_decode(pkg, &ev);
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_uint_eq(ev.id, i < 3 ? 0x10 : 0x42);
+        osd_packet_free(&pkg);
+    }
+    osd_tracefile_reader_free(&reader);
+    unlink(path);
+
+    rv = osd_hostmod_stmlogger_close_flightrec(mod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_stmlogger_get_flightrec_stats(mod_ctx, mock_stm_diaddr,
+                                                   &stats);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+/**
+ * Correlate the STM timestamps to the host receive time
+ */
+START_TEST(test_core_clock_corr)
+{
+    osd_result rv;
+    struct osd_clock_corr_fit fit;
+    uint64_t host_ns;
+
+    rv = osd_hostmod_stmlogger_get_clock_fit(mod_ctx, mock_stm_diaddr, &fit);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // at most one event per ms is used for the correlation
+    const unsigned int num_events = 10;
+    for (unsigned int i = 0; i < num_events; i++) {
+        queue_trace_event(i * 1000, 0x10, i);
+        usleep(5000);
+    }
+    mock_host_controller_wait_for_event_tx();
+
+    for (int i = 0; i < 1000; i++) {
+        rv = osd_hostmod_stmlogger_get_clock_fit(mod_ctx, mock_stm_diaddr,
+                                                 &fit);
+        if (OSD_SUCCEEDED(rv) && fit.samples == num_events) {
+            break;
+        }
+        usleep(1000);
+    }
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(fit.samples, num_events);
+    // host time advances with the STM time
+    ck_assert(fit.ns_per_tick > 0);
+
+    uint64_t host_ns_later;
+    rv = osd_hostmod_stmlogger_get_host_time(mod_ctx, mock_stm_diaddr, 1000,
+                                             &host_ns);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_stmlogger_get_host_time(mod_ctx, mock_stm_diaddr, 8000,
+                                             &host_ns_later);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_gt(host_ns_later, host_ns);
+
+    rv = osd_hostmod_stmlogger_get_host_time(mod_ctx, 13, 1000, &host_ns);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+/**
+ * Trace multiple STMs with a single logger
+ */
+START_TEST(test_multi_stm)
+{
+    osd_result rv;
+    const unsigned int stm_diaddrs[] = { 12, mock_stm_diaddr };
+
+    mock_host_controller_setup();
+    log_ctx = testutil_get_log_ctx();
+
+    rv = osd_hostmod_stmlogger_new_multi(&mod_ctx, log_ctx, "inproc://testing",
+                                         stm_diaddrs, 2);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    mock_host_controller_expect_diaddr_req(mock_hostmod_diaddr);
+    rv = osd_hostmod_stmlogger_connect(mod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // STMs are handled in the order of their DI addresses
+    const unsigned int sorted_diaddrs[] = { mock_stm_diaddr, 12 };
+    for (unsigned int i = 0; i < 2; i++) {
+        mock_host_controller_expect_reg_read(mock_hostmod_diaddr,
+                                             sorted_diaddrs[i],
+                                             OSD_REG_BASE_MOD_VENDOR,
+                                             OSD_MODULE_VENDOR_OSD);
+        mock_host_controller_expect_reg_read(mock_hostmod_diaddr,
+                                             sorted_diaddrs[i],
+                                             OSD_REG_BASE_MOD_TYPE,
+                                             OSD_MODULE_TYPE_STD_STM);
+        mock_host_controller_expect_reg_read(mock_hostmod_diaddr,
+                                             sorted_diaddrs[i],
+                                             OSD_REG_BASE_MOD_VERSION,
+                                             0);
+    }
+    // all writes are issued as one batch
+    for (unsigned int i = 0; i < 2; i++) {
+        mock_host_controller_expect_reg_write(mock_hostmod_diaddr,
+                                              sorted_diaddrs[i],
+                                              OSD_REG_BASE_MOD_EVENT_DEST,
+                                              mock_hostmod_diaddr);
+        mock_host_controller_expect_reg_write(mock_hostmod_diaddr,
+                                              sorted_diaddrs[i],
+                                              OSD_REG_BASE_MOD_CS,
+                                              OSD_REG_BASE_MOD_CS_ACTIVE);
+    }
+    rv = osd_hostmod_stmlogger_tracestart(mod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // events are accounted to the STM which sent them
+    struct osd_packet *event_pkg;
+    osd_packet_new(&event_pkg, osd_packet_get_data_size_words_from_payload(1));
+    osd_packet_set_header(event_pkg, mock_hostmod_diaddr, 12,
+                          OSD_PACKET_TYPE_EVENT, OSD_STM_TYPE_SUB_OVERFLOW);
+    event_pkg->data.payload[0] = 5;
+    mock_host_controller_queue_event_packet(event_pkg);
+    osd_packet_free(&event_pkg);
+    mock_host_controller_wait_for_event_tx();
+
+    struct osd_hostmod_stmlogger_stats stats;
+    for (int i = 0; i < 1000; i++) {
+        rv = osd_hostmod_stmlogger_get_stats(mod_ctx, 12, &stats);
+        ck_assert_int_eq(rv, OSD_OK);
+        if (stats.packets) {
+            break;
+        }
+        usleep(1000);
+    }
+    ck_assert_uint_eq(stats.packets, 1);
+    ck_assert_uint_eq(stats.events_lost, 5);
+
+    rv = osd_hostmod_stmlogger_get_stats(mod_ctx, mock_stm_diaddr, &stats);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(stats.packets, 0);
+
+    rv = osd_hostmod_stmlogger_get_stats(mod_ctx, 13, &stats);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    mock_host_controller_expect_reg_write(mock_hostmod_diaddr,
+                                          mock_stm_diaddr,
+                                          OSD_REG_BASE_MOD_CS, 0);
+    mock_host_controller_expect_reg_write(mock_hostmod_diaddr, 12,
+                                          OSD_REG_BASE_MOD_CS, 0);
+    rv = osd_hostmod_stmlogger_tracestop(mod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    teardown_hostmod();
+    mock_host_controller_teardown();
+}
+END_TEST
+
 Suite * suite(void)
 {
     Suite *s;
@@ -149,12 +471,17 @@ Suite * suite(void)
     // succeeds.
     tc_init = tcase_create("Init");
     tcase_add_test(tc_init, test_init_base);
+    tcase_add_test(tc_init, test_multi_stm);
     suite_add_tcase(s, tc_init);
 
     // Core functionality
     tc_core = tcase_create("Core");
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, test_core_tracestart);
+    tcase_add_test(tc_core, test_core_tracestop_error);
+    tcase_add_test(tc_core, test_core_stats);
+    tcase_add_test(tc_core, test_core_flightrec);
+    tcase_add_test(tc_core, test_core_clock_corr);
     suite_add_tcase(s, tc_core);
 
     return s;
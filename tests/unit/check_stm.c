@@ -0,0 +1,261 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#define TEST_SUITE_NAME "check_stm"
+
+#include "testutil.h"
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <osd/stm.h>
+
+/**
+ * Create a STM event packet with the given payload words
+ */
+static struct osd_packet* create_event_packet(unsigned int type_sub,
+                                              const uint16_t *payload,
+                                              unsigned int payload_words)
+{
+    osd_result rv;
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg,
+        osd_packet_get_data_size_words_from_payload(payload_words));
+    ck_assert_int_eq(rv, OSD_OK);
+
+    rv = osd_packet_set_header(pkg, 0x1000, 0x1005, OSD_PACKET_TYPE_EVENT,
+                               type_sub);
+    ck_assert_int_eq(rv, OSD_OK);
+    for (unsigned int i = 0; i < payload_words; i++) {
+        pkg->data.payload[i] = payload[i];
+    }
+    return pkg;
+}
+
+START_TEST(test_stm_decode_value32)
+{
+    osd_result rv;
+    const uint16_t payload[] = { 0x5678, 0x1234, 0x00ab, 0xbeef, 0xdead };
+    struct osd_packet *pkg = create_event_packet(OSD_STM_TYPE_SUB_EVENT,
+                                                 payload, 5);
+
+    struct osd_stm_event ev;
+    rv = osd_stm_event_decode(pkg, &ev);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_int_eq(ev.type, OSD_STM_EVENT_TRACE);
+    ck_assert_uint_eq(ev.stm_diaddr, 0x1005);
+    ck_assert_uint_eq(ev.timestamp, 0x12345678);
+    ck_assert_uint_eq(ev.id, 0xab);
+    ck_assert_uint_eq(ev.value, 0xdeadbeef);
+    ck_assert_uint_eq(ev.value_width_bit, 32);
+
+    osd_packet_free(&pkg);
+}
+END_TEST
+
+START_TEST(test_stm_decode_value64)
+{
+    osd_result rv;
+    const uint16_t payload[] = { 0x0001, 0x0000, 0x0004,
+                                 0x4444, 0x3333, 0x2222, 0x1111 };
+    struct osd_packet *pkg = create_event_packet(OSD_STM_TYPE_SUB_EVENT,
+                                                 payload, 7);
+
+    struct osd_stm_event ev;
+    rv = osd_stm_event_decode(pkg, &ev);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_int_eq(ev.type, OSD_STM_EVENT_TRACE);
+    ck_assert_uint_eq(ev.timestamp, 1);
+    ck_assert_uint_eq(ev.id, 4);
+    ck_assert_uint_eq(ev.value, 0x1111222233334444ULL);
+    ck_assert_uint_eq(ev.value_width_bit, 64);
+
+    osd_packet_free(&pkg);
+}
+END_TEST
+
+START_TEST(test_stm_decode_overflow)
+{
+    osd_result rv;
+    const uint16_t payload[] = { 42 };
+    struct osd_packet *pkg = create_event_packet(OSD_STM_TYPE_SUB_OVERFLOW,
+                                                 payload, 1);
+
+    struct osd_stm_event ev;
+    rv = osd_stm_event_decode(pkg, &ev);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_int_eq(ev.type, OSD_STM_EVENT_OVERFLOW);
+    ck_assert_uint_eq(ev.lost_events, 42);
+
+    osd_packet_free(&pkg);
+}
+END_TEST
+
+START_TEST(test_stm_decode_invalid)
+{
+    osd_result rv;
+    struct osd_stm_event ev;
+    struct osd_packet *pkg;
+    const uint16_t payload[] = { 0, 0, 0, 0, 0, 0 };
+
+    // unexpected payload size
+    pkg = create_event_packet(OSD_STM_TYPE_SUB_EVENT, payload, 6);
+    rv = osd_stm_event_decode(pkg, &ev);
+    ck_assert_int_eq(rv, OSD_ERROR_DEVICE_INVALID_DATA);
+    osd_packet_free(&pkg);
+
+    // unknown subtype
+    pkg = create_event_packet(1, payload, 5);
+    rv = osd_stm_event_decode(pkg, &ev);
+    ck_assert_int_eq(rv, OSD_ERROR_DEVICE_INVALID_DATA);
+    osd_packet_free(&pkg);
+
+    // no event packet
+    pkg = create_event_packet(OSD_STM_TYPE_SUB_EVENT, payload, 5);
+    rv = osd_packet_set_header(pkg, 0x1000, 0x1005, OSD_PACKET_TYPE_REG,
+                               RESP_READ_REG_SUCCESS_16);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_stm_event_decode(pkg, &ev);
+    ck_assert_int_eq(rv, OSD_ERROR_DEVICE_INVALID_DATA);
+    osd_packet_free(&pkg);
+}
+END_TEST
+
+START_TEST(test_stm_decode_batch)
+{
+    osd_result rv;
+
+    const uint16_t payload_ev32[] = { 10, 0, 1, 0x1111, 0 };
+    const uint16_t payload_ev64[] = { 20, 0, 2, 0x2222, 0, 0, 0x8000 };
+    const uint16_t payload_ovf[] = { 3 };
+    const uint16_t payload_invalid[] = { 0, 0 };
+
+    struct osd_packet *packets[5];
+    packets[0] = create_event_packet(OSD_STM_TYPE_SUB_EVENT, payload_ev32, 5);
+    packets[1] = create_event_packet(OSD_STM_TYPE_SUB_EVENT, payload_invalid,
+                                     2);
+    packets[2] = create_event_packet(OSD_STM_TYPE_SUB_OVERFLOW, payload_ovf, 1);
+    packets[3] = create_event_packet(OSD_STM_TYPE_SUB_EVENT, payload_ev64, 7);
+    packets[4] = create_event_packet(OSD_STM_TYPE_SUB_EVENT, payload_ev32, 5);
+
+    // columns with space for only three events
+    uint8_t type[3];
+    uint32_t timestamp[3];
+    uint16_t id[3];
+    uint64_t value[3];
+    struct osd_stm_event_columns cols = {
+        .capacity = 3, .len = 0,
+        .type = type, .timestamp = timestamp, .id = id, .value = value,
+    };
+
+    size_t num_consumed;
+    rv = osd_stm_event_decode_batch((const struct osd_packet * const *)packets,
+                                    5, &cols, &num_consumed);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(num_consumed, 4);
+    ck_assert_uint_eq(cols.len, 3);
+    ck_assert_uint_eq(cols.invalid_packets, 1);
+
+    ck_assert_uint_eq(type[0], OSD_STM_EVENT_TRACE);
+    ck_assert_uint_eq(timestamp[0], 10);
+    ck_assert_uint_eq(id[0], 1);
+    ck_assert_uint_eq(value[0], 0x1111);
+
+    ck_assert_uint_eq(type[1], OSD_STM_EVENT_OVERFLOW);
+    ck_assert_uint_eq(value[1], 3);
+
+    ck_assert_uint_eq(type[2], OSD_STM_EVENT_TRACE);
+    ck_assert_uint_eq(timestamp[2], 20);
+    ck_assert_uint_eq(id[2], 2);
+    ck_assert_uint_eq(value[2], 0x8000000000002222ULL);
+
+    // no space left
+    rv = osd_stm_event_decode_batch((const struct osd_packet * const *)packets
+                                    + num_consumed, 1, &cols, &num_consumed);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(num_consumed, 0);
+
+    for (unsigned int i = 0; i < 5; i++) {
+        osd_packet_free(&packets[i]);
+    }
+}
+END_TEST
+
+/**
+ * Packets too short to hold a header are counted as invalid
+ */
+START_TEST(test_stm_decode_batch_short)
+{
+    osd_result rv;
+
+    struct osd_packet *packets[2];
+    rv = osd_packet_new(&packets[0], 2);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_packet_new(&packets[1], 0);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    uint8_t type[2];
+    uint32_t timestamp[2];
+    uint16_t id[2];
+    uint64_t value[2];
+    struct osd_stm_event_columns cols = {
+        .capacity = 2, .len = 0,
+        .type = type, .timestamp = timestamp, .id = id, .value = value,
+    };
+
+    size_t num_consumed;
+    rv = osd_stm_event_decode_batch((const struct osd_packet * const *)packets,
+                                    2, &cols, &num_consumed);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(num_consumed, 2);
+    ck_assert_uint_eq(cols.len, 0);
+    ck_assert_uint_eq(cols.invalid_packets, 2);
+
+    osd_packet_free(&packets[0]);
+    osd_packet_free(&packets[1]);
+}
+END_TEST
+
+Suite * suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_stm_decode_value32);
+    tcase_add_test(tc_core, test_stm_decode_value64);
+    tcase_add_test(tc_core, test_stm_decode_overflow);
+    tcase_add_test(tc_core, test_stm_decode_invalid);
+    tcase_add_test(tc_core, test_stm_decode_batch);
+    tcase_add_test(tc_core, test_stm_decode_batch_short);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,270 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#define TEST_SUITE_NAME "check_stm_printf"
+
+#include "testutil.h"
+
+#include <osd/osd.h>
+#include <osd/stm.h>
+#include <osd/stm_printf.h>
+
+#include <string.h>
+
+struct osd_stm_printf *printf_ctx;
+struct osd_log_ctx *log_ctx;
+
+#define LINES_MAX 8
+static char lines[LINES_MAX][OSD_STM_PRINTF_LINE_MAX + 1];
+static uint16_t lines_diaddr[LINES_MAX];
+static unsigned int lines_cnt;
+
+static void line_cb(void *arg, uint16_t stm_diaddr, const char *line,
+                    size_t len)
+{
+    ck_assert_ptr_eq(arg, &lines_cnt);
+    ck_assert_uint_eq(strlen(line), len);
+    ck_assert_uint_lt(lines_cnt, LINES_MAX);
+
+    strcpy(lines[lines_cnt], line);
+    lines_diaddr[lines_cnt] = stm_diaddr;
+    lines_cnt++;
+}
+
+static void send_event(uint16_t stm_diaddr, uint16_t id, uint64_t value,
+                       unsigned int value_width_bit)
+{
+    struct osd_stm_event ev = {
+        .type = OSD_STM_EVENT_TRACE,
+        .stm_diaddr = stm_diaddr,
+        .id = id,
+        .value = value,
+        .value_width_bit = value_width_bit,
+    };
+    ck_assert(OSD_STM_PRINTF_IS_PRINTF_EVENT(&ev));
+
+    osd_result rv = osd_stm_printf_handle_event(printf_ctx, &ev);
+    ck_assert_int_eq(rv, OSD_OK);
+}
+
+static void send_string(uint16_t stm_diaddr, const char *str)
+{
+    for (const char *c = str; *c; c++) {
+        send_event(stm_diaddr, OSD_STM_ID_PUTCHAR, *c, 32);
+    }
+}
+
+static void setup(void)
+{
+    osd_result rv;
+
+    log_ctx = testutil_get_log_ctx();
+    lines_cnt = 0;
+
+    rv = osd_stm_printf_new(&printf_ctx, log_ctx, line_cb, &lines_cnt);
+    ck_assert_int_eq(rv, OSD_OK);
+}
+
+static void teardown(void)
+{
+    osd_stm_printf_free(&printf_ctx);
+    ck_assert_ptr_eq(printf_ctx, NULL);
+    osd_log_free(&log_ctx);
+}
+
+START_TEST(test_stm_printf_putchar)
+{
+    send_string(0x1005, "hello\r\nworld");
+    ck_assert_uint_eq(lines_cnt, 1);
+    ck_assert_str_eq(lines[0], "hello");
+    ck_assert_uint_eq(lines_diaddr[0], 0x1005);
+
+    osd_stm_printf_flush(printf_ctx);
+    ck_assert_uint_eq(lines_cnt, 2);
+    ck_assert_str_eq(lines[1], "world");
+
+    // nothing left to flush
+    osd_stm_printf_flush(printf_ctx);
+    ck_assert_uint_eq(lines_cnt, 2);
+}
+END_TEST
+
+START_TEST(test_stm_printf_format)
+{
+    osd_result rv;
+    rv = osd_stm_printf_set_format(printf_ctx, 1,
+                                   "a=%d b=%5u c=0x%010lx d=%c p=%8p %%\n");
+    ck_assert_int_eq(rv, OSD_OK);
+
+    send_event(0x1005, OSD_STM_ID_PRINTF_FMT, 1, 32);
+    send_event(0x1005, OSD_STM_ID_PRINTF_ARG, 0xfffffffe, 32); // -2
+    send_event(0x1005, OSD_STM_ID_PRINTF_ARG, 42, 32);
+    send_event(0x1005, OSD_STM_ID_PRINTF_ARG, 0xdeadbeefULL, 64);
+    ck_assert_uint_eq(lines_cnt, 0);
+
+    // the print is rendered once all arguments have been received
+    send_event(0x1005, OSD_STM_ID_PRINTF_ARG, 'x', 32);
+    send_event(0x1005, OSD_STM_ID_PRINTF_ARG, 0x1000, 32);
+    ck_assert_uint_eq(lines_cnt, 1);
+    ck_assert_str_eq(lines[0], "a=-2 b=   42 c=0x00deadbeef d=x p=  0x1000 %");
+
+    // missing arguments: the next print completes the previous one
+    send_event(0x1005, OSD_STM_ID_PRINTF_FMT, 1, 32);
+    ck_assert_uint_eq(lines_cnt, 1);
+    send_event(0x1005, OSD_STM_ID_PRINTF_FMT, 2, 32);
+    ck_assert_uint_eq(lines_cnt, 2);
+    ck_assert_str_eq(lines[1], "a=? b=? c=0x? d=? p=? %");
+
+    osd_stm_printf_flush(printf_ctx);
+    ck_assert_uint_eq(lines_cnt, 3);
+    ck_assert_str_eq(lines[2], "<unknown format 0x2>");
+}
+END_TEST
+
+START_TEST(test_stm_printf_format_invalid)
+{
+    osd_result rv;
+    rv = osd_stm_printf_set_format(printf_ctx, 1, "%s");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    rv = osd_stm_printf_set_format(printf_ctx, 1, "%f");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    rv = osd_stm_printf_set_format(printf_ctx, 1, "incomplete %");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+START_TEST(test_stm_printf_format_unknown)
+{
+    osd_result rv;
+
+    send_event(0x1005, OSD_STM_ID_PRINTF_FMT, 0x1234, 32);
+    osd_stm_printf_flush(printf_ctx);
+    ck_assert_uint_eq(lines_cnt, 1);
+    ck_assert_str_eq(lines[0], "<unknown format 0x1234>");
+
+    // only the lower 32 bit of the ID match a registered format string
+    rv = osd_stm_printf_set_format(printf_ctx, 0x1234, "known");
+    ck_assert_int_eq(rv, OSD_OK);
+    send_event(0x1005, OSD_STM_ID_PRINTF_FMT, 0x100001234ULL, 64);
+    osd_stm_printf_flush(printf_ctx);
+    ck_assert_uint_eq(lines_cnt, 2);
+    ck_assert_str_eq(lines[1], "<unknown format 0x100001234>");
+}
+END_TEST
+
+START_TEST(test_stm_printf_format_many)
+{
+    osd_result rv;
+    char fmt[32];
+
+    // force the format string map to grow multiple times
+    for (uint32_t i = 0; i < 1000; i++) {
+        snprintf(fmt, sizeof(fmt), "fmt %u\n", i);
+        rv = osd_stm_printf_set_format(printf_ctx, i * 7919, fmt);
+        ck_assert_int_eq(rv, OSD_OK);
+    }
+    // replace an existing format string
+    rv = osd_stm_printf_set_format(printf_ctx, 7919, "replaced\n");
+    ck_assert_int_eq(rv, OSD_OK);
+
+    send_event(0x1005, OSD_STM_ID_PRINTF_FMT, 999 * 7919, 32);
+    send_event(0x1005, OSD_STM_ID_PRINTF_FMT, 7919, 32);
+    osd_stm_printf_flush(printf_ctx);
+    ck_assert_uint_eq(lines_cnt, 2);
+    ck_assert_str_eq(lines[0], "fmt 999");
+    ck_assert_str_eq(lines[1], "replaced");
+}
+END_TEST
+
+START_TEST(test_stm_printf_multicore)
+{
+    send_string(0x1005, "core ");
+    send_string(0x2005, "other ");
+    send_string(0x1005, "one\n");
+    send_string(0x2005, "core\n");
+
+    ck_assert_uint_eq(lines_cnt, 2);
+    ck_assert_str_eq(lines[0], "core one");
+    ck_assert_uint_eq(lines_diaddr[0], 0x1005);
+    ck_assert_str_eq(lines[1], "other core");
+    ck_assert_uint_eq(lines_diaddr[1], 0x2005);
+}
+END_TEST
+
+START_TEST(test_stm_printf_long_line)
+{
+    for (unsigned int i = 0; i < OSD_STM_PRINTF_LINE_MAX + 10; i++) {
+        send_event(0x1005, OSD_STM_ID_PUTCHAR, 'a', 32);
+    }
+    ck_assert_uint_eq(lines_cnt, 1);
+    ck_assert_uint_eq(strlen(lines[0]), OSD_STM_PRINTF_LINE_MAX);
+
+    send_event(0x1005, OSD_STM_ID_PUTCHAR, '\n', 32);
+    ck_assert_uint_eq(lines_cnt, 2);
+    ck_assert_str_eq(lines[1], "aaaaaaaaaa");
+}
+END_TEST
+
+START_TEST(test_stm_printf_ignore_other)
+{
+    struct osd_stm_event ev = {
+        .type = OSD_STM_EVENT_TRACE,
+        .stm_diaddr = 0x1005,
+        .id = 0x1,
+        .value = '\n',
+        .value_width_bit = 32,
+    };
+    ck_assert(!OSD_STM_PRINTF_IS_PRINTF_EVENT(&ev));
+    osd_result rv = osd_stm_printf_handle_event(printf_ctx, &ev);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(lines_cnt, 0);
+}
+END_TEST
+
+Suite * suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+
+    tcase_add_test(tc_core, test_stm_printf_putchar);
+    tcase_add_test(tc_core, test_stm_printf_format);
+    tcase_add_test(tc_core, test_stm_printf_format_invalid);
+    tcase_add_test(tc_core, test_stm_printf_format_unknown);
+    tcase_add_test(tc_core, test_stm_printf_format_many);
+    tcase_add_test(tc_core, test_stm_printf_multicore);
+    tcase_add_test(tc_core, test_stm_printf_long_line);
+    tcase_add_test(tc_core, test_stm_printf_ignore_other);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,553 @@
+/* Copyright (c) 2017 by the author(s)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ============================================================================
+ *
+ * Author(s):
+ *   Philipp Wagner <philipp.wagner@tum.de>
+ */
+
+
+#define TEST_SUITE_NAME "check_tracefile"
+
+#include "testutil.h"
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <osd/tracefile.h>
+
+#include <endian.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char tracefile_path[PATH_MAX];
+static struct osd_log_ctx *log_ctx;
+
+static void setup(void)
+{
+    log_ctx = testutil_get_log_ctx();
+
+    strcpy(tracefile_path, "/tmp/check_tracefile.XXXXXX");
+    int fd = mkstemp(tracefile_path);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+}
+
+static void teardown(void)
+{
+    unlink(tracefile_path);
+    osd_log_free(&log_ctx);
+}
+
+static struct osd_packet* create_packet(unsigned int size_payload,
+                                        uint16_t seed)
+{
+    osd_result rv;
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg,
+        osd_packet_get_data_size_words_from_payload(size_payload));
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (unsigned int i = 0; i < pkg->data_size_words; i++) {
+        pkg->data_raw[i] = seed + i;
+    }
+    return pkg;
+}
+
+START_TEST(test_tracefile_roundtrip)
+{
+    osd_result rv;
+
+    struct osd_tracefile_meta meta = {
+        .system_vendor_id = 1,
+        .system_device_id = 2,
+        .module = { .addr = 0x1005, .vendor = 1, .type = 4, .version = 0 },
+    };
+
+    // packets of different sizes; timestamps include gaps which don't fit
+    // into the 32 bit delta and are out of order
+    const uint64_t timestamps[] = {
+        1000, 1001, 5000000000ULL, 5000000100ULL, 100, 200, UINT64_MAX
+    };
+    const unsigned int num_packets = sizeof(timestamps) / sizeof(timestamps[0]);
+
+    struct osd_tracefile_writer *writer;
+    rv = osd_tracefile_writer_new(&writer, log_ctx, tracefile_path, &meta);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (unsigned int i = 0; i < num_packets; i++) {
+        struct osd_packet *pkg = create_packet(i * 3, i * 100);
+        rv = osd_tracefile_writer_add(writer, pkg, timestamps[i]);
+        ck_assert_int_eq(rv, OSD_OK);
+        osd_packet_free(&pkg);
+    }
+    ck_assert_uint_eq(osd_tracefile_writer_get_packet_count(writer),
+                      num_packets);
+    osd_tracefile_writer_free(&writer);
+    ck_assert_ptr_eq(writer, NULL);
+
+    struct osd_tracefile_reader *reader;
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    const struct osd_tracefile_meta *meta_read =
+        osd_tracefile_reader_get_meta(reader);
+    ck_assert_uint_eq(meta_read->system_vendor_id, meta.system_vendor_id);
+    ck_assert_uint_eq(meta_read->system_device_id, meta.system_device_id);
+    ck_assert_uint_eq(meta_read->module.addr, meta.module.addr);
+    ck_assert_uint_eq(meta_read->module.vendor, meta.module.vendor);
+    ck_assert_uint_eq(meta_read->module.type, meta.module.type);
+    ck_assert_uint_eq(meta_read->module.version, meta.module.version);
+    ck_assert_uint_ne(meta_read->start_time_realtime_ns, 0);
+
+    for (unsigned int i = 0; i < num_packets; i++) {
+        struct osd_packet *pkg_read;
+        uint64_t ts;
+        rv = osd_tracefile_reader_next(reader, &pkg_read, &ts);
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_uint_eq(ts, timestamps[i]);
+
+        struct osd_packet *pkg_exp = create_packet(i * 3, i * 100);
+        ck_assert_uint_eq(pkg_read->data_size_words, pkg_exp->data_size_words);
+        ck_assert_int_eq(memcmp(pkg_read->data_raw, pkg_exp->data_raw,
+                                pkg_exp->data_size_words * sizeof(uint16_t)),
+                         0);
+        osd_packet_free(&pkg_exp);
+        osd_packet_free(&pkg_read);
+    }
+
+    struct osd_packet *pkg_read;
+    rv = osd_tracefile_reader_next(reader, &pkg_read, NULL);
+    ck_assert_int_eq(rv, OSD_ERROR_EOF);
+
+    osd_tracefile_reader_free(&reader);
+    ck_assert_ptr_eq(reader, NULL);
+}
+END_TEST
+
+START_TEST(test_tracefile_many_packets)
+{
+    osd_result rv;
+    struct osd_tracefile_meta meta = { 0 };
+
+    // enough packets to flush the write buffer multiple times
+    const unsigned int num_packets = 200000;
+
+    struct osd_tracefile_writer *writer;
+    rv = osd_tracefile_writer_new(&writer, log_ctx, tracefile_path, &meta);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (unsigned int i = 0; i < num_packets; i++) {
+        struct osd_packet *pkg = create_packet(5, i);
+        rv = osd_tracefile_writer_add(writer, pkg, 1000ULL * i);
+        ck_assert_int_eq(rv, OSD_OK);
+        osd_packet_free(&pkg);
+    }
+    osd_tracefile_writer_free(&writer);
+
+    struct osd_tracefile_reader *reader;
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (unsigned int i = 0; i < num_packets; i++) {
+        struct osd_packet *pkg_read;
+        uint64_t ts;
+        rv = osd_tracefile_reader_next(reader, &pkg_read, &ts);
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_uint_eq(ts, 1000ULL * i);
+        ck_assert_uint_eq(pkg_read->data_raw[0], (uint16_t)i);
+        osd_packet_free(&pkg_read);
+    }
+
+    struct osd_packet *pkg_read;
+    rv = osd_tracefile_reader_next(reader, &pkg_read, NULL);
+    ck_assert_int_eq(rv, OSD_ERROR_EOF);
+
+    osd_tracefile_reader_free(&reader);
+}
+END_TEST
+
+START_TEST(test_tracefile_async)
+{
+    osd_result rv;
+    struct osd_tracefile_meta meta = { 0 };
+
+    const unsigned int num_packets = 200000;
+
+    // use small buffers to exercise the buffer handover
+    struct osd_tracefile_writer *writer;
+    rv = osd_tracefile_writer_new_async(&writer, log_ctx, tracefile_path,
+                                        &meta, 3, 256 * 1024, 10,
+                                        OSD_TRACEFILE_COMPRESSION_NONE);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (unsigned int i = 0; i < num_packets; i++) {
+        struct osd_packet *pkg = create_packet(5, i);
+        rv = osd_tracefile_writer_add(writer, pkg, 1000ULL * i);
+        ck_assert_int_eq(rv, OSD_OK);
+        osd_packet_free(&pkg);
+    }
+    rv = osd_tracefile_writer_flush(writer);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // packets may have been dropped if the disk was too slow, but every
+    // packet is accounted for
+    struct osd_tracefile_writer_stats stats;
+    osd_tracefile_writer_get_stats(writer, &stats);
+    ck_assert_uint_eq(stats.packets_written + stats.packets_dropped,
+                      num_packets);
+    ck_assert_uint_gt(stats.bytes_written, 0);
+    osd_tracefile_writer_free(&writer);
+
+    struct osd_tracefile_reader *reader;
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    uint64_t packets_read = 0;
+    uint64_t last_ts = 0;
+    struct osd_packet *pkg_read;
+    uint64_t ts;
+    while ((rv = osd_tracefile_reader_next(reader, &pkg_read, &ts)) == OSD_OK) {
+        ck_assert_uint_eq((uint16_t)(ts / 1000), pkg_read->data_raw[0]);
+        if (packets_read > 0) {
+            ck_assert_uint_gt(ts, last_ts);
+        }
+        last_ts = ts;
+        packets_read++;
+        osd_packet_free(&pkg_read);
+    }
+    ck_assert_int_eq(rv, OSD_ERROR_EOF);
+    ck_assert_uint_eq(packets_read, stats.packets_written);
+
+    osd_tracefile_reader_free(&reader);
+}
+END_TEST
+
+/**
+ * Write and read a compressed trace file
+ *
+ * The loop index selects the compression method; unsupported methods are
+ * skipped.
+ */
+START_TEST(test_tracefile_compressed)
+{
+    osd_result rv;
+    struct osd_tracefile_meta meta = { 0 };
+    enum osd_tracefile_compression compression = _i;
+
+    if (!osd_tracefile_compression_supported(compression)) {
+        return;
+    }
+
+    const unsigned int num_packets = 100000;
+
+    struct osd_tracefile_writer *writer;
+    rv = osd_tracefile_writer_new_async(&writer, log_ctx, tracefile_path,
+                                        &meta, 2, 256 * 1024, 0, compression);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (unsigned int i = 0; i < num_packets; i++) {
+        struct osd_packet *pkg = create_packet(i % 8, i % 4);
+        rv = osd_tracefile_writer_add(writer, pkg, 1000ULL * i);
+        ck_assert_int_eq(rv, OSD_OK);
+        osd_packet_free(&pkg);
+
+        // wait for the writer thread from time to time to avoid drops
+        if (i % 1000 == 0) {
+            rv = osd_tracefile_writer_flush(writer);
+            ck_assert_int_eq(rv, OSD_OK);
+        }
+    }
+    rv = osd_tracefile_writer_flush(writer);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    struct osd_tracefile_writer_stats stats;
+    osd_tracefile_writer_get_stats(writer, &stats);
+    ck_assert_uint_eq(stats.packets_written, num_packets);
+    if (compression != OSD_TRACEFILE_COMPRESSION_NONE) {
+        ck_assert_uint_lt(stats.bytes_written, stats.bytes_uncompressed);
+    }
+    osd_tracefile_writer_free(&writer);
+
+    struct osd_tracefile_reader *reader;
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (unsigned int i = 0; i < num_packets; i++) {
+        struct osd_packet *pkg_read;
+        uint64_t ts;
+        rv = osd_tracefile_reader_next(reader, &pkg_read, &ts);
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_uint_eq(ts, 1000ULL * i);
+
+        struct osd_packet *pkg_exp = create_packet(i % 8, i % 4);
+        ck_assert_uint_eq(pkg_read->data_size_words, pkg_exp->data_size_words);
+        ck_assert_int_eq(memcmp(pkg_read->data_raw, pkg_exp->data_raw,
+                                pkg_exp->data_size_words * sizeof(uint16_t)),
+                         0);
+        osd_packet_free(&pkg_exp);
+        osd_packet_free(&pkg_read);
+    }
+
+    struct osd_packet *pkg_read;
+    rv = osd_tracefile_reader_next(reader, &pkg_read, NULL);
+    ck_assert_int_eq(rv, OSD_ERROR_EOF);
+
+    osd_tracefile_reader_free(&reader);
+}
+END_TEST
+
+/**
+ * Check the packets returned by the reader after seeking
+ */
+static void check_seek(struct osd_tracefile_reader *reader,
+                       unsigned int num_packets)
+{
+    osd_result rv;
+    struct osd_packet *pkg_read;
+    uint64_t ts;
+
+    ck_assert_uint_eq(osd_tracefile_reader_get_packet_count(reader),
+                      num_packets);
+    ck_assert_uint_eq(osd_tracefile_reader_tell(reader), 0);
+
+    const unsigned int packets[] = { num_packets - 1, 0, 12345, 12346, 1,
+                                     num_packets / 2 };
+    for (unsigned int i = 0; i < sizeof(packets) / sizeof(packets[0]); i++) {
+        rv = osd_tracefile_reader_seek_packet(reader, packets[i]);
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_uint_eq(osd_tracefile_reader_tell(reader), packets[i]);
+
+        rv = osd_tracefile_reader_next(reader, &pkg_read, &ts);
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_uint_eq(ts, 1000ULL * packets[i]);
+        ck_assert_uint_eq(pkg_read->data_raw[0], (uint16_t)packets[i]);
+        osd_packet_free(&pkg_read);
+        ck_assert_uint_eq(osd_tracefile_reader_tell(reader), packets[i] + 1);
+    }
+
+    // reading continues across block boundaries after seeking
+    rv = osd_tracefile_reader_seek_packet(reader, 20000);
+    ck_assert_int_eq(rv, OSD_OK);
+    for (unsigned int i = 20000; i < 30000; i++) {
+        rv = osd_tracefile_reader_next(reader, &pkg_read, &ts);
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_uint_eq(ts, 1000ULL * i);
+        osd_packet_free(&pkg_read);
+    }
+
+    // exact timestamp
+    rv = osd_tracefile_reader_seek_time(reader, 1000ULL * 31337);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(osd_tracefile_reader_tell(reader), 31337);
+    rv = osd_tracefile_reader_next(reader, &pkg_read, &ts);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(ts, 1000ULL * 31337);
+    osd_packet_free(&pkg_read);
+
+    // timestamp between two packets
+    rv = osd_tracefile_reader_seek_time(reader, 1000ULL * 4242 + 1);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_tracefile_reader_next(reader, &pkg_read, &ts);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(ts, 1000ULL * 4243);
+    osd_packet_free(&pkg_read);
+
+    // before the first packet
+    rv = osd_tracefile_reader_seek_time(reader, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(osd_tracefile_reader_tell(reader), 0);
+
+    // after the last packet
+    rv = osd_tracefile_reader_seek_time(reader, 1000ULL * num_packets);
+    ck_assert_int_eq(rv, OSD_ERROR_EOF);
+    rv = osd_tracefile_reader_next(reader, &pkg_read, NULL);
+    ck_assert_int_eq(rv, OSD_ERROR_EOF);
+
+    rv = osd_tracefile_reader_seek_packet(reader, num_packets);
+    ck_assert_int_eq(rv, OSD_ERROR_EOF);
+}
+
+/**
+ * Seek in a trace file, with and without the block index
+ *
+ * The loop index selects the compression method; unsupported methods are
+ * skipped.
+ */
+START_TEST(test_tracefile_seek)
+{
+    osd_result rv;
+    struct osd_tracefile_meta meta = { 0 };
+    enum osd_tracefile_compression compression = _i;
+
+    if (!osd_tracefile_compression_supported(compression)) {
+        return;
+    }
+
+    const unsigned int num_packets = 50000;
+
+    // frequent flushes result in many blocks
+    struct osd_tracefile_writer *writer;
+    rv = osd_tracefile_writer_new_async(&writer, log_ctx, tracefile_path,
+                                        &meta, 2, 256 * 1024, 0, compression);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (unsigned int i = 0; i < num_packets; i++) {
+        struct osd_packet *pkg = create_packet(5, i);
+        rv = osd_tracefile_writer_add(writer, pkg, 1000ULL * i);
+        ck_assert_int_eq(rv, OSD_OK);
+        osd_packet_free(&pkg);
+
+        if (i % 1000 == 0) {
+            rv = osd_tracefile_writer_flush(writer);
+            ck_assert_int_eq(rv, OSD_OK);
+        }
+    }
+    ck_assert_uint_eq(osd_tracefile_writer_get_packet_count(writer),
+                      num_packets);
+    osd_tracefile_writer_free(&writer);
+
+    struct osd_tracefile_reader *reader;
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_OK);
+    check_seek(reader, num_packets);
+    osd_tracefile_reader_free(&reader);
+
+    // Remove the index, as if the writer had not closed the file. The index
+    // footer at the end of the file holds the offset of the index block.
+    FILE *fp = fopen(tracefile_path, "rb");
+    ck_assert_ptr_ne(fp, NULL);
+    uint64_t index_offset;
+    ck_assert_int_eq(fseek(fp, -16, SEEK_END), 0);
+    ck_assert_int_eq(fread(&index_offset, sizeof(index_offset), 1, fp), 1);
+    fclose(fp);
+    ck_assert_int_eq(truncate(tracefile_path, le64toh(index_offset)), 0);
+
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_OK);
+    check_seek(reader, num_packets);
+    osd_tracefile_reader_free(&reader);
+}
+END_TEST
+
+/**
+ * Overwrite the format version in the header of the trace file
+ */
+static void set_tracefile_version(uint32_t version)
+{
+    FILE *fp = fopen(tracefile_path, "r+b");
+    ck_assert_ptr_ne(fp, NULL);
+    uint32_t version_le = htole32(version);
+    ck_assert_int_eq(fseek(fp, 8, SEEK_SET), 0); // after the magic
+    ck_assert_int_eq(fwrite(&version_le, sizeof(version_le), 1, fp), 1);
+    fclose(fp);
+}
+
+/**
+ * Files with blocks but without an index (version 2) can be read, files with
+ * the flat layout of version 1 are rejected
+ */
+START_TEST(test_tracefile_version)
+{
+    osd_result rv;
+    struct osd_tracefile_meta meta = { 0 };
+
+    struct osd_tracefile_writer *writer;
+    rv = osd_tracefile_writer_new(&writer, log_ctx, tracefile_path, &meta);
+    ck_assert_int_eq(rv, OSD_OK);
+    struct osd_packet *pkg = create_packet(5, 0);
+    rv = osd_tracefile_writer_add(writer, pkg, 1000);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_tracefile_writer_free(&writer);
+
+    // version 2 files end after the last packet block
+    FILE *fp = fopen(tracefile_path, "rb");
+    ck_assert_ptr_ne(fp, NULL);
+    uint64_t index_offset;
+    ck_assert_int_eq(fseek(fp, -16, SEEK_END), 0);
+    ck_assert_int_eq(fread(&index_offset, sizeof(index_offset), 1, fp), 1);
+    fclose(fp);
+    ck_assert_int_eq(truncate(tracefile_path, le64toh(index_offset)), 0);
+
+    struct osd_tracefile_reader *reader;
+    set_tracefile_version(2);
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_OK);
+    struct osd_packet *pkg_read;
+    rv = osd_tracefile_reader_next(reader, &pkg_read, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(pkg_read->data_size_words, pkg->data_size_words);
+    ck_assert_int_eq(memcmp(pkg_read->data_raw, pkg->data_raw,
+                            pkg->data_size_words * sizeof(uint16_t)), 0);
+    osd_packet_free(&pkg_read);
+    osd_tracefile_reader_free(&reader);
+
+    set_tracefile_version(1);
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    set_tracefile_version(OSD_TRACEFILE_VERSION + 1);
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    osd_packet_free(&pkg);
+}
+END_TEST
+
+START_TEST(test_tracefile_invalid)
+{
+    osd_result rv;
+
+    // the empty file created in setup() is no trace file
+    struct osd_tracefile_reader *reader;
+    rv = osd_tracefile_reader_new(&reader, log_ctx, tracefile_path);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+Suite * suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+
+    tcase_add_test(tc_core, test_tracefile_roundtrip);
+    tcase_add_test(tc_core, test_tracefile_many_packets);
+    tcase_add_test(tc_core, test_tracefile_async);
+    tcase_add_loop_test(tc_core, test_tracefile_compressed,
+                        OSD_TRACEFILE_COMPRESSION_NONE,
+                        OSD_TRACEFILE_COMPRESSION_ZSTD + 1);
+    tcase_add_loop_test(tc_core, test_tracefile_seek,
+                        OSD_TRACEFILE_COMPRESSION_NONE,
+                        OSD_TRACEFILE_COMPRESSION_ZSTD + 1);
+    tcase_add_test(tc_core, test_tracefile_version);
+    tcase_add_test(tc_core, test_tracefile_invalid);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -18,6 +18,13 @@ zlist_t *mock_event_tx_list;
 
 zframe_t *last_hostmod_identity_frame;
 
+// time (zclock_mono()) until which no messages are received
+int64_t mock_stall_until;
+bool mock_rx_stalled;
+
+// answer the next heartbeat with UNKNOWN_PEER
+bool mock_forget_hostmod;
+
 void mock_host_controller_wait_for_event_tx()
 {
     while (zlist_size(mock_event_tx_list) != 0) {
@@ -25,6 +32,41 @@ void mock_host_controller_wait_for_event_tx()
     }
 }
 
+void mock_host_controller_wait_for_reqs()
+{
+    while (zlist_size(mock_exp_req_list) != 0) {
+        usleep(10);
+    }
+}
+
+/**
+ * Stop receiving messages for a while
+ *
+ * Messages sent to the mock host controller pile up in the ZeroMQ queues
+ * during this time, making the socket of the sender block once they are full.
+ */
+void mock_host_controller_stall(unsigned int duration_ms)
+{
+    __atomic_store_n(&mock_stall_until, zclock_mono() + duration_ms,
+                     __ATOMIC_RELAXED);
+    // wait until the mock has stopped receiving
+    while (!__atomic_load_n(&mock_rx_stalled, __ATOMIC_RELAXED)) {
+        usleep(10);
+    }
+}
+
+/**
+ * Forget about the registered host module, as if the host controller had been
+ * restarted
+ *
+ * The next heartbeat of the host module is answered with UNKNOWN_PEER, making
+ * it request a new DI address.
+ */
+void mock_host_controller_forget_hostmod(void)
+{
+    __atomic_store_n(&mock_forget_hostmod, true, __ATOMIC_RELAXED);
+}
+
 static int mock_host_controller_shutdown_reactor(zloop_t *loop, int timer_id, void *arg)
 {
     if (mock_host_controller_thread_cancel) {
@@ -48,6 +90,28 @@ static int mock_host_controller_msg_reactor(zloop_t *loop, zsock_t *reader, void
     printf("Received message: \n");
     zmsg_print(msg_req);
 
+    // answer heartbeats of the host module without expecting them
+    if (zmsg_size(msg_req) == 3) {
+        zmsg_first(msg_req); // identity of the sender
+        zframe_t *f_type = zmsg_next(msg_req);
+        zframe_t *f_payload = zmsg_next(msg_req);
+        if (zframe_streq(f_type, "M") && zframe_streq(f_payload, "PING")) {
+            zframe_t *src_frame = zmsg_pop(msg_req);
+            zmsg_t *msg_resp = zmsg_new();
+            zmsg_add(msg_resp, src_frame);
+            zmsg_addstr(msg_resp, "M");
+            if (__atomic_exchange_n(&mock_forget_hostmod, false,
+                                    __ATOMIC_RELAXED)) {
+                zmsg_addstr(msg_resp, "UNKNOWN_PEER");
+            } else {
+                zmsg_addstr(msg_resp, "PONG");
+            }
+            zmsg_send(&msg_resp, reader);
+            zmsg_destroy(&msg_req);
+            return 0;
+        }
+    }
+
     zmsg_t* msg_req_exp = zlist_pop(mock_exp_req_list);
     ck_assert_msg(msg_req_exp, "Received message, but no message was expected.\n");
     printf("Expecting message: \n");
@@ -111,18 +175,42 @@ static int mock_host_controller_msg_reactor(zloop_t *loop, zsock_t *reader, void
     zmsg_destroy(&msg_req);
     zmsg_destroy(&msg_req_exp);
 
-    // send response message
+    // send response message (an empty message stands for no response)
     zmsg_t *msg_resp = zlist_pop(mock_exp_resp_list);
-    if (msg_resp) {
+    if (msg_resp && zmsg_size(msg_resp) != 0) {
         zmsg_prepend(msg_resp, &src_frame);
         zmsg_send(&msg_resp, reader);
     }
+    zmsg_destroy(&msg_resp);
 
     zframe_destroy(&src_frame);
 
     return 0;
 }
 
+/**
+ * Stop and resume receiving messages (see mock_host_controller_stall())
+ */
+static int mock_host_controller_stall_reactor(zloop_t *loop, int timer_id,
+                                              void *sock_void)
+{
+    zsock_t *sock = sock_void;
+
+    bool stall = zclock_mono() <
+                 __atomic_load_n(&mock_stall_until, __ATOMIC_RELAXED);
+    if (stall && !mock_rx_stalled) {
+        zloop_reader_end(loop, sock);
+    } else if (!stall && mock_rx_stalled) {
+        int rv = zloop_reader(loop, sock, mock_host_controller_msg_reactor,
+                              NULL);
+        ck_assert_int_eq(rv, 0);
+        zloop_reader_set_tolerant(loop, sock);
+    }
+    __atomic_store_n(&mock_rx_stalled, stall, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
 /**
  * Send a DI packet (a data message) of type EVENT to the host module
  *
@@ -173,6 +261,9 @@ static void* mock_host_controller(void* arg)
                 mock_host_controller_event_tx_reactor, server_socket);
     ck_assert_int_eq(rv, 0);
 
+    zloop_timer(mock_host_controller_loop, 1, 0,
+                mock_host_controller_stall_reactor, server_socket);
+
     // start processing
     mock_host_controller_ready = 1;
     zloop_start(mock_host_controller_loop);
@@ -241,6 +332,9 @@ void mock_host_controller_expect_data_req(const struct osd_packet *req,
     queue_data_packet(mock_exp_req_list, req);
     if (resp) {
         queue_data_packet(mock_exp_resp_list, resp);
+    } else {
+        int rv = zlist_append(mock_exp_resp_list, zmsg_new());
+        ck_assert_int_eq(rv, 0);
     }
 }
 
@@ -293,6 +387,43 @@ void mock_host_controller_expect_reg_read(unsigned int src,
     osd_packet_free(&pkg_resp);
 }
 
+/**
+ * Expect a 16 bit register read to a module which is not reachable
+ *
+ * The request is answered with a DEST_UNREACHABLE management message, as the
+ * host controller does if the destination module has gone away.
+ */
+void mock_host_controller_expect_reg_read_unreachable(unsigned int src,
+                                                      unsigned int dest,
+                                                      unsigned int reg_addr)
+{
+    osd_result rv;
+
+    // request
+    struct osd_packet *pkg_req;
+    rv = osd_packet_new(&pkg_req,
+                        osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_ptr_ne(pkg_req, NULL);
+
+    osd_packet_set_header(pkg_req, dest, src,
+                          OSD_PACKET_TYPE_REG, REQ_READ_REG_16);
+    pkg_req->data.payload[0] = reg_addr;
+
+    queue_data_packet(mock_exp_req_list, pkg_req);
+    osd_packet_free(&pkg_req);
+
+    // response
+    zmsg_t *resp_msg = zmsg_new();
+    ck_assert_ptr_ne(resp_msg, NULL);
+    int zmq_rv = zmsg_addstr(resp_msg, "M");
+    ck_assert_int_eq(zmq_rv, 0);
+    zmq_rv = zmsg_addstrf(resp_msg, "DEST_UNREACHABLE %u", dest);
+    ck_assert_int_eq(zmq_rv, 0);
+    zmq_rv = zlist_append(mock_exp_resp_list, resp_msg);
+    ck_assert_int_eq(zmq_rv, 0);
+}
+
 /**
  * Add a 16 bit register access to the read/write mock
  *
@@ -341,6 +472,9 @@ void mock_host_controller_setup(void)
 
     mock_host_controller_thread_cancel = 0;
     mock_host_controller_ready = 0;
+    mock_stall_until = 0;
+    mock_rx_stalled = false;
+    mock_forget_hostmod = false;
     rv = pthread_create(&mock_host_controller_thread, 0, mock_host_controller,
                         NULL);
     ck_assert_int_eq(rv, 0);
@@ -19,8 +19,14 @@ void mock_host_controller_expect_reg_read(unsigned int src,
                                           unsigned int dest,
                                           unsigned int reg_addr,
                                           uint16_t ret_value);
+void mock_host_controller_expect_reg_read_unreachable(unsigned int src,
+                                                      unsigned int dest,
+                                                      unsigned int reg_addr);
 void mock_host_controller_expect_mgmt_req(const char* cmd, const char* resp);
 void mock_host_controller_expect_diaddr_req(unsigned int diaddr);
 void mock_host_controller_expect_data_req(struct osd_packet *req, struct osd_packet *resp);
 void mock_host_controller_wait_for_event_tx();
+void mock_host_controller_wait_for_reqs();
+void mock_host_controller_stall(unsigned int duration_ms);
+void mock_host_controller_forget_hostmod(void);
 #endif // MOCK_HOST_CONTROLLER_H